@@ -0,0 +1,297 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/base/numa_replicated_searcher.h"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/barrier.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/strings/str_cat.h"
+#include "scann/base/single_machine_factory_scann.h"
+#include "scann/oss_wrappers/scann_down_cast.h"
+#include "scann/utils/threads.h"
+
+namespace research_scann {
+namespace {
+
+MemoryPolicy ReplicaMemoryPolicy(ConstSpan<int> numa_nodes, size_t replica_idx,
+                                 MemoryPolicy::PageSize page_size) {
+  MemoryPolicy policy;
+  policy.page_size = page_size;
+  if (numa_nodes.size() > 1) {
+    policy.numa_policy = MemoryPolicy::NumaPolicy::kBind;
+    policy.numa_nodes = {numa_nodes[replica_idx]};
+  }
+  return policy;
+}
+
+template <typename T>
+StatusOr<unique_ptr<SingleMachineSearcherBase<T>>> BuildReplica(
+    const ScannConfig& config, const TypedDataset<T>* dataset,
+    const SingleMachineFactoryOptions& opts, int numa_node,
+    const MemoryPolicy& policy) {
+  SCANN_RETURN_IF_ERROR(PinCurrentThreadToNumaNode(numa_node));
+
+  shared_ptr<TypedDataset<T>> replica_dataset;
+  if (dataset) {
+    replica_dataset = make_shared<DenseDataset<T>>(
+        down_cast<const DenseDataset<T>*>(dataset)->Copy());
+  }
+  SingleMachineFactoryOptions replica_opts = opts;
+  if (opts.datapoints_by_token) {
+    replica_opts.datapoints_by_token =
+        make_shared<vector<std::vector<DatapointIndex>>>(
+            *opts.datapoints_by_token);
+  }
+  if (opts.hashed_dataset) {
+    replica_opts.hashed_dataset =
+        make_shared<DenseDataset<uint8_t>>(opts.hashed_dataset->Copy());
+  }
+  if (opts.pre_quantized_fixed_point) {
+    const PreQuantizedFixedPoint& fp = *opts.pre_quantized_fixed_point;
+    auto replica_fp = make_shared<PreQuantizedFixedPoint>(fp);
+    if (fp.fixed_point_dataset) {
+      replica_fp->fixed_point_dataset =
+          make_shared<DenseDataset<int8_t>>(fp.fixed_point_dataset->Copy());
+    }
+    if (fp.multiplier_by_dimension) {
+      replica_fp->multiplier_by_dimension =
+          make_shared<vector<float>>(*fp.multiplier_by_dimension);
+    }
+    if (fp.squared_l2_norm_by_datapoint) {
+      replica_fp->squared_l2_norm_by_datapoint =
+          make_shared<vector<float>>(*fp.squared_l2_norm_by_datapoint);
+    }
+    replica_opts.pre_quantized_fixed_point = std::move(replica_fp);
+  }
+  if (opts.crowding_attributes) {
+    replica_opts.crowding_attributes =
+        make_shared<vector<int64_t>>(*opts.crowding_attributes);
+  }
+  replica_opts.parallelization_pool = nullptr;
+  replica_opts.memory_policy = make_shared<MemoryPolicy>(policy);
+  return SingleMachineFactoryScann<T>(config, std::move(replica_dataset),
+                                      std::move(replica_opts));
+}
+
+}  // namespace
+
+Status PinThreadPoolToNumaNodes(ThreadPool* pool, ConstSpan<int> numa_nodes) {
+  SCANN_RET_CHECK(pool);
+  if (numa_nodes.empty()) {
+    return InvalidArgumentError("numa_nodes must not be empty.");
+  }
+  const int num_threads = pool->NumThreads();
+  std::vector<Status> statuses(num_threads, OkStatus());
+  std::atomic<int> next_worker = 0;
+  auto* all_pinned = new absl::Barrier(num_threads);
+  absl::BlockingCounter done(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    pool->Schedule([&] {
+      const int worker = next_worker.fetch_add(1, std::memory_order_relaxed);
+      statuses[worker] = PinCurrentThreadToNumaNode(
+          numa_nodes[worker % numa_nodes.size()]);
+
+      if (all_pinned->Block()) delete all_pinned;
+      done.DecrementCount();
+    });
+  }
+  done.Wait();
+  for (const Status& status : statuses) SCANN_RETURN_IF_ERROR(status);
+  return OkStatus();
+}
+
+template <typename T>
+StatusOr<unique_ptr<NumaReplicatedSearcher<T>>>
+NumaReplicatedSearcher<T>::Create(
+    const ScannConfig& config,
+    unique_ptr<SingleMachineSearcherBase<T>> searcher,
+    std::vector<int> numa_nodes, MemoryPolicy::PageSize page_size) {
+  SCANN_RET_CHECK(searcher);
+  if (numa_nodes.empty()) {
+    TF_ASSIGN_OR_RETURN(numa_nodes, OnlineNumaNodes());
+  }
+  shared_ptr<const TypedDataset<T>> dataset = searcher->shared_dataset();
+  if (dataset && !dataset->IsDense()) {
+    return UnimplementedError(
+        "NUMA replication is only supported for dense datasets.");
+  }
+
+  TF_ASSIGN_OR_RETURN(SingleMachineFactoryOptions opts,
+                      searcher->ExtractSingleMachineFactoryOptions());
+  if (config.has_partitioning() && !opts.serialized_partitioner) {
+    return FailedPreconditionError(
+        "Cannot replicate a partitioned searcher that does not export its "
+        "partitioner.");
+  }
+  if (config.has_hash() && config.hash().has_asymmetric_hash() &&
+      !opts.ah_codebook) {
+    return FailedPreconditionError(
+        "Cannot replicate an asymmetric hashing searcher that does not export "
+        "its codebook.");
+  }
+
+  std::vector<unique_ptr<SingleMachineSearcherBase<T>>> replicas(
+      numa_nodes.size());
+  if (numa_nodes.size() > 1) {
+    std::vector<StatusOr<unique_ptr<SingleMachineSearcherBase<T>>>> built(
+        numa_nodes.size());
+    auto pool = StartThreadPool("numa_replica_pool", numa_nodes.size() - 1);
+    absl::BlockingCounter done(numa_nodes.size() - 1);
+    for (size_t i : Seq(1, numa_nodes.size())) {
+      pool->Schedule([&, i] {
+        built[i] = BuildReplica<T>(
+            config, dataset.get(), opts, numa_nodes[i],
+            ReplicaMemoryPolicy(numa_nodes, i, page_size));
+        done.DecrementCount();
+      });
+    }
+    done.Wait();
+    for (size_t i : Seq(1, numa_nodes.size())) {
+      TF_ASSIGN_OR_RETURN(replicas[i], std::move(built[i]));
+    }
+  }
+  SCANN_RETURN_IF_ERROR(searcher->ApplyMemoryPolicy(
+      ReplicaMemoryPolicy(numa_nodes, 0, page_size)));
+  replicas[0] = std::move(searcher);
+
+  std::vector<uint32_t> replica_by_cpu;
+  for (size_t i : IndicesOf(numa_nodes)) {
+    TF_ASSIGN_OR_RETURN(std::vector<int> cpus, NumaNodeCpus(numa_nodes[i]));
+    for (int cpu : cpus) {
+      if (cpu < 0) continue;
+      if (static_cast<size_t>(cpu) >= replica_by_cpu.size()) {
+        replica_by_cpu.resize(cpu + 1, 0);
+      }
+      replica_by_cpu[cpu] = i;
+    }
+  }
+
+  auto result = absl::WrapUnique(new NumaReplicatedSearcher<T>(
+      std::move(dataset), std::move(replicas), std::move(numa_nodes),
+      std::move(replica_by_cpu)));
+  if (!result->dataset()) {
+    SCANN_RETURN_IF_ERROR(
+        result->set_docids(result->replicas_.front()->docids()));
+  }
+  if (result->replicas_.front()->crowding_enabled()) {
+    ConstSpan<int64_t> attributes =
+        result->replicas_.front()->datapoint_index_to_crowding_attribute();
+    SCANN_RETURN_IF_ERROR(result->EnableCrowding(
+        std::vector<int64_t>(attributes.begin(), attributes.end())));
+  }
+  return result;
+}
+
+template <typename T>
+NumaReplicatedSearcher<T>::NumaReplicatedSearcher(
+    shared_ptr<const TypedDataset<T>> dataset,
+    std::vector<unique_ptr<SingleMachineSearcherBase<T>>> replicas,
+    std::vector<int> numa_nodes, std::vector<uint32_t> replica_by_cpu)
+    : SingleMachineSearcherBase<T>(
+          std::move(dataset),
+          replicas.front()->default_pre_reordering_num_neighbors(),
+          replicas.front()->default_pre_reordering_epsilon()),
+      replicas_(std::move(replicas)),
+      numa_nodes_(std::move(numa_nodes)),
+      replica_by_cpu_(std::move(replica_by_cpu)) {
+  this->CopyDefaultSearchParametersFrom(*replicas_.front());
+}
+
+template <typename T>
+const SingleMachineSearcherBase<T>& NumaReplicatedSearcher<T>::LocalReplica()
+    const {
+  const int cpu = sched_getcpu();
+  if (cpu < 0 || static_cast<size_t>(cpu) >= replica_by_cpu_.size()) {
+    return *replicas_.front();
+  }
+  return *replicas_[replica_by_cpu_[cpu]];
+}
+
+template <typename T>
+Status NumaReplicatedSearcher<T>::FindNeighbors(
+    const DatapointPtr<T>& query, const SearchParameters& params,
+    NNResultsVector* result) const {
+  return LocalReplica().FindNeighbors(query, params, result);
+}
+
+template <typename T>
+Status NumaReplicatedSearcher<T>::FindNeighborsImpl(
+    const DatapointPtr<T>& query, const SearchParameters& params,
+    NNResultsVector* result) const {
+  return LocalReplica().FindNeighborsNoSortNoExactReorder(query, params,
+                                                          result);
+}
+
+template <typename T>
+Status NumaReplicatedSearcher<T>::FindNeighborsBatchedImpl(
+    const TypedDataset<T>& queries, ConstSpan<SearchParameters> params,
+    MutableSpan<NNResultsVector> results) const {
+  return LocalReplica().FindNeighborsBatched(queries, params, results);
+}
+
+template <typename T>
+Status NumaReplicatedSearcher<T>::EnableCrowdingImpl(
+    ConstSpan<int64_t> datapoint_index_to_crowding_attribute) {
+  for (auto& replica : replicas_) {
+    if (replica->crowding_enabled()) continue;
+    SCANN_RETURN_IF_ERROR(replica->EnableCrowding(
+        std::vector<int64_t>(datapoint_index_to_crowding_attribute.begin(),
+                             datapoint_index_to_crowding_attribute.end())));
+  }
+  return OkStatus();
+}
+
+template <typename T>
+void NumaReplicatedSearcher<T>::DisableCrowdingImpl() {
+  for (auto& replica : replicas_) replica->DisableCrowding();
+}
+
+template <typename T>
+Status NumaReplicatedSearcher<T>::ApplyMemoryPolicy(
+    const MemoryPolicy& policy) {
+  for (size_t i : IndicesOf(replicas_)) {
+    MemoryPolicy replica_policy = policy;
+    if (policy.numa_policy != MemoryPolicy::NumaPolicy::kDefault) {
+      replica_policy.numa_policy = MemoryPolicy::NumaPolicy::kBind;
+      replica_policy.numa_nodes = {numa_nodes_[i]};
+    }
+    SCANN_RETURN_IF_ERROR(replicas_[i]->ApplyMemoryPolicy(replica_policy));
+  }
+  return OkStatus();
+}
+
+template <typename T>
+MemoryUsageReport NumaReplicatedSearcher<T>::MemoryUsageBreakdown() const {
+  MemoryUsageReport report =
+      SingleMachineSearcherBase<T>::MemoryUsageBreakdown();
+  report.set_name("NumaReplicatedSearcher");
+  for (size_t i : IndicesOf(replicas_)) {
+    report.AddChild(replicas_[i]->MemoryUsageBreakdown())
+        .set_name(absl::StrCat("replica_node_", numa_nodes_[i]));
+  }
+  return report;
+}
+
+SCANN_INSTANTIATE_TYPED_CLASS(, NumaReplicatedSearcher);
+
+}  // namespace research_scann
@@ -0,0 +1,118 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_BASE_NUMA_REPLICATED_SEARCHER_H_
+#define SCANN_BASE_NUMA_REPLICATED_SEARCHER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "scann/base/search_parameters.h"
+#include "scann/base/single_machine_base.h"
+#include "scann/base/single_machine_factory_options.h"
+#include "scann/data_format/datapoint.h"
+#include "scann/data_format/dataset.h"
+#include "scann/oss_wrappers/scann_threadpool.h"
+#include "scann/proto/scann.pb.h"
+#include "scann/utils/memory_policy.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+Status PinThreadPoolToNumaNodes(ThreadPool* pool, ConstSpan<int> numa_nodes);
+
+template <typename T>
+class NumaReplicatedSearcher final : public SingleMachineSearcherBase<T> {
+ public:
+  static StatusOr<unique_ptr<NumaReplicatedSearcher<T>>> Create(
+      const ScannConfig& config,
+      unique_ptr<SingleMachineSearcherBase<T>> searcher,
+      std::vector<int> numa_nodes = {},
+      MemoryPolicy::PageSize page_size = MemoryPolicy::PageSize::kDefault);
+
+  using SingleMachineSearcherBase<T>::FindNeighbors;
+
+  Status FindNeighbors(const DatapointPtr<T>& query,
+                       const SearchParameters& params,
+                       NNResultsVector* result) const final;
+
+  Status PreprocessQueryIntoParamsUnlocked(
+      const DatapointPtr<T>& query,
+      SearchParameters& search_params) const final {
+    return LocalReplica().PreprocessQueryIntoParamsUnlocked(query,
+                                                            search_params);
+  }
+
+  StatusOr<shared_ptr<const DenseDataset<float>>> SharedFloatDatasetIfNeeded()
+      final {
+    return replicas_.front()->SharedFloatDatasetIfNeeded();
+  }
+
+  StatusOr<SingleMachineFactoryOptions> ExtractSingleMachineFactoryOptions()
+      final {
+    return replicas_.front()->ExtractSingleMachineFactoryOptions();
+  }
+
+  bool supports_crowding() const final {
+    return replicas_.front()->supports_crowding();
+  }
+
+  DatapointIndex optimal_batch_size() const final {
+    return replicas_.front()->optimal_batch_size();
+  }
+
+  Status ApplyMemoryPolicy(const MemoryPolicy& policy) final;
+
+  MemoryUsageReport MemoryUsageBreakdown() const final;
+
+  size_t num_replicas() const { return replicas_.size(); }
+
+  ConstSpan<int> numa_nodes() const { return numa_nodes_; }
+
+  const SingleMachineSearcherBase<T>& LocalReplica() const;
+
+ protected:
+  bool impl_needs_dataset() const final { return false; }
+
+  Status FindNeighborsImpl(const DatapointPtr<T>& query,
+                           const SearchParameters& params,
+                           NNResultsVector* result) const final;
+
+  Status FindNeighborsBatchedImpl(
+      const TypedDataset<T>& queries, ConstSpan<SearchParameters> params,
+      MutableSpan<NNResultsVector> results) const final;
+
+  Status EnableCrowdingImpl(
+      ConstSpan<int64_t> datapoint_index_to_crowding_attribute) final;
+
+  void DisableCrowdingImpl() final;
+
+ private:
+  NumaReplicatedSearcher(
+      shared_ptr<const TypedDataset<T>> dataset,
+      std::vector<unique_ptr<SingleMachineSearcherBase<T>>> replicas,
+      std::vector<int> numa_nodes, std::vector<uint32_t> replica_by_cpu);
+
+  std::vector<unique_ptr<SingleMachineSearcherBase<T>>> replicas_;
+
+  std::vector<int> numa_nodes_;
+
+  std::vector<uint32_t> replica_by_cpu_;
+};
+
+SCANN_INSTANTIATE_TYPED_CLASS(extern, NumaReplicatedSearcher);
+
+}  // namespace research_scann
+
+#endif
@@ -16,6 +16,7 @@
 
 #include <memory>
 
+#include "scann/data_format/compressed_dense_dataset.h"
 #include "scann/hashes/asymmetric_hashing2/training_model.h"
 #include "scann/oss_wrappers/scann_down_cast.h"
 #include "scann/projection/projection_factory.h"
@@ -63,6 +64,23 @@ StatusOrHelper<float> BuildFixedPointReorderingHelper<float>(
             .SetErrorCode(error::INVALID_ARGUMENT)
         << "Multipliers for pre-quantized FP8 reordering must be of the same "
            "dimensionality as the pre-quantized dataset.";
+    if (config.quantization_type() == FixedPoint::INT4) {
+      if (distance_type == typeid(const DotProductDistance)) {
+        return {make_unique<FixedPointInt4FloatDenseDotProductReorderingHelper>(
+            fixed_point_dataset, multiplier_by_dimension)};
+      } else if (distance_type == typeid(const CosineDistance)) {
+        return {make_unique<FixedPointInt4FloatDenseCosineReorderingHelper>(
+            fixed_point_dataset, multiplier_by_dimension)};
+      } else if (distance_type == typeid(const SquaredL2Distance)) {
+        return {make_unique<FixedPointInt4FloatDenseSquaredL2ReorderingHelper>(
+            fixed_point_dataset, multiplier_by_dimension,
+            opts->pre_quantized_fixed_point->squared_l2_norm_by_datapoint)};
+      } else {
+        return InvalidArgumentError(
+            "Int4 fixed-point reordering is supported only for dot product, "
+            "cosine and squared L2 distance.");
+      }
+    }
     if (distance_type == typeid(const DotProductDistance)) {
       return {make_unique<FixedPointFloatDenseDotProductReorderingHelper>(
           move(fixed_point_dataset), move(multiplier_by_dimension))};
@@ -88,6 +106,22 @@ StatusOrHelper<float> BuildFixedPointReorderingHelper<float>(
     }
     const DenseDataset<float>& dense_dataset =
         *down_cast<const DenseDataset<float>*>(dataset.get());
+    if (config.quantization_type() == FixedPoint::INT4) {
+      if (distance_type == typeid(const DotProductDistance)) {
+        return {make_unique<FixedPointInt4FloatDenseDotProductReorderingHelper>(
+            dense_dataset, fp_quantile)};
+      } else if (distance_type == typeid(const CosineDistance)) {
+        return {make_unique<FixedPointInt4FloatDenseCosineReorderingHelper>(
+            dense_dataset, fp_quantile)};
+      } else if (distance_type == typeid(const SquaredL2Distance)) {
+        return {make_unique<FixedPointInt4FloatDenseSquaredL2ReorderingHelper>(
+            dense_dataset, fp_quantile)};
+      } else {
+        return InvalidArgumentError(
+            "Int4 fixed-point reordering is supported only for dot product, "
+            "cosine and squared L2 distance.");
+      }
+    }
     if (distance_type == typeid(const DotProductDistance)) {
       return {make_unique<FixedPointFloatDenseDotProductReorderingHelper>(
           dense_dataset, fp_quantile)};
@@ -108,12 +142,108 @@ StatusOrHelper<float> BuildFixedPointReorderingHelper<float>(
   }
 }
 
+template <typename T>
+StatusOrHelper<T> BuildCompressedReorderingHelper(
+    const BlockCompression& config,
+    const shared_ptr<const DistanceMeasure>& reordering_dist,
+    const shared_ptr<TypedDataset<T>>& dataset,
+    SingleMachineFactoryOptions* opts) {
+  return InvalidArgumentError(
+      "Block-compressed exact reordering is only supported for float types.");
+}
+
+template <>
+StatusOrHelper<float> BuildCompressedReorderingHelper<float>(
+    const BlockCompression& config,
+    const shared_ptr<const DistanceMeasure>& reordering_dist,
+    const shared_ptr<TypedDataset<float>>& dataset,
+    SingleMachineFactoryOptions* opts) {
+  shared_ptr<const CompressedDenseDataset> compressed =
+      opts->compressed_reordering_dataset;
+  if (!compressed) {
+    if (!dataset || !dataset->IsDense()) {
+      return InvalidArgumentError(
+          "Block-compressed exact reordering requires a dense dataset.");
+    }
+    if (config.datapoints_per_block() <= 0 ||
+        config.decoded_block_cache_size() < 0) {
+      return InvalidArgumentError(
+          "exact_reordering.block_compression.datapoints_per_block must be "
+          "> 0 and decoded_block_cache_size must be >= 0.");
+    }
+    CompressedDenseDatasetOptions compression_opts;
+    compression_opts.datapoints_per_block = config.datapoints_per_block();
+    compression_opts.decoded_block_cache_size =
+        config.decoded_block_cache_size();
+    TF_ASSIGN_OR_RETURN(
+        compressed,
+        CompressedDenseDataset::Create(
+            *down_cast<const DenseDataset<float>*>(dataset.get()),
+            compression_opts, opts->parallelization_pool.get()));
+  }
+  return {make_unique<CompressedExactReorderingHelper>(
+      reordering_dist, std::move(compressed), opts->parallelization_pool)};
+}
+
+template <typename T>
+StatusOrHelper<T> ChainedReorderingFactory(
+    const ExactReordering& config,
+    const shared_ptr<const DistanceMeasure>& reordering_dist,
+    const shared_ptr<TypedDataset<T>>& dataset,
+    SingleMachineFactoryOptions* opts,
+    unique_ptr<ReorderingInterface<T>> final_stage) {
+  int num_fixed_point_stages =
+      config.fixed_point().enabled() || config.use_fixed_point_if_possible();
+  vector<typename ChainedReorderingHelper<T>::Stage> stages;
+  for (const ReorderingStage& stage_config : config.intermediate_stages()) {
+    if (stage_config.num_neighbors() <= 0) {
+      return InvalidArgumentError(
+          "exact_reordering.intermediate_stages.num_neighbors must be > 0.");
+    }
+    typename ChainedReorderingHelper<T>::Stage stage;
+    stage.num_neighbors = stage_config.num_neighbors();
+    stage.epsilon = stage_config.epsilon_distance();
+    if (stage_config.fixed_point().enabled()) {
+      if (++num_fixed_point_stages > 1) {
+        return InvalidArgumentError(
+            "At most one exact_reordering stage may use fixed-point "
+            "reordering.");
+      }
+      TF_ASSIGN_OR_RETURN(
+          auto helper,
+          BuildFixedPointReorderingHelper<T>(stage_config.fixed_point(),
+                                             reordering_dist, dataset, opts));
+      if (!helper) {
+        return InvalidArgumentError(
+            "Fixed-point intermediate reordering stages require a dense "
+            "dataset.");
+      }
+      stage.helper = std::move(helper);
+    } else {
+      stage.helper =
+          std::make_shared<ExactReorderingHelper<T>>(reordering_dist, dataset);
+    }
+    stages.push_back(std::move(stage));
+  }
+  return {make_unique<ChainedReorderingHelper<T>>(std::move(stages),
+                                                  std::move(final_stage))};
+}
+
 template <typename T>
 StatusOrHelper<T> ExactReorderingFactory(
     const ExactReordering& config,
     const shared_ptr<const DistanceMeasure>& reordering_dist,
     const shared_ptr<TypedDataset<T>>& dataset,
     SingleMachineFactoryOptions* opts) {
+  if (config.intermediate_stages_size() > 0) {
+    ExactReordering final_config = config;
+    final_config.clear_intermediate_stages();
+    TF_ASSIGN_OR_RETURN(auto final_stage,
+                        ExactReorderingFactory<T>(final_config, reordering_dist,
+                                                  dataset, opts));
+    return ChainedReorderingFactory<T>(config, reordering_dist, dataset, opts,
+                                       std::move(final_stage));
+  }
   if (config.fixed_point().enabled() || config.use_fixed_point_if_possible()) {
     auto statusor = BuildFixedPointReorderingHelper<T>(
         config.fixed_point(), reordering_dist, dataset, opts);
@@ -124,6 +254,10 @@ StatusOrHelper<T> ExactReorderingFactory(
     } else {
     }
   }
+  if (config.block_compression().enabled()) {
+    return BuildCompressedReorderingHelper<T>(config.block_compression(),
+                                              reordering_dist, dataset, opts);
+  }
   return {make_unique<ExactReorderingHelper<T>>(reordering_dist, dataset)};
 }
 
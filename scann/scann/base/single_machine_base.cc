@@ -116,6 +116,33 @@ StatusOr<DatapointIndex> UntypedSingleMachineSearcherBase::DatasetSize() const {
   }
 }
 
+Status UntypedSingleMachineSearcherBase::ApplyMemoryPolicy(
+    const MemoryPolicy& policy) {
+  if (hashed_dataset_) {
+    SCANN_RETURN_IF_ERROR(
+        research_scann::ApplyMemoryPolicy(policy, hashed_dataset_->data()));
+  }
+  return OkStatus();
+}
+
+MemoryUsageReport UntypedSingleMachineSearcherBase::MemoryUsageBreakdown()
+    const {
+  MemoryUsageReport report("Searcher");
+  if (hashed_dataset_) {
+    report.AddSharedChild("hashed_dataset", hashed_dataset_.get(),
+                          hashed_dataset_->MemoryUsageExcludingDocids());
+  }
+  if (docids_) {
+    report.AddSharedChild("docids", docids_.get(), docids_->MemoryUsage());
+  }
+  if (datapoint_index_to_crowding_attribute_) {
+    report.AddSharedChild(
+        "crowding_attributes", datapoint_index_to_crowding_attribute_.get(),
+        VectorStorage(*datapoint_index_to_crowding_attribute_));
+  }
+  return report;
+}
+
 bool UntypedSingleMachineSearcherBase::impl_needs_dataset() const {
   return true;
 }
@@ -460,6 +487,36 @@ void SingleMachineSearcherBase<T>::ReleaseHashedDataset() {
   hashed_dataset_.reset();
 }
 
+template <typename T>
+Status SingleMachineSearcherBase<T>::ApplyMemoryPolicy(
+    const MemoryPolicy& policy) {
+  SCANN_RETURN_IF_ERROR(
+      UntypedSingleMachineSearcherBase::ApplyMemoryPolicy(policy));
+  if (dataset_ && dataset_->IsDense()) {
+    SCANN_RETURN_IF_ERROR(research_scann::ApplyMemoryPolicy(
+        policy, down_cast<const DenseDataset<T>&>(*dataset_).data()));
+  }
+  return OkStatus();
+}
+
+template <typename T>
+MemoryUsageReport SingleMachineSearcherBase<T>::MemoryUsageBreakdown() const {
+  MemoryUsageReport report =
+      UntypedSingleMachineSearcherBase::MemoryUsageBreakdown();
+  if (dataset_) {
+    report.AddSharedChild("dataset", dataset_.get(),
+                          dataset_->MemoryUsageExcludingDocids());
+    if (dataset_->docids()) {
+      report.AddSharedChild("docids", dataset_->docids().get(),
+                            dataset_->DocidMemoryUsage());
+    }
+  }
+  if (reordering_helper_) {
+    report.AddChild(reordering_helper_->MemoryUsageBreakdown());
+  }
+  return report;
+}
+
 template <typename T>
 void SingleMachineSearcherBase<T>::ReleaseDatasetAndDocids() {
   if (needs_dataset()) {
@@ -29,6 +29,8 @@
 #include "scann/metadata/metadata_getter.h"
 #include "scann/oss_wrappers/scann_down_cast.h"
 #include "scann/proto/scann.pb.h"
+#include "scann/utils/memory_logging.h"
+#include "scann/utils/memory_policy.h"
 #include "scann/utils/reordering_helper.h"
 #include "scann/utils/types.h"
 #include "scann/utils/util_functions.h"
@@ -132,6 +134,10 @@ class UntypedSingleMachineSearcherBase {
 
   StatusOr<DatapointIndex> DatasetSize() const;
 
+  virtual Status ApplyMemoryPolicy(const MemoryPolicy& policy);
+
+  virtual MemoryUsageReport MemoryUsageBreakdown() const;
+
   virtual int64_t num_active_dimensions() const {
     return (dataset() == nullptr) ? -1 : (dataset()->NumActiveDimensions());
   }
@@ -157,6 +163,15 @@ class UntypedSingleMachineSearcherBase {
 
   virtual void DisableCrowdingImpl() {}
 
+  void CopyDefaultSearchParametersFrom(
+      const UntypedSingleMachineSearcherBase& other) {
+    default_search_parameters_ = SearchParameters(
+        other.default_pre_reordering_num_neighbors(),
+        other.default_pre_reordering_epsilon(),
+        other.default_post_reordering_num_neighbors(),
+        other.default_post_reordering_epsilon());
+  }
+
  private:
   UntypedSingleMachineSearcherBase(
       const shared_ptr<const DenseDataset<uint8_t>> hashed_dataset,
@@ -238,9 +253,9 @@ class SingleMachineSearcherBase : public UntypedSingleMachineSearcherBase {
 
   Status FindNeighborsBatched(const TypedDataset<T>& queries,
                               MutableSpan<NNResultsVector> results) const;
-  Status FindNeighborsBatched(const TypedDataset<T>& queries,
-                              ConstSpan<SearchParameters> params,
-                              MutableSpan<NNResultsVector> results) const;
+  virtual Status FindNeighborsBatched(
+      const TypedDataset<T>& queries, ConstSpan<SearchParameters> params,
+      MutableSpan<NNResultsVector> results) const;
   Status FindNeighborsBatchedNoSortNoExactReorder(
       const TypedDataset<T>& queries, ConstSpan<SearchParameters> params,
       MutableSpan<NNResultsVector> results) const;
@@ -272,6 +287,10 @@ class SingleMachineSearcherBase : public UntypedSingleMachineSearcherBase {
   void ReleaseHashedDataset() final;
   void ReleaseDatasetAndDocids() final;
 
+  Status ApplyMemoryPolicy(const MemoryPolicy& policy) override;
+
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
   DatapointPtr<T> GetDatapointPtr(DatapointIndex i) const {
     DCHECK(dataset_);
     return (*dataset_)[i];
@@ -332,10 +351,6 @@ class SingleMachineSearcherBase : public UntypedSingleMachineSearcherBase {
       const TypedDataset<T>& queries, ConstSpan<SearchParameters> params,
       MutableSpan<NNResultsVector> results) const;
 
- private:
-  Status PopulateDefaultParameters(const ScannConfig& config);
-  Status BaseInitImpl();
-
   Status ReorderResults(const DatapointPtr<T>& query,
                         const SearchParameters& params,
                         NNResultsVector* result) const;
@@ -343,6 +358,10 @@ class SingleMachineSearcherBase : public UntypedSingleMachineSearcherBase {
   Status SortAndDropResults(NNResultsVector* result,
                             const SearchParameters& params) const;
 
+ private:
+  Status PopulateDefaultParameters(const ScannConfig& config);
+  Status BaseInitImpl();
+
   shared_ptr<const TypedDataset<T>> dataset_ = nullptr;
 
   shared_ptr<const ReorderingInterface<T>> reordering_helper_ = nullptr;
@@ -20,16 +20,17 @@ namespace research_scann {
 
 StatusOr<DatapointIndex> SingleMachineFactoryOptions::ComputeConsistentSize(
     const Dataset* dataset) const {
-  return ComputeConsistentNumPointsFromIndex(dataset, hashed_dataset.get(),
-                                             pre_quantized_fixed_point.get(),
-                                             crowding_attributes.get());
+  return ComputeConsistentNumPointsFromIndex(
+      dataset, hashed_dataset.get(), pre_quantized_fixed_point.get(),
+      compressed_reordering_dataset.get(), crowding_attributes.get());
 }
 
 StatusOr<DimensionIndex>
 SingleMachineFactoryOptions::ComputeConsistentDimensionality(
     const HashConfig& config, const Dataset* dataset) const {
   return ComputeConsistentDimensionalityFromIndex(
-      config, dataset, hashed_dataset.get(), pre_quantized_fixed_point.get());
+      config, dataset, hashed_dataset.get(), pre_quantized_fixed_point.get(),
+      compressed_reordering_dataset.get());
 }
 
 }  // namespace research_scann
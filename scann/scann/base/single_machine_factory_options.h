@@ -34,6 +34,8 @@ class TypedDataset;
 template <typename T>
 class SingleMachineSearcherBase;
 class ScannConfig;
+class CompressedDenseDataset;
+struct MemoryPolicy;
 
 struct SingleMachineFactoryOptions {
   SingleMachineFactoryOptions() {}
@@ -50,6 +52,8 @@ struct SingleMachineFactoryOptions {
 
   shared_ptr<PreQuantizedFixedPoint> pre_quantized_fixed_point;
 
+  shared_ptr<const CompressedDenseDataset> compressed_reordering_dataset;
+
   shared_ptr<DenseDataset<uint8_t>> hashed_dataset;
 
   std::shared_ptr<CentersForAllSubspaces> ah_codebook;
@@ -63,6 +67,8 @@ struct SingleMachineFactoryOptions {
   shared_ptr<vector<int64_t>> crowding_attributes;
 
   shared_ptr<ThreadPool> parallelization_pool;
+
+  shared_ptr<const MemoryPolicy> memory_policy;
 };
 
 }  // namespace research_scann
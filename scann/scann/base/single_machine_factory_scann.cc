@@ -14,6 +14,7 @@
 
 #include "scann/base/single_machine_factory_scann.h"
 
+#include <cmath>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -28,6 +29,7 @@
 #include "scann/base/single_machine_factory_options.h"
 #include "scann/brute_force/brute_force.h"
 #include "scann/brute_force/scalar_quantized_brute_force.h"
+#include "scann/brute_force/sparse_inverted_index_searcher.h"
 #include "scann/data_format/dataset.h"
 #include "scann/distance_measures/distance_measure_factory.h"
 #include "scann/oss_wrappers/scann_threadpool.h"
@@ -51,6 +53,30 @@ using std::dynamic_pointer_cast;
 namespace research_scann {
 namespace {
 
+template <typename T>
+class SequentialMmapAdviceScope {
+ public:
+  explicit SequentialMmapAdviceScope(const TypedDataset<T>* dataset) {
+    auto dense = dynamic_cast<const DenseDataset<T>*>(dataset);
+    if (!dense || !dense->IsMemoryMapped()) return;
+    restore_ = dense->IsAdvisedRandomAccess() ? MmapAccessPattern::kRandom
+                                              : MmapAccessPattern::kNormal;
+    if (dense->AdviseMemoryMapping(MmapAccessPattern::kSequential).ok()) {
+      dense_ = dense;
+    }
+  }
+
+  ~SequentialMmapAdviceScope() {
+    if (dense_) dense_->AdviseMemoryMapping(restore_).IgnoreError();
+  }
+
+  SCANN_DECLARE_IMMOBILE_CLASS(SequentialMmapAdviceScope);
+
+ private:
+  const DenseDataset<T>* dense_ = nullptr;
+  MmapAccessPattern restore_ = MmapAccessPattern::kNormal;
+};
+
 template <typename T>
 StatusOr<unique_ptr<Partitioner<T>>> CreateTreeXPartitioner(
     shared_ptr<const TypedDataset<T>> dataset, const ScannConfig& config,
@@ -74,6 +100,7 @@ StatusOr<unique_ptr<Partitioner<T>>> CreateTreeXPartitioner(
       return InvalidArgumentError(
           "Partitioning_on_the_fly needs original dataset to proceed.");
     }
+    SequentialMmapAdviceScope<T> advice(dataset.get());
     TF_ASSIGN_OR_RETURN(
         partitioner, PartitionerFactory<T>(dataset.get(), config.partitioning(),
                                            opts->parallelization_pool));
@@ -124,6 +151,7 @@ StatusOrSearcherUntyped AsymmetricHasherFactory(
     LOG(INFO) << "Single-machine AH training with dataset size = "
               << dataset->size() << ", " << num_workers + 1 << " thread(s).";
 
+    SequentialMmapAdviceScope<T> advice(dataset.get());
     TF_ASSIGN_OR_RETURN(
         training_results,
         internal::HashLeafHelpers<T>::TrainAsymmetricHashingModel(
@@ -181,6 +209,7 @@ StatusOrSearcherUntyped TreeAhHybridResidualFactory<float>(
     if (opts->datapoints_by_token) {
       datapoints_by_token = std::move(*opts->datapoints_by_token);
     } else if (dense) {
+      SequentialMmapAdviceScope<float> advice(dense.get());
       TF_ASSIGN_OR_RETURN(datapoints_by_token,
                           kmeans_tree_partitioner->TokenizeDatabase(
                               *dense, opts->parallelization_pool.get()));
@@ -323,6 +352,9 @@ StatusOrSearcherUntyped PretrainedTreeSQFactoryFromAssets(
                                   &tokenized_squared_l2_norms);
 
   auto inverse_multipliers = InverseMultiplier(fp_assets.get());
+  const bool use_int4 =
+      config.brute_force().fixed_point().quantization_type() ==
+      FixedPoint::INT4;
 
   auto searcher = make_unique<TreeXHybridSMMD<float>>(
       nullptr, nullptr, params.pre_reordering_num_neighbors,
@@ -336,7 +368,8 @@ StatusOrSearcherUntyped PretrainedTreeSQFactoryFromAssets(
         CreateFromQuantizedDatasetAndInverseMultipliers(
             params.pre_reordering_dist, std::move(scalar_quantized_partition),
             inverse_multipliers, std::move(squared_l2_norms),
-            params.pre_reordering_num_neighbors, params.pre_reordering_epsilon);
+            params.pre_reordering_num_neighbors, params.pre_reordering_epsilon,
+            use_int4);
     if (!searcher_or_error.ok()) return searcher_or_error.status();
     auto searcher = std::move(searcher_or_error.ValueOrDie());
     return std::unique_ptr<SingleMachineSearcherBase<float>>(
@@ -412,15 +445,33 @@ StatusOrSearcherUntyped NonResidualTreeXHybridFactory(
         return InvalidArgumentError(
             "Dataset must be dense for scalar-quantized brute force.");
       }
+      if (config.partitioning().has_reindexing()) {
+        return InvalidArgumentError(
+            "partitioning.reindexing is not supported with scalar-quantized "
+            "leaves.");
+      }
       auto sq_config = config.brute_force().fixed_point();
-      auto sq_result = ScalarQuantizeFloatDataset(
-          *dense, sq_config.fixed_point_multiplier_quantile(),
-          sq_config.noise_shaping_threshold());
       auto fp_assets = make_shared<PreQuantizedFixedPoint>();
-      fp_assets->fixed_point_dataset = make_shared<DenseDataset<int8_t>>(
-          std::move(sq_result.quantized_dataset));
-      fp_assets->multiplier_by_dimension = make_shared<vector<float>>(
-          std::move(sq_result.multiplier_by_dimension));
+      if (sq_config.quantization_type() == FixedPoint::INT4) {
+        if (!std::isnan(sq_config.noise_shaping_threshold())) {
+          return InvalidArgumentError(
+              "Noise shaping is not supported for int4 scalar quantization.");
+        }
+        auto int4_result = ScalarQuantizeFloatDatasetToInt4(
+            *dense, sq_config.fixed_point_multiplier_quantile());
+        fp_assets->fixed_point_dataset = make_shared<DenseDataset<int8_t>>(
+            UnpackInt4QuantizedDataset(int4_result.packed_dataset));
+        fp_assets->multiplier_by_dimension = make_shared<vector<float>>(
+            std::move(int4_result.multiplier_by_dimension));
+      } else {
+        auto sq_result = ScalarQuantizeFloatDataset(
+            *dense, sq_config.fixed_point_multiplier_quantile(),
+            sq_config.noise_shaping_threshold());
+        fp_assets->fixed_point_dataset = make_shared<DenseDataset<int8_t>>(
+            std::move(sq_result.quantized_dataset));
+        fp_assets->multiplier_by_dimension = make_shared<vector<float>>(
+            std::move(sq_result.multiplier_by_dimension));
+      }
 
       fp_assets->squared_l2_norm_by_datapoint = make_shared<vector<float>>();
 
@@ -442,7 +493,17 @@ StatusOrSearcherUntyped NonResidualTreeXHybridFactory(
   auto result = make_unique<TreeXHybridSMMD<T>>(
       dataset, opts->hashed_dataset, params.pre_reordering_num_neighbors,
       params.pre_reordering_epsilon);
+  const LazyLeafConfig& lazy_config = config.partitioning().lazy_leaves();
+  if (lazy_config.enabled() && config.partitioning().has_reindexing()) {
+    return InvalidArgumentError(
+        "partitioning.reindexing is not supported with lazy leaves.");
+  }
+  if (lazy_config.enabled()) {
+    result->EnableLazyLeafSearchers(lazy_config.max_resident_bytes());
+  }
 
+  shared_ptr<ThreadPool> leaf_pool =
+      lazy_config.enabled() ? nullptr : opts->parallelization_pool;
   if (config.hash().has_asymmetric_hash() &&
       !config.hash().asymmetric_hash().use_per_leaf_partition_training()) {
     const auto& ah_config = config.hash().asymmetric_hash();
@@ -461,12 +522,13 @@ StatusOrSearcherUntyped NonResidualTreeXHybridFactory(
               dataset, ah_config, params, opts->parallelization_pool));
     }
     auto leaf_searcher_builder_lambda =
-        [&](shared_ptr<TypedDataset<T>> leaf_dataset,
+        [training_results, params, leaf_pool](
+            shared_ptr<TypedDataset<T>> leaf_dataset,
             shared_ptr<DenseDataset<uint8_t>> leaf_hashed_dataset,
             int32_t token) {
           return internal::HashLeafHelpers<T>::AsymmetricHasherFactory(
               leaf_dataset, leaf_hashed_dataset, training_results, params,
-              opts->parallelization_pool);
+              leaf_pool);
         };
 
     std::function<StatusOrSearcher<T>(
@@ -481,6 +543,10 @@ StatusOrSearcherUntyped NonResidualTreeXHybridFactory(
       SCANN_RETURN_IF_ERROR(result->BuildLeafSearchers(
           *partitioner, leaf_searcher_builder, opts->parallelization_pool));
     }
+    if (config.partitioning().has_reindexing()) {
+      result->EnableLeafMaintenance(config.partitioning().reindexing(),
+                                    leaf_searcher_builder);
+    }
 
     result->set_leaf_searcher_optional_parameter_creator(
         make_unique<
@@ -499,12 +565,13 @@ StatusOrSearcherUntyped NonResidualTreeXHybridFactory(
       }
     }
     auto leaf_searcher_builder_lambda =
-        [&](shared_ptr<TypedDataset<T>> leaf_dataset,
+        [spec_config, params, leaf_pool](
+            shared_ptr<TypedDataset<T>> leaf_dataset,
             shared_ptr<DenseDataset<uint8_t>> leaf_hashed_dataset,
             int32_t token) -> StatusOrSearcher<T> {
       SingleMachineFactoryOptions leaf_opts;
       leaf_opts.hashed_dataset = leaf_hashed_dataset;
-      leaf_opts.parallelization_pool = opts->parallelization_pool;
+      leaf_opts.parallelization_pool = leaf_pool;
       TF_ASSIGN_OR_RETURN(auto leaf_searcher,
                           internal::SingleMachineFactoryLeafSearcherScann<T>(
                               spec_config, leaf_dataset, params, &leaf_opts));
@@ -524,6 +591,10 @@ StatusOrSearcherUntyped NonResidualTreeXHybridFactory(
       SCANN_RETURN_IF_ERROR(result->BuildLeafSearchers(
           *partitioner, leaf_searcher_builder, opts->parallelization_pool));
     }
+    if (config.partitioning().has_reindexing()) {
+      result->EnableLeafMaintenance(config.partitioning().reindexing(),
+                                    leaf_searcher_builder);
+    }
   }
 
   if (config.has_input_output() &&
@@ -532,7 +603,7 @@ StatusOrSearcherUntyped NonResidualTreeXHybridFactory(
       config.hash().has_parameters_filename()) {
     return InvalidArgumentError("Serialized hashers are not supported.");
   }
-  if (result->hashed_dataset()) {
+  if (result->hashed_dataset() && !result->lazy_leaves_enabled()) {
     if (opts->hashed_dataset) opts->hashed_dataset.reset();
     result->ReleaseHashedDataset();
   }
@@ -562,7 +633,7 @@ StatusOrSearcherUntyped TreeXHybridFactory(
 template <typename T>
 StatusOrSearcherUntyped BruteForceFactory(
     const BruteForceConfig& config, const shared_ptr<TypedDataset<T>>& dataset,
-    const GenericSearchParameters& params) {
+    const GenericSearchParameters& params, shared_ptr<ThreadPool> pool) {
   SCANN_RET_CHECK(dataset);
 
   if (config.fixed_point().enabled()) {
@@ -576,7 +647,8 @@ StatusOrSearcherUntyped BruteForceFactory(
 
 StatusOrSearcherUntyped BruteForceFactory(const BruteForceConfig& config,
                                           const GenericSearchParameters& params,
-                                          PreQuantizedFixedPoint* fixed_point) {
+                                          PreQuantizedFixedPoint* fixed_point,
+                                          shared_ptr<ThreadPool> pool) {
   auto fixed_point_dataset = std::move(*(fixed_point->fixed_point_dataset));
 
   std::vector<float> inverse_multipliers = InverseMultiplier(fixed_point);
@@ -587,6 +659,23 @@ StatusOrSearcherUntyped BruteForceFactory(const BruteForceConfig& config,
   if (distance_type == typeid(const DotProductDistance) ||
       distance_type == typeid(const CosineDistance) ||
       distance_type == typeid(const SquaredL2Distance)) {
+    if (config.fixed_point().quantization_type() == FixedPoint::INT4) {
+      return {make_unique<ScalarQuantizedBruteForceSearcher>(
+          params.reordering_dist, std::move(squared_l2_norm_by_datapoint),
+          PackInt4QuantizedDataset(fixed_point_dataset),
+          std::move(inverse_multipliers), params.pre_reordering_num_neighbors,
+          params.pre_reordering_epsilon)};
+    }
+    if (config.fixed_point().simd_block_transposed()) {
+      auto searcher = make_unique<ScalarQuantizedBruteForceSearcher>(
+          params.reordering_dist, std::move(squared_l2_norm_by_datapoint),
+          std::move(fixed_point_dataset),
+          fixed_point->transposed_simd_block_size,
+          std::move(inverse_multipliers), params.pre_reordering_num_neighbors,
+          params.pre_reordering_epsilon);
+      searcher->set_thread_pool(std::move(pool));
+      return {std::move(searcher)};
+    }
     return {make_unique<ScalarQuantizedBruteForceSearcher>(
         params.reordering_dist, std::move(squared_l2_norm_by_datapoint),
         std::move(fixed_point_dataset), std::move(inverse_multipliers),
@@ -602,7 +691,7 @@ template <>
 StatusOrSearcherUntyped BruteForceFactory<float>(
     const BruteForceConfig& config,
     const shared_ptr<TypedDataset<float>>& dataset,
-    const GenericSearchParameters& params) {
+    const GenericSearchParameters& params, shared_ptr<ThreadPool> pool) {
   SCANN_RET_CHECK(dataset);
 
   if (config.fixed_point().enabled()) {
@@ -629,9 +718,23 @@ StatusOrSearcherUntyped BruteForceFactory<float>(
         config.fixed_point().fixed_point_multiplier_quantile();
     opts.noise_shaping_threshold =
         config.scalar_quantization_noise_shaping_threshold();
-    return {make_unique<ScalarQuantizedBruteForceSearcher>(
+    opts.use_int4 =
+        config.fixed_point().quantization_type() == FixedPoint::INT4;
+    if (opts.use_int4 && !std::isnan(opts.noise_shaping_threshold)) {
+      return InvalidArgumentError(
+          "Noise shaping is not supported for int4 scalar quantization.");
+    }
+    opts.simd_block_transposed = config.fixed_point().simd_block_transposed();
+    if (opts.use_int4 && opts.simd_block_transposed) {
+      return InvalidArgumentError(
+          "SIMD block-transposed brute force only supports INT8 "
+          "quantization.");
+    }
+    auto searcher = make_unique<ScalarQuantizedBruteForceSearcher>(
         params.pre_reordering_dist, dense, params.pre_reordering_num_neighbors,
-        params.pre_reordering_epsilon, opts)};
+        params.pre_reordering_epsilon, opts);
+    searcher->set_thread_pool(std::move(pool));
+    return {std::move(searcher)};
   } else {
     return {make_unique<BruteForceSearcher<float>>(
         params.pre_reordering_dist, dataset,
@@ -639,6 +742,30 @@ StatusOrSearcherUntyped BruteForceFactory<float>(
   }
 }
 
+template <typename T>
+StatusOrSearcherUntyped SparseInvertedIndexFactory(
+    const BruteForceConfig& config, const shared_ptr<TypedDataset<T>>& dataset,
+    const GenericSearchParameters& params) {
+  SCANN_RET_CHECK(dataset);
+
+  if (config.fixed_point().enabled()) {
+    return InvalidArgumentError(
+        "The sparse inverted index cannot be combined with scalar-quantized "
+        "brute force.");
+  }
+  typename SparseInvertedIndexSearcher<T>::Options opts;
+  opts.pruning =
+      config.sparse_inverted_index().pruning() == SparseInvertedIndex::EXHAUSTIVE
+          ? SparseInvertedIndexSearcher<T>::Pruning::kExhaustive
+          : SparseInvertedIndexSearcher<T>::Pruning::kMaxScore;
+  TF_ASSIGN_OR_RETURN(auto searcher,
+                      SparseInvertedIndexSearcher<T>::Create(
+                          params.pre_reordering_dist, dataset,
+                          params.pre_reordering_num_neighbors,
+                          params.pre_reordering_epsilon, opts));
+  return {std::move(searcher)};
+}
+
 template <typename T>
 StatusOrSearcherUntyped HashFactory(shared_ptr<TypedDataset<T>> dataset,
                                     const ScannConfig& config,
@@ -679,13 +806,18 @@ class ScannLeafSearcher {
     if (config.has_partitioning()) {
       return TreeXHybridFactory<T>(config, dataset, params, opts);
     } else if (config.has_brute_force()) {
-      if (std::is_same<T, float>::value &&
-          config.brute_force().fixed_point().enabled() &&
-          opts->pre_quantized_fixed_point) {
+      if (config.brute_force().sparse_inverted_index().enabled()) {
+        return SparseInvertedIndexFactory<T>(config.brute_force(), dataset,
+                                             params);
+      } else if (std::is_same<T, float>::value &&
+                 config.brute_force().fixed_point().enabled() &&
+                 opts->pre_quantized_fixed_point) {
         return BruteForceFactory(config.brute_force(), params,
-                                 opts->pre_quantized_fixed_point.get());
+                                 opts->pre_quantized_fixed_point.get(),
+                                 opts->parallelization_pool);
       } else {
-        return BruteForceFactory(config.brute_force(), dataset, params);
+        return BruteForceFactory(config.brute_force(), dataset, params,
+                                 opts->parallelization_pool);
       }
     } else if (config.has_hash()) {
       return HashFactory<T>(dataset, config, opts, params);
@@ -711,8 +843,15 @@ StatusOr<unique_ptr<SingleMachineSearcherBase<T>>> SingleMachineFactoryScann(
 StatusOrSearcherUntyped SingleMachineFactoryUntypedScann(
     const ScannConfig& config, shared_ptr<Dataset> dataset,
     SingleMachineFactoryOptions opts) {
-  return internal::SingleMachineFactoryUntypedImpl<ScannLeafSearcher>(
-      config, dataset, opts);
+  const shared_ptr<const MemoryPolicy> memory_policy = opts.memory_policy;
+  TF_ASSIGN_OR_RETURN(
+      auto searcher,
+      internal::SingleMachineFactoryUntypedImpl<ScannLeafSearcher>(
+          config, dataset, opts));
+  if (memory_policy) {
+    SCANN_RETURN_IF_ERROR(searcher->ApplyMemoryPolicy(*memory_policy));
+  }
+  return searcher;
 }
 
 namespace internal {
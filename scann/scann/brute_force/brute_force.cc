@@ -23,7 +23,10 @@
 #include "scann/base/search_parameters.h"
 #include "scann/base/single_machine_base.h"
 #include "scann/distance_measures/many_to_many/many_to_many.h"
+#include "scann/distance_measures/many_to_many/many_to_many_binary.h"
 #include "scann/distance_measures/one_to_many/one_to_many.h"
+#include "scann/distance_measures/one_to_many/one_to_many_binary.h"
+#include "scann/distance_measures/one_to_many/one_to_many_sparse_dense.h"
 #include "scann/oss_wrappers/scann_down_cast.h"
 #include "scann/utils/common.h"
 #include "scann/utils/fast_top_neighbors.h"
@@ -43,11 +46,15 @@ BruteForceSearcher<T>::BruteForceSearcher(
                                    default_pre_reordering_num_neighbors,
                                    default_pre_reordering_epsilon),
       distance_(distance),
+      is_binary_popcount_distance_(
+          IsSameAny<T, uint8_t, uint64_t>() && dataset->IsDense() &&
+          IsSupportedBinaryPopcountDistance(*distance)),
       supports_low_level_batching_(
-          (typeid(*distance) == typeid(DotProductDistance) ||
-           typeid(*distance) == typeid(CosineDistance) ||
-           typeid(*distance) == typeid(SquaredL2Distance)) &&
-          dataset->IsDense() && IsFloatingType<T>()) {}
+          ((typeid(*distance) == typeid(DotProductDistance) ||
+            typeid(*distance) == typeid(CosineDistance) ||
+            typeid(*distance) == typeid(SquaredL2Distance)) &&
+           dataset->IsDense() && IsFloatingType<T>()) ||
+          is_binary_popcount_distance_) {}
 
 template <typename T>
 BruteForceSearcher<T>::~BruteForceSearcher() {}
@@ -253,8 +260,24 @@ BruteForceSearcher<T>::FinishBatchedSearch(
     const DenseDataset<Float>& db, const DenseDataset<Float>& queries,
     ConstSpan<SearchParameters> params,
     MutableSpan<NNResultsVector> results) const {
+  if constexpr (IsSameAny<Float, uint8_t, uint64_t>()) {
+    if (is_binary_popcount_distance_) {
+      vector<FastTopNeighbors<float>> top_ns(queries.size());
+      for (size_t i : IndicesOf(params)) {
+        top_ns[i].Init(params[i].pre_reordering_num_neighbors(),
+                       params[i].pre_reordering_epsilon());
+      }
+      DenseBinaryDistanceManyToManyTopK(*distance_, queries, db,
+                                        MakeMutableSpan(top_ns), pool_.get());
+      for (size_t i : IndicesOf(top_ns)) {
+        top_ns[i].FinishUnsorted(&results[i]);
+      }
+      return;
+    }
+  }
   LOG(FATAL) << "Low-level batching only works and should only be called with "
-                "float/double types.  This codepath should be impossible.";
+                "float/double types or binary popcount distances.  This "
+                "codepath should be impossible.";
 }
 
 template <typename T>
@@ -322,7 +345,8 @@ Status BruteForceSearcher<T>::FindNeighborsBatchedImpl(
   }
 
   for (const SearchParameters& p : params) {
-    if (p.restricts_enabled()) {
+    if (p.restricts_enabled() ||
+        (is_binary_popcount_distance_ && p.pre_reordering_crowding_enabled())) {
       return SingleMachineSearcherBase<T>::FindNeighborsBatchedImpl(
           queries, params, results);
     }
@@ -368,7 +392,18 @@ void BruteForceSearcher<T>::FindNeighborsInternal(
     } else {
       unique_ptr<float[]> distances_storage(new float[dataset.size()]);
       MutableSpan<float> distances(distances_storage.get(), dataset.size());
-      DenseDistanceOneToMany<T, float>(*distance_, query, dataset, distances);
+      if constexpr (IsSameAny<T, uint8_t, uint64_t>()) {
+        if (is_binary_popcount_distance_) {
+          DenseBinaryDistanceOneToMany<T>(*distance_, query, dataset,
+                                          distances);
+        } else {
+          DenseDistanceOneToMany<T, float>(*distance_, query, dataset,
+                                           distances);
+        }
+      } else {
+        DenseDistanceOneToMany<T, float>(*distance_, query, dataset,
+                                         distances);
+      }
       for (DatapointIndex i : IndicesOf(dataset)) {
         if (distances[i] <= min_keep_distance) {
           top_n.push(std::make_pair(i, distances[i]));
@@ -379,6 +414,8 @@ void BruteForceSearcher<T>::FindNeighborsInternal(
       }
     }
     *top_n_ptr = std::move(top_n);
+  } else if (UseSparseDenseDotProduct(query, params)) {
+    FindNeighborsSparseDenseDotProduct(query, params, top_n_ptr);
   } else if (params.restricts_enabled()) {
     auto it = params.restrict_whitelist()->WhitelistedPointIterator();
     FindNeighborsOneToOneInternal(query, params, &it, top_n_ptr);
@@ -389,6 +426,48 @@ void BruteForceSearcher<T>::FindNeighborsInternal(
   }
 }
 
+template <typename T>
+bool BruteForceSearcher<T>::UseSparseDenseDotProduct(
+    const DatapointPtr<T>& query, const SearchParameters& params) const {
+  return std::is_same_v<T, float> && query.IsSparse() &&
+         this->dataset()->IsDense() && !params.restricts_enabled() &&
+         distance_->specially_optimized_distance_tag() ==
+             DistanceMeasure::DOT_PRODUCT;
+}
+
+template <typename T>
+template <typename TopN>
+void BruteForceSearcher<T>::FindNeighborsSparseDenseDotProduct(
+    const DatapointPtr<T>& query, const SearchParameters& params,
+    TopN* top_n_ptr) const {
+  if constexpr (std::is_same_v<T, float>) {
+    const DenseDataset<float>& dataset =
+        *down_cast<const DenseDataset<float>*>(this->dataset());
+    const size_t num_entries = query.nonzero_entries();
+    vector<uint32_t> indices(query.indices(), query.indices() + num_entries);
+    vector<float> values(num_entries, 1.0f);
+    if (query.has_values()) {
+      std::copy(query.values(), query.values() + num_entries, values.begin());
+    }
+    vector<float> dot_products(dataset.size());
+    SparseDenseDotProductOneToMany(indices, values, dataset,
+                                   MakeMutableSpan(dot_products));
+
+    TopN top_n = std::move(*top_n_ptr);
+    float min_keep_distance = params.pre_reordering_epsilon();
+    for (DatapointIndex i : IndicesOf(dataset)) {
+      const float dist = -dot_products[i];
+      if (dist <= min_keep_distance) {
+        top_n.push(std::make_pair(i, dist));
+        if (top_n.full()) {
+          min_keep_distance = top_n.approx_bottom().second;
+        }
+      }
+    }
+    *top_n_ptr = std::move(top_n);
+  }
+}
+
 template <typename T>
 template <typename AllowlistIterator, typename TopN>
 void BruteForceSearcher<T>::FindNeighborsOneToOneInternal(
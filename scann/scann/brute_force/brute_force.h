@@ -68,6 +68,14 @@ class BruteForceSearcher final : public SingleMachineSearcherBase<T> {
                              const SearchParameters& params,
                              TopN* top_n_ptr) const;
 
+  bool UseSparseDenseDotProduct(const DatapointPtr<T>& query,
+                                const SearchParameters& params) const;
+
+  template <typename TopN>
+  void FindNeighborsSparseDenseDotProduct(const DatapointPtr<T>& query,
+                                          const SearchParameters& params,
+                                          TopN* top_n_ptr) const;
+
   template <typename WhitelistIterator, typename TopN>
   void FindNeighborsOneToOneInternal(const DatapointPtr<T>& query,
                                      const SearchParameters& params,
@@ -93,6 +101,8 @@ class BruteForceSearcher final : public SingleMachineSearcherBase<T> {
 
   shared_ptr<const DistanceMeasure> distance_;
 
+  const bool is_binary_popcount_distance_;
+
   const bool supports_low_level_batching_;
 
   std::shared_ptr<ThreadPool> pool_;
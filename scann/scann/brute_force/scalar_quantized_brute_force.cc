@@ -14,14 +14,20 @@
 
 #include "scann/brute_force/scalar_quantized_brute_force.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <numeric>
+#include <utility>
 
 #include "absl/memory/memory.h"
 #include "scann/base/restrict_allowlist.h"
 #include "scann/base/search_parameters.h"
 #include "scann/base/single_machine_base.h"
 #include "scann/data_format/dataset.h"
+#include "scann/distance_measures/many_to_many/many_to_many.h"
 #include "scann/distance_measures/one_to_many/one_to_many.h"
+#include "scann/distance_measures/one_to_many/one_to_many_int4.h"
+#include "scann/distance_measures/one_to_one/dot_product.h"
 #include "scann/oss_wrappers/scann_status_builder.h"
 #include "scann/utils/fixed_point/pre_quantized_fixed_point.h"
 #include "scann/utils/scalar_quantization_helpers.h"
@@ -45,6 +51,35 @@ Status CheckValidDistanceTag(
   return OkStatus();
 }
 
+namespace {
+
+void DenseDotProductDistanceOneToManyFP8Transposed(
+    const DatapointPtr<float>& query,
+    const FP8SimdBlockTransposedDatabase& database,
+    MutableSpan<float> result) {
+  DCHECK_EQ(result.size(), database.size());
+  const float* query_ptr = query.values();
+  const size_t dimensionality = database.dimensionality();
+  const size_t simd_block_size = database.simd_block_size();
+  for (size_t block_start = 0; block_start < database.size();
+       block_start += simd_block_size) {
+    ConstSpan<int8_t> block =
+        database.GetBlock(block_start / simd_block_size);
+    const size_t block_size = block.size() / dimensionality;
+    float* out = result.data() + block_start;
+    std::fill(out, out + block_size, 0.0f);
+    for (size_t dim : Seq(dimensionality)) {
+      const float q = query_ptr[dim];
+      const int8_t* values = block.data() + dim * block_size;
+      for (size_t j : Seq(block_size)) {
+        out[j] -= q * values[j];
+      }
+    }
+  }
+}
+
+}  // namespace
+
 ScalarQuantizedBruteForceSearcher::ScalarQuantizedBruteForceSearcher(
     shared_ptr<const DistanceMeasure> distance,
     shared_ptr<const DenseDataset<float>> dataset,
@@ -55,11 +90,20 @@ ScalarQuantizedBruteForceSearcher::ScalarQuantizedBruteForceSearcher(
                                        default_pre_reordering_epsilon),
       distance_(distance),
       opts_(opts) {
-  ScalarQuantizationResults quantization_results = ScalarQuantizeFloatDataset(
-      *dataset, opts.multiplier_quantile, opts.noise_shaping_threshold);
-  quantized_dataset_ = std::move(quantization_results.quantized_dataset);
-  inverse_multiplier_by_dimension_ =
-      std::move(quantization_results.inverse_multiplier_by_dimension);
+  if (opts.use_int4) {
+    Int4ScalarQuantizationResults quantization_results =
+        ScalarQuantizeFloatDatasetToInt4(*dataset, opts.multiplier_quantile);
+    int4_quantized_dataset_ = std::move(quantization_results.packed_dataset);
+    inverse_multiplier_by_dimension_ =
+        std::move(quantization_results.inverse_multiplier_by_dimension);
+  } else {
+    ScalarQuantizationResults quantization_results =
+        ScalarQuantizeFloatDataset(*dataset, opts.multiplier_quantile,
+                                   opts.noise_shaping_threshold);
+    quantized_dataset_ = std::move(quantization_results.quantized_dataset);
+    inverse_multiplier_by_dimension_ =
+        std::move(quantization_results.inverse_multiplier_by_dimension);
+  }
   const auto distance_tag = distance->specially_optimized_distance_tag();
   auto distance_tag_status = CheckValidDistanceTag(distance_tag);
   if (!distance_tag_status.ok()) {
@@ -71,6 +115,12 @@ ScalarQuantizedBruteForceSearcher::ScalarQuantizedBruteForceSearcher(
       squared_l2_norms_[i] = SquaredL2Norm((*dataset)[i]);
     }
   }
+  if (opts.simd_block_transposed) {
+    CHECK(!opts.use_int4)
+        << "SIMD block transposition is only supported for int8 data.";
+    BuildSimdBlockTransposedDataset(quantized_dataset_);
+    quantized_dataset_ = DenseDataset<int8_t>();
+  }
 }
 
 ScalarQuantizedBruteForceSearcher::ScalarQuantizedBruteForceSearcher(
@@ -88,6 +138,61 @@ ScalarQuantizedBruteForceSearcher::ScalarQuantizedBruteForceSearcher(
   TF_CHECK_OK(this->set_docids(quantized_dataset_.ReleaseDocids()));
 }
 
+ScalarQuantizedBruteForceSearcher::ScalarQuantizedBruteForceSearcher(
+    shared_ptr<const DistanceMeasure> distance, vector<float> squared_l2_norms,
+    DenseDataset<uint8_t> int4_packed_dataset,
+    vector<float> inverse_multiplier_by_dimension,
+    int32_t default_num_neighbors, float default_epsilon)
+    : SingleMachineSearcherBase<float>(nullptr, default_num_neighbors,
+                                       default_epsilon),
+      distance_(distance),
+      squared_l2_norms_(std::move(squared_l2_norms)),
+      int4_quantized_dataset_(std::move(int4_packed_dataset)),
+      inverse_multiplier_by_dimension_(
+          std::move(inverse_multiplier_by_dimension)) {
+  DCHECK_EQ(int4_quantized_dataset_.packing_strategy(), HashedItem::NIBBLE);
+  opts_.use_int4 = true;
+  TF_CHECK_OK(this->set_docids(int4_quantized_dataset_.ReleaseDocids()));
+}
+
+ScalarQuantizedBruteForceSearcher::ScalarQuantizedBruteForceSearcher(
+    shared_ptr<const DistanceMeasure> distance, vector<float> squared_l2_norms,
+    DenseDataset<int8_t> quantized_dataset, uint8_t transposed_simd_block_size,
+    vector<float> inverse_multiplier_by_dimension,
+    int32_t default_num_neighbors, float default_epsilon)
+    : SingleMachineSearcherBase<float>(nullptr, default_num_neighbors,
+                                       default_epsilon),
+      distance_(distance),
+      squared_l2_norms_(std::move(squared_l2_norms)),
+      inverse_multiplier_by_dimension_(
+          std::move(inverse_multiplier_by_dimension)) {
+  opts_.simd_block_transposed = true;
+  TF_CHECK_OK(this->set_docids(quantized_dataset.ReleaseDocids()));
+  if (transposed_simd_block_size ==
+      FP8SimdBlockTransposedDatabase::NativeSimdBlockSize()) {
+    fp8_transposed_dataset_ = FP8SimdBlockTransposedDatabase(
+        quantized_dataset.data(), quantized_dataset.dimensionality(),
+        transposed_simd_block_size, inverse_multiplier_by_dimension_);
+  } else if (transposed_simd_block_size == 0) {
+    BuildSimdBlockTransposedDataset(quantized_dataset);
+  } else {
+    LOG(INFO) << "Serialized SIMD block size "
+              << static_cast<int>(transposed_simd_block_size)
+              << " does not match this CPU; re-blocking the database.";
+    FP8SimdBlockTransposedDatabase serialized(
+        quantized_dataset.data(), quantized_dataset.dimensionality(),
+        transposed_simd_block_size);
+    quantized_dataset = DenseDataset<int8_t>();
+    BuildSimdBlockTransposedDataset(serialized.Untranspose());
+  }
+}
+
+void ScalarQuantizedBruteForceSearcher::BuildSimdBlockTransposedDataset(
+    const DenseDataset<int8_t>& quantized) {
+  fp8_transposed_dataset_ =
+      FP8SimdBlockTransposedDatabase(quantized, inverse_multiplier_by_dimension_);
+}
+
 StatusOr<vector<float>>
 ScalarQuantizedBruteForceSearcher::ComputeSquaredL2NormsFromQuantizedDataset(
     const DenseDataset<int8_t>& quantized,
@@ -116,7 +221,7 @@ ScalarQuantizedBruteForceSearcher::
         shared_ptr<const DistanceMeasure> distance,
         DenseDataset<int8_t> quantized, vector<float> inverse_multipliers,
         vector<float> squared_l2_norms, int32_t default_num_neighbors,
-        float default_epsilon) {
+        float default_epsilon, bool use_int4) {
   const auto distance_tag = distance->specially_optimized_distance_tag();
   SCANN_RETURN_IF_ERROR(CheckValidDistanceTag(distance_tag));
   if (distance_tag == DistanceMeasure::SQUARED_L2 && !quantized.empty() &&
@@ -128,6 +233,12 @@ ScalarQuantizedBruteForceSearcher::
                             quantized, inverse_multipliers));
   }
 
+  if (use_int4) {
+    return absl::make_unique<ScalarQuantizedBruteForceSearcher>(
+        distance, std::move(squared_l2_norms),
+        PackInt4QuantizedDataset(quantized), std::move(inverse_multipliers),
+        default_num_neighbors, default_epsilon);
+  }
   return absl::make_unique<ScalarQuantizedBruteForceSearcher>(
       distance, std::move(squared_l2_norms), std::move(quantized),
       std::move(inverse_multipliers), default_num_neighbors, default_epsilon);
@@ -176,12 +287,12 @@ ScalarQuantizedBruteForceSearcher::~ScalarQuantizedBruteForceSearcher() {}
 Status ScalarQuantizedBruteForceSearcher::EnableCrowdingImpl(
     ConstSpan<int64_t> datapoint_index_to_crowding_attribute) {
   if (datapoint_index_to_crowding_attribute.size() !=
-      quantized_dataset_.size()) {
+      num_quantized_datapoints()) {
     return InvalidArgumentError(absl::StrCat(
         "datapoint_index_to_crowding_attribute must have size equal to "
         "number of datapoints.  (",
         datapoint_index_to_crowding_attribute.size(), " vs. ",
-        quantized_dataset_.size(), "."));
+        num_quantized_datapoints(), "."));
   }
   return OkStatus();
 }
@@ -220,12 +331,20 @@ Status ScalarQuantizedBruteForceSearcher::FindNeighborsImpl(
   if (params.restricts_enabled()) {
     return UnimplementedError("Restricts not supported.");
   } else {
+    const DatapointIndex num_datapoints = num_quantized_datapoints();
     auto dot_products_ptr =
-        static_cast<float*>(malloc(quantized_dataset_.size() * sizeof(float)));
-    MutableSpan<float> dot_products(dot_products_ptr,
-                                    quantized_dataset_.size());
-    DenseDotProductDistanceOneToManyInt8Float(preprocessed, quantized_dataset_,
-                                              dot_products);
+        static_cast<float*>(malloc(num_datapoints * sizeof(float)));
+    MutableSpan<float> dot_products(dot_products_ptr, num_datapoints);
+    if (opts_.simd_block_transposed) {
+      DenseDotProductDistanceOneToManyFP8Transposed(
+          preprocessed, fp8_transposed_dataset_, dot_products);
+    } else if (opts_.use_int4) {
+      DenseDotProductDistanceOneToManyInt4Float(
+          preprocessed, int4_quantized_dataset_, dot_products);
+    } else {
+      DenseDotProductDistanceOneToManyInt8Float(
+          preprocessed, quantized_dataset_, dot_products);
+    }
     Status status =
         PostprocessDistances<float>(query, params, dot_products, result);
     free(dot_products_ptr);
@@ -233,6 +352,73 @@ Status ScalarQuantizedBruteForceSearcher::FindNeighborsImpl(
   }
 }
 
+Status ScalarQuantizedBruteForceSearcher::FindNeighborsBatchedImpl(
+    const TypedDataset<float>& queries, ConstSpan<SearchParameters> params,
+    MutableSpan<NNResultsVector> results) const {
+  if (!opts_.simd_block_transposed) {
+    return SingleMachineSearcherBase<float>::FindNeighborsBatchedImpl(
+        queries, params, results);
+  }
+  if (!queries.IsDense()) {
+    return InvalidArgumentError(
+        "ScalarQuantizedBruteForceSearcher only works with dense data.");
+  }
+  return FindNeighborsSimdBlockTransposed(
+      *down_cast<const DenseDataset<float>*>(&queries), params, results);
+}
+
+Status ScalarQuantizedBruteForceSearcher::FindNeighborsSimdBlockTransposed(
+    const DenseDataset<float>& queries, ConstSpan<SearchParameters> params,
+    MutableSpan<NNResultsVector> results) const {
+  DCHECK_EQ(queries.size(), params.size());
+  DCHECK_EQ(queries.size(), results.size());
+  for (const SearchParameters& p : params) {
+    if (p.restricts_enabled()) {
+      return UnimplementedError("Restricts not supported.");
+    }
+    if (p.pre_reordering_crowding_enabled()) {
+      return FailedPreconditionError("Crowding is not supported.");
+    }
+  }
+  if (queries.empty()) return OkStatus();
+  if (fp8_transposed_dataset_.empty()) {
+    for (NNResultsVector& result : results) result.clear();
+    return OkStatus();
+  }
+
+  const bool is_cosine =
+      distance_->specially_optimized_distance_tag() == DistanceMeasure::COSINE;
+  const float cosine_offset = is_cosine ? 1.0f : 0.0f;
+  vector<FastTopNeighbors<float>> top_ns(queries.size());
+  for (size_t i : IndicesOf(params)) {
+    top_ns[i].Init(params[i].pre_reordering_num_neighbors(),
+                   params[i].pre_reordering_epsilon() - cosine_offset);
+  }
+
+  ManyToManyTopKCallback topk_callback(MakeMutableSpan(top_ns));
+  EpsilonFilteringCallback<float> eps_callback(topk_callback.epsilons(),
+                                               topk_callback);
+  vector<DatapointIndex> query_idx_table(queries.size());
+  std::iota(query_idx_table.begin(), query_idx_table.end(), 0);
+  EpsilonFilteringOffsetWrapper<float> callback(std::move(eps_callback), 0,
+                                                query_idx_table);
+
+  const DotProductDistance dot_product;
+  const DistanceMeasure& kernel_distance =
+      is_cosine ? dot_product : *distance_;
+  SCANN_RETURN_IF_ERROR(DenseDistanceManyToManyFP8Pretransposed(
+      kernel_distance, queries, fp8_transposed_dataset_, pool_.get(),
+      std::move(callback)));
+
+  for (size_t i : IndicesOf(top_ns)) {
+    top_ns[i].FinishUnsorted(&results[i]);
+    if (is_cosine) {
+      for (auto& neighbor : results[i]) neighbor.second += cosine_offset;
+    }
+  }
+  return OkStatus();
+}
+
 template <typename ResultElem>
 Status ScalarQuantizedBruteForceSearcher::PostprocessDistances(
     const DatapointPtr<float>& query, const SearchParameters& params,
@@ -349,6 +535,23 @@ TreeScalarQuantizationPreprocessedQueryCreator::inverse_multipliers() const {
                        inverse_multipliers_.size());
 }
 
+MemoryUsageReport ScalarQuantizedBruteForceSearcher::MemoryUsageBreakdown()
+    const {
+  MemoryUsageReport report =
+      SingleMachineSearcherBase<float>::MemoryUsageBreakdown();
+  report.set_name("ScalarQuantizedBruteForceSearcher");
+  report.AddChild("quantized_dataset",
+                  quantized_dataset_.MemoryUsageExcludingDocids());
+  report.AddChild("int4_quantized_dataset",
+                  int4_quantized_dataset_.MemoryUsageExcludingDocids());
+  report.AddChild("fp8_transposed_dataset",
+                  fp8_transposed_dataset_.payload().size());
+  report.AddChild("squared_l2_norms", VectorStorage(squared_l2_norms_));
+  report.AddChild("inverse_multipliers",
+                  VectorStorage(inverse_multiplier_by_dimension_));
+  return report;
+}
+
 StatusOr<SingleMachineFactoryOptions>
 ScalarQuantizedBruteForceSearcher::ExtractSingleMachineFactoryOptions() {
   TF_ASSIGN_OR_RETURN(
@@ -360,6 +563,27 @@ ScalarQuantizedBruteForceSearcher::ExtractSingleMachineFactoryOptions() {
         "or use float32 reordering, because scalar-quantized reordering with "
         "scalar-quantized brute force provides no benefit.");
   }
+  if (opts_.simd_block_transposed) {
+    ConstSpan<int8_t> payload = fp8_transposed_dataset_.payload();
+    opts.pre_quantized_fixed_point = make_shared<PreQuantizedFixedPoint>(
+        CreatePreQuantizedFixedPoint(DenseDataset<int8_t>(),
+                                     inverse_multiplier_by_dimension_,
+                                     squared_l2_norms_, true));
+    opts.pre_quantized_fixed_point->fixed_point_dataset =
+        make_shared<DenseDataset<int8_t>>(
+            vector<int8_t>(payload.begin(), payload.end()),
+            fp8_transposed_dataset_.size());
+    opts.pre_quantized_fixed_point->transposed_simd_block_size =
+        fp8_transposed_dataset_.simd_block_size();
+    return opts;
+  }
+  if (opts_.use_int4) {
+    opts.pre_quantized_fixed_point =
+        make_shared<PreQuantizedFixedPoint>(CreatePreQuantizedFixedPoint(
+            UnpackInt4QuantizedDataset(int4_quantized_dataset_),
+            inverse_multiplier_by_dimension_, squared_l2_norms_, true));
+    return opts;
+  }
   opts.pre_quantized_fixed_point =
       make_shared<PreQuantizedFixedPoint>(CreatePreQuantizedFixedPoint(
           quantized_dataset_, inverse_multiplier_by_dimension_,
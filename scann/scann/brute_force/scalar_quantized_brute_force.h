@@ -25,6 +25,7 @@
 #include "scann/data_format/datapoint.h"
 #include "scann/data_format/dataset.h"
 #include "scann/distance_measures/distance_measure_base.h"
+#include "scann/distance_measures/many_to_many/fp8_transposed.h"
 #include "scann/oss_wrappers/scann_status.h"
 #include "scann/tree_x_hybrid/leaf_searcher_optional_parameter_creator.h"
 #include "scann/utils/types.h"
@@ -38,6 +39,10 @@ class ScalarQuantizedBruteForceSearcher final
   struct Options {
     float multiplier_quantile = 1.0f;
     float noise_shaping_threshold = NAN;
+
+    bool use_int4 = false;
+
+    bool simd_block_transposed = false;
   };
 
   ScalarQuantizedBruteForceSearcher(
@@ -66,6 +71,25 @@ class ScalarQuantizedBruteForceSearcher final
       vector<float> inverse_multiplier_by_dimension,
       int32_t default_num_neighbors, float default_epsilon);
 
+  ScalarQuantizedBruteForceSearcher(
+      shared_ptr<const DistanceMeasure> distance,
+      vector<float> squared_l2_norms, DenseDataset<uint8_t> int4_packed_dataset,
+      vector<float> inverse_multiplier_by_dimension,
+      int32_t default_num_neighbors, float default_epsilon);
+
+  ScalarQuantizedBruteForceSearcher(
+      shared_ptr<const DistanceMeasure> distance,
+      vector<float> squared_l2_norms, DenseDataset<int8_t> quantized_dataset,
+      uint8_t transposed_simd_block_size,
+      vector<float> inverse_multiplier_by_dimension,
+      int32_t default_num_neighbors, float default_epsilon);
+
+  DatapointIndex optimal_batch_size() const final {
+    return opts_.simd_block_transposed ? 128 : 1;
+  }
+
+  void set_thread_pool(std::shared_ptr<ThreadPool> p) { pool_ = std::move(p); }
+
   static StatusOr<vector<float>> ComputeSquaredL2NormsFromQuantizedDataset(
       const DenseDataset<int8_t>& quantized,
       const vector<float>& inverse_multipliers);
@@ -75,7 +99,7 @@ class ScalarQuantizedBruteForceSearcher final
       shared_ptr<const DistanceMeasure> distance,
       DenseDataset<int8_t> quantized, vector<float> inverse_multipliers,
       vector<float> squared_l2_norms, int32_t default_num_neighbors,
-      float default_epsilon);
+      float default_epsilon, bool use_int4 = false);
 
   static StatusOr<unique_ptr<ScalarQuantizedBruteForceSearcher>>
   CreateWithFixedRange(shared_ptr<const DistanceMeasure> distance,
@@ -86,15 +110,27 @@ class ScalarQuantizedBruteForceSearcher final
   StatusOr<SingleMachineFactoryOptions> ExtractSingleMachineFactoryOptions()
       override;
 
+  MemoryUsageReport MemoryUsageBreakdown() const final;
+
  protected:
   Status FindNeighborsImpl(const DatapointPtr<float>& query,
                            const SearchParameters& params,
                            NNResultsVector* result) const final;
 
+  Status FindNeighborsBatchedImpl(
+      const TypedDataset<float>& queries, ConstSpan<SearchParameters> params,
+      MutableSpan<NNResultsVector> results) const final;
+
   Status EnableCrowdingImpl(
       ConstSpan<int64_t> datapoint_index_to_crowding_attribute) final;
 
  private:
+  void BuildSimdBlockTransposedDataset(const DenseDataset<int8_t>& quantized);
+
+  Status FindNeighborsSimdBlockTransposed(
+      const DenseDataset<float>& queries, ConstSpan<SearchParameters> params,
+      MutableSpan<NNResultsVector> results) const;
+
   template <typename ResultElem>
   Status PostprocessDistances(const DatapointPtr<float>& query,
                               const SearchParameters& params,
@@ -123,15 +159,27 @@ class ScalarQuantizedBruteForceSearcher final
 
   bool impl_needs_dataset() const override { return false; }
 
+  DatapointIndex num_quantized_datapoints() const {
+    if (opts_.simd_block_transposed) return fp8_transposed_dataset_.size();
+    return opts_.use_int4 ? int4_quantized_dataset_.size()
+                          : quantized_dataset_.size();
+  }
+
   shared_ptr<const DistanceMeasure> distance_;
 
   vector<float> squared_l2_norms_;
 
   DenseDataset<int8_t> quantized_dataset_;
 
+  DenseDataset<uint8_t> int4_quantized_dataset_;
+
   Options opts_;
 
   vector<float> inverse_multiplier_by_dimension_;
+
+  FP8SimdBlockTransposedDatabase fp8_transposed_dataset_;
+
+  std::shared_ptr<ThreadPool> pool_;
 };
 
 class TreeScalarQuantizationPreprocessedQuery final
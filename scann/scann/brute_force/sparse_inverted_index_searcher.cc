@@ -0,0 +1,319 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/brute_force/sparse_inverted_index_searcher.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#include "scann/base/restrict_allowlist.h"
+#include "scann/utils/common.h"
+#include "scann/utils/fast_top_neighbors.h"
+
+namespace research_scann {
+namespace {
+
+struct PostingCursor {
+  DatapointIndex datapoint() const {
+    return pos == end ? kInvalidDatapointIndex : *pos;
+  }
+
+  float Score() const { return query_value * *value; }
+
+  void Next() {
+    ++pos;
+    ++value;
+  }
+
+  void SkipTo(DatapointIndex target) {
+    if (pos == end || *pos >= target) return;
+
+    const DatapointIndex* lo = pos;
+    size_t step = 1;
+    while (step < static_cast<size_t>(end - lo) && lo[step] < target) {
+      lo += step;
+      step *= 2;
+    }
+    const DatapointIndex* hi = lo + std::min<size_t>(step + 1, end - lo);
+    const DatapointIndex* new_pos = std::lower_bound(lo + 1, hi, target);
+    value += new_pos - pos;
+    pos = new_pos;
+  }
+
+  const DatapointIndex* begin;
+  const DatapointIndex* pos;
+  const DatapointIndex* end;
+  const float* value;
+  float query_value;
+  float upper_bound;
+};
+
+void PushZeroScoreDatapoints(MutableSpan<PostingCursor> cursors,
+                             DatapointIndex num_datapoints,
+                             int32_t num_neighbors,
+                             const RestrictAllowlist* allowlist,
+                             FastTopNeighbors<float>::Mutator* mut) {
+  for (PostingCursor& c : cursors) {
+    c.value -= c.pos - c.begin;
+    c.pos = c.begin;
+  }
+  auto has_query_dimension = [&cursors](DatapointIndex dp_idx) {
+    for (PostingCursor& c : cursors) {
+      c.SkipTo(dp_idx);
+      if (c.datapoint() == dp_idx) return true;
+    }
+    return false;
+  };
+
+  int32_t num_pushed = 0;
+  for (DatapointIndex dp_idx : Seq(num_datapoints)) {
+    if (num_pushed >= num_neighbors || mut->epsilon() < 0.0f) break;
+    if (allowlist && !allowlist->IsWhitelisted(dp_idx)) continue;
+    if (has_query_dimension(dp_idx)) continue;
+    if (mut->Push(dp_idx, 0.0f)) mut->GarbageCollect();
+    ++num_pushed;
+  }
+}
+
+}  // namespace
+
+template <typename T>
+StatusOr<unique_ptr<SparseInvertedIndexSearcher<T>>>
+SparseInvertedIndexSearcher<T>::Create(
+    shared_ptr<const DistanceMeasure> distance,
+    shared_ptr<const TypedDataset<T>> dataset,
+    int32_t default_pre_reordering_num_neighbors,
+    float default_pre_reordering_epsilon, Options opts) {
+  SCANN_RET_CHECK(distance);
+  if (distance->specially_optimized_distance_tag() !=
+      DistanceMeasure::DOT_PRODUCT) {
+    return InvalidArgumentError(
+        "The sparse inverted index searcher only supports DotProductDistance.");
+  }
+  auto sparse = std::dynamic_pointer_cast<const SparseDataset<T>>(dataset);
+  if (!sparse) {
+    return InvalidArgumentError(
+        "The sparse inverted index searcher requires a non-null sparse "
+        "dataset.");
+  }
+  return unique_ptr<SparseInvertedIndexSearcher<T>>(
+      new SparseInvertedIndexSearcher<T>(
+          std::move(sparse), default_pre_reordering_num_neighbors,
+          default_pre_reordering_epsilon, opts));
+}
+
+template <typename T>
+SparseInvertedIndexSearcher<T>::SparseInvertedIndexSearcher(
+    shared_ptr<const SparseDataset<T>> dataset,
+    int32_t default_pre_reordering_num_neighbors,
+    float default_pre_reordering_epsilon, Options opts)
+    : SingleMachineSearcherBase<T>(dataset,
+                                   default_pre_reordering_num_neighbors,
+                                   default_pre_reordering_epsilon),
+      opts_(opts),
+      num_datapoints_(dataset->size()) {
+  BuildPostingLists(*dataset);
+}
+
+template <typename T>
+SparseInvertedIndexSearcher<T>::~SparseInvertedIndexSearcher() {}
+
+template <typename T>
+MemoryUsageReport SparseInvertedIndexSearcher<T>::MemoryUsageBreakdown() const {
+  MemoryUsageReport report =
+      SingleMachineSearcherBase<T>::MemoryUsageBreakdown();
+  report.set_name("SparseInvertedIndexSearcher");
+  MemoryUsageReport& posting_lists = report.AddChild(
+      "posting_lists", HashMapStorage(dimension_to_posting_list_) +
+                           VectorStorage(posting_list_offsets_) +
+                           VectorStorage(posting_list_max_value_) +
+                           VectorStorage(posting_list_min_value_));
+  posting_lists.AddChild("datapoints", VectorStorage(posting_datapoints_));
+  posting_lists.AddChild("values", VectorStorage(posting_values_));
+  return report;
+}
+
+template <typename T>
+void SparseInvertedIndexSearcher<T>::BuildPostingLists(
+    const SparseDataset<T>& dataset) {
+  vector<size_t> posting_list_sizes;
+  for (DatapointIndex dp_idx : IndicesOf(dataset)) {
+    const DatapointPtr<T> dptr = dataset[dp_idx];
+    for (DimensionIndex j : Seq(dptr.nonzero_entries())) {
+      if (dptr.has_values() && dptr.values()[j] == 0) continue;
+      auto [it, inserted] = dimension_to_posting_list_.try_emplace(
+          dptr.indices()[j], posting_list_sizes.size());
+      if (inserted) posting_list_sizes.push_back(0);
+      ++posting_list_sizes[it->second];
+    }
+  }
+
+  const size_t num_lists = posting_list_sizes.size();
+  posting_list_offsets_.resize(num_lists + 1);
+  posting_list_offsets_[0] = 0;
+  for (size_t i : Seq(num_lists)) {
+    posting_list_offsets_[i + 1] =
+        posting_list_offsets_[i] + posting_list_sizes[i];
+  }
+  posting_datapoints_.resize(posting_list_offsets_.back());
+  posting_values_.resize(posting_list_offsets_.back());
+  posting_list_max_value_.assign(num_lists,
+                                 -std::numeric_limits<float>::infinity());
+  posting_list_min_value_.assign(num_lists,
+                                 std::numeric_limits<float>::infinity());
+
+  vector<size_t> write_pos(posting_list_offsets_.begin(),
+                           posting_list_offsets_.end() - 1);
+  for (DatapointIndex dp_idx : IndicesOf(dataset)) {
+    const DatapointPtr<T> dptr = dataset[dp_idx];
+    for (DimensionIndex j : Seq(dptr.nonzero_entries())) {
+      const float value =
+          dptr.has_values() ? static_cast<float>(dptr.values()[j]) : 1.0f;
+      if (value == 0.0f) continue;
+      const uint32_t list_idx =
+          dimension_to_posting_list_.find(dptr.indices()[j])->second;
+      const size_t pos = write_pos[list_idx]++;
+      posting_datapoints_[pos] = dp_idx;
+      posting_values_[pos] = value;
+      posting_list_max_value_[list_idx] =
+          std::max(posting_list_max_value_[list_idx], value);
+      posting_list_min_value_[list_idx] =
+          std::min(posting_list_min_value_[list_idx], value);
+    }
+  }
+}
+
+template <typename T>
+Status SparseInvertedIndexSearcher<T>::FindNeighborsImpl(
+    const DatapointPtr<T>& query, const SearchParameters& params,
+    NNResultsVector* result) const {
+  DCHECK(result);
+  if (params.pre_reordering_crowding_enabled()) {
+    return FailedPreconditionError("Crowding is not supported.");
+  }
+
+  vector<PostingCursor> cursors;
+  cursors.reserve(query.nonzero_entries());
+  auto add_query_dimension = [&](DimensionIndex dim, float query_value) {
+    if (query_value == 0.0f) return;
+    auto it = dimension_to_posting_list_.find(dim);
+    if (it == dimension_to_posting_list_.end()) return;
+    const uint32_t list_idx = it->second;
+    PostingCursor c;
+    c.begin = posting_datapoints_.data() + posting_list_offsets_[list_idx];
+    c.pos = c.begin;
+    c.end = posting_datapoints_.data() + posting_list_offsets_[list_idx + 1];
+    c.value = posting_values_.data() + posting_list_offsets_[list_idx];
+    c.query_value = query_value;
+
+    c.upper_bound =
+        std::max({0.0f, query_value * posting_list_max_value_[list_idx],
+                  query_value * posting_list_min_value_[list_idx]});
+    cursors.push_back(c);
+  };
+  if (query.IsSparse()) {
+    for (DimensionIndex j : Seq(query.nonzero_entries())) {
+      add_query_dimension(
+          query.indices()[j],
+          query.has_values() ? static_cast<float>(query.values()[j]) : 1.0f);
+    }
+  } else {
+    for (DimensionIndex j : Seq(query.nonzero_entries())) {
+      add_query_dimension(j, static_cast<float>(query.values()[j]));
+    }
+  }
+
+  std::sort(cursors.begin(), cursors.end(),
+            [](const PostingCursor& a, const PostingCursor& b) {
+              return a.upper_bound < b.upper_bound;
+            });
+  vector<float> cumulative_upper_bounds(cursors.size());
+  float upper_bound_sum = 0.0f;
+  for (size_t i : IndicesOf(cursors)) {
+    upper_bound_sum += cursors[i].upper_bound;
+    cumulative_upper_bounds[i] = upper_bound_sum;
+  }
+
+  const RestrictAllowlist* allowlist =
+      params.restricts_enabled() ? params.restrict_whitelist() : nullptr;
+  const int32_t num_neighbors = params.pre_reordering_num_neighbors();
+  FastTopNeighbors<float> top_n(num_neighbors,
+                                params.pre_reordering_epsilon());
+  FastTopNeighbors<float>::Mutator mut;
+  top_n.AcquireMutator(&mut);
+
+  const size_t num_cursors = cursors.size();
+  size_t first_essential = 0;
+  auto update_essential_lists = [&] {
+    if (opts_.pruning != Pruning::kMaxScore) return;
+    const float min_score = -mut.epsilon();
+    while (first_essential < num_cursors &&
+           cumulative_upper_bounds[first_essential] < min_score) {
+      ++first_essential;
+    }
+  };
+  update_essential_lists();
+
+  int32_t num_matched = 0;
+  DatapointIndex cur = kInvalidDatapointIndex;
+  for (size_t i : Seq(first_essential, num_cursors)) {
+    cur = std::min(cur, cursors[i].datapoint());
+  }
+  while (cur != kInvalidDatapointIndex) {
+    float score = 0.0f;
+    DatapointIndex next = kInvalidDatapointIndex;
+    for (size_t i : Seq(first_essential, num_cursors)) {
+      PostingCursor& c = cursors[i];
+      if (c.datapoint() == cur) {
+        score += c.Score();
+        c.Next();
+      }
+      next = std::min(next, c.datapoint());
+    }
+
+    if (!allowlist || allowlist->IsWhitelisted(cur)) {
+      const float min_score = -mut.epsilon();
+      for (size_t i = first_essential; i-- > 0;) {
+        if (score + cumulative_upper_bounds[i] < min_score) break;
+        PostingCursor& c = cursors[i];
+        c.SkipTo(cur);
+        if (c.datapoint() == cur) score += c.Score();
+      }
+
+      const float dist = -score;
+      if (dist < 0.0f) ++num_matched;
+      if (dist <= mut.epsilon()) {
+        if (mut.Push(cur, dist)) {
+          mut.GarbageCollect();
+          update_essential_lists();
+        }
+      }
+    }
+    cur = next;
+  }
+
+  if (num_matched < num_neighbors && mut.epsilon() >= 0.0f) {
+    PushZeroScoreDatapoints(MakeMutableSpan(cursors), num_datapoints_,
+                            num_neighbors - num_matched, allowlist, &mut);
+  }
+  mut.Release();
+  top_n.FinishUnsorted(result);
+  return OkStatus();
+}
+
+SCANN_INSTANTIATE_TYPED_CLASS(, SparseInvertedIndexSearcher);
+
+}  // namespace research_scann
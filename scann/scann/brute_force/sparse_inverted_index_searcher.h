@@ -0,0 +1,91 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_BRUTE_FORCE_SPARSE_INVERTED_INDEX_SEARCHER_H_
+#define SCANN_BRUTE_FORCE_SPARSE_INVERTED_INDEX_SEARCHER_H_
+
+#include <cstdint>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "scann/base/search_parameters.h"
+#include "scann/base/single_machine_base.h"
+#include "scann/data_format/datapoint.h"
+#include "scann/data_format/dataset.h"
+#include "scann/distance_measures/distance_measure_base.h"
+#include "scann/oss_wrappers/scann_status.h"
+#include "scann/utils/types.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace research_scann {
+
+template <typename T>
+class SparseInvertedIndexSearcher final : public SingleMachineSearcherBase<T> {
+ public:
+  enum class Pruning { kExhaustive, kMaxScore };
+
+  struct Options {
+    Pruning pruning = Pruning::kMaxScore;
+  };
+
+  static StatusOr<unique_ptr<SparseInvertedIndexSearcher<T>>> Create(
+      shared_ptr<const DistanceMeasure> distance,
+      shared_ptr<const TypedDataset<T>> dataset,
+      int32_t default_pre_reordering_num_neighbors,
+      float default_pre_reordering_epsilon, Options opts = Options());
+
+  ~SparseInvertedIndexSearcher() override;
+
+  DimensionIndex num_posting_lists() const {
+    return posting_list_offsets_.size() - 1;
+  }
+
+  MemoryUsageReport MemoryUsageBreakdown() const final;
+
+ protected:
+  Status FindNeighborsImpl(const DatapointPtr<T>& query,
+                           const SearchParameters& params,
+                           NNResultsVector* result) const final;
+
+ private:
+  SparseInvertedIndexSearcher(shared_ptr<const SparseDataset<T>> dataset,
+                              int32_t default_pre_reordering_num_neighbors,
+                              float default_pre_reordering_epsilon,
+                              Options opts);
+
+  bool impl_needs_dataset() const final { return false; }
+
+  void BuildPostingLists(const SparseDataset<T>& dataset);
+
+  Options opts_;
+
+  DatapointIndex num_datapoints_ = 0;
+
+  absl::flat_hash_map<DimensionIndex, uint32_t> dimension_to_posting_list_;
+
+  vector<size_t> posting_list_offsets_;
+
+  vector<DatapointIndex> posting_datapoints_;
+
+  vector<float> posting_values_;
+
+  vector<float> posting_list_max_value_;
+  vector<float> posting_list_min_value_;
+};
+
+SCANN_INSTANTIATE_TYPED_CLASS(extern, SparseInvertedIndexSearcher);
+
+}  // namespace research_scann
+
+#endif
@@ -0,0 +1,432 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/data_format/compact_docid_collection.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "absl/numeric/bits.h"
+#include "absl/strings/str_cat.h"
+
+namespace research_scann {
+namespace {
+
+constexpr uint64_t kMagic = 0x31434449444E4353;
+constexpr uint64_t kVersion = 1;
+
+enum HeaderField {
+  kMagicField,
+  kVersionField,
+  kNumDocids,
+  kOffsetWidth,
+  kDataBytes,
+  kNumLevels,
+  kNumBitWords,
+  kNumPerm,
+  kNumFallback,
+  kHeaderSize
+};
+
+constexpr int kMaxLevels = 24;
+
+constexpr double kGamma = 2.0;
+
+constexpr size_t kWordsPerRankSample = 8;
+
+uint64_t HashDocid(string_view docid, uint64_t seed) {
+  constexpr uint64_t kMul = 0xc6a4a7935bd1e995;
+  constexpr int kShift = 47;
+  uint64_t h = (seed * 0x9e3779b97f4a7c15) ^ (docid.size() * kMul);
+  auto mix = [&](uint64_t k) {
+    k *= kMul;
+    k ^= k >> kShift;
+    k *= kMul;
+    h ^= k;
+    h *= kMul;
+  };
+  const char* ptr = docid.data();
+  const char* end = ptr + docid.size() / 8 * 8;
+  for (; ptr < end; ptr += 8) {
+    uint64_t k;
+    std::memcpy(&k, ptr, 8);
+    mix(k);
+  }
+  if (docid.size() % 8) {
+    uint64_t k = 0;
+    std::memcpy(&k, ptr, docid.size() % 8);
+    mix(k);
+  }
+  h ^= h >> kShift;
+  h *= kMul;
+  h ^= h >> kShift;
+  return h;
+}
+
+size_t NumWords(size_t num_bytes) {
+  return DivRoundUp(num_bytes, sizeof(uint64_t));
+}
+
+size_t NumRankSamples(size_t num_bit_words) {
+  return DivRoundUp(num_bit_words, kWordsPerRankSample) + 1;
+}
+
+struct Sections {
+  size_t num_docids = 0;
+
+  vector<uint64_t> block_bases = {0};
+
+  vector<uint32_t> end_offsets;
+
+  bool use_16bit_offsets = true;
+
+  std::string data;
+
+  vector<uint64_t> level_word_offsets = {0};
+
+  vector<uint64_t> level_bits;
+
+  vector<uint32_t> perm;
+
+  vector<uint64_t> fallback;
+};
+
+template <typename T>
+void AppendSection(ConstSpan<T> section, vector<uint64_t>* buffer) {
+  const size_t start = buffer->size();
+  buffer->resize(start + NumWords(section.size() * sizeof(T)), 0);
+  if (!section.empty()) {
+    std::memcpy(buffer->data() + start, section.data(),
+                section.size() * sizeof(T));
+  }
+}
+
+vector<uint64_t> Serialize(const Sections& sections) {
+  vector<uint64_t> rank_samples(NumRankSamples(sections.level_bits.size()));
+  for (size_t w : IndicesOf(sections.level_bits)) {
+    rank_samples[w / kWordsPerRankSample + 1] +=
+        absl::popcount(sections.level_bits[w]);
+  }
+  for (size_t s : Seq(1, rank_samples.size())) {
+    rank_samples[s] += rank_samples[s - 1];
+  }
+
+  vector<uint64_t> buffer(kHeaderSize);
+  buffer[kMagicField] = kMagic;
+  buffer[kVersionField] = kVersion;
+  buffer[kNumDocids] = sections.num_docids;
+  buffer[kOffsetWidth] = sections.use_16bit_offsets ? 2 : 4;
+  buffer[kDataBytes] = sections.data.size();
+  buffer[kNumLevels] = sections.level_word_offsets.size() - 1;
+  buffer[kNumBitWords] = sections.level_bits.size();
+  buffer[kNumPerm] = sections.perm.size();
+  buffer[kNumFallback] = sections.fallback.size() / 2;
+  AppendSection<uint64_t>(sections.block_bases, &buffer);
+  if (sections.use_16bit_offsets) {
+    vector<uint16_t> end_offsets(sections.end_offsets.begin(),
+                                 sections.end_offsets.end());
+    AppendSection<uint16_t>(end_offsets, &buffer);
+  } else {
+    AppendSection<uint32_t>(sections.end_offsets, &buffer);
+  }
+  AppendSection<char>(sections.data, &buffer);
+  AppendSection<uint64_t>(sections.level_word_offsets, &buffer);
+  AppendSection<uint64_t>(sections.level_bits, &buffer);
+  AppendSection<uint64_t>(rank_samples, &buffer);
+  AppendSection<uint32_t>(sections.perm, &buffer);
+  AppendSection<uint64_t>(sections.fallback, &buffer);
+  buffer.shrink_to_fit();
+  return buffer;
+}
+
+}  // namespace
+
+StatusOr<unique_ptr<CompactDocidCollection>> CompactDocidCollection::Create(
+    const DocidCollectionInterface& docids) {
+  const size_t num_docids = docids.size();
+  if (num_docids > numeric_limits<DatapointIndex>::max()) {
+    return InvalidArgumentError(
+        "Too many docids for a CompactDocidCollection (%d).", num_docids);
+  }
+  Sections sections;
+  sections.num_docids = num_docids;
+  sections.block_bases.resize(DivRoundUp(num_docids, kBlockSize) + 1);
+  sections.end_offsets.resize(num_docids);
+  for (size_t i : Seq(num_docids)) {
+    const string_view docid = docids.Get(i);
+    const size_t block = i / kBlockSize;
+    if (i % kBlockSize == 0) {
+      sections.block_bases[block] = sections.data.size();
+    }
+    sections.data.append(docid.data(), docid.size());
+    const uint64_t end_offset =
+        sections.data.size() - sections.block_bases[block];
+    if (end_offset > numeric_limits<uint32_t>::max()) {
+      return InvalidArgumentError(
+          "Docids %d through %d exceed the maximum block size of a "
+          "CompactDocidCollection.",
+          block * kBlockSize, i);
+    }
+    sections.end_offsets[i] = end_offset;
+    sections.use_16bit_offsets &= end_offset <= numeric_limits<uint16_t>::max();
+  }
+  sections.block_bases.back() = sections.data.size();
+
+  vector<DatapointIndex> keys;
+  keys.reserve(num_docids);
+  for (DatapointIndex i : Seq(num_docids)) {
+    if (!docids.Get(i).empty()) keys.push_back(i);
+  }
+  vector<pair<uint64_t, DatapointIndex>> placed;
+  placed.reserve(keys.size());
+  vector<uint64_t> positions, seen, collided;
+  for (int level = 0; level < kMaxLevels && !keys.empty(); ++level) {
+    const size_t num_words =
+        DivRoundUp(static_cast<size_t>(kGamma * keys.size()), 64);
+    const uint64_t num_bits = num_words * 64;
+    positions.resize(keys.size());
+    seen.assign(num_words, 0);
+    collided.assign(num_words, 0);
+    for (size_t i : IndicesOf(keys)) {
+      const uint64_t pos = HashDocid(docids.Get(keys[i]), level) % num_bits;
+      const uint64_t mask = uint64_t{1} << (pos % 64);
+      if (seen[pos / 64] & mask) collided[pos / 64] |= mask;
+      seen[pos / 64] |= mask;
+      positions[i] = pos;
+    }
+
+    const uint64_t level_start = sections.level_word_offsets.back() * 64;
+    size_t num_remaining = 0;
+    for (size_t i : IndicesOf(keys)) {
+      const uint64_t pos = positions[i];
+      if ((collided[pos / 64] >> (pos % 64)) & 1) {
+        keys[num_remaining++] = keys[i];
+      } else {
+        placed.emplace_back(level_start + pos, keys[i]);
+      }
+    }
+    keys.resize(num_remaining);
+    for (size_t w : Seq(num_words)) {
+      sections.level_bits.push_back(seen[w] & ~collided[w]);
+    }
+    sections.level_word_offsets.push_back(sections.level_bits.size());
+  }
+
+  std::sort(placed.begin(), placed.end());
+  sections.perm.reserve(placed.size());
+  for (const auto& [bit, index] : placed) sections.perm.push_back(index);
+
+  vector<pair<uint64_t, DatapointIndex>> fallback;
+  fallback.reserve(keys.size());
+  for (DatapointIndex index : keys) {
+    fallback.emplace_back(HashDocid(docids.Get(index), kMaxLevels), index);
+  }
+  std::sort(fallback.begin(), fallback.end(),
+            [&docids](const pair<uint64_t, DatapointIndex>& a,
+                      const pair<uint64_t, DatapointIndex>& b) {
+              if (a.first != b.first) return a.first < b.first;
+              return docids.Get(a.second) < docids.Get(b.second);
+            });
+  for (size_t i : IndicesOf(fallback)) {
+    if (i > 0 && fallback[i].first == fallback[i - 1].first &&
+        docids.Get(fallback[i].second) ==
+            docids.Get(fallback[i - 1].second)) {
+      return AlreadyExistsError(absl::StrCat(
+          "Duplicate docid: ", docids.Get(fallback[i].second)));
+    }
+    sections.fallback.push_back(fallback[i].first);
+    sections.fallback.push_back(fallback[i].second);
+  }
+
+  unique_ptr<CompactDocidCollection> result(new CompactDocidCollection);
+  result->storage_ = Serialize(sections);
+  SCANN_RETURN_IF_ERROR(result->InitFromBuffer(result->storage_));
+  return result;
+}
+
+StatusOr<unique_ptr<CompactDocidCollection>> CompactDocidCollection::Mmap(
+    string_view filename) {
+  unique_ptr<CompactDocidCollection> result(new CompactDocidCollection);
+  TF_ASSIGN_OR_RETURN(result->mmap_, MemoryMappedFile::Open(filename));
+  ConstSpan<char> bytes = result->mmap_->data();
+  if (bytes.size() % sizeof(uint64_t) != 0) {
+    return InvalidArgumentError(
+        "%s is not a valid CompactDocidCollection file.", filename);
+  }
+  SCANN_RETURN_IF_ERROR(result->InitFromBuffer(
+      MakeConstSpan(reinterpret_cast<const uint64_t*>(bytes.data()),
+                    bytes.size() / sizeof(uint64_t))));
+  return result;
+}
+
+Status CompactDocidCollection::WriteToFile(string_view filename) const {
+  OpenSourceableFileWriter writer(filename);
+  return writer.Write(
+      MakeConstSpan(reinterpret_cast<const char*>(buffer_.data()),
+                    buffer_.size() * sizeof(uint64_t)));
+}
+
+Status CompactDocidCollection::InitFromBuffer(ConstSpan<uint64_t> buffer) {
+  if (buffer.size() < kHeaderSize || buffer[kMagicField] != kMagic) {
+    return InvalidArgumentError("Invalid CompactDocidCollection header.");
+  }
+  if (buffer[kVersionField] != kVersion) {
+    return InvalidArgumentError(
+        "Unsupported CompactDocidCollection version %d.",
+        buffer[kVersionField]);
+  }
+  const uint64_t offset_width = buffer[kOffsetWidth];
+  if (offset_width != 2 && offset_width != 4) {
+    return InvalidArgumentError("Invalid CompactDocidCollection offset width.");
+  }
+
+  const uint64_t buffer_bytes = buffer.size() * sizeof(uint64_t);
+  if (buffer[kNumLevels] > kMaxLevels) {
+    return InvalidArgumentError(
+        "Truncated or corrupt CompactDocidCollection buffer.");
+  }
+  for (size_t field :
+       {kNumDocids, kDataBytes, kNumBitWords, kNumPerm, kNumFallback}) {
+    if (buffer[field] > buffer_bytes) {
+      return InvalidArgumentError(
+          "Truncated or corrupt CompactDocidCollection buffer.");
+    }
+  }
+
+  size_t cursor = kHeaderSize;
+  auto next_section = [&](size_t num_bytes) -> const uint64_t* {
+    const size_t num_words = NumWords(num_bytes);
+    if (num_words > buffer.size() - cursor) return nullptr;
+    const uint64_t* section = buffer.data() + cursor;
+    cursor += num_words;
+    return section;
+  };
+  const size_t num_docids = buffer[kNumDocids];
+  const size_t num_blocks = DivRoundUp(num_docids, kBlockSize);
+  const size_t num_levels = buffer[kNumLevels];
+  const size_t num_bit_words = buffer[kNumBitWords];
+  const size_t num_rank_samples = NumRankSamples(num_bit_words);
+  const uint64_t* block_bases = next_section((num_blocks + 1) * 8);
+  const uint64_t* end_offsets = next_section(num_docids * offset_width);
+  const uint64_t* data = next_section(buffer[kDataBytes]);
+  const uint64_t* level_word_offsets = next_section((num_levels + 1) * 8);
+  const uint64_t* level_bits = next_section(num_bit_words * 8);
+  const uint64_t* rank_samples = next_section(num_rank_samples * 8);
+  const uint64_t* perm = next_section(buffer[kNumPerm] * sizeof(uint32_t));
+  const uint64_t* fallback = next_section(buffer[kNumFallback] * 16);
+  if (!block_bases || !end_offsets || !data || !level_word_offsets ||
+      !level_bits || !rank_samples || !perm || !fallback ||
+      num_rank_samples == 0 || cursor != buffer.size() ||
+      block_bases[num_blocks] != buffer[kDataBytes] ||
+      level_word_offsets[num_levels] != num_bit_words ||
+      rank_samples[num_rank_samples - 1] != buffer[kNumPerm]) {
+    return InvalidArgumentError(
+        "Truncated or corrupt CompactDocidCollection buffer.");
+  }
+
+  buffer_ = buffer;
+  size_ = num_docids;
+  block_bases_ = block_bases;
+  end_offsets16_ = nullptr;
+  end_offsets32_ = nullptr;
+  if (offset_width == 2) {
+    end_offsets16_ = reinterpret_cast<const uint16_t*>(end_offsets);
+  } else {
+    end_offsets32_ = reinterpret_cast<const uint32_t*>(end_offsets);
+  }
+  data_ = reinterpret_cast<const char*>(data);
+  level_word_offsets_ = MakeConstSpan(level_word_offsets, num_levels + 1);
+  level_bits_ = MakeConstSpan(level_bits, num_bit_words);
+  rank_samples_ = MakeConstSpan(rank_samples, num_rank_samples);
+  perm_ = MakeConstSpan(reinterpret_cast<const uint32_t*>(perm),
+                        buffer[kNumPerm]);
+  fallback_ = MakeConstSpan(fallback, buffer[kNumFallback] * 2);
+  return OkStatus();
+}
+
+size_t CompactDocidCollection::Rank(uint64_t bit) const {
+  const size_t word = bit / 64;
+  const size_t sample = word / kWordsPerRankSample;
+  size_t result = rank_samples_[sample];
+  for (size_t w : Seq(sample * kWordsPerRankSample, word)) {
+    result += absl::popcount(level_bits_[w]);
+  }
+  const uint64_t mask = (uint64_t{1} << (bit % 64)) - 1;
+  return result + absl::popcount(level_bits_[word] & mask);
+}
+
+bool CompactDocidCollection::LookupDatapointIndex(
+    string_view docid, DatapointIndex* index) const {
+  if (docid.empty()) return false;
+  auto matches = [&](uint64_t candidate) {
+    if (candidate >= size_ || Get(candidate) != docid) return false;
+    *index = candidate;
+    return true;
+  };
+  for (size_t level : Seq(level_word_offsets_.size() - 1)) {
+    const uint64_t level_start = level_word_offsets_[level] * 64;
+    const uint64_t num_bits = level_word_offsets_[level + 1] * 64 - level_start;
+    const uint64_t bit = level_start + HashDocid(docid, level) % num_bits;
+    if ((level_bits_[bit / 64] >> (bit % 64)) & 1) {
+      return matches(perm_[Rank(bit)]);
+    }
+  }
+
+  const uint64_t hash = HashDocid(docid, kMaxLevels);
+  size_t lo = 0, hi = fallback_.size() / 2;
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    if (fallback_[2 * mid] < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  for (; 2 * lo < fallback_.size() && fallback_[2 * lo] == hash; ++lo) {
+    if (matches(fallback_[2 * lo + 1])) return true;
+  }
+  return false;
+}
+
+Status CompactDocidCollection::Append(string_view docid) {
+  return FailedPreconditionError("CompactDocidCollection is read-only.");
+}
+
+size_t CompactDocidCollection::MemoryUsage() const {
+  return sizeof(*this) + storage_.capacity() * sizeof(uint64_t);
+}
+
+void CompactDocidCollection::Clear() {
+  mmap_.reset();
+  storage_ = Serialize(Sections());
+  CHECK_OK(InitFromBuffer(storage_));
+}
+
+unique_ptr<DocidCollectionInterface> CompactDocidCollection::Copy() const {
+  unique_ptr<CompactDocidCollection> result(new CompactDocidCollection);
+  result->storage_.assign(buffer_.begin(), buffer_.end());
+  CHECK_OK(result->InitFromBuffer(result->storage_));
+  return result;
+}
+
+StatusOr<DocidCollectionInterface::Mutator*>
+CompactDocidCollection::GetMutator() const {
+  return FailedPreconditionError(
+      "CompactDocidCollection is read-only and does not support mutation.");
+}
+
+}  // namespace research_scann
@@ -0,0 +1,109 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_DATA_FORMAT_COMPACT_DOCID_COLLECTION_H_
+#define SCANN_DATA_FORMAT_COMPACT_DOCID_COLLECTION_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "scann/data_format/docid_collection_interface.h"
+#include "scann/utils/common.h"
+#include "scann/utils/io_oss_wrapper.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+class CompactDocidCollection final : public DocidCollectionInterface {
+ public:
+  static StatusOr<unique_ptr<CompactDocidCollection>> Create(
+      const DocidCollectionInterface& docids);
+
+  static StatusOr<unique_ptr<CompactDocidCollection>> Mmap(
+      string_view filename);
+
+  Status WriteToFile(string_view filename) const;
+
+  bool LookupDatapointIndex(string_view docid, DatapointIndex* index) const;
+
+  Status Append(string_view docid) final;
+
+  size_t size() const final { return size_; }
+
+  bool empty() const final { return size_ == 0; }
+
+  string_view Get(size_t i) const final {
+    DCHECK_LT(i, size_);
+    const uint64_t base = block_bases_[i / kBlockSize];
+    const uint64_t begin = i % kBlockSize == 0 ? 0 : EndOffset(i - 1);
+    return string_view(data_ + base + begin, EndOffset(i) - begin);
+  }
+
+  size_t capacity() const final { return size_; }
+
+  size_t MemoryUsage() const final;
+
+  void Clear() final;
+
+  void Reserve(DatapointIndex n_elements) final {}
+
+  void ShrinkToFit() final {}
+
+  unique_ptr<DocidCollectionInterface> Copy() const final;
+
+  StatusOr<Mutator*> GetMutator() const final;
+
+ private:
+  static constexpr size_t kBlockSize = 64;
+
+  CompactDocidCollection() {}
+
+  Status InitFromBuffer(ConstSpan<uint64_t> buffer);
+
+  uint64_t EndOffset(size_t i) const {
+    return end_offsets16_ ? end_offsets16_[i] : end_offsets32_[i];
+  }
+
+  size_t Rank(uint64_t bit) const;
+
+  std::vector<uint64_t> storage_;
+
+  unique_ptr<MemoryMappedFile> mmap_;
+
+  ConstSpan<uint64_t> buffer_;
+
+  size_t size_ = 0;
+
+  const uint64_t* block_bases_ = nullptr;
+
+  const uint16_t* end_offsets16_ = nullptr;
+
+  const uint32_t* end_offsets32_ = nullptr;
+
+  const char* data_ = nullptr;
+
+  ConstSpan<uint64_t> level_word_offsets_;
+
+  ConstSpan<uint64_t> level_bits_;
+
+  ConstSpan<uint64_t> rank_samples_;
+
+  ConstSpan<uint32_t> perm_;
+
+  ConstSpan<uint64_t> fallback_;
+};
+
+}  // namespace research_scann
+
+#endif
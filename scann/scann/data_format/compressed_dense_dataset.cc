@@ -0,0 +1,499 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/data_format/compressed_dense_dataset.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "scann/utils/parallel_for.h"
+
+namespace research_scann {
+namespace {
+
+constexpr uint64_t kMagic = 0x3144464E4E414353;
+constexpr uint64_t kVersion = 1;
+
+enum HeaderField : size_t {
+  kMagicField,
+  kVersionField,
+  kSizeField,
+  kDimensionalityField,
+  kBlockSizeField,
+  kNumBlocksField,
+  kEntropyCodedMaskField,
+  kDataSizeField,
+  kHeaderSize,
+};
+
+constexpr int kNumPlanes = sizeof(float);
+constexpr int kScaleBits = 12;
+constexpr uint32_t kTotalFreq = 1 << kScaleBits;
+constexpr uint32_t kRansLowerBound = 1 << 23;
+constexpr size_t kFreqTableWords = kNumPlanes * 256 * sizeof(uint16_t) / 8;
+
+constexpr double kMaxEntropyCodedBitsPerByte = 7.5;
+
+constexpr size_t kMinBlocksForParallelDecode = 32;
+
+size_t NumWords(size_t num_bytes) { return DivRoundUp(num_bytes, 8); }
+
+std::array<uint16_t, 256> NormalizeFrequencies(
+    const std::array<uint64_t, 256>& counts) {
+  std::array<uint16_t, 256> freq = {};
+  uint64_t total = 0;
+  for (uint64_t count : counts) total += count;
+  if (total == 0) return freq;
+  int64_t assigned = 0;
+  for (int s = 0; s < 256; ++s) {
+    if (counts[s] == 0) continue;
+    freq[s] = std::max<uint64_t>(1, counts[s] * kTotalFreq / total);
+    assigned += freq[s];
+  }
+  int64_t diff = static_cast<int64_t>(kTotalFreq) - assigned;
+  while (diff != 0) {
+    const int largest =
+        std::max_element(freq.begin(), freq.end()) - freq.begin();
+    if (diff > 0) {
+      freq[largest] += diff;
+      diff = 0;
+    } else {
+      const int64_t delta = std::min<int64_t>(-diff, freq[largest] - 1);
+      freq[largest] -= delta;
+      diff += delta;
+    }
+  }
+  return freq;
+}
+
+double EntropyBitsPerByte(const std::array<uint64_t, 256>& counts) {
+  uint64_t total = 0;
+  for (uint64_t count : counts) total += count;
+  if (total == 0) return 0.0;
+  double entropy = 0.0;
+  for (uint64_t count : counts) {
+    if (count == 0) continue;
+    const double p = static_cast<double>(count) / total;
+    entropy -= p * std::log2(p);
+  }
+  return entropy;
+}
+
+void RansEncode(ConstSpan<uint16_t> freq, ConstSpan<uint16_t> start,
+                const uint8_t* bytes, size_t n, std::vector<uint8_t>* out) {
+  const size_t begin = out->size();
+  uint32_t x = kRansLowerBound;
+  for (size_t i = n; i-- > 0;) {
+    const uint8_t s = bytes[i * kNumPlanes];
+    const uint32_t f = freq[s];
+    const uint32_t x_max = ((kRansLowerBound >> kScaleBits) << 8) * f;
+    while (x >= x_max) {
+      out->push_back(x & 0xFF);
+      x >>= 8;
+    }
+    x = ((x / f) << kScaleBits) + (x % f) + start[s];
+  }
+  for (int i = 0; i < 4; ++i) {
+    out->push_back(x & 0xFF);
+    x >>= 8;
+  }
+  std::reverse(out->begin() + begin, out->end());
+}
+
+}  // namespace
+
+class CompressedDenseDataset::DecodedBlockCache {
+ public:
+  explicit DecodedBlockCache(size_t capacity)
+      : shard_capacity_(DivRoundUp(capacity, kNumShards)) {}
+
+  shared_ptr<const std::vector<float>> Lookup(size_t block) {
+    Shard& shard = shards_[block % kNumShards];
+    absl::MutexLock lock(&shard.mutex);
+    auto it = shard.entries.find(block);
+    if (it == shard.entries.end()) return nullptr;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.second);
+    return it->second.first;
+  }
+
+  void Insert(size_t block, shared_ptr<const std::vector<float>> decoded) {
+    Shard& shard = shards_[block % kNumShards];
+    absl::MutexLock lock(&shard.mutex);
+    if (shard.entries.contains(block)) return;
+    shard.lru.push_front(block);
+    shard.entries[block] = {std::move(decoded), shard.lru.begin()};
+    if (shard.lru.size() > shard_capacity_) {
+      shard.entries.erase(shard.lru.back());
+      shard.lru.pop_back();
+    }
+  }
+
+  size_t MemoryUsage() {
+    size_t result = 0;
+    for (Shard& shard : shards_) {
+      absl::MutexLock lock(&shard.mutex);
+      for (const auto& [block, entry] : shard.entries) {
+        result += entry.first->capacity() * sizeof(float);
+      }
+    }
+    return result;
+  }
+
+ private:
+  static constexpr size_t kNumShards = 16;
+
+  struct Shard {
+    absl::Mutex mutex;
+
+    std::list<size_t> lru ABSL_GUARDED_BY(mutex);
+
+    absl::flat_hash_map<size_t, pair<shared_ptr<const std::vector<float>>,
+                                     std::list<size_t>::iterator>>
+        entries ABSL_GUARDED_BY(mutex);
+  };
+
+  const size_t shard_capacity_;
+
+  std::array<Shard, kNumShards> shards_;
+};
+
+CompressedDenseDataset::CompressedDenseDataset() {}
+
+CompressedDenseDataset::~CompressedDenseDataset() {}
+
+StatusOr<unique_ptr<CompressedDenseDataset>> CompressedDenseDataset::Create(
+    const DenseDataset<float>& dataset,
+    const CompressedDenseDatasetOptions& opts, ThreadPool* pool) {
+  if (opts.datapoints_per_block == 0) {
+    return InvalidArgumentError("datapoints_per_block must be > 0.");
+  }
+  const size_t size = dataset.size();
+  const size_t dim = dataset.dimensionality();
+  const size_t dp_per_block = opts.datapoints_per_block;
+  const size_t num_blocks = DivRoundUp(size, dp_per_block);
+  const uint8_t* bytes =
+      reinterpret_cast<const uint8_t*>(dataset.data().data());
+
+  std::array<std::array<uint64_t, 256>, kNumPlanes> counts = {};
+  for (size_t i : Seq(size * dim)) {
+    for (int p = 0; p < kNumPlanes; ++p) {
+      ++counts[p][bytes[i * kNumPlanes + p]];
+    }
+  }
+  std::array<std::array<uint16_t, 256>, kNumPlanes> freqs = {};
+  std::array<std::array<uint16_t, 256>, kNumPlanes> starts = {};
+  uint64_t entropy_coded_mask = 0;
+  for (int p = 0; p < kNumPlanes; ++p) {
+    if (size == 0 ||
+        EntropyBitsPerByte(counts[p]) > kMaxEntropyCodedBitsPerByte) {
+      continue;
+    }
+    entropy_coded_mask |= 1 << p;
+    freqs[p] = NormalizeFrequencies(counts[p]);
+    for (int s = 1; s < 256; ++s) {
+      starts[p][s] = starts[p][s - 1] + freqs[p][s - 1];
+    }
+  }
+
+  std::vector<std::vector<uint8_t>> encoded(num_blocks);
+  ParallelFor<1>(Seq(num_blocks), pool, [&](size_t block) {
+    const size_t first = block * dp_per_block;
+    const size_t n = (std::min(first + dp_per_block, size) - first) * dim;
+    const uint8_t* block_bytes = bytes + first * dim * kNumPlanes;
+    std::vector<uint8_t>& out = encoded[block];
+    for (int p = 0; p < kNumPlanes; ++p) {
+      if (entropy_coded_mask & (1 << p)) {
+        const size_t size_pos = out.size();
+        out.resize(size_pos + sizeof(uint32_t));
+        RansEncode(freqs[p], starts[p], block_bytes + p, n, &out);
+        const uint32_t coded_size = out.size() - size_pos - sizeof(uint32_t);
+        std::memcpy(out.data() + size_pos, &coded_size, sizeof(coded_size));
+      } else {
+        for (size_t i : Seq(n)) out.push_back(block_bytes[i * kNumPlanes + p]);
+      }
+    }
+  });
+
+  size_t data_size = 0;
+  for (const auto& block : encoded) data_size += block.size();
+  std::vector<uint64_t> buffer(kHeaderSize + kFreqTableWords + num_blocks + 1 +
+                               NumWords(data_size));
+  buffer[kMagicField] = kMagic;
+  buffer[kVersionField] = kVersion;
+  buffer[kSizeField] = size;
+  buffer[kDimensionalityField] = dim;
+  buffer[kBlockSizeField] = dp_per_block;
+  buffer[kNumBlocksField] = num_blocks;
+  buffer[kEntropyCodedMaskField] = entropy_coded_mask;
+  buffer[kDataSizeField] = data_size;
+  std::memcpy(buffer.data() + kHeaderSize, freqs.data(), sizeof(freqs));
+  uint64_t* offsets = buffer.data() + kHeaderSize + kFreqTableWords;
+  uint8_t* data = reinterpret_cast<uint8_t*>(offsets + num_blocks + 1);
+  offsets[0] = 0;
+  for (size_t block : Seq(num_blocks)) {
+    std::copy(encoded[block].begin(), encoded[block].end(),
+              data + offsets[block]);
+    offsets[block + 1] = offsets[block] + encoded[block].size();
+    FreeBackingStorage(&encoded[block]);
+  }
+
+  unique_ptr<CompressedDenseDataset> result(new CompressedDenseDataset);
+  result->storage_ = std::move(buffer);
+  SCANN_RETURN_IF_ERROR(result->InitFromBuffer(result->storage_,
+                                               opts.decoded_block_cache_size));
+  return result;
+}
+
+StatusOr<unique_ptr<CompressedDenseDataset>> CompressedDenseDataset::Mmap(
+    string_view filename, uint32_t decoded_block_cache_size) {
+  unique_ptr<CompressedDenseDataset> result(new CompressedDenseDataset);
+  MemoryMappedFileOptions mmap_opts;
+  mmap_opts.access_pattern = MmapAccessPattern::kRandom;
+  TF_ASSIGN_OR_RETURN(result->mmap_,
+                      MemoryMappedFile::Open(filename, mmap_opts));
+  ConstSpan<char> bytes = result->mmap_->data();
+  if (bytes.size() % sizeof(uint64_t) != 0) {
+    return InvalidArgumentError(
+        "%s is not a valid CompressedDenseDataset file.", filename);
+  }
+  SCANN_RETURN_IF_ERROR(result->InitFromBuffer(
+      MakeConstSpan(reinterpret_cast<const uint64_t*>(bytes.data()),
+                    bytes.size() / sizeof(uint64_t)),
+      decoded_block_cache_size));
+  return result;
+}
+
+Status CompressedDenseDataset::WriteToFile(string_view filename) const {
+  OpenSourceableFileWriter writer(filename);
+  return writer.Write(
+      MakeConstSpan(reinterpret_cast<const char*>(buffer_.data()),
+                    buffer_.size() * sizeof(uint64_t)));
+}
+
+Status CompressedDenseDataset::InitFromBuffer(
+    ConstSpan<uint64_t> buffer, uint32_t decoded_block_cache_size) {
+  if (buffer.size() < kHeaderSize + kFreqTableWords ||
+      buffer[kMagicField] != kMagic) {
+    return InvalidArgumentError("Invalid CompressedDenseDataset header.");
+  }
+  if (buffer[kVersionField] != kVersion) {
+    return InvalidArgumentError(
+        "Unsupported CompressedDenseDataset version %d.",
+        buffer[kVersionField]);
+  }
+  size_ = buffer[kSizeField];
+  dimensionality_ = buffer[kDimensionalityField];
+  datapoints_per_block_ = buffer[kBlockSizeField];
+  num_blocks_ = buffer[kNumBlocksField];
+  data_size_ = buffer[kDataSizeField];
+  if (datapoints_per_block_ == 0 ||
+      num_blocks_ != DivRoundUp(size_, datapoints_per_block_)) {
+    return InvalidArgumentError("Inconsistent CompressedDenseDataset sizes.");
+  }
+  if (buffer.size() != kHeaderSize + kFreqTableWords + num_blocks_ + 1 +
+                           NumWords(data_size_)) {
+    return InvalidArgumentError("Truncated CompressedDenseDataset buffer.");
+  }
+
+  const uint16_t* freq_table =
+      reinterpret_cast<const uint16_t*>(buffer.data() + kHeaderSize);
+  for (int p = 0; p < kNumPlanes; ++p) {
+    PlaneModel& plane = planes_[p];
+    plane.entropy_coded = buffer[kEntropyCodedMaskField] & (1 << p);
+    if (!plane.entropy_coded) continue;
+    std::copy(freq_table + p * 256, freq_table + (p + 1) * 256,
+              plane.freq.begin());
+    uint32_t total = 0;
+    for (int s = 0; s < 256; ++s) {
+      plane.start[s] = total;
+      total += plane.freq[s];
+    }
+    if (total != kTotalFreq) {
+      return InvalidArgumentError(
+          "Invalid CompressedDenseDataset frequency table.");
+    }
+    plane.slot_to_symbol.resize(kTotalFreq);
+    for (int s = 0; s < 256; ++s) {
+      std::fill_n(plane.slot_to_symbol.begin() + plane.start[s], plane.freq[s],
+                  s);
+    }
+  }
+
+  block_offsets_ = buffer.data() + kHeaderSize + kFreqTableWords;
+  data_ = reinterpret_cast<const uint8_t*>(block_offsets_ + num_blocks_ + 1);
+  if (block_offsets_[0] != 0 || block_offsets_[num_blocks_] != data_size_) {
+    return InvalidArgumentError("Invalid CompressedDenseDataset offsets.");
+  }
+  for (size_t block : Seq(num_blocks_)) {
+    if (block_offsets_[block] > block_offsets_[block + 1]) {
+      return InvalidArgumentError("Invalid CompressedDenseDataset offsets.");
+    }
+  }
+  buffer_ = buffer;
+  if (decoded_block_cache_size > 0) {
+    cache_ = make_unique<DecodedBlockCache>(decoded_block_cache_size);
+  }
+  return OkStatus();
+}
+
+size_t CompressedDenseDataset::MemoryUsage() const {
+  size_t result = storage_.capacity() * sizeof(uint64_t);
+  for (const PlaneModel& plane : planes_) {
+    result += plane.slot_to_symbol.capacity();
+  }
+  if (cache_) result += cache_->MemoryUsage();
+  return result;
+}
+
+size_t CompressedDenseDataset::BlockNumFloats(size_t block) const {
+  const size_t first = block * datapoints_per_block_;
+  return (std::min<size_t>(first + datapoints_per_block_, size_) - first) *
+         dimensionality_;
+}
+
+Status CompressedDenseDataset::DecodeBlock(size_t block,
+                                           MutableSpan<float> dst) const {
+  const size_t n = BlockNumFloats(block);
+  DCHECK_EQ(dst.size(), n);
+  const uint8_t* ptr = data_ + block_offsets_[block];
+  const uint8_t* const block_end = data_ + block_offsets_[block + 1];
+  uint8_t* out = reinterpret_cast<uint8_t*>(dst.data());
+  auto corrupt = [block] {
+    return InternalError("Corrupt CompressedDenseDataset block %d.", block);
+  };
+  for (int p = 0; p < kNumPlanes; ++p) {
+    const PlaneModel& plane = planes_[p];
+    if (!plane.entropy_coded) {
+      if (static_cast<size_t>(block_end - ptr) < n) return corrupt();
+      for (size_t i : Seq(n)) out[i * kNumPlanes + p] = ptr[i];
+      ptr += n;
+      continue;
+    }
+    uint32_t coded_size;
+    if (static_cast<size_t>(block_end - ptr) < sizeof(coded_size)) {
+      return corrupt();
+    }
+    std::memcpy(&coded_size, ptr, sizeof(coded_size));
+    ptr += sizeof(coded_size);
+    if (static_cast<size_t>(block_end - ptr) < coded_size || coded_size < 4) {
+      return corrupt();
+    }
+    const uint8_t* in = ptr;
+    const uint8_t* const in_end = ptr + coded_size;
+    uint32_t x = (uint32_t{in[0]} << 24) | (uint32_t{in[1]} << 16) |
+                 (uint32_t{in[2]} << 8) | uint32_t{in[3]};
+    in += 4;
+    for (size_t i : Seq(n)) {
+      const uint32_t slot = x & (kTotalFreq - 1);
+      const uint8_t s = plane.slot_to_symbol[slot];
+      out[i * kNumPlanes + p] = s;
+      x = plane.freq[s] * (x >> kScaleBits) + slot - plane.start[s];
+      while (x < kRansLowerBound) {
+        if (in == in_end) return corrupt();
+        x = (x << 8) | *in++;
+      }
+    }
+    ptr = in_end;
+  }
+  return OkStatus();
+}
+
+StatusOr<shared_ptr<const std::vector<float>>> CompressedDenseDataset::GetBlock(
+    size_t block) const {
+  if (cache_) {
+    auto cached = cache_->Lookup(block);
+    if (cached) return cached;
+  }
+  auto decoded = make_shared<std::vector<float>>(BlockNumFloats(block));
+  SCANN_RETURN_IF_ERROR(DecodeBlock(block, MakeMutableSpan(*decoded)));
+  if (cache_) cache_->Insert(block, decoded);
+  return {std::move(decoded)};
+}
+
+Status CompressedDenseDataset::GetDatapoint(DatapointIndex index,
+                                            MutableSpan<float> dst) const {
+  return GetDatapoints(MakeConstSpan(&index, 1), dst);
+}
+
+Status CompressedDenseDataset::GetDatapoints(ConstSpan<DatapointIndex> indices,
+                                             MutableSpan<float> dst,
+                                             ThreadPool* pool) const {
+  if (dst.size() != indices.size() * dimensionality_) {
+    return InvalidArgumentError(
+        "Destination has %d floats but %d datapoints of dimensionality %d "
+        "were requested.",
+        dst.size(), indices.size(), dimensionality_);
+  }
+  std::vector<pair<DatapointIndex, uint32_t>> sorted(indices.size());
+  for (size_t i : IndicesOf(indices)) {
+    if (indices[i] >= size_) {
+      return OutOfRangeError("Datapoint index %d is >= dataset size %d.",
+                             indices[i], size_);
+    }
+    sorted[i] = {indices[i], i};
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  std::vector<size_t> run_starts;
+  for (size_t i : IndicesOf(sorted)) {
+    if (i == 0 || sorted[i].first / datapoints_per_block_ !=
+                      sorted[i - 1].first / datapoints_per_block_) {
+      run_starts.push_back(i);
+    }
+  }
+  run_starts.push_back(sorted.size());
+  const size_t num_runs = run_starts.size() - 1;
+
+  auto copy_run = [&](size_t run) -> Status {
+    const size_t block = sorted[run_starts[run]].first / datapoints_per_block_;
+    TF_ASSIGN_OR_RETURN(auto decoded, GetBlock(block));
+    for (size_t i : Seq(run_starts[run], run_starts[run + 1])) {
+      const size_t offset =
+          (sorted[i].first - block * datapoints_per_block_) * dimensionality_;
+      std::copy_n(decoded->data() + offset, dimensionality_,
+                  dst.data() + sorted[i].second * dimensionality_);
+    }
+    return OkStatus();
+  };
+  if (pool && num_runs >= kMinBlocksForParallelDecode) {
+    return ParallelForWithStatus<1>(Seq(num_runs), pool, copy_run);
+  }
+  for (size_t run : Seq(num_runs)) SCANN_RETURN_IF_ERROR(copy_run(run));
+  return OkStatus();
+}
+
+StatusOr<DenseDataset<float>> CompressedDenseDataset::Decompress(
+    ThreadPool* pool) const {
+  std::vector<float> result(size_ * dimensionality_);
+  SCANN_RETURN_IF_ERROR(
+      ParallelForWithStatus<1>(Seq(num_blocks_), pool, [&](size_t block) {
+        return DecodeBlock(
+            block, MakeMutableSpan(result.data() + block *
+                                                       datapoints_per_block_ *
+                                                       dimensionality_,
+                                   BlockNumFloats(block)));
+      }));
+  return DenseDataset<float>(std::move(result), size_);
+}
+
+}  // namespace research_scann
@@ -0,0 +1,126 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_DATA_FORMAT_COMPRESSED_DENSE_DATASET_H_
+#define SCANN_DATA_FORMAT_COMPRESSED_DENSE_DATASET_H_
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "scann/data_format/dataset.h"
+#include "scann/oss_wrappers/scann_threadpool.h"
+#include "scann/utils/common.h"
+#include "scann/utils/io_oss_wrapper.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+struct CompressedDenseDatasetOptions {
+  uint32_t datapoints_per_block = 16;
+
+  uint32_t decoded_block_cache_size = 1024;
+};
+
+class CompressedDenseDataset {
+ public:
+  static StatusOr<unique_ptr<CompressedDenseDataset>> Create(
+      const DenseDataset<float>& dataset,
+      const CompressedDenseDatasetOptions& opts =
+          CompressedDenseDatasetOptions(),
+      ThreadPool* pool = nullptr);
+
+  static StatusOr<unique_ptr<CompressedDenseDataset>> Mmap(
+      string_view filename, uint32_t decoded_block_cache_size = 1024);
+
+  Status WriteToFile(string_view filename) const;
+
+  ~CompressedDenseDataset();
+
+  DatapointIndex size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  DimensionIndex dimensionality() const { return dimensionality_; }
+
+  uint32_t datapoints_per_block() const { return datapoints_per_block_; }
+
+  size_t num_blocks() const { return num_blocks_; }
+
+  size_t CompressedSizeInBytes() const {
+    return buffer_.size() * sizeof(uint64_t);
+  }
+
+  size_t MemoryUsage() const;
+
+  Status GetDatapoint(DatapointIndex index, MutableSpan<float> dst) const;
+
+  Status GetDatapoints(ConstSpan<DatapointIndex> indices,
+                       MutableSpan<float> dst,
+                       ThreadPool* pool = nullptr) const;
+
+  StatusOr<DenseDataset<float>> Decompress(ThreadPool* pool = nullptr) const;
+
+ private:
+  class DecodedBlockCache;
+
+  struct PlaneModel {
+    bool entropy_coded = false;
+
+    std::array<uint16_t, 256> freq = {};
+
+    std::array<uint16_t, 256> start = {};
+
+    std::vector<uint8_t> slot_to_symbol;
+  };
+
+  CompressedDenseDataset();
+
+  Status InitFromBuffer(ConstSpan<uint64_t> buffer,
+                        uint32_t decoded_block_cache_size);
+
+  size_t BlockNumFloats(size_t block) const;
+
+  Status DecodeBlock(size_t block, MutableSpan<float> dst) const;
+
+  StatusOr<shared_ptr<const std::vector<float>>> GetBlock(size_t block) const;
+
+  std::vector<uint64_t> storage_;
+
+  unique_ptr<MemoryMappedFile> mmap_;
+
+  ConstSpan<uint64_t> buffer_;
+
+  DatapointIndex size_ = 0;
+
+  DimensionIndex dimensionality_ = 0;
+
+  uint32_t datapoints_per_block_ = 0;
+
+  size_t num_blocks_ = 0;
+
+  std::array<PlaneModel, sizeof(float)> planes_;
+
+  const uint64_t* block_offsets_ = nullptr;
+
+  const uint8_t* data_ = nullptr;
+
+  size_t data_size_ = 0;
+
+  unique_ptr<DecodedBlockCache> cache_;
+};
+
+}  // namespace research_scann
+
+#endif
@@ -16,7 +16,9 @@
 
 #include "scann/data_format/dataset.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <hash_set>
 
 #include "absl/container/flat_hash_set.h"
@@ -44,6 +46,17 @@ shared_ptr<DocidCollectionInterface> Dataset::ReleaseDocids() {
   return result;
 }
 
+Status Dataset::set_docids(shared_ptr<DocidCollectionInterface> docids) {
+  if (!docids) return InvalidArgumentError("Docids must be non-null.");
+  if (docids->size() != size()) {
+    return InvalidArgumentError(
+        "Docid collection has %d docids but the dataset has %d datapoints.",
+        docids->size(), size());
+  }
+  docids_ = std::move(docids);
+  return OkStatus();
+}
+
 Status Dataset::NormalizeByTag(Normalization tag) {
   if (tag == normalization()) return OkStatus();
   switch (tag) {
@@ -247,6 +260,12 @@ Status TypedDataset<T>::NormalizeUnitL2() {
         "Unit L2 normalization is not supported for binary "
         "and integral datasets.");
   }
+  if (this->IsDense() &&
+      down_cast<const DenseDataset<T>*>(this)->IsMemoryMapped()) {
+    return FailedPreconditionError(
+        "Unit L2 normalization is not supported for memory-mapped "
+        "datasets.");
+  }
 
   const size_t size = this->size();
   for (size_t i = 0; i < size; ++i) {
@@ -374,6 +393,17 @@ double DenseDataset<T>::GetDistance(const DistanceMeasure& dist,
 
 template <typename T>
 Status DenseDataset<T>::Append(const DatapointPtr<T>& dptr, string_view docid) {
+  if (mutator_) return mutator_->AddDatapoint(dptr, docid);
+  return AppendImpl(dptr, docid);
+}
+
+template <typename T>
+Status DenseDataset<T>::AppendImpl(const DatapointPtr<T>& dptr,
+                                   string_view docid) {
+  if (mapped_file_) {
+    return FailedPreconditionError(
+        "Cannot append to a memory-mapped DenseDataset.");
+  }
   if (!dptr.IsDense()) {
     if (dptr.IsSparseOrigin()) {
       return FailedPreconditionError(
@@ -457,8 +487,60 @@ DenseDataset<T>::DenseDataset(vector<T> datapoint_vec, size_t num_dp)
           make_unique<VariableLengthDocidCollection>(
               VariableLengthDocidCollection::CreateWithEmptyDocids(num_dp))) {}
 
+template <typename T>
+StatusOr<DenseDataset<T>> DenseDataset<T>::FromMemoryMappedFile(
+    shared_ptr<const MemoryMappedFile> file, size_t offset, size_t num_dp,
+    DimensionIndex dimensionality,
+    unique_ptr<DocidCollectionInterface> docids) {
+  if (!file) return InvalidArgumentError("Memory-mapped file is null.");
+  const ConstSpan<char> bytes = file->data();
+  const size_t num_elements = num_dp * dimensionality;
+  if (offset > bytes.size() ||
+      num_elements > (bytes.size() - offset) / sizeof(T)) {
+    return InvalidArgumentError(
+        "Memory-mapped file has %d bytes after offset %d, but %d x %d "
+        "datapoints require %d bytes.",
+        bytes.size() - std::min(offset, bytes.size()), offset, num_dp,
+        dimensionality, num_elements * sizeof(T));
+  }
+  if (reinterpret_cast<uintptr_t>(bytes.data() + offset) % alignof(T) != 0) {
+    return InvalidArgumentError(
+        "Offset %d is not aligned for the dataset element type.", offset);
+  }
+  if (!docids) {
+    docids = make_unique<VariableLengthDocidCollection>(
+        VariableLengthDocidCollection::CreateWithEmptyDocids(num_dp));
+  }
+  if (docids->size() != num_dp) {
+    return InvalidArgumentError(
+        "Got %d docids for a memory-mapped dataset of %d datapoints.",
+        docids->size(), num_dp);
+  }
+
+  DenseDataset<T> result(std::move(docids));
+  result.set_dimensionality_no_checks(dimensionality);
+  result.stride_ = dimensionality;
+  result.mapped_data_ = MakeConstSpan(
+      reinterpret_cast<const T*>(bytes.data() + offset), num_elements);
+  result.mapped_file_ = std::move(file);
+  return result;
+}
+
+template <typename T>
+Status DenseDataset<T>::AdviseMemoryMapping(
+    MmapAccessPattern access_pattern) const {
+  if (!mapped_file_) {
+    return FailedPreconditionError("DenseDataset is not memory-mapped.");
+  }
+  SCANN_RETURN_IF_ERROR(mapped_file_->Advise(access_pattern));
+  madvise_prefetch_.store(access_pattern == MmapAccessPattern::kRandom,
+                          std::memory_order_relaxed);
+  return OkStatus();
+}
+
 template <typename T>
 void DenseDataset<T>::Reserve(size_t n) {
+  if (mapped_file_) return;
   if (mutator_) {
     mutator_->Reserve(n);
     return;
@@ -473,6 +555,7 @@ void DenseDataset<T>::ReserveImpl(size_t n) {
 
 template <typename T>
 void DenseDataset<T>::Resize(size_t n) {
+  CHECK(!mapped_file_) << "Cannot resize a memory-mapped DenseDataset.";
   CHECK_EQ(this->docids()->capacity(), 0)
       << "Resize only works for datasets with empty docids.";
   if (this->size() != n) {
@@ -505,7 +588,171 @@ size_t DenseDataset<T>::MemoryUsageExcludingDocids() const {
 template <typename T>
 StatusOr<typename TypedDataset<T>::Mutator*> DenseDataset<T>::GetMutator()
     const {
-  return UnimplementedError("No mutator supported.");
+  if (mapped_file_) {
+    return FailedPreconditionError(
+        "Memory-mapped DenseDatasets are read-only.");
+  }
+  if (!mutator_) {
+    auto mutable_this = const_cast<DenseDataset<T>*>(this);
+    TF_ASSIGN_OR_RETURN(mutator_,
+                        DenseDataset<T>::Mutator::Create(mutable_this));
+  }
+  return static_cast<typename TypedDataset<T>::Mutator*>(mutator_.get());
+}
+
+template <typename T>
+StatusOr<unique_ptr<typename DenseDataset<T>::Mutator>>
+DenseDataset<T>::Mutator::Create(DenseDataset<T>* dataset) {
+  TF_ASSIGN_OR_RETURN(DocidCollectionInterface::Mutator * docid_mutator,
+                      dataset->docids()->GetMutator());
+  return absl::WrapUnique(
+      new typename DenseDataset<T>::Mutator(dataset, docid_mutator));
+}
+
+template <typename T>
+Status DenseDataset<T>::Mutator::AddDatapoint(const DatapointPtr<T>& dptr,
+                                              string_view docid) {
+  const size_t stride = dataset_->stride_;
+  if (stride > 0 &&
+      dataset_->data_.capacity() < dataset_->data_.size() + stride) {
+    Reserve(dataset_->size() * kGrowthFactor + 1);
+  }
+  return dataset_->AppendImpl(dptr, docid);
+}
+
+template <typename T>
+bool DenseDataset<T>::Mutator::LookupDatapointIndex(
+    string_view docid, DatapointIndex* index) const {
+  return docid_mutator_->LookupDatapointIndex(docid, index);
+}
+
+template <typename T>
+Status DenseDataset<T>::Mutator::RemoveDatapoint(string_view docid) {
+  DatapointIndex index;
+  if (!LookupDatapointIndex(docid, &index)) {
+    return NotFoundError(absl::StrCat("Docid: ", docid, " is not found."));
+  }
+  return RemoveDatapoint(index);
+}
+
+template <typename T>
+Status DenseDataset<T>::Mutator::RemoveDatapoint(DatapointIndex index) {
+  const size_t size = dataset_->size();
+  if (index >= size) {
+    return OutOfRangeError(
+        absl::StrCat("Removing a datapoint out of bound: index = ", index,
+                     ", but size() =  ", size, "."));
+  }
+  const size_t stride = dataset_->stride_;
+  std::vector<T>& data = dataset_->data_;
+  if (index != size - 1) {
+    std::copy(data.begin() + (size - 1) * stride, data.begin() + size * stride,
+              data.begin() + index * stride);
+  }
+  data.resize((size - 1) * stride);
+  return docid_mutator_->RemoveDatapoint(index);
+}
+
+template <typename T>
+Status DenseDataset<T>::Mutator::UpdateDatapoint(const DatapointPtr<T>& dptr,
+                                                 string_view docid) {
+  DatapointIndex index;
+  if (!LookupDatapointIndex(docid, &index)) {
+    return NotFoundError(absl::StrCat("Docid: ", docid, " is not found."));
+  }
+  return UpdateDatapoint(dptr, index);
+}
+
+template <typename T>
+Status DenseDataset<T>::Mutator::UpdateDatapoint(const DatapointPtr<T>& dptr,
+                                                 DatapointIndex index) {
+  if (index >= dataset_->size()) {
+    return OutOfRangeError(
+        absl::StrCat("Updating a datapoint out of bound: index = ", index,
+                     ", but size() =  ", dataset_->size(), "."));
+  }
+  if (!dptr.IsDense()) {
+    return FailedPreconditionError(
+        "Cannot update a dense dataset with a sparse datapoint.");
+  }
+  if (dptr.dimensionality() != dataset_->dimensionality() ||
+      dptr.nonzero_entries() != dataset_->stride_) {
+    return FailedPreconditionError(
+        StrFormat("Dimensionality mismatch:  Updating a %u dimensional "
+                  "datapoint in a %u dimensional dataset.",
+                  static_cast<uint64_t>(dptr.dimensionality()),
+                  static_cast<uint64_t>(dataset_->dimensionality())));
+  }
+
+  Datapoint<T> storage;
+  DatapointPtr<T> to_insert = dptr;
+  if (dataset_->normalization() != NONE) {
+    CopyToDatapoint(dptr, &storage);
+    SCANN_RETURN_IF_ERROR(NormalizeByTag(dataset_->normalization(), &storage));
+    to_insert = storage.ToPtr();
+  }
+  std::copy(to_insert.values(), to_insert.values() + dataset_->stride_,
+            dataset_->mutable_data(index).begin());
+  return OkStatus();
+}
+
+template <typename T>
+void DenseDataset<T>::Mutator::Reserve(size_t size) {
+  dataset_->ReserveImpl(size);
+  docid_mutator_->Reserve(size);
+}
+
+template <typename T>
+Status DenseDataset<T>::Mutator::AddDatapoints(const DenseDataset<T>& batch) {
+  if (batch.empty()) return OkStatus();
+  if (!dataset_->empty() &&
+      batch.dimensionality() != dataset_->dimensionality()) {
+    return FailedPreconditionError(
+        StrFormat("Dimensionality mismatch:  Adding %u dimensional "
+                  "datapoints to a %u dimensional dataset.",
+                  static_cast<uint64_t>(batch.dimensionality()),
+                  static_cast<uint64_t>(dataset_->dimensionality())));
+  }
+  const size_t new_size = dataset_->size() + batch.size();
+  if (dataset_->data_.capacity() < new_size * batch.stride_) {
+    Reserve(std::max<size_t>(new_size, dataset_->size() * kGrowthFactor + 1));
+  }
+  for (DatapointIndex i : Seq(batch.size())) {
+    SCANN_RETURN_IF_ERROR(dataset_->AppendImpl(batch[i], batch.GetDocid(i)));
+  }
+  return OkStatus();
+}
+
+template <typename T>
+Status DenseDataset<T>::Mutator::RemoveDatapoints(
+    ConstSpan<DatapointIndex> indices) {
+  std::vector<DatapointIndex> sorted(indices.begin(), indices.end());
+  std::sort(sorted.begin(), sorted.end(), std::greater<DatapointIndex>());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+  if (!sorted.empty() && sorted.front() >= dataset_->size()) {
+    return OutOfRangeError(
+        absl::StrCat("Removing a datapoint out of bound: index = ",
+                     sorted.front(), ", but size() =  ", dataset_->size(),
+                     "."));
+  }
+  for (DatapointIndex index : sorted) {
+    SCANN_RETURN_IF_ERROR(RemoveDatapoint(index));
+  }
+  return OkStatus();
+}
+
+template <typename T>
+Status DenseDataset<T>::Mutator::UpdateDatapoints(
+    ConstSpan<DatapointIndex> indices, const DenseDataset<T>& batch) {
+  if (indices.size() != batch.size()) {
+    return InvalidArgumentError(
+        absl::StrCat("Got ", indices.size(), " indices but ", batch.size(),
+                     " datapoints to update."));
+  }
+  for (size_t i : IndicesOf(indices)) {
+    SCANN_RETURN_IF_ERROR(UpdateDatapoint(batch[i], indices[i]));
+  }
+  return OkStatus();
 }
 
 template <typename T>
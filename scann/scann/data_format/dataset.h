@@ -17,6 +17,7 @@
 #ifndef SCANN_DATA_FORMAT_DATASET_H_
 #define SCANN_DATA_FORMAT_DATASET_H_
 
+#include <atomic>
 #include <memory>
 #include <type_traits>
 
@@ -29,6 +30,7 @@
 #include "scann/distance_measures/distance_measure_base.h"
 #include "scann/proto/hashed.pb.h"
 #include "scann/utils/common.h"
+#include "scann/utils/io_oss_wrapper.h"
 #include "scann/utils/iterators.h"
 #include "scann/utils/types.h"
 #include "scann/utils/util_functions.h"
@@ -74,6 +76,8 @@ class Dataset : public VirtualDestructor {
 
   const shared_ptr<DocidCollectionInterface>& docids() const { return docids_; }
 
+  Status set_docids(shared_ptr<DocidCollectionInterface> docids);
+
   virtual shared_ptr<DocidCollectionInterface> ReleaseDocids();
 
   virtual void clear() = 0;
@@ -259,10 +263,33 @@ class TypedDataset<T>::Mutator : public Dataset::Mutator {
 template <typename T>
 class DenseDataset final : public TypedDataset<T> {
  public:
-  SCANN_DECLARE_MOVE_ONLY_CLASS(DenseDataset);
+  SCANN_DECLARE_MOVE_ONLY_CLASS_CUSTOM_IMPL(DenseDataset);
 
   DenseDataset() {}
 
+  DenseDataset(DenseDataset&& other) noexcept
+      : TypedDataset<T>(std::move(other)),
+        data_(std::move(other.data_)),
+        mapped_file_(std::move(other.mapped_file_)),
+        mapped_data_(other.mapped_data_),
+        madvise_prefetch_(
+            other.madvise_prefetch_.load(std::memory_order_relaxed)),
+        stride_(other.stride_),
+        mutator_(std::move(other.mutator_)) {}
+
+  DenseDataset& operator=(DenseDataset&& other) noexcept {
+    TypedDataset<T>::operator=(std::move(other));
+    data_ = std::move(other.data_);
+    mapped_file_ = std::move(other.mapped_file_);
+    mapped_data_ = other.mapped_data_;
+    madvise_prefetch_.store(
+        other.madvise_prefetch_.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+    stride_ = other.stride_;
+    mutator_ = std::move(other.mutator_);
+    return *this;
+  }
+
   explicit DenseDataset(unique_ptr<DocidCollectionInterface> docids)
       : TypedDataset<T>(std::move(docids)) {}
 
@@ -271,7 +298,24 @@ class DenseDataset final : public TypedDataset<T> {
 
   DenseDataset(std::vector<T> datapoint_vec, size_t num_dp);
 
+  static StatusOr<DenseDataset<T>> FromMemoryMappedFile(
+      shared_ptr<const MemoryMappedFile> file, size_t offset, size_t num_dp,
+      DimensionIndex dimensionality,
+      unique_ptr<DocidCollectionInterface> docids = nullptr);
+
   DenseDataset<T> Copy() const {
+    if (mapped_file_) {
+      DenseDataset<T> result(this->docids()->Copy());
+      result.set_normalization_tag(this->normalization());
+      result.set_dimensionality_no_checks(this->dimensionality());
+      result.stride_ = stride_;
+      result.mapped_file_ = mapped_file_;
+      result.mapped_data_ = mapped_data_;
+      result.madvise_prefetch_.store(
+          madvise_prefetch_.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+      return result;
+    }
     auto result = DenseDataset<T>(data_, this->docids()->Copy());
     result.set_normalization_tag(this->normalization());
 
@@ -298,21 +342,37 @@ class DenseDataset final : public TypedDataset<T> {
   template <typename Real>
   void ConvertType(DenseDataset<Real>* target) const;
 
-  ConstSpan<T> data() const { return data_; }
+  ConstSpan<T> data() const {
+    return mapped_file_ ? mapped_data_ : ConstSpan<T>(data_);
+  }
   ConstSpan<T> data(size_t index) const {
-    return MakeConstSpan(data_.data() + index * stride_, stride_);
+    return MakeConstSpan(raw_data() + index * stride_, stride_);
+  }
+  MutableSpan<T> mutable_data() {
+    CHECK(!mapped_file_) << "Cannot mutate a memory-mapped DenseDataset.";
+    return MakeMutableSpan(data_);
   }
-  MutableSpan<T> mutable_data() { return MakeMutableSpan(data_); }
   MutableSpan<T> mutable_data(size_t index) {
+    CHECK(!mapped_file_) << "Cannot mutate a memory-mapped DenseDataset.";
     return MakeMutableSpan(data_.data() + index * stride_, stride_);
   }
 
   vector<T> ClearRecyclingDataVector() {
-    vector<T> result = std::move(data_);
+    vector<T> result = mapped_file_
+                           ? vector<T>(mapped_data_.begin(), mapped_data_.end())
+                           : std::move(data_);
     this->clear();
     return result;
   }
 
+  bool IsMemoryMapped() const { return mapped_file_ != nullptr; }
+
+  Status AdviseMemoryMapping(MmapAccessPattern access_pattern) const;
+
+  bool IsAdvisedRandomAccess() const {
+    return madvise_prefetch_.load(std::memory_order_relaxed);
+  }
+
   void clear() final;
   DimensionIndex NumActiveDimensions() const final;
   void ShrinkToFit() final;
@@ -338,13 +398,26 @@ class DenseDataset final : public TypedDataset<T> {
     AppendOrDie(MakeDatapointPtr<T>(values), absl::StrCat(this->size()));
   }
 
+  class Mutator;
   StatusOr<typename TypedDataset<T>::Mutator*> GetMutator() const final;
 
  private:
+  Status AppendImpl(const DatapointPtr<T>& dptr, string_view docid);
+
   void SetStride();
 
+  const T* raw_data() const {
+    return mapped_file_ ? mapped_data_.data() : data_.data();
+  }
+
   std::vector<T> data_;
 
+  shared_ptr<const MemoryMappedFile> mapped_file_;
+
+  ConstSpan<T> mapped_data_;
+
+  mutable std::atomic<bool> madvise_prefetch_{false};
+
   DimensionIndex stride_ = 0;
 
   mutable unique_ptr<typename DenseDataset<T>::Mutator> mutator_;
@@ -353,6 +426,42 @@ class DenseDataset final : public TypedDataset<T> {
   friend class DenseDataset;
 };
 
+template <typename T>
+class DenseDataset<T>::Mutator : public TypedDataset<T>::Mutator {
+ public:
+  static StatusOr<unique_ptr<Mutator>> Create(DenseDataset<T>* dataset);
+  Mutator(const Mutator&) = delete;
+  Mutator& operator=(const Mutator&) = delete;
+
+  ~Mutator() final {}
+  Status AddDatapoint(const DatapointPtr<T>& dptr, string_view docid) final;
+  bool LookupDatapointIndex(string_view docid,
+                            DatapointIndex* index) const final;
+  Status RemoveDatapoint(string_view docid) final;
+  Status RemoveDatapoint(DatapointIndex index) final;
+  Status UpdateDatapoint(const DatapointPtr<T>& dptr,
+                         string_view docid) final;
+  Status UpdateDatapoint(const DatapointPtr<T>& dptr,
+                         DatapointIndex index) final;
+  void Reserve(size_t size) final;
+
+  Status AddDatapoints(const DenseDataset<T>& batch);
+
+  Status RemoveDatapoints(ConstSpan<DatapointIndex> indices);
+
+  Status UpdateDatapoints(ConstSpan<DatapointIndex> indices,
+                          const DenseDataset<T>& batch);
+
+ private:
+  static constexpr int kGrowthFactor = 2;
+  Mutator(DenseDataset<T>* dataset,
+          DocidCollectionInterface::Mutator* docid_mutator)
+      : dataset_(dataset), docid_mutator_(docid_mutator) {}
+
+  DenseDataset<T>* dataset_ = nullptr;
+  DocidCollectionInterface::Mutator* docid_mutator_ = nullptr;
+};
+
 template <typename T>
 class DenseDatasetSubView;
 
@@ -535,15 +644,20 @@ class SparseDataset final : public TypedDataset<T> {
 template <typename T>
 DatapointPtr<T> DenseDataset<T>::operator[](size_t i) const {
   DCHECK_LT(i, this->size());
-  return MakeDatapointPtr(nullptr, data_.data() + i * stride_, stride_,
+  return MakeDatapointPtr(nullptr, raw_data() + i * stride_, stride_,
                           this->dimensionality());
 }
 
 template <typename T>
 void DenseDataset<T>::Prefetch(size_t i) const {
   DCHECK_LT(i, this->size());
+  const T* ptr = raw_data() + i * stride_;
+  const bool will_need = madvise_prefetch_.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(will_need)) {
+    mapped_file_->WillNeed(ptr, stride_ * sizeof(T));
+  }
   ::tensorflow::port::prefetch<::tensorflow::port::PREFETCH_HINT_NTA>(
-      reinterpret_cast<const char*>(data_.data() + i * stride_));
+      reinterpret_cast<const char*>(ptr));
 }
 
 template <typename T>
@@ -558,7 +672,8 @@ void DenseDataset<T>::ConvertType(DenseDataset<Real>* target) const {
   target->set_dimensionality_no_checks(this->dimensionality());
   target->stride_ = stride_;
   target->set_docids_no_checks(this->docids()->Copy());
-  target->data_.insert(target->data_.begin(), data_.begin(), data_.end());
+  const ConstSpan<T> source = data();
+  target->data_.insert(target->data_.begin(), source.begin(), source.end());
 }
 
 template <typename T>
@@ -0,0 +1,125 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_DATA_FORMAT_SPARSE_CSR_DATASET_H_
+#define SCANN_DATA_FORMAT_SPARSE_CSR_DATASET_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "scann/data_format/dataset.h"
+#include "scann/utils/common.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+class SparseCsrDataset {
+ public:
+  SCANN_DECLARE_MOVE_ONLY_CLASS(SparseCsrDataset);
+
+  SparseCsrDataset() {}
+
+  template <typename T>
+  static StatusOr<SparseCsrDataset> Create(const SparseDataset<T>& dataset,
+                                           DatapointIndex begin,
+                                           DatapointIndex end);
+
+  template <typename T>
+  static StatusOr<SparseCsrDataset> Create(const SparseDataset<T>& dataset) {
+    return Create(dataset, 0, dataset.size());
+  }
+
+  DatapointIndex size() const { return row_starts_.size() - 1; }
+
+  bool empty() const { return size() == 0; }
+
+  DimensionIndex dimensionality() const { return dimensionality_; }
+
+  size_t num_entries() const { return indices_.size(); }
+
+  ConstSpan<uint32_t> indices(DatapointIndex i) const {
+    DCHECK_LT(i, size());
+    return ConstSpan<uint32_t>(indices_.data() + row_starts_[i],
+                               row_starts_[i + 1] - row_starts_[i]);
+  }
+
+  ConstSpan<float> values(DatapointIndex i) const {
+    DCHECK_LT(i, size());
+    return ConstSpan<float>(values_.data() + row_starts_[i],
+                            row_starts_[i + 1] - row_starts_[i]);
+  }
+
+  ConstSpan<float> squared_l2_norms() const { return squared_l2_norms_; }
+
+  size_t MemoryUsage() const {
+    return row_starts_.capacity() * sizeof(size_t) +
+           indices_.capacity() * sizeof(uint32_t) +
+           (values_.capacity() + squared_l2_norms_.capacity()) *
+               sizeof(float);
+  }
+
+ private:
+  std::vector<size_t> row_starts_ = {0};
+
+  std::vector<uint32_t> indices_;
+
+  std::vector<float> values_;
+
+  std::vector<float> squared_l2_norms_;
+
+  DimensionIndex dimensionality_ = 0;
+};
+
+template <typename T>
+StatusOr<SparseCsrDataset> SparseCsrDataset::Create(
+    const SparseDataset<T>& dataset, DatapointIndex begin,
+    DatapointIndex end) {
+  if (begin > end || end > dataset.size()) {
+    return OutOfRangeError("Invalid row range [%d, %d) for %d datapoints.",
+                           begin, end, dataset.size());
+  }
+  if (dataset.dimensionality() > numeric_limits<uint32_t>::max()) {
+    return InvalidArgumentError(
+        "SparseCsrDataset requires dimensionality < 2^32 (got %d).",
+        dataset.dimensionality());
+  }
+  SparseCsrDataset result;
+  result.dimensionality_ = dataset.dimensionality();
+  size_t num_entries = 0;
+  for (DatapointIndex i : Seq(begin, end)) {
+    num_entries += dataset[i].nonzero_entries();
+  }
+  result.row_starts_.reserve(end - begin + 1);
+  result.indices_.reserve(num_entries);
+  result.values_.reserve(num_entries);
+  result.squared_l2_norms_.reserve(end - begin);
+  for (DatapointIndex i : Seq(begin, end)) {
+    const DatapointPtr<T> dptr = dataset[i];
+    double squared_norm = 0.0;
+    for (size_t j : Seq(dptr.nonzero_entries())) {
+      const float value =
+          dptr.has_values() ? static_cast<float>(dptr.values()[j]) : 1.0f;
+      result.indices_.push_back(dptr.indices()[j]);
+      result.values_.push_back(value);
+      squared_norm += static_cast<double>(value) * value;
+    }
+    result.row_starts_.push_back(result.indices_.size());
+    result.squared_l2_norms_.push_back(squared_norm);
+  }
+  return result;
+}
+
+}  // namespace research_scann
+
+#endif
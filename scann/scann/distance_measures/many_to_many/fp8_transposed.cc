@@ -14,7 +14,9 @@
 
 #include "scann/distance_measures/many_to_many/fp8_transposed.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <utility>
 
 #include "scann/utils/intrinsics/flags.h"
 #include "scann/utils/types.h"
@@ -67,6 +69,45 @@ FP8SimdBlockTransposedDatabase::FP8SimdBlockTransposedDatabase(
   }
 }
 
+FP8SimdBlockTransposedDatabase::FP8SimdBlockTransposedDatabase(
+    ConstSpan<int8_t> transposed_payload, DimensionIndex dimensionality,
+    uint8_t simd_block_size, ConstSpan<float> inverse_fp8_multipliers)
+    : payload_(new int8_t[transposed_payload.size()]),
+      inverse_fp8_multipliers_(inverse_fp8_multipliers.data()),
+      size_(dimensionality ? transposed_payload.size() / dimensionality : 0),
+      dimensionality_(dimensionality),
+      simd_block_size_(simd_block_size) {
+  CHECK_EQ(transposed_payload.size(),
+           static_cast<size_t>(size_) * dimensionality_);
+  if (!inverse_fp8_multipliers.empty()) {
+    CHECK_EQ(dimensionality_, inverse_fp8_multipliers.size());
+  }
+  std::copy(transposed_payload.begin(), transposed_payload.end(),
+            payload_.get());
+}
+
+uint8_t FP8SimdBlockTransposedDatabase::NativeSimdBlockSize() {
+  return SimdBlockSize();
+}
+
+DenseDataset<int8_t> FP8SimdBlockTransposedDatabase::Untranspose() const {
+  vector<int8_t> untransposed(static_cast<size_t>(size_) * dimensionality_);
+  for (DatapointIndex block_start = 0; block_start < size_;
+       block_start += simd_block_size_) {
+    const DatapointIndex block_size =
+        std::min<DatapointIndex>(simd_block_size_, size_ - block_start);
+    const int8_t* src = payload_.get() + block_start * dimensionality_;
+    int8_t* dest = untransposed.data() + block_start * dimensionality_;
+    for (DatapointIndex dp_idx : Seq(block_size)) {
+      for (DimensionIndex dim_idx : Seq(dimensionality_)) {
+        dest[dimensionality_ * dp_idx + dim_idx] =
+            src[dim_idx * block_size + dp_idx];
+      }
+    }
+  }
+  return DenseDataset<int8_t>(std::move(untransposed), size_);
+}
+
 void FP8SimdBlockTransposedDatabase::TransposeOneBlock(const int8_t* src,
                                                        size_t block_size,
                                                        int8_t* dest) {
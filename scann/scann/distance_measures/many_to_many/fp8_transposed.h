@@ -36,6 +36,13 @@ class FP8SimdBlockTransposedDatabase {
                                  uint8_t simd_block_size,
                                  ConstSpan<float> inverse_fp8_multipliers = {});
 
+  FP8SimdBlockTransposedDatabase(ConstSpan<int8_t> transposed_payload,
+                                 DimensionIndex dimensionality,
+                                 uint8_t simd_block_size,
+                                 ConstSpan<float> inverse_fp8_multipliers = {});
+
+  static uint8_t NativeSimdBlockSize();
+
   uint8_t simd_block_size() const { return simd_block_size_; }
 
   DimensionIndex dimensionality() const { return dimensionality_; }
@@ -53,6 +60,12 @@ class FP8SimdBlockTransposedDatabase {
     return {payload_.get() + block_start, block_size};
   }
 
+  ConstSpan<int8_t> payload() const {
+    return {payload_.get(), static_cast<size_t>(size_) * dimensionality_};
+  }
+
+  DenseDataset<int8_t> Untranspose() const;
+
   ConstSpan<float> inverse_fp8_multipliers() const {
     return {inverse_fp8_multipliers_, inverse_fp8_multipliers_
                                           ? static_cast<size_t>(dimensionality_)
@@ -0,0 +1,85 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/distance_measures/many_to_many/many_to_many_binary.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "scann/distance_measures/one_to_many/one_to_many_binary.h"
+#include "scann/utils/common.h"
+#include "scann/utils/parallel_for.h"
+
+namespace research_scann {
+namespace {
+
+constexpr size_t kQueryBlockSize = 16;
+
+constexpr size_t kDatabaseBlockBytes = 32 * 1024;
+
+}  // namespace
+
+template <typename T>
+void DenseBinaryDistanceManyToManyTopK(
+    const DistanceMeasure& dist, const DenseDataset<T>& queries,
+    const DenseDataset<T>& database,
+    MutableSpan<FastTopNeighbors<float>> topns, ThreadPool* pool) {
+  static_assert(IsSameAny<T, uint8_t, uint64_t>(),
+                "Binary popcount distances require uint8_t or uint64_t data.");
+  DCHECK_EQ(queries.size(), topns.size());
+  if (queries.empty() || database.empty()) return;
+
+  const DefaultDenseDatasetView<T> query_view(queries);
+  const DefaultDenseDatasetView<T> db_view(database);
+  DCHECK_EQ(query_view.dimensionality(), db_view.dimensionality());
+  const size_t num_bytes = db_view.dimensionality() * sizeof(T);
+  const auto merge = one_to_many_low_level::BinaryMergeForDistance(dist);
+  const size_t db_block_size =
+      std::max<size_t>(1, kDatabaseBlockBytes / std::max<size_t>(1, num_bytes));
+  const auto* db_bytes = reinterpret_cast<const uint8_t*>(db_view.GetPtr(0));
+
+  ParallelFor<1>(
+      Seq(DivRoundUp(queries.size(), kQueryBlockSize)), pool,
+      [&](size_t query_block) {
+        const size_t query_begin = query_block * kQueryBlockSize;
+        const size_t query_end =
+            std::min<size_t>(query_begin + kQueryBlockSize, queries.size());
+        vector<float> distances(db_block_size);
+        for (size_t db_begin = 0; db_begin < database.size();
+             db_begin += db_block_size) {
+          const size_t block_size =
+              std::min<size_t>(db_block_size, database.size() - db_begin);
+          MutableSpan<float> block_distances(distances.data(), block_size);
+          for (size_t query_idx : Seq(query_begin, query_end)) {
+            one_to_many_low_level::DenseBinaryPopcountOneToMany(
+                merge,
+                reinterpret_cast<const uint8_t*>(
+                    query_view.GetPtr(query_idx)),
+                db_bytes + db_begin * num_bytes, num_bytes, block_distances);
+            topns[query_idx].PushBlock(block_distances, db_begin);
+          }
+        }
+      });
+}
+
+template void DenseBinaryDistanceManyToManyTopK<uint8_t>(
+    const DistanceMeasure&, const DenseDataset<uint8_t>&,
+    const DenseDataset<uint8_t>&, MutableSpan<FastTopNeighbors<float>>,
+    ThreadPool*);
+template void DenseBinaryDistanceManyToManyTopK<uint64_t>(
+    const DistanceMeasure&, const DenseDataset<uint64_t>&,
+    const DenseDataset<uint64_t>&, MutableSpan<FastTopNeighbors<float>>,
+    ThreadPool*);
+
+}  // namespace research_scann
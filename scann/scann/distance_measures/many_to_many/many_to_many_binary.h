@@ -0,0 +1,36 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_DISTANCE_MEASURES_MANY_TO_MANY_MANY_TO_MANY_BINARY_H_
+#define SCANN_DISTANCE_MEASURES_MANY_TO_MANY_MANY_TO_MANY_BINARY_H_
+
+#include <cstdint>
+
+#include "scann/data_format/dataset.h"
+#include "scann/distance_measures/distance_measure_base.h"
+#include "scann/oss_wrappers/scann_threadpool.h"
+#include "scann/utils/fast_top_neighbors.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+template <typename T>
+void DenseBinaryDistanceManyToManyTopK(
+    const DistanceMeasure& dist, const DenseDataset<T>& queries,
+    const DenseDataset<T>& database,
+    MutableSpan<FastTopNeighbors<float>> topns, ThreadPool* pool = nullptr);
+
+}  // namespace research_scann
+
+#endif
@@ -0,0 +1,129 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/distance_measures/many_to_many/many_to_many_sparse_dense.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "scann/distance_measures/one_to_many/one_to_many_sparse_dense.h"
+#include "scann/utils/parallel_for.h"
+
+namespace research_scann {
+namespace {
+
+constexpr size_t kTransposeTileSize = 64;
+
+constexpr size_t kQueryBlockSize = 16;
+
+constexpr size_t kCenterBlockSize = 256;
+
+}  // namespace
+
+DenseTransposedDatabase::DenseTransposedDatabase(
+    const DenseDataset<float>& database)
+    : payload_(database.size() * database.dimensionality()),
+      squared_l2_norms_(database.size()),
+      size_(database.size()),
+      dimensionality_(database.dimensionality()) {
+  const DefaultDenseDatasetView<float> view(database);
+  for (size_t dp_begin = 0; dp_begin < size_; dp_begin += kTransposeTileSize) {
+    const size_t dp_end =
+        std::min<size_t>(dp_begin + kTransposeTileSize, size_);
+    for (size_t dim_begin = 0; dim_begin < dimensionality_;
+         dim_begin += kTransposeTileSize) {
+      const size_t dim_end =
+          std::min<size_t>(dim_begin + kTransposeTileSize, dimensionality_);
+      for (size_t dp_idx : Seq(dp_begin, dp_end)) {
+        const float* src = view.GetPtr(dp_idx);
+        for (size_t dim : Seq(dim_begin, dim_end)) {
+          payload_[dim * size_ + dp_idx] = src[dim];
+        }
+      }
+    }
+  }
+  for (size_t dp_idx : Seq(size_)) {
+    const float* src = view.GetPtr(dp_idx);
+    double squared_norm = 0.0;
+    for (size_t dim : Seq(dimensionality_)) {
+      squared_norm += static_cast<double>(src[dim]) * src[dim];
+    }
+    squared_l2_norms_[dp_idx] = squared_norm;
+  }
+}
+
+bool SupportsSparseDenseDistanceManyToMany(const DistanceMeasure& dist) {
+  const auto tag = dist.specially_optimized_distance_tag();
+  return tag == DistanceMeasure::DOT_PRODUCT ||
+         tag == DistanceMeasure::SQUARED_L2;
+}
+
+Status SparseDenseDistanceManyToMany(const DistanceMeasure& dist,
+                                     const SparseCsrDataset& queries,
+                                     const DenseTransposedDatabase& database,
+                                     ThreadPool* pool,
+                                     EpsilonFilteringCallback<float> callback) {
+  if (!SupportsSparseDenseDistanceManyToMany(dist)) {
+    return InvalidArgumentError(
+        "Sparse-dense many-to-many only supports DotProductDistance and "
+        "SquaredL2Distance (got %s).",
+        dist.name());
+  }
+  if (queries.dimensionality() != database.dimensionality()) {
+    return InvalidArgumentError(
+        "Query dimensionality %d does not match database dimensionality %d.",
+        queries.dimensionality(), database.dimensionality());
+  }
+  if (queries.empty() || database.empty()) return OkStatus();
+
+  const bool is_squared_l2 =
+      dist.specially_optimized_distance_tag() == DistanceMeasure::SQUARED_L2;
+  const ConstSpan<float> query_norms = queries.squared_l2_norms();
+  const ConstSpan<float> database_norms = database.squared_l2_norms();
+  const float* transposed =
+      database.dimensionality() ? database.GetDimension(0) : nullptr;
+  ParallelFor<1>(
+      Seq(DivRoundUp(queries.size(), kQueryBlockSize)), pool,
+      [&](size_t query_block) {
+        const size_t query_begin = query_block * kQueryBlockSize;
+        const size_t query_end =
+            std::min<size_t>(query_begin + kQueryBlockSize, queries.size());
+        float distances[kCenterBlockSize];
+        for (size_t db_begin = 0; db_begin < database.size();
+             db_begin += kCenterBlockSize) {
+          const size_t block_size =
+              std::min<size_t>(kCenterBlockSize, database.size() - db_begin);
+          MutableSpan<float> block_distances(distances, block_size);
+          for (size_t query_idx : Seq(query_begin, query_end)) {
+            one_to_many_low_level::SparseTransposedDenseDotProducts(
+                queries.indices(query_idx), queries.values(query_idx),
+                transposed + db_begin, database.size(), block_distances);
+            if (is_squared_l2) {
+              for (size_t j : Seq(block_size)) {
+                distances[j] = std::max(
+                    0.0f, query_norms[query_idx] +
+                              database_norms[db_begin + j] -
+                              2.0f * distances[j]);
+              }
+            } else {
+              for (size_t j : Seq(block_size)) distances[j] = -distances[j];
+            }
+            callback(block_distances, db_begin, query_idx);
+          }
+        }
+      });
+  return OkStatus();
+}
+
+}  // namespace research_scann
@@ -0,0 +1,70 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_DISTANCE_MEASURES_MANY_TO_MANY_MANY_TO_MANY_SPARSE_DENSE_H_
+#define SCANN_DISTANCE_MEASURES_MANY_TO_MANY_MANY_TO_MANY_SPARSE_DENSE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "scann/data_format/dataset.h"
+#include "scann/data_format/sparse_csr_dataset.h"
+#include "scann/distance_measures/distance_measure_base.h"
+#include "scann/distance_measures/many_to_many/many_to_many_common.h"
+#include "scann/oss_wrappers/scann_threadpool.h"
+#include "scann/utils/common.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+class DenseTransposedDatabase {
+ public:
+  DenseTransposedDatabase() {}
+
+  explicit DenseTransposedDatabase(const DenseDataset<float>& database);
+
+  DatapointIndex size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  DimensionIndex dimensionality() const { return dimensionality_; }
+
+  const float* GetDimension(DimensionIndex dim) const {
+    DCHECK_LT(dim, dimensionality_);
+    return payload_.data() + dim * size_;
+  }
+
+  ConstSpan<float> squared_l2_norms() const { return squared_l2_norms_; }
+
+ private:
+  std::vector<float> payload_;
+
+  std::vector<float> squared_l2_norms_;
+
+  DatapointIndex size_ = 0;
+
+  DimensionIndex dimensionality_ = 0;
+};
+
+bool SupportsSparseDenseDistanceManyToMany(const DistanceMeasure& dist);
+
+Status SparseDenseDistanceManyToMany(const DistanceMeasure& dist,
+                                     const SparseCsrDataset& queries,
+                                     const DenseTransposedDatabase& database,
+                                     ThreadPool* pool,
+                                     EpsilonFilteringCallback<float> callback);
+
+}  // namespace research_scann
+
+#endif
@@ -0,0 +1,304 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/distance_measures/one_to_many/one_to_many_binary.h"
+
+#include <cstdint>
+#include <typeinfo>
+
+#include "absl/base/internal/unaligned_access.h"
+#include "absl/numeric/bits.h"
+#include "scann/distance_measures/one_to_one/dot_product.h"
+#include "scann/distance_measures/one_to_one/hamming_distance.h"
+#include "scann/utils/intrinsics/attributes.h"
+#include "scann/utils/intrinsics/flags.h"
+#include "tensorflow/core/platform/prefetch.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace research_scann {
+namespace one_to_many_low_level {
+namespace {
+
+struct XorMerge {
+  static constexpr float kSign = 1.0f;
+
+  SCANN_INLINE static uint64_t Merge(uint64_t a, uint64_t b) { return a ^ b; }
+
+#ifdef __x86_64__
+  SCANN_AVX2_INLINE static __m256i Merge(__m256i a, __m256i b) {
+    return _mm256_xor_si256(a, b);
+  }
+
+  SCANN_AVX512_VPOPCNTDQ_INLINE static __m512i Merge(__m512i a, __m512i b) {
+    return _mm512_xor_si512(a, b);
+  }
+#endif
+};
+
+struct AndMerge {
+  static constexpr float kSign = -1.0f;
+
+  SCANN_INLINE static uint64_t Merge(uint64_t a, uint64_t b) { return a & b; }
+
+#ifdef __x86_64__
+  SCANN_AVX2_INLINE static __m256i Merge(__m256i a, __m256i b) {
+    return _mm256_and_si256(a, b);
+  }
+
+  SCANN_AVX512_VPOPCNTDQ_INLINE static __m512i Merge(__m512i a, __m512i b) {
+    return _mm512_and_si512(a, b);
+  }
+#endif
+};
+
+template <typename Merge>
+SCANN_INLINE uint32_t PopcountMergeFallback(const uint8_t* a, const uint8_t* b,
+                                            size_t num_bytes) {
+  uint32_t result = 0;
+  size_t i = 0;
+  for (; i + 8 <= num_bytes; i += 8) {
+    result += absl::popcount(Merge::Merge(ABSL_INTERNAL_UNALIGNED_LOAD64(a + i),
+                                          ABSL_INTERNAL_UNALIGNED_LOAD64(b + i)));
+  }
+  for (; i < num_bytes; ++i) {
+    result += absl::popcount(Merge::Merge(a[i], b[i]) & 0xFF);
+  }
+  return result;
+}
+
+#ifdef __x86_64__
+
+SCANN_AVX2_INLINE __m256i PopcountBytesAvx2(__m256i v) {
+  const __m256i lookup =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                       2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0F);
+  const __m256i lo = _mm256_and_si256(v, low_mask);
+  const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                         _mm256_shuffle_epi8(lookup, hi));
+}
+
+SCANN_AVX2_INLINE __m256i Popcount64Avx2(__m256i v) {
+  return _mm256_sad_epu8(PopcountBytesAvx2(v), _mm256_setzero_si256());
+}
+
+SCANN_AVX2_INLINE void CarrySaveAdd(__m256i* h, __m256i* l, __m256i a,
+                                    __m256i b, __m256i c) {
+  const __m256i u = _mm256_xor_si256(a, b);
+  *h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+  *l = _mm256_xor_si256(u, c);
+}
+
+SCANN_AVX2_INLINE uint64_t HorizontalSum64Avx2(__m256i v) {
+  const __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(v),
+                                    _mm256_extracti128_si256(v, 1));
+  return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+}
+
+template <typename Merge>
+SCANN_AVX2_INLINE uint32_t PopcountMergeAvx2(const uint8_t* a,
+                                             const uint8_t* b,
+                                             size_t num_bytes) {
+  auto load = [&](size_t i) SCANN_AVX2_INLINE_LAMBDA {
+    return Merge::Merge(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + 32 * i)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 32 * i)));
+  };
+  const size_t num_registers = num_bytes / 32;
+  __m256i total = _mm256_setzero_si256();
+  size_t i = 0;
+
+  if (num_registers >= 16) {
+    __m256i ones = _mm256_setzero_si256();
+    __m256i twos = _mm256_setzero_si256();
+    __m256i fours = _mm256_setzero_si256();
+    __m256i eights = _mm256_setzero_si256();
+    __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+    for (; i + 16 <= num_registers; i += 16) {
+      CarrySaveAdd(&twos_a, &ones, ones, load(i + 0), load(i + 1));
+      CarrySaveAdd(&twos_b, &ones, ones, load(i + 2), load(i + 3));
+      CarrySaveAdd(&fours_a, &twos, twos, twos_a, twos_b);
+      CarrySaveAdd(&twos_a, &ones, ones, load(i + 4), load(i + 5));
+      CarrySaveAdd(&twos_b, &ones, ones, load(i + 6), load(i + 7));
+      CarrySaveAdd(&fours_b, &twos, twos, twos_a, twos_b);
+      CarrySaveAdd(&eights_a, &fours, fours, fours_a, fours_b);
+      CarrySaveAdd(&twos_a, &ones, ones, load(i + 8), load(i + 9));
+      CarrySaveAdd(&twos_b, &ones, ones, load(i + 10), load(i + 11));
+      CarrySaveAdd(&fours_a, &twos, twos, twos_a, twos_b);
+      CarrySaveAdd(&twos_a, &ones, ones, load(i + 12), load(i + 13));
+      CarrySaveAdd(&twos_b, &ones, ones, load(i + 14), load(i + 15));
+      CarrySaveAdd(&fours_b, &twos, twos, twos_a, twos_b);
+      CarrySaveAdd(&eights_b, &fours, fours, fours_a, fours_b);
+      CarrySaveAdd(&sixteens, &eights, eights, eights_a, eights_b);
+      total = _mm256_add_epi64(total, Popcount64Avx2(sixteens));
+    }
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(
+        total, _mm256_slli_epi64(Popcount64Avx2(eights), 3));
+    total =
+        _mm256_add_epi64(total, _mm256_slli_epi64(Popcount64Avx2(fours), 2));
+    total =
+        _mm256_add_epi64(total, _mm256_slli_epi64(Popcount64Avx2(twos), 1));
+    total = _mm256_add_epi64(total, Popcount64Avx2(ones));
+  }
+
+  for (; i < num_registers; ++i) {
+    total = _mm256_add_epi64(total, Popcount64Avx2(load(i)));
+  }
+  return HorizontalSum64Avx2(total) +
+         PopcountMergeFallback<Merge>(a + 32 * i, b + 32 * i,
+                                      num_bytes - 32 * i);
+}
+
+template <typename Merge>
+SCANN_AVX512_VPOPCNTDQ_INLINE uint32_t PopcountMergeAvx512(const uint8_t* a,
+                                                           const uint8_t* b,
+                                                           size_t num_bytes) {
+  __m512i acc0 = _mm512_setzero_si512();
+  __m512i acc1 = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 128 <= num_bytes; i += 128) {
+    acc0 = _mm512_add_epi64(
+        acc0, _mm512_popcnt_epi64(Merge::Merge(_mm512_loadu_si512(a + i),
+                                               _mm512_loadu_si512(b + i))));
+    acc1 = _mm512_add_epi64(
+        acc1,
+        _mm512_popcnt_epi64(Merge::Merge(_mm512_loadu_si512(a + i + 64),
+                                         _mm512_loadu_si512(b + i + 64))));
+  }
+  if (i + 64 <= num_bytes) {
+    acc0 = _mm512_add_epi64(
+        acc0, _mm512_popcnt_epi64(Merge::Merge(_mm512_loadu_si512(a + i),
+                                               _mm512_loadu_si512(b + i))));
+    i += 64;
+  }
+  if (i < num_bytes) {
+    const __mmask64 mask = (uint64_t{1} << (num_bytes - i)) - 1;
+    acc1 = _mm512_add_epi64(
+        acc1, _mm512_popcnt_epi64(
+                  Merge::Merge(_mm512_maskz_loadu_epi8(mask, a + i),
+                               _mm512_maskz_loadu_epi8(mask, b + i))));
+  }
+  return _mm512_reduce_add_epi64(_mm512_add_epi64(acc0, acc1));
+}
+
+template <typename Merge>
+SCANN_AVX2_OUTLINE void DenseBinaryPopcountOneToManyAvx2(
+    const uint8_t* query, const uint8_t* database, size_t num_bytes,
+    MutableSpan<float> result) {
+  for (size_t i : IndicesOf(result)) {
+    const uint8_t* dptr = database + i * num_bytes;
+    if (i + 1 < result.size()) {
+      ::tensorflow::port::prefetch<::tensorflow::port::PREFETCH_HINT_T0>(
+          dptr + num_bytes);
+    }
+    result[i] =
+        Merge::kSign * PopcountMergeAvx2<Merge>(query, dptr, num_bytes);
+  }
+}
+
+template <typename Merge>
+SCANN_AVX512_VPOPCNTDQ_OUTLINE void DenseBinaryPopcountOneToManyAvx512(
+    const uint8_t* query, const uint8_t* database, size_t num_bytes,
+    MutableSpan<float> result) {
+  for (size_t i : IndicesOf(result)) {
+    const uint8_t* dptr = database + i * num_bytes;
+    if (i + 1 < result.size()) {
+      ::tensorflow::port::prefetch<::tensorflow::port::PREFETCH_HINT_T0>(
+          dptr + num_bytes);
+    }
+    result[i] =
+        Merge::kSign * PopcountMergeAvx512<Merge>(query, dptr, num_bytes);
+  }
+}
+
+#endif
+
+template <typename Merge>
+void DenseBinaryPopcountOneToManyDispatch(const uint8_t* query,
+                                          const uint8_t* database,
+                                          size_t num_bytes,
+                                          MutableSpan<float> result) {
+#ifdef __x86_64__
+  if (RuntimeSupportsAvx512Vpopcntdq()) {
+    return DenseBinaryPopcountOneToManyAvx512<Merge>(query, database,
+                                                     num_bytes, result);
+  } else if (RuntimeSupportsAvx2()) {
+    return DenseBinaryPopcountOneToManyAvx2<Merge>(query, database, num_bytes,
+                                                   result);
+  }
+#endif
+  for (size_t i : IndicesOf(result)) {
+    result[i] = Merge::kSign * PopcountMergeFallback<Merge>(
+                                   query, database + i * num_bytes, num_bytes);
+  }
+}
+
+}  // namespace
+
+BinaryMerge BinaryMergeForDistance(const DistanceMeasure& dist) {
+  DCHECK(IsSupportedBinaryPopcountDistance(dist));
+  return typeid(dist) == typeid(const BinaryDotProductDistance)
+             ? BinaryMerge::kAnd
+             : BinaryMerge::kXor;
+}
+
+void DenseBinaryPopcountOneToMany(BinaryMerge merge, const uint8_t* query,
+                                  const uint8_t* database, size_t num_bytes,
+                                  MutableSpan<float> result) {
+  if (merge == BinaryMerge::kAnd) {
+    DenseBinaryPopcountOneToManyDispatch<AndMerge>(query, database, num_bytes,
+                                                   result);
+  } else {
+    DenseBinaryPopcountOneToManyDispatch<XorMerge>(query, database, num_bytes,
+                                                   result);
+  }
+}
+
+}  // namespace one_to_many_low_level
+
+bool IsSupportedBinaryPopcountDistance(const DistanceMeasure& dist) {
+  return typeid(dist) == typeid(const BinaryHammingDistance) ||
+         typeid(dist) == typeid(const BinaryDotProductDistance);
+}
+
+template <typename T>
+void DenseBinaryDistanceOneToMany(const DistanceMeasure& dist,
+                                  const DatapointPtr<T>& query,
+                                  const DenseDataset<T>& database,
+                                  MutableSpan<float> result) {
+  static_assert(IsSameAny<T, uint8_t, uint64_t>(),
+                "Binary popcount distances require uint8_t or uint64_t data.");
+  DCHECK_EQ(result.size(), database.size());
+  DefaultDenseDatasetView<T> view(database);
+  DCHECK_EQ(query.nonzero_entries(), view.dimensionality());
+  one_to_many_low_level::DenseBinaryPopcountOneToMany(
+      one_to_many_low_level::BinaryMergeForDistance(dist),
+      reinterpret_cast<const uint8_t*>(query.values()),
+      reinterpret_cast<const uint8_t*>(view.GetPtr(0)),
+      view.dimensionality() * sizeof(T), result);
+}
+
+template void DenseBinaryDistanceOneToMany<uint8_t>(
+    const DistanceMeasure&, const DatapointPtr<uint8_t>&,
+    const DenseDataset<uint8_t>&, MutableSpan<float>);
+template void DenseBinaryDistanceOneToMany<uint64_t>(
+    const DistanceMeasure&, const DatapointPtr<uint64_t>&,
+    const DenseDataset<uint64_t>&, MutableSpan<float>);
+
+}  // namespace research_scann
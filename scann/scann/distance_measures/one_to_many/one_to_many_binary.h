@@ -0,0 +1,48 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_DISTANCE_MEASURES_ONE_TO_MANY_ONE_TO_MANY_BINARY_H_
+#define SCANN_DISTANCE_MEASURES_ONE_TO_MANY_ONE_TO_MANY_BINARY_H_
+
+#include <cstdint>
+
+#include "scann/data_format/datapoint.h"
+#include "scann/data_format/dataset.h"
+#include "scann/distance_measures/distance_measure_base.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+bool IsSupportedBinaryPopcountDistance(const DistanceMeasure& dist);
+
+template <typename T>
+void DenseBinaryDistanceOneToMany(const DistanceMeasure& dist,
+                                  const DatapointPtr<T>& query,
+                                  const DenseDataset<T>& database,
+                                  MutableSpan<float> result);
+
+namespace one_to_many_low_level {
+
+enum class BinaryMerge { kXor, kAnd };
+
+BinaryMerge BinaryMergeForDistance(const DistanceMeasure& dist);
+
+void DenseBinaryPopcountOneToMany(BinaryMerge merge, const uint8_t* query,
+                                  const uint8_t* database, size_t num_bytes,
+                                  MutableSpan<float> result);
+
+}  // namespace one_to_many_low_level
+}  // namespace research_scann
+
+#endif
@@ -0,0 +1,152 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/distance_measures/one_to_many/one_to_many_int4.h"
+
+#include <cstdint>
+
+#include "scann/distance_measures/one_to_many/one_to_many.h"
+#include "scann/utils/internal/avx2_funcs.h"
+#include "scann/utils/intrinsics/flags.h"
+#include "tensorflow/core/platform/prefetch.h"
+
+namespace research_scann {
+namespace one_to_many_low_level {
+namespace {
+
+constexpr int8_t kInt4DecodeTable[16] = {-8, -7, -6, -5, -4, -3, -2, -1,
+                                         0,  1,  2,  3,  4,  5,  6,  7};
+
+SCANN_INLINE float DenseDotProductInt4FloatFallback(const float* query,
+                                                    const uint8_t* packed,
+                                                    size_t dims) {
+  float result = 0.0f;
+  size_t j = 0;
+  for (; j + 2 <= dims; j += 2) {
+    const uint8_t byte = packed[j / 2];
+    result += query[j] * kInt4DecodeTable[byte & 0x0F];
+    result += query[j + 1] * kInt4DecodeTable[byte >> 4];
+  }
+  if (j < dims) {
+    result += query[j] * kInt4DecodeTable[packed[j / 2] & 0x0F];
+  }
+  return result;
+}
+
+#ifdef __x86_64__
+
+SCANN_AVX2_INLINE float DenseDotProductInt4FloatAvx2(const float* query,
+                                                     const uint8_t* packed,
+                                                     size_t dims) {
+  using AvxFuncs = AvxFunctionsAvx2Fma;
+  const __m128i decode_table =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(kInt4DecodeTable));
+  const __m128i low_nibble_mask = _mm_set1_epi8(0x0F);
+  __m256 a0 = _mm256_setzero_ps();
+  __m256 a1 = _mm256_setzero_ps();
+  size_t j = 0;
+  for (; j + 32 <= dims; j += 32) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + j / 2));
+    const __m128i lo = _mm_shuffle_epi8(
+        decode_table, _mm_and_si128(bytes, low_nibble_mask));
+    const __m128i hi = _mm_shuffle_epi8(
+        decode_table,
+        _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble_mask));
+
+    const __m128i v0 = _mm_unpacklo_epi8(lo, hi);
+    const __m128i v1 = _mm_unpackhi_epi8(lo, hi);
+    a0 = AvxFuncs::MultiplyAdd(_mm256_loadu_ps(query + j),
+                               AvxFuncs::Int8ToFloatLower(v0), a0);
+    a1 = AvxFuncs::MultiplyAdd(_mm256_loadu_ps(query + j + 8),
+                               AvxFuncs::Int8ToFloatUpper(v0), a1);
+    a0 = AvxFuncs::MultiplyAdd(_mm256_loadu_ps(query + j + 16),
+                               AvxFuncs::Int8ToFloatLower(v1), a0);
+    a1 = AvxFuncs::MultiplyAdd(_mm256_loadu_ps(query + j + 24),
+                               AvxFuncs::Int8ToFloatUpper(v1), a1);
+  }
+  return AvxFuncs::Sum8(_mm256_add_ps(a0, a1)) +
+         DenseDotProductInt4FloatFallback(query + j, packed + j / 2, dims - j);
+}
+
+template <bool kHasIndices, typename ResultElemT>
+SCANN_AVX2_OUTLINE void DenseDotProductDistanceOneToManyInt4FloatAvx2(
+    const float* query, const DefaultDenseDatasetView<uint8_t>& view,
+    size_t dims, const DatapointIndex* indices,
+    MutableSpan<ResultElemT> result) {
+  auto get_index = [&](size_t i) SCANN_INLINE_LAMBDA -> size_t {
+    return kHasIndices ? indices[i] : GetDatapointIndex(result, i);
+  };
+  for (size_t i : IndicesOf(result)) {
+    if (i + 1 < result.size()) {
+      ::tensorflow::port::prefetch<::tensorflow::port::PREFETCH_HINT_T0>(
+          view.GetPtr(get_index(i + 1)));
+    }
+    SetDistance(
+        result, i,
+        -DenseDotProductInt4FloatAvx2(query, view.GetPtr(get_index(i)), dims));
+  }
+}
+
+#endif
+
+template <bool kHasIndices = false, typename ResultElemT>
+void DenseDotProductDistanceOneToManyInt4FloatDispatch(
+    const DatapointPtr<float>& query, const DenseDataset<uint8_t>& database,
+    const DatapointIndex* indices, MutableSpan<ResultElemT> result) {
+  DCHECK_EQ(database.packing_strategy(), HashedItem::NIBBLE);
+  DCHECK_EQ(query.nonzero_entries(), database.dimensionality());
+  const size_t dims = database.dimensionality();
+  DefaultDenseDatasetView<uint8_t> view(database);
+#ifdef __x86_64__
+  if (RuntimeSupportsAvx2()) {
+    DenseDotProductDistanceOneToManyInt4FloatAvx2<kHasIndices>(
+        query.values(), view, dims, indices, result);
+    return;
+  }
+#endif
+  for (size_t i : IndicesOf(result)) {
+    const size_t idx = kHasIndices ? indices[i] : GetDatapointIndex(result, i);
+    SetDistance(result, i,
+                -DenseDotProductInt4FloatFallback(query.values(),
+                                                  view.GetPtr(idx), dims));
+  }
+}
+
+}  // namespace
+}  // namespace one_to_many_low_level
+
+void DenseDotProductDistanceOneToManyInt4Float(
+    const DatapointPtr<float>& query, const DenseDataset<uint8_t>& database,
+    MutableSpan<float> result) {
+  one_to_many_low_level::DenseDotProductDistanceOneToManyInt4FloatDispatch(
+      query, database, nullptr, result);
+}
+
+void DenseDotProductDistanceOneToManyInt4Float(
+    const DatapointPtr<float>& query, const DenseDataset<uint8_t>& database,
+    MutableSpan<pair<DatapointIndex, float>> result) {
+  one_to_many_low_level::DenseDotProductDistanceOneToManyInt4FloatDispatch(
+      query, database, nullptr, result);
+}
+
+void DenseDotProductDistanceOneToManyInt4Float(
+    const DatapointPtr<float>& query, const DenseDataset<uint8_t>& database,
+    ConstSpan<DatapointIndex> indices, MutableSpan<float> result) {
+  QCHECK_EQ(indices.size(), result.size());
+  one_to_many_low_level::DenseDotProductDistanceOneToManyInt4FloatDispatch<
+      true>(query, database, indices.data(), result);
+}
+
+}  // namespace research_scann
@@ -0,0 +1,40 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_DISTANCE_MEASURES_ONE_TO_MANY_ONE_TO_MANY_INT4_H_
+#define SCANN_DISTANCE_MEASURES_ONE_TO_MANY_ONE_TO_MANY_INT4_H_
+
+#include <cstdint>
+
+#include "scann/data_format/datapoint.h"
+#include "scann/data_format/dataset.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+void DenseDotProductDistanceOneToManyInt4Float(
+    const DatapointPtr<float>& query, const DenseDataset<uint8_t>& database,
+    MutableSpan<float> result);
+
+void DenseDotProductDistanceOneToManyInt4Float(
+    const DatapointPtr<float>& query, const DenseDataset<uint8_t>& database,
+    MutableSpan<pair<DatapointIndex, float>> result);
+
+void DenseDotProductDistanceOneToManyInt4Float(
+    const DatapointPtr<float>& query, const DenseDataset<uint8_t>& database,
+    ConstSpan<DatapointIndex> indices, MutableSpan<float> result);
+
+}  // namespace research_scann
+
+#endif
@@ -0,0 +1,274 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/distance_measures/one_to_many/one_to_many_sparse_dense.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "scann/utils/intrinsics/attributes.h"
+#include "scann/utils/intrinsics/flags.h"
+#include "tensorflow/core/platform/prefetch.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace research_scann {
+namespace one_to_many_low_level {
+namespace {
+
+SCANN_INLINE float SparseDenseDotProductFallback(const uint32_t* indices,
+                                                 const float* values,
+                                                 size_t num_entries,
+                                                 const float* dense) {
+  float acc0 = 0.0f, acc1 = 0.0f;
+  size_t i = 0;
+  for (; i + 2 <= num_entries; i += 2) {
+    acc0 += values[i] * dense[indices[i]];
+    acc1 += values[i + 1] * dense[indices[i + 1]];
+  }
+  if (i < num_entries) acc0 += values[i] * dense[indices[i]];
+  return acc0 + acc1;
+}
+
+SCANN_INLINE void SparseTransposedDenseDotProductsFallback(
+    const uint32_t* indices, const float* values, size_t num_entries,
+    const float* transposed, size_t stride, MutableSpan<float> result) {
+  std::fill(result.begin(), result.end(), 0.0f);
+  for (size_t i : Seq(num_entries)) {
+    const float* row = transposed + indices[i] * stride;
+    const float value = values[i];
+    for (size_t j : IndicesOf(result)) result[j] += value * row[j];
+  }
+}
+
+#ifdef __x86_64__
+
+SCANN_AVX2_INLINE float HorizontalSumAvx2(__m256 v) {
+  __m128 sum =
+      _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+  return _mm_cvtss_f32(sum);
+}
+
+SCANN_AVX2_INLINE __m256 GatherFmaAvx2(const uint32_t* indices,
+                                       const float* values,
+                                       const float* dense, __m256 acc) {
+  const __m256i idx =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices));
+  return _mm256_fmadd_ps(_mm256_loadu_ps(values),
+                         _mm256_i32gather_ps(dense, idx, sizeof(float)), acc);
+}
+
+SCANN_AVX2_OUTLINE float SparseDenseDotProductAvx2(const uint32_t* indices,
+                                                   const float* values,
+                                                   size_t num_entries,
+                                                   const float* dense) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= num_entries; i += 16) {
+    acc0 = GatherFmaAvx2(indices + i, values + i, dense, acc0);
+    acc1 = GatherFmaAvx2(indices + i + 8, values + i + 8, dense, acc1);
+  }
+  if (i + 8 <= num_entries) {
+    acc0 = GatherFmaAvx2(indices + i, values + i, dense, acc0);
+    i += 8;
+  }
+  return HorizontalSumAvx2(_mm256_add_ps(acc0, acc1)) +
+         SparseDenseDotProductFallback(indices + i, values + i,
+                                       num_entries - i, dense);
+}
+
+SCANN_AVX512_OUTLINE float SparseDenseDotProductAvx512(const uint32_t* indices,
+                                                       const float* values,
+                                                       size_t num_entries,
+                                                       const float* dense) {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 32 <= num_entries; i += 32) {
+    acc0 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(values + i),
+        _mm512_i32gather_ps(_mm512_loadu_si512(indices + i), dense,
+                            sizeof(float)),
+        acc0);
+    acc1 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(values + i + 16),
+        _mm512_i32gather_ps(_mm512_loadu_si512(indices + i + 16), dense,
+                            sizeof(float)),
+        acc1);
+  }
+  for (; i < num_entries; i += 16) {
+    const __mmask16 mask =
+        num_entries - i >= 16 ? 0xFFFF : (1u << (num_entries - i)) - 1;
+    const __m512i idx = _mm512_maskz_loadu_epi32(mask, indices + i);
+    acc0 = _mm512_fmadd_ps(
+        _mm512_maskz_loadu_ps(mask, values + i),
+        _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, idx, dense,
+                                 sizeof(float)),
+        acc0);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+SCANN_AVX2_OUTLINE void SparseTransposedDenseDotProductsAvx2(
+    const uint32_t* indices, const float* values, size_t num_entries,
+    const float* transposed, size_t stride, MutableSpan<float> result) {
+  size_t j = 0;
+  for (; j + 32 <= result.size(); j += 32) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    for (size_t i : Seq(num_entries)) {
+      const float* row = transposed + indices[i] * stride + j;
+      if (i + 1 < num_entries) {
+        ::tensorflow::port::prefetch<::tensorflow::port::PREFETCH_HINT_T0>(
+            transposed + indices[i + 1] * stride + j);
+      }
+      const __m256 value = _mm256_broadcast_ss(values + i);
+      acc0 = _mm256_fmadd_ps(value, _mm256_loadu_ps(row), acc0);
+      acc1 = _mm256_fmadd_ps(value, _mm256_loadu_ps(row + 8), acc1);
+      acc2 = _mm256_fmadd_ps(value, _mm256_loadu_ps(row + 16), acc2);
+      acc3 = _mm256_fmadd_ps(value, _mm256_loadu_ps(row + 24), acc3);
+    }
+    _mm256_storeu_ps(result.data() + j, acc0);
+    _mm256_storeu_ps(result.data() + j + 8, acc1);
+    _mm256_storeu_ps(result.data() + j + 16, acc2);
+    _mm256_storeu_ps(result.data() + j + 24, acc3);
+  }
+  for (; j + 8 <= result.size(); j += 8) {
+    __m256 acc = _mm256_setzero_ps();
+    for (size_t i : Seq(num_entries)) {
+      acc = _mm256_fmadd_ps(
+          _mm256_broadcast_ss(values + i),
+          _mm256_loadu_ps(transposed + indices[i] * stride + j), acc);
+    }
+    _mm256_storeu_ps(result.data() + j, acc);
+  }
+  if (j < result.size()) {
+    SparseTransposedDenseDotProductsFallback(indices, values, num_entries,
+                                             transposed + j, stride,
+                                             result.subspan(j));
+  }
+}
+
+SCANN_AVX512_OUTLINE void SparseTransposedDenseDotProductsAvx512(
+    const uint32_t* indices, const float* values, size_t num_entries,
+    const float* transposed, size_t stride, MutableSpan<float> result) {
+  size_t j = 0;
+  for (; j + 64 <= result.size(); j += 64) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    for (size_t i : Seq(num_entries)) {
+      const float* row = transposed + indices[i] * stride + j;
+      if (i + 1 < num_entries) {
+        ::tensorflow::port::prefetch<::tensorflow::port::PREFETCH_HINT_T0>(
+            transposed + indices[i + 1] * stride + j);
+      }
+      const __m512 value = _mm512_set1_ps(values[i]);
+      acc0 = _mm512_fmadd_ps(value, _mm512_loadu_ps(row), acc0);
+      acc1 = _mm512_fmadd_ps(value, _mm512_loadu_ps(row + 16), acc1);
+      acc2 = _mm512_fmadd_ps(value, _mm512_loadu_ps(row + 32), acc2);
+      acc3 = _mm512_fmadd_ps(value, _mm512_loadu_ps(row + 48), acc3);
+    }
+    _mm512_storeu_ps(result.data() + j, acc0);
+    _mm512_storeu_ps(result.data() + j + 16, acc1);
+    _mm512_storeu_ps(result.data() + j + 32, acc2);
+    _mm512_storeu_ps(result.data() + j + 48, acc3);
+  }
+  for (; j < result.size(); j += 16) {
+    const size_t remaining = result.size() - j;
+    const __mmask16 mask =
+        remaining >= 16 ? 0xFFFF : (1u << remaining) - 1;
+    __m512 acc = _mm512_setzero_ps();
+    for (size_t i : Seq(num_entries)) {
+      acc = _mm512_fmadd_ps(
+          _mm512_set1_ps(values[i]),
+          _mm512_maskz_loadu_ps(mask, transposed + indices[i] * stride + j),
+          acc);
+    }
+    _mm512_mask_storeu_ps(result.data() + j, mask, acc);
+  }
+}
+
+#endif
+
+}  // namespace
+
+float SparseDenseDotProduct(ConstSpan<uint32_t> indices,
+                            ConstSpan<float> values, ConstSpan<float> dense) {
+  DCHECK_EQ(indices.size(), values.size());
+#ifdef __x86_64__
+  if (dense.size() <= numeric_limits<int32_t>::max()) {
+    if (RuntimeSupportsAvx512()) {
+      return SparseDenseDotProductAvx512(indices.data(), values.data(),
+                                         indices.size(), dense.data());
+    } else if (RuntimeSupportsAvx2()) {
+      return SparseDenseDotProductAvx2(indices.data(), values.data(),
+                                       indices.size(), dense.data());
+    }
+  }
+#endif
+  return SparseDenseDotProductFallback(indices.data(), values.data(),
+                                       indices.size(), dense.data());
+}
+
+void SparseTransposedDenseDotProducts(ConstSpan<uint32_t> indices,
+                                      ConstSpan<float> values,
+                                      const float* transposed, size_t stride,
+                                      MutableSpan<float> result) {
+  DCHECK_EQ(indices.size(), values.size());
+  DCHECK_LE(result.size(), stride);
+#ifdef __x86_64__
+  if (RuntimeSupportsAvx512()) {
+    return SparseTransposedDenseDotProductsAvx512(
+        indices.data(), values.data(), indices.size(), transposed, stride,
+        result);
+  } else if (RuntimeSupportsAvx2()) {
+    return SparseTransposedDenseDotProductsAvx2(indices.data(), values.data(),
+                                                indices.size(), transposed,
+                                                stride, result);
+  }
+#endif
+  SparseTransposedDenseDotProductsFallback(indices.data(), values.data(),
+                                           indices.size(), transposed, stride,
+                                           result);
+}
+
+}  // namespace one_to_many_low_level
+
+void SparseDenseDotProductOneToMany(ConstSpan<uint32_t> indices,
+                                    ConstSpan<float> values,
+                                    const DenseDataset<float>& database,
+                                    MutableSpan<float> result) {
+  DCHECK_EQ(result.size(), database.size());
+  const DefaultDenseDatasetView<float> view(database);
+  for (size_t i : IndicesOf(result)) {
+    if (i + 1 < result.size() && !indices.empty()) {
+      ::tensorflow::port::prefetch<::tensorflow::port::PREFETCH_HINT_T0>(
+          view.GetPtr(i + 1) + indices[0]);
+    }
+    result[i] = one_to_many_low_level::SparseDenseDotProduct(
+        indices, values,
+        ConstSpan<float>(view.GetPtr(i), view.dimensionality()));
+  }
+}
+
+}  // namespace research_scann
@@ -49,8 +49,40 @@ SCANN_DEFINE_BINARY_DISTANCE_METHODS_UNIMPLEMENTED(uint16_t);
 SCANN_DEFINE_BINARY_DISTANCE_METHODS_UNIMPLEMENTED(int32_t);
 SCANN_DEFINE_BINARY_DISTANCE_METHODS_UNIMPLEMENTED(uint32_t);
 SCANN_DEFINE_BINARY_DISTANCE_METHODS_UNIMPLEMENTED(int64_t);
-SCANN_DEFINE_BINARY_DISTANCE_METHODS_UNIMPLEMENTED(uint64_t);
 SCANN_DEFINE_BINARY_DISTANCE_METHODS_UNIMPLEMENTED(float);
 SCANN_DEFINE_BINARY_DISTANCE_METHODS_UNIMPLEMENTED(double);
 
+namespace {
+
+DatapointPtr<uint8_t> ReinterpretAsBinaryBytes(
+    const DatapointPtr<uint64_t>& dptr) {
+  const size_t num_bytes = dptr.nonzero_entries() * sizeof(uint64_t);
+  return MakeDatapointPtr(nullptr,
+                          reinterpret_cast<const uint8_t*>(dptr.values()),
+                          num_bytes, num_bytes * 8);
+}
+
+}  // namespace
+
+double BinaryDistanceMeasureBase::GetDistanceDense(
+    const DatapointPtr<uint64_t>& a, const DatapointPtr<uint64_t>& b) const {
+  return GetDistanceDense(ReinterpretAsBinaryBytes(a),
+                          ReinterpretAsBinaryBytes(b));
+}
+double BinaryDistanceMeasureBase::GetDistanceDense(
+    const DatapointPtr<uint64_t>& a, const DatapointPtr<uint64_t>& b,
+    double threshold) const {
+  return GetDistanceDense(a, b);
+}
+double BinaryDistanceMeasureBase::GetDistanceSparse(
+    const DatapointPtr<uint64_t>& a, const DatapointPtr<uint64_t>& b) const {
+  LOG_FATAL_CRASH_OK << "Binary distance measures don't support sparse "
+                        "uint64_t data.";
+}
+double BinaryDistanceMeasureBase::GetDistanceHybrid(
+    const DatapointPtr<uint64_t>& a, const DatapointPtr<uint64_t>& b) const {
+  LOG_FATAL_CRASH_OK << "Binary distance measures don't support sparse "
+                        "uint64_t data.";
+}
+
 }  // namespace research_scann
@@ -66,6 +66,46 @@ DenseDataset<uint8_t> UnpackDataset(const PackedDataset& packed) {
   return DenseDataset<uint8_t>(unpacked, packed.num_datapoints);
 }
 
+void GetPackedDatapoint(const PackedDataset& packed, DatapointIndex index,
+                        MutableSpan<uint8_t> hashed) {
+  DCHECK_LT(index, packed.num_datapoints);
+  DCHECK_EQ(hashed.size(), packed.num_blocks);
+  const uint8_t* start =
+      packed.bit_packed_data.data() + (index / 32) * 16 * packed.num_blocks +
+      (index & 15);
+  const int shift = (index & 16) ? 4 : 0;
+  for (size_t j : Seq(packed.num_blocks)) {
+    hashed[j] = (start[j * 16] >> shift) & 15;
+  }
+}
+
+void SetPackedDatapoint(ConstSpan<uint8_t> hashed, DatapointIndex index,
+                        PackedDataset* packed) {
+  DCHECK_LT(index, packed->num_datapoints);
+  DCHECK_EQ(hashed.size(), packed->num_blocks);
+  uint8_t* start = packed->bit_packed_data.data() +
+                   (index / 32) * 16 * packed->num_blocks + (index & 15);
+  const int shift = (index & 16) ? 4 : 0;
+  const uint8_t keep_mask = (index & 16) ? 0x0F : 0xF0;
+  for (size_t j : Seq(packed->num_blocks)) {
+    start[j * 16] = (start[j * 16] & keep_mask) | ((hashed[j] & 15) << shift);
+  }
+}
+
+void AppendPackedDatapoint(ConstSpan<uint8_t> hashed, PackedDataset* packed) {
+  if (packed->num_datapoints == 0) {
+    packed->num_blocks = hashed.size();
+    packed->bit_packed_data.clear();
+  }
+  DCHECK_EQ(hashed.size(), packed->num_blocks);
+  if (packed->num_datapoints % 32 == 0) {
+    packed->bit_packed_data.resize(
+        packed->bit_packed_data.size() + 16 * packed->num_blocks, 0);
+  }
+  ++packed->num_datapoints;
+  SetPackedDatapoint(hashed, packed->num_datapoints - 1, packed);
+}
+
 template <typename T>
 AsymmetricQueryer<T>::AsymmetricQueryer(
     shared_ptr<const ChunkingProjection<T>> projector,
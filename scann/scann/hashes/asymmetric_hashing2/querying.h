@@ -71,6 +71,14 @@ PackedDataset CreatePackedDataset(const DenseDataset<uint8_t>& hashed_database);
 
 DenseDataset<uint8_t> UnpackDataset(const PackedDataset& packed);
 
+void GetPackedDatapoint(const PackedDataset& packed, DatapointIndex index,
+                        MutableSpan<uint8_t> hashed);
+
+void SetPackedDatapoint(ConstSpan<uint8_t> hashed, DatapointIndex index,
+                        PackedDataset* packed);
+
+void AppendPackedDatapoint(ConstSpan<uint8_t> hashed, PackedDataset* packed);
+
 template <typename PostprocessFunctor =
               asymmetric_hashing_internal::IdentityPostprocessFunctor,
           typename DatasetView = DefaultDenseDatasetView<uint8_t>>
@@ -95,29 +95,8 @@ Searcher<T>::Searcher(shared_ptr<TypedDataset<T>> dataset,
   DCHECK(hashed_dataset);
 
   if (lut16_) {
-    packed_dataset_ =
-        ::research_scann::asymmetric_hashing2::CreatePackedDataset(
-            *this->hashed_dataset());
-
-    const size_t l2_cache_bytes = 256 * 1024;
-    if (packed_dataset_.bit_packed_data.size() <= l2_cache_bytes / 2) {
-      optimal_low_level_batch_size_ = 3;
-      max_low_level_batch_size_ = 3;
-    } else {
-      if (RuntimeSupportsAvx2()) {
-        if (packed_dataset_.num_blocks <= 300) {
-          optimal_low_level_batch_size_ = 7;
-        } else {
-          optimal_low_level_batch_size_ = 5;
-        }
-      } else {
-        if (packed_dataset_.num_blocks <= 300) {
-          optimal_low_level_batch_size_ = 6;
-        } else {
-          optimal_low_level_batch_size_ = 5;
-        }
-      }
-    }
+    SetPackedDataset(::research_scann::asymmetric_hashing2::CreatePackedDataset(
+        *this->hashed_dataset()));
   }
 
   if (opts_.quantization_scheme() == AsymmetricHasherConfig::PRODUCT_AND_BIAS) {
@@ -150,6 +129,31 @@ Searcher<T>::Searcher(shared_ptr<TypedDataset<T>> dataset,
 template <typename T>
 Searcher<T>::~Searcher() {}
 
+template <typename T>
+void Searcher<T>::SetPackedDataset(PackedDataset packed_dataset) {
+  packed_dataset_ = std::move(packed_dataset);
+  const size_t l2_cache_bytes = 256 * 1024;
+  if (packed_dataset_.bit_packed_data.size() <= l2_cache_bytes / 2) {
+    optimal_low_level_batch_size_ = 3;
+    max_low_level_batch_size_ = 3;
+  } else {
+    max_low_level_batch_size_ = 9;
+    if (RuntimeSupportsAvx2()) {
+      if (packed_dataset_.num_blocks <= 300) {
+        optimal_low_level_batch_size_ = 7;
+      } else {
+        optimal_low_level_batch_size_ = 5;
+      }
+    } else {
+      if (packed_dataset_.num_blocks <= 300) {
+        optimal_low_level_batch_size_ = 6;
+      } else {
+        optimal_low_level_batch_size_ = 5;
+      }
+    }
+  }
+}
+
 template <typename T>
 Status Searcher<T>::FindNeighborsImpl(const DatapointPtr<T>& query,
                                       const SearchParameters& params,
@@ -395,6 +399,26 @@ PrecomputedAsymmetricLookupTableCreator<T>::
       new AsymmetricHashingOptionalParameters(std::move(lookup_table)));
 }
 
+template <typename T>
+Status Searcher<T>::ApplyMemoryPolicy(const MemoryPolicy& policy) {
+  SCANN_RETURN_IF_ERROR(
+      SingleMachineSearcherBase<T>::ApplyMemoryPolicy(policy));
+  return research_scann::ApplyMemoryPolicy(
+      policy, MakeConstSpan(packed_dataset_.bit_packed_data));
+}
+
+template <typename T>
+MemoryUsageReport Searcher<T>::MemoryUsageBreakdown() const {
+  MemoryUsageReport report =
+      SingleMachineSearcherBase<T>::MemoryUsageBreakdown();
+  report.set_name("AsymmetricHashingSearcher");
+  report.AddChild("lut16_codes",
+                  VectorStorage(packed_dataset_.bit_packed_data));
+  report.AddChild("norm_inv", VectorStorage(norm_inv_));
+  report.AddChild("bias", VectorStorage(bias_));
+  return report;
+}
+
 template <typename T>
 StatusOr<SingleMachineFactoryOptions>
 Searcher<T>::ExtractSingleMachineFactoryOptions() {
@@ -76,6 +76,10 @@ class SearcherOptions {
 
   void set_noise_shaping_threshold(double t) { noise_shaping_threshold_ = t; }
 
+  double noise_shaping_threshold() const { return noise_shaping_threshold_; }
+
+  const Indexer<T>* indexer() const { return indexer_.get(); }
+
  private:
   shared_ptr<const AsymmetricQueryer<T>> asymmetric_queryer_ = nullptr;
 
@@ -115,6 +119,10 @@ class Searcher final : public SingleMachineSearcherBase<T> {
   StatusOr<SingleMachineFactoryOptions> ExtractSingleMachineFactoryOptions()
       override;
 
+  Status ApplyMemoryPolicy(const MemoryPolicy& policy) final;
+
+  MemoryUsageReport MemoryUsageBreakdown() const final;
+
  protected:
   Status FindNeighborsImpl(const DatapointPtr<T>& query,
                            const SearchParameters& params,
@@ -161,6 +169,8 @@ class Searcher final : public SingleMachineSearcherBase<T> {
       const QueryerOptions<PostprocessFunctor>& queryer_options,
       MutableSpan<NNResultsVector> results) const;
 
+  void SetPackedDataset(PackedDataset packed_dataset);
+
   SearcherOptions<T> opts_;
 
   PackedDataset packed_dataset_;
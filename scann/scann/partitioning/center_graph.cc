@@ -0,0 +1,307 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/partitioning/center_graph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/random/distributions.h"
+#include "scann/utils/common.h"
+
+namespace research_scann {
+namespace {
+
+using Candidate = pair<float, DatapointIndex>;
+
+template <typename NeighborsFn, typename DistanceFn>
+void SearchLevel(ConstSpan<Candidate> entry_points, int32_t search_breadth,
+                 const NeighborsFn& neighbors_fn,
+                 const DistanceFn& distance_fn, vector<Candidate>* result) {
+  absl::flat_hash_set<DatapointIndex> visited;
+  std::priority_queue<Candidate, vector<Candidate>, std::greater<Candidate>>
+      candidates;
+  std::priority_queue<Candidate> nearest;
+  for (const Candidate& entry : entry_points) {
+    if (!visited.insert(entry.second).second) continue;
+    candidates.push(entry);
+    nearest.push(entry);
+  }
+  while (nearest.size() > search_breadth) nearest.pop();
+
+  while (!candidates.empty()) {
+    const Candidate cur = candidates.top();
+    if (nearest.size() >= search_breadth && cur.first > nearest.top().first) {
+      break;
+    }
+    candidates.pop();
+    for (DatapointIndex neighbor : neighbors_fn(cur.second)) {
+      if (!visited.insert(neighbor).second) continue;
+      const float dist = distance_fn(neighbor);
+      if (nearest.size() < search_breadth || dist < nearest.top().first) {
+        candidates.emplace(dist, neighbor);
+        nearest.emplace(dist, neighbor);
+        if (nearest.size() > search_breadth) nearest.pop();
+      }
+    }
+  }
+
+  result->resize(nearest.size());
+  for (size_t i = nearest.size(); i-- > 0;) {
+    (*result)[i] = nearest.top();
+    nearest.pop();
+  }
+}
+
+template <typename PairDistanceFn>
+void SelectNeighbors(int32_t max_degree, const PairDistanceFn& pair_distance,
+                     vector<Candidate>* candidates) {
+  vector<Candidate> selected;
+  selected.reserve(max_degree);
+  for (const Candidate& candidate : *candidates) {
+    if (selected.size() >= max_degree) break;
+    bool dominated = false;
+    for (const Candidate& s : selected) {
+      if (pair_distance(candidate.second, s.second) < candidate.first) {
+        dominated = true;
+        break;
+      }
+    }
+    if (!dominated) selected.push_back(candidate);
+  }
+  *candidates = std::move(selected);
+}
+
+}  // namespace
+
+CenterGraph::Options CenterGraphOptionsFromConfig(
+    const CenterGraphConfig& config) {
+  CenterGraph::Options opts;
+  opts.max_degree = config.max_degree();
+  opts.construction_search_breadth = config.construction_search_breadth();
+  return opts;
+}
+
+StatusOr<unique_ptr<CenterGraph>> CenterGraph::Build(
+    const DenseDataset<float>& centers, const DistanceMeasure& dist,
+    const Options& opts) {
+  if (centers.empty()) {
+    return InvalidArgumentError("Cannot build a CenterGraph without centers.");
+  }
+  if (opts.max_degree < 2 || opts.construction_search_breadth < 1) {
+    return InvalidArgumentError(
+        "CenterGraph max_degree must be at least 2 and "
+        "construction_search_breadth must be positive (got %d and %d).",
+        opts.max_degree, opts.construction_search_breadth);
+  }
+  const DatapointIndex num_centers = centers.size();
+
+  MTRandom rng(opts.seed);
+  const double level_multiplier = 1.0 / std::log(opts.max_degree);
+  vector<uint32_t> levels(num_centers);
+  for (uint32_t& level : levels) {
+    const double u =
+        absl::Uniform<double>(absl::IntervalOpenClosed, rng, 0.0, 1.0);
+    level = static_cast<uint32_t>(-std::log(u) * level_multiplier);
+  }
+
+  unique_ptr<CenterGraph> result(new CenterGraph);
+  result->first_list_.resize(num_centers + 1);
+  for (DatapointIndex i : Seq(num_centers)) {
+    result->first_list_[i + 1] = result->first_list_[i] + levels[i] + 1;
+  }
+  const vector<uint32_t>& first_list = result->first_list_;
+  vector<vector<DatapointIndex>> lists(first_list.back());
+
+  auto pair_distance = [&](DatapointIndex a, DatapointIndex b) -> float {
+    return dist.GetDistanceDense(centers[a], centers[b]);
+  };
+  auto add_back_link = [&](DatapointIndex from, DatapointIndex to,
+                           uint32_t level) {
+    vector<DatapointIndex>& links = lists[first_list[from] + level];
+    links.push_back(to);
+    const size_t max_degree =
+        level == 0 ? 2 * opts.max_degree : opts.max_degree;
+    if (links.size() <= max_degree) return;
+    vector<Candidate> pruned;
+    pruned.reserve(links.size());
+    for (DatapointIndex j : links) {
+      pruned.emplace_back(pair_distance(from, j), j);
+    }
+    std::sort(pruned.begin(), pruned.end());
+    SelectNeighbors(max_degree, pair_distance, &pruned);
+    links.clear();
+    for (const Candidate& c : pruned) links.push_back(c.second);
+  };
+
+  DatapointIndex entry_point = 0;
+  uint32_t max_level = levels[0];
+  vector<Candidate> entry, nearest;
+  for (DatapointIndex i : Seq(1, num_centers)) {
+    auto distance_to_i = [&](DatapointIndex j) -> float {
+      return pair_distance(i, j);
+    };
+    entry = {{distance_to_i(entry_point), entry_point}};
+    for (uint32_t level = max_level + 1; level-- > 0;) {
+      auto neighbors_fn = [&](DatapointIndex j) -> ConstSpan<DatapointIndex> {
+        return lists[first_list[j] + level];
+      };
+      if (level > levels[i]) {
+        SearchLevel(entry, 1, neighbors_fn, distance_to_i, &nearest);
+        entry.swap(nearest);
+        continue;
+      }
+      SearchLevel(entry, opts.construction_search_breadth, neighbors_fn,
+                  distance_to_i, &nearest);
+      entry = nearest;
+      SelectNeighbors(opts.max_degree, pair_distance, &nearest);
+      for (const Candidate& c : nearest) {
+        lists[first_list[i] + level].push_back(c.second);
+      }
+      for (const Candidate& c : nearest) {
+        add_back_link(c.second, i, level);
+      }
+    }
+    if (levels[i] > max_level) {
+      max_level = levels[i];
+      entry_point = i;
+    }
+  }
+
+  result->entry_point_ = entry_point;
+  result->list_offsets_.resize(lists.size() + 1);
+  for (size_t list : IndicesOf(lists)) {
+    result->list_offsets_[list + 1] =
+        result->list_offsets_[list] + lists[list].size();
+  }
+  result->neighbors_.reserve(result->list_offsets_.back());
+  for (const vector<DatapointIndex>& list : lists) {
+    result->neighbors_.insert(result->neighbors_.end(), list.begin(),
+                              list.end());
+  }
+  return result;
+}
+
+StatusOr<unique_ptr<CenterGraph>> CenterGraph::FromProto(
+    const SerializedCenterGraph& proto, DatapointIndex num_centers) {
+  if (proto.num_levels_size() != num_centers) {
+    return InvalidArgumentError(
+        "SerializedCenterGraph has %d centers but the partitioner has %d.",
+        proto.num_levels_size(), num_centers);
+  }
+  if (proto.entry_point() >= num_centers) {
+    return InvalidArgumentError("Invalid CenterGraph entry point %d.",
+                                proto.entry_point());
+  }
+
+  unique_ptr<CenterGraph> result(new CenterGraph);
+  result->entry_point_ = proto.entry_point();
+  result->first_list_.resize(num_centers + 1);
+  uint32_t max_levels = 0;
+  for (DatapointIndex i : Seq(num_centers)) {
+    if (proto.num_levels(i) == 0) {
+      return InvalidArgumentError("CenterGraph center %d has no levels.", i);
+    }
+    max_levels = std::max(max_levels, proto.num_levels(i));
+    result->first_list_[i + 1] = result->first_list_[i] + proto.num_levels(i);
+  }
+  if (proto.num_levels(result->entry_point_) != max_levels) {
+    return InvalidArgumentError(
+        "CenterGraph entry point must be on the top level.");
+  }
+  if (proto.list_sizes_size() != result->first_list_.back()) {
+    return InvalidArgumentError(
+        "SerializedCenterGraph has %d neighbor lists; expected %d.",
+        proto.list_sizes_size(), result->first_list_.back());
+  }
+
+  result->list_offsets_.resize(proto.list_sizes_size() + 1);
+  for (size_t list : Seq(proto.list_sizes_size())) {
+    result->list_offsets_[list + 1] =
+        result->list_offsets_[list] + proto.list_sizes(list);
+  }
+  if (proto.neighbors_size() != result->list_offsets_.back()) {
+    return InvalidArgumentError(
+        "SerializedCenterGraph has %d neighbors; expected %d.",
+        proto.neighbors_size(), result->list_offsets_.back());
+  }
+  result->neighbors_.assign(proto.neighbors().begin(),
+                            proto.neighbors().end());
+  for (DatapointIndex neighbor : result->neighbors_) {
+    if (neighbor >= num_centers) {
+      return InvalidArgumentError("Invalid CenterGraph neighbor %d.",
+                                  neighbor);
+    }
+  }
+  return result;
+}
+
+void CenterGraph::CopyToProto(SerializedCenterGraph* proto) const {
+  proto->Clear();
+  proto->set_entry_point(entry_point_);
+  for (DatapointIndex i : Seq(size())) {
+    proto->add_num_levels(num_levels(i));
+  }
+  for (size_t list : Seq(list_offsets_.size() - 1)) {
+    proto->add_list_sizes(list_offsets_[list + 1] - list_offsets_[list]);
+  }
+  proto->mutable_neighbors()->Add(neighbors_.begin(), neighbors_.end());
+}
+
+Status CenterGraph::Search(const DatapointPtr<float>& query,
+                           const DenseDataset<float>& centers,
+                           const DistanceMeasure& dist, int32_t num_neighbors,
+                           int32_t search_breadth,
+                           NNResultsVector* result) const {
+  if (centers.size() != size()) {
+    return FailedPreconditionError(
+        "CenterGraph was built over %d centers but %d were provided.", size(),
+        centers.size());
+  }
+  if (num_neighbors <= 0) {
+    return InvalidArgumentError("num_neighbors must be positive.");
+  }
+
+  auto distance_to_query = [&](DatapointIndex j) -> float {
+    return dist.GetDistanceDense(query, centers[j]);
+  };
+  vector<Candidate> entry = {{distance_to_query(entry_point_), entry_point_}};
+  vector<Candidate> nearest;
+  for (uint32_t level = num_levels(entry_point_) - 1; level > 0; --level) {
+    SearchLevel(
+        entry, 1,
+        [&](DatapointIndex j) { return Neighbors(j, level); },
+        distance_to_query, &nearest);
+    entry.swap(nearest);
+  }
+  SearchLevel(
+      entry, std::max(search_breadth, num_neighbors),
+      [&](DatapointIndex j) { return Neighbors(j, 0); }, distance_to_query,
+      &nearest);
+
+  if (nearest.size() > num_neighbors) nearest.resize(num_neighbors);
+  result->clear();
+  result->reserve(nearest.size());
+  for (const Candidate& c : nearest) {
+    result->emplace_back(c.second, c.first);
+  }
+  return OkStatus();
+}
+
+}  // namespace research_scann
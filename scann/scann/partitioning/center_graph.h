@@ -0,0 +1,91 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_PARTITIONING_CENTER_GRAPH_H_
+#define SCANN_PARTITIONING_CENTER_GRAPH_H_
+
+#include <cstdint>
+
+#include "scann/data_format/datapoint.h"
+#include "scann/data_format/dataset.h"
+#include "scann/distance_measures/distance_measure_base.h"
+#include "scann/oss_wrappers/scann_random.h"
+#include "scann/oss_wrappers/scann_status.h"
+#include "scann/partitioning/kmeans_tree_partitioner.pb.h"
+#include "scann/proto/partitioning.pb.h"
+#include "scann/utils/memory_logging.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+class CenterGraph {
+ public:
+  struct Options {
+    int32_t max_degree = 16;
+
+    int32_t construction_search_breadth = 100;
+
+    int32_t seed = kDeterministicSeed;
+  };
+
+  static StatusOr<unique_ptr<CenterGraph>> Build(
+      const DenseDataset<float>& centers, const DistanceMeasure& dist,
+      const Options& opts);
+
+  static StatusOr<unique_ptr<CenterGraph>> FromProto(
+      const SerializedCenterGraph& proto, DatapointIndex num_centers);
+
+  void CopyToProto(SerializedCenterGraph* proto) const;
+
+  Status Search(const DatapointPtr<float>& query,
+                const DenseDataset<float>& centers,
+                const DistanceMeasure& dist, int32_t num_neighbors,
+                int32_t search_breadth, NNResultsVector* result) const;
+
+  DatapointIndex size() const { return first_list_.size() - 1; }
+
+  size_t MemoryUsage() const {
+    return VectorStorage(first_list_) + VectorStorage(list_offsets_) +
+           VectorStorage(neighbors_);
+  }
+
+ private:
+  CenterGraph() {}
+
+  uint32_t num_levels(DatapointIndex center) const {
+    return first_list_[center + 1] - first_list_[center];
+  }
+
+  ConstSpan<DatapointIndex> Neighbors(DatapointIndex center,
+                                      uint32_t level) const {
+    const uint32_t list = first_list_[center] + level;
+    return MakeConstSpan(neighbors_.data() + list_offsets_[list],
+                         list_offsets_[list + 1] - list_offsets_[list]);
+  }
+
+  DatapointIndex entry_point_ = 0;
+
+  vector<uint32_t> first_list_ = {0};
+
+  vector<uint32_t> list_offsets_ = {0};
+
+  vector<DatapointIndex> neighbors_;
+};
+
+CenterGraph::Options CenterGraphOptionsFromConfig(
+    const CenterGraphConfig& config);
+
+}  // namespace research_scann
+
+#endif
@@ -15,13 +15,16 @@
 #include "scann/partitioning/kmeans_tree_partitioner.h"
 
 #include <cstdint>
+#include <numeric>
 
 #include "absl/base/internal/spinlock.h"
 #include "absl/memory/memory.h"
 #include "absl/synchronization/mutex.h"
 #include "scann/base/search_parameters.h"
 #include "scann/base/single_machine_base.h"
+#include "scann/data_format/sparse_csr_dataset.h"
 #include "scann/distance_measures/many_to_many/many_to_many.h"
+#include "scann/distance_measures/many_to_many/many_to_many_sparse_dense.h"
 #include "scann/oss_wrappers/scann_down_cast.h"
 #include "scann/partitioning/kmeans_tree_partitioner.pb.h"
 #include "scann/partitioning/partitioner_base.h"
@@ -29,6 +32,7 @@
 #include "scann/trees/kmeans_tree/kmeans_tree.h"
 #include "scann/utils/common.h"
 #include "scann/utils/fast_top_neighbors.h"
+#include "scann/utils/parallel_for.h"
 #include "scann/utils/types.h"
 #include "scann/utils/zip_sort.h"
 #include "tensorflow/core/lib/core/errors.h"
@@ -74,16 +78,42 @@ unique_ptr<Partitioner<T>> KMeansTreePartitioner<T>::Clone() const {
   result->query_spilling_type_ = query_spilling_type_;
   result->query_spilling_threshold_ = query_spilling_threshold_;
   result->query_spilling_max_centers_ = query_spilling_max_centers_;
+  result->use_leaf_spilling_thresholds_ = use_leaf_spilling_thresholds_;
   result->query_tokenization_type_ = query_tokenization_type_;
   result->database_tokenization_type_ = database_tokenization_type_;
   result->database_tokenization_searcher_ = database_tokenization_searcher_;
   result->database_spilling_fixed_number_of_centers_ =
       database_spilling_fixed_number_of_centers_;
+  result->database_spilling_orthogonality_amplified_centers_ =
+      database_spilling_orthogonality_amplified_centers_;
+  result->database_spilling_orthogonality_lambda_ =
+      database_spilling_orthogonality_lambda_;
   result->query_tokenization_searcher_ = query_tokenization_searcher_;
+  result->center_graph_ = center_graph_;
+  result->center_graph_search_breadth_ = center_graph_search_breadth_;
   result->populate_residual_stdev_ = populate_residual_stdev_;
   return std::move(result);
 }
 
+template <typename T>
+StatusOr<unique_ptr<KMeansTreePartitioner<T>>>
+KMeansTreePartitioner<T>::CloneWithTree(
+    shared_ptr<const KMeansTree> tree) const {
+  if (database_tokenization_searcher_ || query_tokenization_searcher_ ||
+      center_graph_) {
+    return FailedPreconditionError(
+        "Cannot replace the tree of a KMeansTreePartitioner that tokenizes "
+        "with asymmetric hashing searchers or a center graph built from the "
+        "original tree.");
+  }
+  unique_ptr<KMeansTreePartitioner<T>> result(
+      down_cast<KMeansTreePartitioner<T>*>(Clone().release()));
+  result->kmeans_tree_ = std::move(tree);
+  result->SetIsOneLevelTree();
+  result->set_tokenization_mode(this->tokenization_mode());
+  return result;
+}
+
 template <typename T>
 KMeansTreePartitioner<T>::~KMeansTreePartitioner() {}
 
@@ -104,11 +134,101 @@ Status KMeansTreePartitioner<T>::CreatePartitioning(
   return OkStatus();
 }
 
+template <typename T>
+Status KMeansTreePartitioner<T>::CreatePartitioning(
+    StreamingDatasetSource* training_source,
+    const DistanceMeasure& training_dist, int32_t num_clusters,
+    KMeansTreeTrainingOptions* opts) {
+  if (kmeans_tree_) {
+    return FailedPreconditionError(
+        "Cannot call CreatePartitioning twice with the same "
+        "KMeansTreePartitioner.");
+  }
+  auto tree = make_shared<KMeansTree>();
+  SCANN_RETURN_IF_ERROR(tree->TrainFromSource(training_source, training_dist,
+                                              num_clusters, opts));
+  kmeans_tree_ = std::move(tree);
+  SetIsOneLevelTree();
+  return OkStatus();
+}
+
 template <typename T>
 void KMeansTreePartitioner<T>::set_query_spilling_threshold(double val) {
   query_spilling_threshold_ = val;
 }
 
+template <typename T>
+Status KMeansTreePartitioner<T>::SetLeafQuerySpillingThresholds(
+    ConstSpan<double> thresholds) {
+  if (!kmeans_tree_) {
+    return FailedPreconditionError(
+        "Cannot set leaf query spilling thresholds before the KMeansTree is "
+        "trained.");
+  }
+  shared_ptr<KMeansTree> tree = kmeans_tree_->Clone();
+  SCANN_RETURN_IF_ERROR(tree->SetLeafQuerySpillingThresholds(thresholds));
+  kmeans_tree_ = std::move(tree);
+  return OkStatus();
+}
+
+template <typename T>
+KMeansTree::TokenizationOptions
+KMeansTreePartitioner<T>::QuerySpillingTokenizationOptions(
+    int32_t max_centers) const {
+  auto result = KMeansTree::TokenizationOptions::UserSpecifiedSpilling(
+      query_spilling_type_, query_spilling_threshold_, max_centers,
+      static_cast<KMeansTree::TokenizationType>(query_tokenization_type_),
+      populate_residual_stdev_);
+  result.use_leaf_spilling_thresholds = use_leaf_spilling_thresholds_;
+  return result;
+}
+
+template <typename T>
+ConstSpan<double> KMeansTreePartitioner<T>::OneLevelLeafSpillingThresholds()
+    const {
+  if (!use_leaf_spilling_thresholds_ || !is_one_level_tree_) return {};
+  return kmeans_tree_->root()->leaf_query_spilling_thresholds();
+}
+
+namespace {
+
+StatusOr<double> QuerySpillingMaxDistance(
+    QuerySpillingConfig::SpillingType spilling_type, double spilling_threshold,
+    double nearest_center_distance) {
+  switch (spilling_type) {
+    case QuerySpillingConfig::NO_SPILLING:
+      return nearest_center_distance;
+    case QuerySpillingConfig::MULTIPLICATIVE:
+      return nearest_center_distance * spilling_threshold;
+    case QuerySpillingConfig::ADDITIVE:
+      return nearest_center_distance + spilling_threshold;
+    case QuerySpillingConfig::ABSOLUTE_DISTANCE:
+      return spilling_threshold;
+    case QuerySpillingConfig::FIXED_NUMBER_OF_CENTERS:
+      return numeric_limits<double>::infinity();
+    default:
+      return InvalidArgumentError("Unknown spilling type.");
+  }
+}
+
+StatusOr<double> LeafSpillingMaxDistance(
+    QuerySpillingConfig::SpillingType spilling_type,
+    ConstSpan<double> leaf_thresholds, DatapointIndex leaf,
+    double nearest_center_distance, double default_max_distance) {
+  if (leaf_thresholds.empty() || std::isnan(leaf_thresholds[leaf]) ||
+      spilling_type == QuerySpillingConfig::NO_SPILLING ||
+      spilling_type == QuerySpillingConfig::FIXED_NUMBER_OF_CENTERS) {
+    return default_max_distance;
+  }
+  TF_ASSIGN_OR_RETURN(double max_distance,
+                      QuerySpillingMaxDistance(spilling_type,
+                                               leaf_thresholds[leaf],
+                                               nearest_center_distance));
+  return std::max(max_distance, nearest_center_distance);
+}
+
+}  // namespace
+
 constexpr int kAhMultiplierSpilling = 10;
 
 constexpr int kAhMultiplierNoSpilling = 100;
@@ -131,6 +251,12 @@ Status KMeansTreePartitioner<T>::TokenForDatapoint(
                                                      : 1;
     return TokenForDatapointUseSearcher(dptr, result,
                                         pre_reordering_num_neighbors);
+  } else if (cur_type == CENTER_GRAPH) {
+    vector<KMeansTreeSearchResult> result_vec;
+    SCANN_RETURN_IF_ERROR(TokensForDatapointUseCenterGraph(
+        dptr, QuerySpillingConfig::NO_SPILLING, 1, &result_vec));
+    *result = result_vec[0];
+    return OkStatus();
   } else {
     vector<KMeansTreeSearchResult> result_vec;
     const shared_ptr<const DistanceMeasure>& dist =
@@ -150,10 +276,24 @@ template <typename T>
 Status KMeansTreePartitioner<T>::TokenForDatapointBatched(
     const TypedDataset<T>& queries, vector<int32_t>* results,
     ThreadPool* pool) const {
-  if (cur_tokenization_type() != FLOAT || queries.IsSparse() ||
-      !is_one_level_tree_) {
+  if (cur_tokenization_type() == ASYMMETRIC_HASHING ||
+      cur_tokenization_type() == CENTER_GRAPH || queries.IsSparse()) {
     return Partitioner<T>::TokenForDatapointBatched(queries, results);
   }
+  if (cur_tokenization_type() != FLOAT || !is_one_level_tree_) {
+    vector<vector<KMeansTreeSearchResult>> tree_results(queries.size());
+    SCANN_RETURN_IF_ERROR(TokenizeBatchedWithTree(
+        queries,
+        KMeansTree::TokenizationOptions::NoSpilling(
+            static_cast<KMeansTree::TokenizationType>(cur_tokenization_type()),
+            populate_residual_stdev_),
+        {}, MakeMutableSpan(tree_results), pool));
+    results->resize(queries.size());
+    for (size_t j : Seq(queries.size())) {
+      (*results)[j] = tree_results[j].front().node->LeafId();
+    }
+    return OkStatus();
+  }
   TF_ASSIGN_OR_RETURN(auto top1_results,
                       TokenForDatapointBatchedImpl(queries, pool));
   results->resize(queries.size());
@@ -167,12 +307,27 @@ template <typename T>
 Status KMeansTreePartitioner<T>::TokenForDatapointBatched(
     const TypedDataset<T>& queries,
     vector<KMeansTreeSearchResult>* results) const {
-  if (cur_tokenization_type() != FLOAT || queries.IsSparse() ||
-      !is_one_level_tree_) {
+  if (cur_tokenization_type() == ASYMMETRIC_HASHING ||
+      cur_tokenization_type() == CENTER_GRAPH || queries.IsSparse()) {
     results->resize(queries.size());
     for (size_t i : IndicesOf(queries)) {
       SCANN_RETURN_IF_ERROR(TokenForDatapoint(queries[i], &(*results)[i]));
     }
+    return OkStatus();
+  }
+  if (cur_tokenization_type() != FLOAT || !is_one_level_tree_) {
+    vector<vector<KMeansTreeSearchResult>> tree_results(queries.size());
+    SCANN_RETURN_IF_ERROR(TokenizeBatchedWithTree(
+        queries,
+        KMeansTree::TokenizationOptions::NoSpilling(
+            static_cast<KMeansTree::TokenizationType>(cur_tokenization_type()),
+            populate_residual_stdev_),
+        {}, MakeMutableSpan(tree_results)));
+    results->resize(queries.size());
+    for (size_t i : IndicesOf(queries)) {
+      (*results)[i] = tree_results[i].front();
+    }
+    return OkStatus();
   }
   TF_ASSIGN_OR_RETURN(auto top1_results,
                       TokenForDatapointBatchedImpl(queries, nullptr));
@@ -199,15 +354,18 @@ Status KMeansTreePartitioner<T>::TokensForDatapointWithSpilling(
       return TokensForDatapointWithSpillingUseSearcher(
           dptr, result, max_centers, pre_reordering_num_neighbors);
     }
+    if (query_tokenization_type_ == CENTER_GRAPH) {
+      return TokensForDatapointUseCenterGraph(dptr, query_spilling_type_,
+                                              max_centers, result);
+    }
 
-    return kmeans_tree_->Tokenize(
-        dptr, *query_tokenization_dist_,
-        KMeansTree::TokenizationOptions::UserSpecifiedSpilling(
-            query_spilling_type_, query_spilling_threshold_, max_centers,
-            static_cast<KMeansTree::TokenizationType>(query_tokenization_type_),
-            populate_residual_stdev_),
-        result);
+    return kmeans_tree_->Tokenize(dptr, *query_tokenization_dist_,
+                                  QuerySpillingTokenizationOptions(max_centers),
+                                  result);
   } else if (this->tokenization_mode() == UntypedPartitioner::DATABASE) {
+    if (database_spilling_orthogonality_amplified_centers_ > 0) {
+      return TokensForDatapointWithOrthogonalityAmplifiedSpilling(dptr, result);
+    }
     if (database_spilling_fixed_number_of_centers_ > 0) {
       if (database_tokenization_type_ == ASYMMETRIC_HASHING) {
         int pre_reordering_num_neighbors =
@@ -318,6 +476,153 @@ Status KMeansTreePartitioner<T>::TokensForDatapointWithSpillingAndOverride(
   return OkStatus();
 }
 
+template <typename T>
+Status KMeansTreePartitioner<T>::TokensForDatapointUseCenterGraph(
+    const DatapointPtr<T>& dptr,
+    QuerySpillingConfig::SpillingType spilling_type, int32_t max_centers,
+    vector<KMeansTreeSearchResult>* result) const {
+  if (!center_graph_) {
+    return FailedPreconditionError(
+        "CreateCenterGraphForQueryTokenization must be called first.");
+  }
+  const DenseDataset<float>& centers = kmeans_tree_->root()->Centers();
+  if (centers.dimensionality() != dptr.dimensionality()) {
+    return FailedPreconditionError(
+        "Incorrect query dimensionality.  Expected %d, got %d.\n",
+        centers.dimensionality(), dptr.dimensionality());
+  }
+  Datapoint<float> dp;
+  DatapointPtr<float> query = ToFloat(dptr, &dp);
+
+  const int32_t max_centers_bound =
+      max_centers > 0 ? std::min(max_centers, n_tokens()) : n_tokens();
+  int32_t num_neighbors = 1;
+  if (spilling_type == QuerySpillingConfig::FIXED_NUMBER_OF_CENTERS) {
+    num_neighbors = max_centers_bound;
+  } else if (spilling_type != QuerySpillingConfig::NO_SPILLING) {
+    num_neighbors = std::max<int32_t>(
+        1, std::min(center_graph_search_breadth_, max_centers_bound));
+  }
+  NNResultsVector nearest;
+  SCANN_RETURN_IF_ERROR(center_graph_->Search(
+      query, centers, *query_tokenization_dist_, num_neighbors,
+      center_graph_search_breadth_, &nearest));
+  result->clear();
+  if (nearest.empty()) return OkStatus();
+
+  const double nearest_center_distance = nearest.front().second;
+  double max_dist_to_consider = numeric_limits<double>::infinity();
+  if (spilling_type != QuerySpillingConfig::NO_SPILLING) {
+    TF_ASSIGN_OR_RETURN(max_dist_to_consider,
+                        QuerySpillingMaxDistance(spilling_type,
+                                                 query_spilling_threshold_,
+                                                 nearest_center_distance));
+  }
+  ConstSpan<double> leaf_thresholds = OneLevelLeafSpillingThresholds();
+  size_t num_kept = 0;
+  for (const auto& elem : nearest) {
+    TF_ASSIGN_OR_RETURN(
+        const double leaf_max_dist,
+        LeafSpillingMaxDistance(spilling_type, leaf_thresholds, elem.first,
+                                nearest_center_distance, max_dist_to_consider));
+    if (elem.second <= leaf_max_dist) nearest[num_kept++] = elem;
+  }
+  nearest.resize(num_kept);
+  *result = ToKmeansTreeSearchResults(nearest);
+  return OkStatus();
+}
+
+constexpr int32_t kOrthogonalitySpillingCandidates = 32;
+
+template <typename T>
+Status
+KMeansTreePartitioner<T>::TokensForDatapointWithOrthogonalityAmplifiedSpilling(
+    const DatapointPtr<T>& dptr, vector<KMeansTreeSearchResult>* result) const {
+  if (database_tokenization_type_ == ASYMMETRIC_HASHING) {
+    return FailedPreconditionError(
+        "ORTHOGONALITY_AMPLIFIED_RESIDUAL database spilling is not supported "
+        "with ASYMMETRIC_HASHING database tokenization.");
+  }
+  vector<KMeansTreeSearchResult> candidates;
+  SCANN_RETURN_IF_ERROR(kmeans_tree_->Tokenize(
+      dptr, *database_tokenization_dist_,
+      KMeansTree::TokenizationOptions::UserSpecifiedSpilling(
+          QuerySpillingConfig::FIXED_NUMBER_OF_CENTERS, 0.0,
+          std::max(kOrthogonalitySpillingCandidates,
+                   database_spilling_orthogonality_amplified_centers_),
+          static_cast<KMeansTree::TokenizationType>(
+              database_tokenization_type_),
+          populate_residual_stdev_),
+      &candidates));
+  result->clear();
+  if (candidates.empty()) return OkStatus();
+  const size_t max_candidates =
+      std::max(kOrthogonalitySpillingCandidates,
+               database_spilling_orthogonality_amplified_centers_);
+  if (candidates.size() > max_candidates) candidates.resize(max_candidates);
+  result->push_back(candidates[0]);
+  const size_t num_assignments =
+      std::min<size_t>(database_spilling_orthogonality_amplified_centers_,
+                       candidates.size());
+  if (num_assignments <= 1) return OkStatus();
+
+  Datapoint<float> dp_storage;
+  const DatapointPtr<float> dp = ToFloat(dptr, &dp_storage);
+  const DimensionIndex dims = dp.dimensionality();
+  vector<float> residuals(candidates.size() * dims);
+  vector<float> residual_sq_norms(candidates.size());
+  for (size_t i : IndicesOf(candidates)) {
+    ConstSpan<float> center =
+        candidates[i].node->cur_node_center().values_slice();
+    float* residual = residuals.data() + i * dims;
+    float sq_norm = 0.0f;
+    for (DimensionIndex d : Seq(dims)) {
+      residual[d] = dp.values()[d] - center[d];
+      sq_norm += residual[d] * residual[d];
+    }
+    residual_sq_norms[i] = sq_norm;
+  }
+
+  vector<float> parallel_penalties(candidates.size(), 0.0f);
+  vector<bool> chosen(candidates.size(), false);
+  chosen[0] = true;
+  size_t last_chosen = 0;
+  for (size_t assignment_idx = 1; assignment_idx < num_assignments;
+       ++assignment_idx) {
+    const float last_sq_norm = residual_sq_norms[last_chosen];
+    if (last_sq_norm > 0.0f) {
+      const float* last_residual = residuals.data() + last_chosen * dims;
+      for (size_t i : IndicesOf(candidates)) {
+        if (chosen[i]) continue;
+        const float* residual = residuals.data() + i * dims;
+        float dot = 0.0f;
+        for (DimensionIndex d : Seq(dims)) {
+          dot += residual[d] * last_residual[d];
+        }
+        parallel_penalties[i] += dot * dot / last_sq_norm;
+      }
+    }
+
+    size_t best = candidates.size();
+    float best_loss = numeric_limits<float>::infinity();
+    for (size_t i : IndicesOf(candidates)) {
+      if (chosen[i]) continue;
+      const float loss = residual_sq_norms[i] +
+                         database_spilling_orthogonality_lambda_ *
+                             parallel_penalties[i];
+      if (loss < best_loss) {
+        best_loss = loss;
+        best = i;
+      }
+    }
+    if (best == candidates.size()) break;
+    chosen[best] = true;
+    last_chosen = best;
+    result->push_back(candidates[best]);
+  }
+  return OkStatus();
+}
+
 template <typename T>
 Status KMeansTreePartitioner<T>::TokensForDatapointWithSpillingUseSearcher(
     const DatapointPtr<T>& dptr, vector<KMeansTreeSearchResult>* result,
@@ -437,6 +742,9 @@ void KMeansTreePartitioner<T>::CopyToProto(
   auto kmeans_proto = result->mutable_kmeans();
 
   kmeans_tree_->SerializeWithoutIndices(kmeans_proto->mutable_kmeans_tree());
+  if (center_graph_) {
+    center_graph_->CopyToProto(kmeans_proto->mutable_center_graph());
+  }
 }
 
 namespace {
@@ -465,113 +773,238 @@ KMeansTreePartitioner<T>::TokenizeDatabase(const TypedDataset<T>& database,
     return FailedPreconditionError(
         "Cannot run TokenizeDatabase when not in database tokenization mode.");
   }
-  if (typeid(*database_tokenization_dist_) == typeid(const SquaredL2Distance) &&
-      is_one_level_tree_ && database.IsDense() &&
-      kmeans_tree_->learned_spilling_type() ==
-          DatabaseSpillingConfig::NO_SPILLING &&
-      (IsSame<T, float>() || IsSame<T, double>()) &&
-      (database_tokenization_type_ == FLOAT)) {
-    const DenseDataset<T>& dense_database =
-        *down_cast<const DenseDataset<T>*>(&database);
-    TF_ASSIGN_OR_RETURN(
-        auto datapoint_index_to_result,
-        TokenizeDatabaseImplFastPath(dense_database, pool_or_null));
-    vector<std::vector<DatapointIndex>> token_to_datapoint_index(
-        this->n_tokens());
-    for (DatapointIndex dp_index = 0;
-         dp_index < datapoint_index_to_result.size(); ++dp_index) {
-      const int32_t token = datapoint_index_to_result[dp_index].node->LeafId();
-      token_to_datapoint_index[token].push_back(dp_index);
-    }
-    for (auto& elem : token_to_datapoint_index) {
-      elem.shrink_to_fit();
-    }
-    return std::move(token_to_datapoint_index);
+  if (SupportsDenseDatabaseTokenization(database)) {
+    return TokenizeDenseDatabase(*down_cast<const DenseDataset<T>*>(&database),
+                                 pool_or_null);
+  }
+  if (SupportsSparseDatabaseTokenization(database)) {
+    return TokenizeSparseDatabase(
+        *down_cast<const SparseDataset<T>*>(&database), pool_or_null);
   }
 
   return Partitioner<T>::TokenizeDatabase(database, pool_or_null);
 }
 
 template <typename T>
-StatusOr<vector<KMeansTreeSearchResult>>
-KMeansTreePartitioner<T>::TokenizeDatabaseImplFastPath(
-    const DenseDataset<T>& database, ThreadPool* pool_or_null) const {
-  vector<KMeansTreeSearchResult> datapoint_index_to_result;
-  if (kmeans_tree_->root()->IsLeaf()) {
-    datapoint_index_to_result.resize(
-        database.size(), KMeansTreeSearchResult{kmeans_tree_->root(), NAN});
-    return std::move(datapoint_index_to_result);
+bool KMeansTreePartitioner<T>::SupportsDenseDatabaseTokenization(
+    const TypedDataset<T>& database) const {
+  const auto tag =
+      database_tokenization_dist_->specially_optimized_distance_tag();
+  return database.IsDense() && !database.is_binary() && !database.empty() &&
+         database_tokenization_type_ != ASYMMETRIC_HASHING &&
+         database_spilling_orthogonality_amplified_centers_ == 0 &&
+         (tag == DistanceMeasure::DOT_PRODUCT ||
+          tag == DistanceMeasure::SQUARED_L2);
+}
+
+template <typename T>
+bool KMeansTreePartitioner<T>::SupportsSparseDatabaseTokenization(
+    const TypedDataset<T>& database) const {
+  return database.IsSparse() && !database.empty() &&
+         database_tokenization_type_ == FLOAT &&
+         database_spilling_orthogonality_amplified_centers_ == 0 &&
+         is_one_level_tree_ &&
+         (database_spilling_fixed_number_of_centers_ > 0 ||
+          kmeans_tree_->learned_spilling_type() ==
+              DatabaseSpillingConfig::NO_SPILLING) &&
+         SupportsSparseDenseDistanceManyToMany(*database_tokenization_dist_);
+}
+
+namespace {
+
+constexpr size_t kDatabaseTokenizationChunkSize = 1 << 16;
+
+constexpr size_t kDatabaseTokenizationTreeBatchSize = 256;
+
+template <typename ComputeDistancesFn>
+Status AssignChunkToRootCenters(
+    ConstSpan<KMeansTreeNode> children, int32_t num_spilled_centers,
+    size_t chunk_begin, size_t chunk_size,
+    ComputeDistancesFn& compute_distances,
+    vector<std::vector<DatapointIndex>>* token_to_datapoint_index) {
+  if (num_spilled_centers <= 1) {
+    vector<pair<DatapointIndex, float>> top1(
+        chunk_size,
+        std::make_pair(kInvalidDatapointIndex, numeric_limits<float>::max()));
+    ManyToManyTop1Callback<float> top1_callback(MakeMutableSpan(top1));
+    SCANN_RETURN_IF_ERROR(compute_distances(EpsilonFilteringCallback<float>(
+        top1_callback.epsilons(), top1_callback)));
+    for (size_t i : Seq(chunk_size)) {
+      if (top1[i].first >= children.size()) {
+        return InvalidArgumentError(
+            "Could not tokenize database point %d.  Is it finite?",
+            chunk_begin + i);
+      }
+      (*token_to_datapoint_index)[children[top1[i].first].LeafId()].push_back(
+          chunk_begin + i);
+    }
+    return OkStatus();
   }
 
-  if (database_tokenization_type_ == FLOAT) {
-    DCHECK_EQ(database_tokenization_type_, FLOAT);
-    TF_ASSIGN_OR_RETURN(
-        datapoint_index_to_result,
-        TokenizeDatabaseImplFastPath<float>(
-            database, kmeans_tree_->root()->Centers(), pool_or_null));
+  vector<FastTopNeighbors<float>> topns(chunk_size);
+  for (auto& topn : topns) topn.Init(num_spilled_centers);
+  ManyToManyTopKCallback topk_callback(MakeMutableSpan(topns));
+  SCANN_RETURN_IF_ERROR(compute_distances(EpsilonFilteringCallback<float>(
+      topk_callback.epsilons(), topk_callback)));
+  NNResultsVector spilled_centers;
+  for (size_t i : Seq(chunk_size)) {
+    topns[i].FinishUnsorted(&spilled_centers);
+    for (const auto& center : spilled_centers) {
+      (*token_to_datapoint_index)[children[center.first].LeafId()].push_back(
+          chunk_begin + i);
+    }
   }
-  return std::move(datapoint_index_to_result);
+  return OkStatus();
 }
 
-template <typename T>
-template <typename CenterType>
-enable_if_t<IsSame<T, CenterType>(), StatusOr<vector<KMeansTreeSearchResult>>>
-KMeansTreePartitioner<T>::TokenizeDatabaseImplFastPath(
-    const DenseDataset<T>& database, const DenseDataset<CenterType>& centers,
-    ThreadPool* pool_or_null) const {
-  SquaredL2Distance dist;
-  auto nearest_centers =
-      DenseDistanceManyToManyTop1<T>(dist, database, centers, pool_or_null);
-  return PostprocessNearestCenters<CenterType>(nearest_centers);
-}
+}  // namespace
 
 template <typename T>
-template <typename CenterType>
-enable_if_t<!IsSame<T, CenterType>(), StatusOr<vector<KMeansTreeSearchResult>>>
-KMeansTreePartitioner<T>::TokenizeDatabaseImplFastPath(
-    const DenseDataset<T>& database, const DenseDataset<CenterType>& centers,
-    ThreadPool* pool_or_null) const {
-  constexpr size_t kBatchSize = 128;
-  vector<pair<DatapointIndex, CenterType>> nearest_centers(database.size());
-  SquaredL2Distance dist;
+StatusOr<vector<std::vector<DatapointIndex>>>
+KMeansTreePartitioner<T>::TokenizeDenseDatabase(
+    const DenseDataset<T>& database, ThreadPool* pool_or_null) const {
+  const KMeansTreeNode* root = kmeans_tree_->root();
+  vector<std::vector<DatapointIndex>> token_to_datapoint_index(
+      this->n_tokens());
+  if (root->IsLeaf()) {
+    auto& all_datapoints = token_to_datapoint_index[root->LeafId()];
+    all_datapoints.resize(database.size());
+    std::iota(all_datapoints.begin(), all_datapoints.end(), 0);
+    return std::move(token_to_datapoint_index);
+  }
+  if (root->Centers().dimensionality() != database.dimensionality()) {
+    return FailedPreconditionError(
+        "Incorrect database dimensionality.  Expected %d, got %d.",
+        root->Centers().dimensionality(), database.dimensionality());
+  }
 
-  ParallelFor<1>(
-      SeqWithStride<kBatchSize>(0, database.size()), pool_or_null,
-      [&](size_t batch_begin) {
-        const size_t batch_end =
-            std::min<size_t>(batch_begin + kBatchSize, database.size());
-        DenseDataset<CenterType> batch_submatrix =
-            GetBatchSubmatrix<CenterType>(database, batch_begin, batch_end);
-        auto local_results = DenseDistanceManyToManyTop1<CenterType>(
-            dist, batch_submatrix, centers);
-        std::copy(local_results.begin(), local_results.end(),
-                  nearest_centers.begin() + batch_begin);
-      });
+  const DistanceMeasure& dist = *database_tokenization_dist_;
+  const auto tokenization_type =
+      static_cast<KMeansTree::TokenizationType>(database_tokenization_type_);
+  const int32_t num_spilled_centers =
+      database_spilling_fixed_number_of_centers_;
 
-  return PostprocessNearestCenters<CenterType>(nearest_centers);
+  const bool use_root_centers =
+      is_one_level_tree_ &&
+      (num_spilled_centers > 0 || kmeans_tree_->learned_spilling_type() ==
+                                      DatabaseSpillingConfig::NO_SPILLING);
+  unique_ptr<FP8SimdBlockTransposedDatabase> fp8_centers;
+  if (use_root_centers && database_tokenization_type_ == FIXED_POINT_INT8) {
+    fp8_centers = make_unique<FP8SimdBlockTransposedDatabase>(
+        root->fixed_point_centers(), root->inv_int8_multipliers());
+  }
+  const KMeansTree::TokenizationOptions tree_opts =
+      num_spilled_centers > 0
+          ? KMeansTree::TokenizationOptions::UserSpecifiedSpilling(
+                QuerySpillingConfig::FIXED_NUMBER_OF_CENTERS, 0.0,
+                num_spilled_centers, tokenization_type)
+          : KMeansTree::TokenizationOptions::LearnedSpilling(tokenization_type);
+
+  const ConstSpan<KMeansTreeNode> children = root->Children();
+  vector<DatapointIndex> query_idx_table;
+  vector<std::vector<KMeansTreeSearchResult>> tree_results;
+  for (size_t chunk_begin = 0; chunk_begin < database.size();
+       chunk_begin += kDatabaseTokenizationChunkSize) {
+    const size_t chunk_end = std::min<size_t>(
+        chunk_begin + kDatabaseTokenizationChunkSize, database.size());
+    const size_t chunk_size = chunk_end - chunk_begin;
+
+    if (!use_root_centers) {
+      tree_results.resize(chunk_size);
+      SCANN_RETURN_IF_ERROR(ParallelForWithStatus<1>(
+          SeqWithStride<kDatabaseTokenizationTreeBatchSize>(chunk_begin,
+                                                            chunk_end),
+          pool_or_null, [&](size_t batch_begin) -> Status {
+            const size_t batch_end = std::min<size_t>(
+                batch_begin + kDatabaseTokenizationTreeBatchSize, chunk_end);
+            DenseDataset<float> batch =
+                GetBatchSubmatrix<float>(database, batch_begin, batch_end);
+            return kmeans_tree_->TokenizeBatched(
+                batch, dist, tree_opts,
+                MakeMutableSpan(tree_results)
+                    .subspan(batch_begin - chunk_begin,
+                             batch_end - batch_begin));
+          }));
+      for (size_t i : Seq(chunk_size)) {
+        for (const KMeansTreeSearchResult& result : tree_results[i]) {
+          token_to_datapoint_index[result.node->LeafId()].push_back(
+              chunk_begin + i);
+        }
+      }
+      continue;
+    }
+
+    DenseDataset<float> chunk =
+        GetBatchSubmatrix<float>(database, chunk_begin, chunk_end);
+    auto compute_distances =
+        [&](EpsilonFilteringCallback<float> eps_callback) -> Status {
+      if (!fp8_centers) {
+        DenseDistanceManyToMany<float>(dist, chunk, root->Centers(),
+                                       pool_or_null, std::move(eps_callback));
+        return OkStatus();
+      }
+      query_idx_table.resize(chunk_size);
+      std::iota(query_idx_table.begin(), query_idx_table.end(), 0);
+      return DenseDistanceManyToManyFP8Pretransposed(
+          dist, chunk, *fp8_centers, pool_or_null,
+          EpsilonFilteringOffsetWrapper<float>(std::move(eps_callback), 0,
+                                               query_idx_table));
+    };
+
+    SCANN_RETURN_IF_ERROR(AssignChunkToRootCenters(
+        children, num_spilled_centers, chunk_begin, chunk_size,
+        compute_distances, &token_to_datapoint_index));
+  }
+
+  for (auto& elem : token_to_datapoint_index) {
+    elem.shrink_to_fit();
+  }
+  return std::move(token_to_datapoint_index);
 }
 
 template <typename T>
-template <typename FloatT>
-vector<KMeansTreeSearchResult>
-KMeansTreePartitioner<T>::PostprocessNearestCenters(
-    ConstSpan<pair<DatapointIndex, FloatT>> nearest_centers) const {
-  vector<KMeansTreeSearchResult> datapoint_index_to_result(
-      nearest_centers.size());
-  const auto* root = kmeans_tree_->root();
-  const ConstSpan<KMeansTreeNode> nodes_array = root->Children();
-  for (DatapointIndex dp_idx : IndicesOf(nearest_centers)) {
-    DCHECK_LT(nearest_centers[dp_idx].first,
-              numeric_limits<DatapointIndex>::max());
-    const auto token = nearest_centers[dp_idx].first;
-    datapoint_index_to_result[dp_idx] = {
-        &nodes_array[token], nearest_centers[dp_idx].second,
-        populate_residual_stdev_ && token < root->residual_stdevs().size()
-            ? root->residual_stdevs()[token]
-            : 1.0};
+StatusOr<vector<std::vector<DatapointIndex>>>
+KMeansTreePartitioner<T>::TokenizeSparseDatabase(
+    const SparseDataset<T>& database, ThreadPool* pool_or_null) const {
+  const KMeansTreeNode* root = kmeans_tree_->root();
+  vector<std::vector<DatapointIndex>> token_to_datapoint_index(
+      this->n_tokens());
+  if (root->IsLeaf()) {
+    auto& all_datapoints = token_to_datapoint_index[root->LeafId()];
+    all_datapoints.resize(database.size());
+    std::iota(all_datapoints.begin(), all_datapoints.end(), 0);
+    return std::move(token_to_datapoint_index);
+  }
+  if (root->Centers().dimensionality() != database.dimensionality()) {
+    return FailedPreconditionError(
+        "Incorrect database dimensionality.  Expected %d, got %d.",
+        root->Centers().dimensionality(), database.dimensionality());
+  }
+
+  const DenseTransposedDatabase transposed_centers(root->Centers());
+  const ConstSpan<KMeansTreeNode> children = root->Children();
+  for (size_t chunk_begin = 0; chunk_begin < database.size();
+       chunk_begin += kDatabaseTokenizationChunkSize) {
+    const size_t chunk_end = std::min<size_t>(
+        chunk_begin + kDatabaseTokenizationChunkSize, database.size());
+    TF_ASSIGN_OR_RETURN(
+        const SparseCsrDataset chunk,
+        SparseCsrDataset::Create(database, chunk_begin, chunk_end));
+    auto compute_distances =
+        [&](EpsilonFilteringCallback<float> eps_callback) -> Status {
+      return SparseDenseDistanceManyToMany(*database_tokenization_dist_, chunk,
+                                           transposed_centers, pool_or_null,
+                                           std::move(eps_callback));
+    };
+    SCANN_RETURN_IF_ERROR(AssignChunkToRootCenters(
+        children, database_spilling_fixed_number_of_centers_, chunk_begin,
+        chunk.size(), compute_distances, &token_to_datapoint_index));
   }
 
-  return datapoint_index_to_result;
+  for (auto& elem : token_to_datapoint_index) {
+    elem.shrink_to_fit();
+  }
+  return std::move(token_to_datapoint_index);
 }
 
 template <typename T>
@@ -605,7 +1038,8 @@ Status KMeansTreePartitioner<T>::TokensForDatapointWithSpillingBatched(
         "size as batched queries.");
 
   if (this->tokenization_mode() != UntypedPartitioner::QUERY ||
-      !SupportsLowLevelQueryBatching() || !queries.IsDense()) {
+      query_tokenization_type_ == ASYMMETRIC_HASHING ||
+      query_tokenization_type_ == CENTER_GRAPH || !queries.IsDense()) {
     for (DatapointIndex i = 0; i < queries.size(); ++i) {
       const auto max_centers =
           max_centers_override.empty() ? 0 : max_centers_override[i];
@@ -614,6 +1048,11 @@ Status KMeansTreePartitioner<T>::TokensForDatapointWithSpillingBatched(
     }
     return OkStatus();
   }
+  if (!SupportsLowLevelQueryBatching()) {
+    return TokenizeBatchedWithTree(
+        queries, QuerySpillingTokenizationOptions(query_spilling_max_centers_),
+        max_centers_override, results);
+  }
 
   const DenseDataset<float>& centers = kmeans_tree_->root()->Centers();
   if (centers.dimensionality() != queries.dimensionality()) {
@@ -660,6 +1099,8 @@ Status KMeansTreePartitioner<T>::TokensForDatapointWithSpillingBatched(
   DenseDistanceManyToMany<float>(*query_tokenization_dist_, *float_queries,
                                  centers, distance_callback);
 
+  ConstSpan<double> leaf_thresholds = OneLevelLeafSpillingThresholds();
+
   for (DatapointIndex query_idx : IndicesOf(*float_queries)) {
     const auto max_centers = max_centers_override.empty()
                                  ? query_spilling_max_centers_
@@ -671,29 +1112,19 @@ Status KMeansTreePartitioner<T>::TokensForDatapointWithSpillingBatched(
                       std::min_element(distances.begin(), distances.end()));
     const double nearest_center_distance = distances[nearest_center_index];
 
-    double max_dist_to_consider;
-    switch (query_spilling_type_) {
-      case QuerySpillingConfig::NO_SPILLING:
-        max_dist_to_consider = nearest_center_distance;
-        break;
-      case QuerySpillingConfig::MULTIPLICATIVE:
-        max_dist_to_consider =
-            nearest_center_distance * query_spilling_threshold_;
-        break;
-      case QuerySpillingConfig::ADDITIVE:
-        max_dist_to_consider =
-            nearest_center_distance + query_spilling_threshold_;
-        break;
-      case QuerySpillingConfig::ABSOLUTE_DISTANCE:
-        max_dist_to_consider = query_spilling_threshold_;
-        break;
-      default:
-        return InvalidArgumentError("Unknown spilling type.");
-    }
+    TF_ASSIGN_OR_RETURN(const double max_dist_to_consider,
+                        QuerySpillingMaxDistance(query_spilling_type_,
+                                                 query_spilling_threshold_,
+                                                 nearest_center_distance));
 
     NNResultsVector child_centers;
     for (DatapointIndex center_idx : IndicesOf(distances)) {
-      if (distances[center_idx] <= max_dist_to_consider) {
+      TF_ASSIGN_OR_RETURN(
+          const double center_max_dist,
+          LeafSpillingMaxDistance(query_spilling_type_, leaf_thresholds,
+                                  center_idx, nearest_center_distance,
+                                  max_dist_to_consider));
+      if (distances[center_idx] <= center_max_dist) {
         child_centers.emplace_back(center_idx, distances[center_idx]);
       }
     }
@@ -713,6 +1144,37 @@ Status KMeansTreePartitioner<T>::TokensForDatapointWithSpillingBatched(
   return OkStatus();
 }
 
+template <typename T>
+MemoryUsageReport KMeansTreePartitioner<T>::MemoryUsageBreakdown() const {
+  MemoryUsageReport report("KMeansTreePartitioner");
+  if (kmeans_tree_) {
+    report.AddSharedChild("kmeans_tree", kmeans_tree_.get(), 0)
+        .MergeFrom(kmeans_tree_->root()->MemoryUsageBreakdown());
+  }
+  report.AddChild("center_squared_norms", VectorStorage(center_squared_norms_));
+  {
+    absl::MutexLock lock(&leaf_centers_mutex_);
+    report.AddChild("leaf_centers", leaf_centers_.MemoryUsageExcludingDocids());
+  }
+  if (center_graph_) {
+    report.AddSharedChild("center_graph", center_graph_.get(),
+                          center_graph_->MemoryUsage());
+  }
+  if (database_tokenization_searcher_) {
+    report
+        .AddSharedChild("database_tokenization_searcher",
+                        database_tokenization_searcher_.get(), 0)
+        .MergeFrom(database_tokenization_searcher_->MemoryUsageBreakdown());
+  }
+  if (query_tokenization_searcher_) {
+    report
+        .AddSharedChild("query_tokenization_searcher",
+                        query_tokenization_searcher_.get(), 0)
+        .MergeFrom(query_tokenization_searcher_->MemoryUsageBreakdown());
+  }
+  return report;
+}
+
 template <typename T>
 int32_t KMeansTreePartitioner<T>::n_tokens() const {
   DCHECK(kmeans_tree_)
@@ -825,6 +1287,40 @@ Status KMeansTreePartitioner<
   return OkStatus();
 }
 
+template <typename T>
+Status KMeansTreePartitioner<T>::CreateCenterGraphForQueryTokenization(
+    const CenterGraph::Options& opts) {
+  if (!kmeans_tree_) {
+    return FailedPreconditionError(
+        "Must train partitioner first before building a center graph for "
+        "tokenization.");
+  }
+  if (!is_one_level_tree_) {
+    return FailedPreconditionError(
+        "Center graph tokenization only works for one_level_tree.");
+  }
+  TF_ASSIGN_OR_RETURN(center_graph_,
+                      CenterGraph::Build(kmeans_tree_->root()->Centers(),
+                                         *query_tokenization_dist_, opts));
+  return OkStatus();
+}
+
+template <typename T>
+Status KMeansTreePartitioner<T>::SetCenterGraphForQueryTokenization(
+    shared_ptr<const CenterGraph> center_graph) {
+  if (!kmeans_tree_ || !is_one_level_tree_) {
+    return FailedPreconditionError(
+        "Center graph tokenization only works for a trained one_level_tree.");
+  }
+  if (center_graph->size() != kmeans_tree_->n_tokens()) {
+    return InvalidArgumentError(
+        "Center graph has %d centers but the partitioner has %d tokens.",
+        center_graph->size(), kmeans_tree_->n_tokens());
+  }
+  center_graph_ = std::move(center_graph);
+  return OkStatus();
+}
+
 template <typename T>
 StatusOr<vector<pair<DatapointIndex, float>>>
 KMeansTreePartitioner<T>::TokenForDatapointBatchedImpl(
@@ -848,6 +1344,27 @@ KMeansTreePartitioner<T>::TokenForDatapointBatchedImpl(
                                             pool);
 }
 
+template <typename T>
+Status KMeansTreePartitioner<T>::TokenizeBatchedWithTree(
+    const TypedDataset<T>& queries,
+    const KMeansTree::TokenizationOptions& opts,
+    ConstSpan<int32_t> max_centers_override,
+    MutableSpan<vector<KMeansTreeSearchResult>> results,
+    ThreadPool* pool) const {
+  if (!kmeans_tree_) {
+    return FailedPreconditionError(
+        "Cannot query a KMeansTreePartitioner before training.");
+  }
+  const auto& dist = (this->tokenization_mode() == UntypedPartitioner::QUERY)
+                         ? *query_tokenization_dist_
+                         : *database_tokenization_dist_;
+  DenseDataset<float> float_query_storage;
+  auto float_queries = ConvertToFloatIfNecessary(
+      *down_cast<const DenseDataset<T>*>(&queries), &float_query_storage);
+  return kmeans_tree_->TokenizeBatched(*float_queries, dist, opts, results,
+                                       max_centers_override, pool);
+}
+
 template <typename T>
 vector<KMeansTreeSearchResult>
 KMeansTreePartitioner<T>::ToKmeansTreeSearchResults(
@@ -22,12 +22,14 @@
 
 #include "absl/synchronization/mutex.h"
 #include "scann/base/single_machine_base.h"
+#include "scann/partitioning/center_graph.h"
 #include "scann/partitioning/kmeans_tree_like_partitioner.h"
 #include "scann/partitioning/partitioner.pb.h"
 #include "scann/partitioning/partitioner_base.h"
 #include "scann/trees/kmeans_tree/kmeans_tree.h"
 #include "scann/trees/kmeans_tree/kmeans_tree_node.h"
 #include "scann/trees/kmeans_tree/training_options.h"
+#include "scann/utils/streaming_dataset_source.h"
 #include "scann/utils/types.h"
 
 namespace research_scann {
@@ -51,6 +53,9 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
 
   unique_ptr<Partitioner<T>> Clone() const override;
 
+  StatusOr<unique_ptr<KMeansTreePartitioner<T>>> CloneWithTree(
+      shared_ptr<const KMeansTree> tree) const;
+
   ~KMeansTreePartitioner() final;
 
   Status CreatePartitioning(const Dataset& training_dataset,
@@ -58,6 +63,11 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
                             int32_t k_per_level,
                             KMeansTreeTrainingOptions* opts);
 
+  Status CreatePartitioning(StreamingDatasetSource* training_source,
+                            const DistanceMeasure& training_dist,
+                            int32_t num_clusters,
+                            KMeansTreeTrainingOptions* opts);
+
   void set_query_spilling_type(QuerySpillingConfig::SpillingType val) {
     query_spilling_type_ = val;
   }
@@ -68,10 +78,22 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
     query_spilling_max_centers_ = val;
   }
 
+  void set_use_leaf_spilling_thresholds(bool val) {
+    use_leaf_spilling_thresholds_ = val;
+  }
+
+  Status SetLeafQuerySpillingThresholds(ConstSpan<double> thresholds);
+
   void set_database_spilling_fixed_number_of_centers(uint32_t val) {
     database_spilling_fixed_number_of_centers_ = val;
   }
 
+  void set_database_spilling_orthogonality_amplified(uint32_t num_centers,
+                                                     float lambda) {
+    database_spilling_orthogonality_amplified_centers_ = num_centers;
+    database_spilling_orthogonality_lambda_ = lambda;
+  }
+
   QuerySpillingConfig::SpillingType query_spilling_type() const {
     return query_spilling_type_;
   }
@@ -82,16 +104,30 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
     return query_spilling_max_centers_;
   }
 
+  bool use_leaf_spilling_thresholds() const {
+    return use_leaf_spilling_thresholds_;
+  }
+
   uint32_t database_spilling_fixed_number_of_centers() const {
     return database_spilling_fixed_number_of_centers_;
   }
 
+  uint32_t database_spilling_orthogonality_amplified_centers() const {
+    return database_spilling_orthogonality_amplified_centers_;
+  }
+
+  float database_spilling_orthogonality_lambda() const {
+    return database_spilling_orthogonality_lambda_;
+  }
+
   enum TokenizationType {
     FLOAT = 1,
 
     FIXED_POINT_INT8 = 2,
 
-    ASYMMETRIC_HASHING = 3
+    ASYMMETRIC_HASHING = 3,
+
+    CENTER_GRAPH = 4
   };
 
   void SetQueryTokenizationType(TokenizationType type) {
@@ -154,6 +190,8 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
 
   void CopyToProto(SerializedPartitioner* result) const final;
 
+  MemoryUsageReport MemoryUsageBreakdown() const final;
+
   int32_t n_tokens() const final;
 
   Normalization NormalizationRequired() const final;
@@ -175,6 +213,24 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
 
   const SingleMachineSearcherBase<float>* TokenizationSearcher() const;
 
+  Status CreateCenterGraphForQueryTokenization(
+      const CenterGraph::Options& opts = CenterGraph::Options());
+
+  Status SetCenterGraphForQueryTokenization(
+      shared_ptr<const CenterGraph> center_graph);
+
+  const shared_ptr<const CenterGraph>& center_graph() const {
+    return center_graph_;
+  }
+
+  void set_center_graph_search_breadth(int32_t val) {
+    center_graph_search_breadth_ = val;
+  }
+
+  int32_t center_graph_search_breadth() const {
+    return center_graph_search_breadth_;
+  }
+
   const shared_ptr<const KMeansTree>& kmeans_tree() const final {
     return kmeans_tree_;
   }
@@ -197,29 +253,31 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
   Status TokensForDatapointWithSpillingUseSearcher(
       const DatapointPtr<T>& dptr, std::vector<KMeansTreeSearchResult>* result,
       int32_t num_neighbors, int32_t pre_reordering_num_neighbors) const;
+  KMeansTree::TokenizationOptions QuerySpillingTokenizationOptions(
+      int32_t max_centers) const;
+
+  ConstSpan<double> OneLevelLeafSpillingThresholds() const;
+
+  Status TokensForDatapointUseCenterGraph(
+      const DatapointPtr<T>& dptr,
+      QuerySpillingConfig::SpillingType spilling_type, int32_t max_centers,
+      std::vector<KMeansTreeSearchResult>* result) const;
+  Status TokensForDatapointWithOrthogonalityAmplifiedSpilling(
+      const DatapointPtr<T>& dptr,
+      std::vector<KMeansTreeSearchResult>* result) const;
 
   void SetIsOneLevelTree();
 
-  StatusOr<std::vector<KMeansTreeSearchResult>> TokenizeDatabaseImplFastPath(
-      const DenseDataset<T>& database, ThreadPool* pool_or_null) const;
+  bool SupportsDenseDatabaseTokenization(const TypedDataset<T>& database) const;
 
-  template <typename CenterType>
-  enable_if_t<!IsSame<T, CenterType>(),
-              StatusOr<std::vector<KMeansTreeSearchResult>>>
-  TokenizeDatabaseImplFastPath(const DenseDataset<T>& database,
-                               const DenseDataset<CenterType>& centers,
-                               ThreadPool* pool_or_null) const;
+  StatusOr<vector<std::vector<DatapointIndex>>> TokenizeDenseDatabase(
+      const DenseDataset<T>& database, ThreadPool* pool_or_null) const;
 
-  template <typename CenterType>
-  enable_if_t<IsSame<T, CenterType>(),
-              StatusOr<std::vector<KMeansTreeSearchResult>>>
-  TokenizeDatabaseImplFastPath(const DenseDataset<T>& database,
-                               const DenseDataset<CenterType>& centers,
-                               ThreadPool* pool_or_null) const;
+  bool SupportsSparseDatabaseTokenization(
+      const TypedDataset<T>& database) const;
 
-  template <typename FloatT>
-  std::vector<KMeansTreeSearchResult> PostprocessNearestCenters(
-      ConstSpan<pair<DatapointIndex, FloatT>> nearest_centers) const;
+  StatusOr<vector<std::vector<DatapointIndex>>> TokenizeSparseDatabase(
+      const SparseDataset<T>& database, ThreadPool* pool_or_null) const;
 
   const DenseDataset<float>* ConvertToFloatIfNecessary(
       const DenseDataset<T>& dataset, DenseDataset<float>* storage) const {
@@ -242,6 +300,13 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
   StatusOr<vector<pair<DatapointIndex, float>>> TokenForDatapointBatchedImpl(
       const TypedDataset<T>& queries, ThreadPool* pool = nullptr) const;
 
+  Status TokenizeBatchedWithTree(
+      const TypedDataset<T>& queries,
+      const KMeansTree::TokenizationOptions& opts,
+      ConstSpan<int32_t> max_centers_override,
+      MutableSpan<vector<KMeansTreeSearchResult>> results,
+      ThreadPool* pool = nullptr) const;
+
   vector<KMeansTreeSearchResult> ToKmeansTreeSearchResults(
       ConstSpan<pair<DatapointIndex, float>> partitions) const;
 
@@ -263,8 +328,13 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
 
   int32_t query_spilling_max_centers_ = numeric_limits<int32_t>::max();
 
+  bool use_leaf_spilling_thresholds_ = false;
+
   int32_t database_spilling_fixed_number_of_centers_ = 0;
 
+  int32_t database_spilling_orthogonality_amplified_centers_ = 0;
+  float database_spilling_orthogonality_lambda_ = 1.0;
+
   bool ready_to_tokenize_ = false;
 
   TokenizationType query_tokenization_type_ = FLOAT;
@@ -281,6 +351,10 @@ class KMeansTreePartitioner final : public KMeansTreeLikePartitioner<T> {
   shared_ptr<const SingleMachineSearcherBase<float>>
       query_tokenization_searcher_ = nullptr;
 
+  shared_ptr<const CenterGraph> center_graph_ = nullptr;
+
+  int32_t center_graph_search_breadth_ = 64;
+
   TF_DISALLOW_COPY_AND_ASSIGN(KMeansTreePartitioner);
 };
 
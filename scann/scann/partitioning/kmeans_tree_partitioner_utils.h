@@ -72,11 +72,21 @@ KMeansTreePartitionerFactoryPreSampledAndProjected(
   result->set_query_spilling_type(config.query_spilling().spilling_type());
   result->set_query_spilling_max_centers(
       config.query_spilling().max_spill_centers());
+  result->set_use_leaf_spilling_thresholds(
+      config.query_spilling().use_leaf_spilling_thresholds());
   if (config.database_spilling().spilling_type() ==
       DatabaseSpillingConfig::FIXED_NUMBER_OF_CENTERS) {
     result->set_database_spilling_fixed_number_of_centers(
         config.database_spilling().max_spill_centers());
   }
+  if (config.database_spilling().spilling_type() ==
+      DatabaseSpillingConfig::ORTHOGONALITY_AMPLIFIED_RESIDUAL) {
+    result->set_database_spilling_orthogonality_amplified(
+        config.database_spilling().has_max_spill_centers()
+            ? config.database_spilling().max_spill_centers()
+            : 2,
+        config.database_spilling().orthogonality_amplification_lambda());
+  }
 
   if (config.query_tokenization_type() == PartitioningConfig::FLOAT) {
     result->SetQueryTokenizationType(KMeansTreePartitioner<T>::FLOAT);
@@ -84,6 +94,13 @@ KMeansTreePartitionerFactoryPreSampledAndProjected(
              PartitioningConfig::FIXED_POINT_INT8) {
     result->SetQueryTokenizationType(
         KMeansTreePartitioner<T>::FIXED_POINT_INT8);
+  } else if (config.query_tokenization_type() ==
+             PartitioningConfig::CENTER_GRAPH) {
+    SCANN_RETURN_IF_ERROR(result->CreateCenterGraphForQueryTokenization(
+        CenterGraphOptionsFromConfig(config.center_graph())));
+    result->set_center_graph_search_breadth(
+        config.center_graph().search_breadth());
+    result->SetQueryTokenizationType(KMeansTreePartitioner<T>::CENTER_GRAPH);
   }
 
   if (config.database_tokenization_type() == PartitioningConfig::FLOAT) {
@@ -0,0 +1,289 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/partitioning/leaf_spilling_thresholds.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <tuple>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "scann/distance_measures/one_to_many/one_to_many.h"
+#include "scann/utils/common.h"
+#include "scann/utils/parallel_for.h"
+
+namespace research_scann {
+namespace {
+
+constexpr int kMaxLambdaSearchIterations = 50;
+
+double RequiredThreshold(QuerySpillingConfig::SpillingType spilling_type,
+                         double distance, double nearest_center_distance) {
+  switch (spilling_type) {
+    case QuerySpillingConfig::MULTIPLICATIVE:
+      return distance / nearest_center_distance;
+    case QuerySpillingConfig::ADDITIVE:
+      return distance - nearest_center_distance;
+    default:
+      return distance;
+  }
+}
+
+double NoSpillingThreshold(QuerySpillingConfig::SpillingType spilling_type) {
+  switch (spilling_type) {
+    case QuerySpillingConfig::MULTIPLICATIVE:
+      return 1.0;
+    case QuerySpillingConfig::ADDITIVE:
+      return 0.0;
+    default:
+      return numeric_limits<float>::lowest();
+  }
+}
+
+struct LeafGroup {
+  std::vector<double> required;
+
+  std::vector<float> probe_thresholds;
+};
+
+pair<double, size_t> BestGroupThreshold(const LeafGroup& group, double lambda,
+                                        double no_spilling_threshold) {
+  const size_t num_always_covered =
+      std::upper_bound(group.required.begin(), group.required.end(),
+                       no_spilling_threshold) -
+      group.required.begin();
+  pair<double, size_t> best = {no_spilling_threshold, num_always_covered};
+  double best_objective = num_always_covered;
+  for (size_t i : Seq(num_always_covered, group.required.size())) {
+    const double threshold = group.required[i];
+    if (i + 1 < group.required.size() && group.required[i + 1] == threshold) {
+      continue;
+    }
+    const size_t num_probes =
+        std::upper_bound(group.probe_thresholds.begin(),
+                         group.probe_thresholds.end(), threshold) -
+        group.probe_thresholds.begin();
+    const double objective = (i + 1.0) - lambda * num_probes;
+    if (objective > best_objective) {
+      best_objective = objective;
+      best = {threshold, i + 1};
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+StatusOr<std::vector<double>> FitLeafSpillingThresholds(
+    const KMeansTree& tree, const DistanceMeasure& query_dist,
+    const DenseDataset<float>& queries,
+    ConstSpan<std::vector<DatapointIndex>> ground_truth,
+    ConstSpan<std::vector<DatapointIndex>> datapoints_by_token,
+    const LeafSpillingThresholdOptions& opts) {
+  if (opts.spilling_type != QuerySpillingConfig::MULTIPLICATIVE &&
+      opts.spilling_type != QuerySpillingConfig::ADDITIVE &&
+      opts.spilling_type != QuerySpillingConfig::ABSOLUTE_DISTANCE) {
+    return InvalidArgumentError(
+        "Leaf spilling thresholds can only be fit for MULTIPLICATIVE, "
+        "ADDITIVE and ABSOLUTE_DISTANCE query spilling (got %d).",
+        opts.spilling_type);
+  }
+  if (!(opts.target_recall > 0.0 && opts.target_recall <= 1.0)) {
+    return InvalidArgumentError("target_recall must be in (0, 1] (got %f).",
+                                opts.target_recall);
+  }
+  if (queries.size() != ground_truth.size()) {
+    return InvalidArgumentError(
+        "Got %d queries but ground truth for %d queries.", queries.size(),
+        ground_truth.size());
+  }
+  if (datapoints_by_token.size() != tree.n_tokens()) {
+    return InvalidArgumentError(
+        "datapoints_by_token has %d tokens but the tree has %d.",
+        datapoints_by_token.size(), tree.n_tokens());
+  }
+  const KMeansTreeNode* root = tree.root();
+  if (root->IsLeaf()) {
+    return FailedPreconditionError(
+        "Cannot fit leaf spilling thresholds for a single-leaf KMeansTree.");
+  }
+  for (const KMeansTreeNode& child : root->Children()) {
+    if (!child.IsLeaf()) {
+      return FailedPreconditionError(
+          "Leaf spilling thresholds can only be fit for one-level "
+          "KMeansTrees.");
+    }
+  }
+  const DenseDataset<float>& centers = root->Centers();
+  if (!queries.empty() &&
+      queries.dimensionality() != centers.dimensionality()) {
+    return InvalidArgumentError(
+        "Query dimensionality %d does not match center dimensionality %d.",
+        queries.dimensionality(), centers.dimensionality());
+  }
+
+  absl::flat_hash_map<DatapointIndex, std::vector<int32_t>> tokens_by_dp;
+  for (const auto& neighbors : ground_truth) {
+    for (DatapointIndex dp_idx : neighbors) tokens_by_dp[dp_idx];
+  }
+  for (size_t token : IndicesOf(datapoints_by_token)) {
+    for (DatapointIndex dp_idx : datapoints_by_token[token]) {
+      auto it = tokens_by_dp.find(dp_idx);
+      if (it != tokens_by_dp.end()) it->second.push_back(token);
+    }
+  }
+
+  const double no_spilling_threshold = NoSpillingThreshold(opts.spilling_type);
+  std::vector<std::vector<pair<int32_t, double>>> samples(queries.size());
+  std::vector<std::vector<pair<int32_t, float>>> probes(queries.size());
+  std::vector<uint8_t> has_nonpositive_nearest(queries.size(), false);
+  auto query_distances = [&](size_t query_idx, std::vector<float>* distances) {
+    distances->resize(centers.size());
+    DenseDistanceOneToMany(query_dist, queries[query_idx], centers,
+                           MakeMutableSpan(*distances));
+    const auto nearest_it =
+        std::min_element(distances->begin(), distances->end());
+    return std::make_pair<int32_t, double>(nearest_it - distances->begin(),
+                                           *nearest_it);
+  };
+  ParallelFor<1>(
+      Seq(queries.size()), opts.parallelization_pool, [&](size_t query_idx) {
+        std::vector<float> distances;
+        const auto [nearest_token, nearest_center_distance] =
+            query_distances(query_idx, &distances);
+        if (opts.spilling_type == QuerySpillingConfig::MULTIPLICATIVE &&
+            nearest_center_distance <= 0.0) {
+          has_nonpositive_nearest[query_idx] = true;
+          return;
+        }
+        for (DatapointIndex dp_idx : ground_truth[query_idx]) {
+          const std::vector<int32_t>& tokens = tokens_by_dp.at(dp_idx);
+          if (tokens.empty()) continue;
+          pair<int32_t, double> best = {-1,
+                                        numeric_limits<double>::infinity()};
+          for (int32_t token : tokens) {
+            const double required =
+                token == nearest_token
+                    ? no_spilling_threshold
+                    : RequiredThreshold(opts.spilling_type, distances[token],
+                                        nearest_center_distance);
+            if (required < best.second) best = {token, required};
+          }
+          samples[query_idx].push_back(best);
+        }
+      });
+  const size_t num_skipped = std::count(has_nonpositive_nearest.begin(),
+                                        has_nonpositive_nearest.end(), 1);
+  if (num_skipped > 0) {
+    LOG(WARNING) << "Skipped " << num_skipped
+                 << " queries whose nearest center distance is not positive; "
+                    "consider ADDITIVE leaf spilling thresholds.";
+  }
+
+  double max_required = no_spilling_threshold;
+  for (const auto& query_samples : samples) {
+    for (const auto& [token, required] : query_samples) {
+      max_required = std::max(max_required, required);
+    }
+  }
+  ParallelFor<1>(
+      Seq(queries.size()), opts.parallelization_pool, [&](size_t query_idx) {
+        if (has_nonpositive_nearest[query_idx]) return;
+        std::vector<float> distances;
+        const auto [nearest_token, nearest_center_distance] =
+            query_distances(query_idx, &distances);
+        for (int32_t token : IndicesOf(distances)) {
+          if (token == nearest_token) continue;
+          const double required = RequiredThreshold(
+              opts.spilling_type, distances[token], nearest_center_distance);
+          if (required <= max_required) {
+            probes[query_idx].emplace_back(token, required);
+          }
+        }
+      });
+
+  std::vector<size_t> num_samples_by_token(tree.n_tokens());
+  size_t num_samples = 0;
+  for (const auto& query_samples : samples) {
+    for (const auto& [token, required] : query_samples) {
+      ++num_samples_by_token[token];
+      ++num_samples;
+    }
+  }
+  if (num_samples == 0) {
+    return InvalidArgumentError(
+        "None of the ground truth neighbors appear in datapoints_by_token.");
+  }
+
+  std::vector<uint32_t> group_by_token(tree.n_tokens());
+  uint32_t num_groups = 1;
+  for (size_t token : IndicesOf(group_by_token)) {
+    group_by_token[token] =
+        num_samples_by_token[token] >= opts.min_samples_per_leaf ? num_groups++
+                                                                 : 0;
+  }
+  std::vector<LeafGroup> groups(num_groups);
+  for (size_t query_idx : IndicesOf(samples)) {
+    for (const auto& [token, required] : samples[query_idx]) {
+      groups[group_by_token[token]].required.push_back(required);
+    }
+    for (const auto& [token, required] : probes[query_idx]) {
+      groups[group_by_token[token]].probe_thresholds.push_back(required);
+    }
+    FreeBackingStorage(&samples[query_idx]);
+    FreeBackingStorage(&probes[query_idx]);
+  }
+  ParallelFor<1>(Seq(num_groups), opts.parallelization_pool, [&](size_t i) {
+    std::sort(groups[i].required.begin(), groups[i].required.end());
+    std::sort(groups[i].probe_thresholds.begin(),
+              groups[i].probe_thresholds.end());
+  });
+
+  const double target_samples = opts.target_recall * num_samples;
+  std::vector<double> group_thresholds(num_groups);
+  auto thresholds_for_lambda = [&](double lambda) {
+    std::vector<size_t> covered(num_groups);
+    ParallelFor<1>(Seq(num_groups), opts.parallelization_pool, [&](size_t i) {
+      std::tie(group_thresholds[i], covered[i]) =
+          BestGroupThreshold(groups[i], lambda, no_spilling_threshold);
+    });
+    return std::accumulate(covered.begin(), covered.end(), size_t{0});
+  };
+
+  double lo = 0.0, hi = 1.0;
+  while (hi < 1e12 && thresholds_for_lambda(hi) >= target_samples) hi *= 2.0;
+  for (int iter = 0; iter < kMaxLambdaSearchIterations; ++iter) {
+    const double mid = 0.5 * (lo + hi);
+    if (thresholds_for_lambda(mid) >= target_samples) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  const size_t num_covered = thresholds_for_lambda(lo);
+
+  std::vector<double> result(tree.n_tokens());
+  for (size_t token : IndicesOf(result)) {
+    result[token] = group_thresholds[group_by_token[token]];
+  }
+  LOG(INFO) << "Fit spilling thresholds for " << num_groups - 1 << " of "
+            << tree.n_tokens() << " leaves; training recall = "
+            << static_cast<double>(num_covered) / num_samples;
+  return result;
+}
+
+}  // namespace research_scann
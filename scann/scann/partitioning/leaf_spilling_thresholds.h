@@ -0,0 +1,50 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_PARTITIONING_LEAF_SPILLING_THRESHOLDS_H_
+#define SCANN_PARTITIONING_LEAF_SPILLING_THRESHOLDS_H_
+
+#include <cstdint>
+
+#include "scann/data_format/dataset.h"
+#include "scann/distance_measures/distance_measure_base.h"
+#include "scann/oss_wrappers/scann_status.h"
+#include "scann/oss_wrappers/scann_threadpool.h"
+#include "scann/proto/partitioning.pb.h"
+#include "scann/trees/kmeans_tree/kmeans_tree.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+struct LeafSpillingThresholdOptions {
+  QuerySpillingConfig::SpillingType spilling_type =
+      QuerySpillingConfig::MULTIPLICATIVE;
+
+  double target_recall = 0.95;
+
+  int32_t min_samples_per_leaf = 16;
+
+  ThreadPool* parallelization_pool = nullptr;
+};
+
+StatusOr<std::vector<double>> FitLeafSpillingThresholds(
+    const KMeansTree& tree, const DistanceMeasure& query_dist,
+    const DenseDataset<float>& queries,
+    ConstSpan<std::vector<DatapointIndex>> ground_truth,
+    ConstSpan<std::vector<DatapointIndex>> datapoints_by_token,
+    const LeafSpillingThresholdOptions& opts);
+
+}  // namespace research_scann
+
+#endif
@@ -25,6 +25,7 @@
 #include "scann/data_format/dataset.h"
 #include "scann/oss_wrappers/scann_threadpool.h"
 #include "scann/partitioning/partitioner.pb.h"
+#include "scann/utils/memory_logging.h"
 #include "scann/utils/types.h"
 #include "scann/utils/util_functions.h"
 
@@ -57,6 +58,10 @@ class UntypedPartitioner {
 
   virtual void set_training_parallelization_pool(shared_ptr<ThreadPool> pool);
 
+  virtual MemoryUsageReport MemoryUsageBreakdown() const {
+    return MemoryUsageReport("Partitioner");
+  }
+
  protected:
   virtual void OnSetTokenizationMode() {}
 
@@ -24,6 +24,7 @@
 #include "absl/time/time.h"
 #include "scann/distance_measures/distance_measure_factory.h"
 #include "scann/oss_wrappers/scann_random.h"
+#include "scann/partitioning/center_graph.h"
 #include "scann/partitioning/kmeans_tree_partitioner.pb.h"
 #include "scann/partitioning/kmeans_tree_partitioner_utils.h"
 #include "scann/partitioning/partitioner.pb.h"
@@ -37,6 +38,14 @@
 #include "tensorflow/core/lib/core/errors.h"
 
 namespace research_scann {
+namespace {
+
+template <typename T>
+StatusOr<unique_ptr<Partitioner<T>>> PartitionerFromKMeansTreeImpl(
+    shared_ptr<const KMeansTree> kmeans_tree, const PartitioningConfig& config,
+    const SerializedCenterGraph* serialized_center_graph);
+
+}  // namespace
 
 template <typename T>
 StatusOr<unique_ptr<Partitioner<T>>> PartitionerFromSerializedImpl(
@@ -53,7 +62,10 @@ StatusOr<unique_ptr<Partitioner<T>>> PartitionerFromSerializedImpl(
   if (proto.has_kmeans()) {
     auto kmeans_tree =
         std::make_shared<KMeansTree>(proto.kmeans().kmeans_tree());
-    return PartitionerFromKMeansTree<T>(std::move(kmeans_tree), config);
+    return PartitionerFromKMeansTreeImpl<T>(
+        std::move(kmeans_tree), config,
+        proto.kmeans().has_center_graph() ? &proto.kmeans().center_graph()
+                                          : nullptr);
   } else if (proto.has_linear_projection()) {
     return InternalError("Linear projection tree partitioners not supported.");
   }
@@ -90,6 +102,16 @@ template <typename T>
 StatusOr<unique_ptr<Partitioner<T>>> PartitionerFromKMeansTree(
     shared_ptr<const KMeansTree> kmeans_tree,
     const PartitioningConfig& config) {
+  return PartitionerFromKMeansTreeImpl<T>(std::move(kmeans_tree), config,
+                                          nullptr);
+}
+
+namespace {
+
+template <typename T>
+StatusOr<unique_ptr<Partitioner<T>>> PartitionerFromKMeansTreeImpl(
+    shared_ptr<const KMeansTree> kmeans_tree, const PartitioningConfig& config,
+    const SerializedCenterGraph* serialized_center_graph) {
   TF_ASSIGN_OR_RETURN(auto training_dist,
                       GetDistanceMeasure(config.partitioning_distance()));
 
@@ -120,12 +142,22 @@ StatusOr<unique_ptr<Partitioner<T>>> PartitionerFromKMeansTree(
   km->set_query_spilling_type(config.query_spilling().spilling_type());
   km->set_query_spilling_max_centers(
       config.query_spilling().max_spill_centers());
+  km->set_use_leaf_spilling_thresholds(
+      config.query_spilling().use_leaf_spilling_thresholds());
 
   if (config.database_spilling().spilling_type() ==
       DatabaseSpillingConfig::FIXED_NUMBER_OF_CENTERS) {
     km->set_database_spilling_fixed_number_of_centers(
         config.database_spilling().max_spill_centers());
   }
+  if (config.database_spilling().spilling_type() ==
+      DatabaseSpillingConfig::ORTHOGONALITY_AMPLIFIED_RESIDUAL) {
+    km->set_database_spilling_orthogonality_amplified(
+        config.database_spilling().has_max_spill_centers()
+            ? config.database_spilling().max_spill_centers()
+            : 2,
+        config.database_spilling().orthogonality_amplification_lambda());
+  }
   if (config.query_tokenization_type() == PartitioningConfig::FLOAT) {
     km->SetQueryTokenizationType(KMeansTreePartitioner<T>::FLOAT);
   } else if (config.query_tokenization_type() ==
@@ -137,8 +169,27 @@ StatusOr<unique_ptr<Partitioner<T>>> PartitionerFromKMeansTree(
         km->CreateAsymmetricHashingSearcherForQueryTokenization());
     km->SetQueryTokenizationType(
         research_scann::KMeansTreePartitioner<T>::ASYMMETRIC_HASHING);
+  } else if (config.query_tokenization_type() ==
+             PartitioningConfig::CENTER_GRAPH) {
+    if (serialized_center_graph) {
+      TF_ASSIGN_OR_RETURN(
+          shared_ptr<const CenterGraph> center_graph,
+          CenterGraph::FromProto(*serialized_center_graph, km->n_tokens()));
+      SCANN_RETURN_IF_ERROR(
+          km->SetCenterGraphForQueryTokenization(std::move(center_graph)));
+    } else {
+      SCANN_RETURN_IF_ERROR(km->CreateCenterGraphForQueryTokenization(
+          CenterGraphOptionsFromConfig(config.center_graph())));
+    }
+    km->set_center_graph_search_breadth(config.center_graph().search_breadth());
+    km->SetQueryTokenizationType(KMeansTreePartitioner<T>::CENTER_GRAPH);
   }
 
+  if (config.database_tokenization_type() ==
+      PartitioningConfig::CENTER_GRAPH) {
+    return InvalidArgumentError(
+        "CENTER_GRAPH tokenization is only supported for queries.");
+  }
   if (config.database_tokenization_type() == PartitioningConfig::FLOAT) {
     km->SetDatabaseTokenizationType(KMeansTreePartitioner<T>::FLOAT);
   } else if (config.database_tokenization_type() ==
@@ -159,6 +210,8 @@ StatusOr<unique_ptr<Partitioner<T>>> PartitionerFromKMeansTree(
   return StatusOr<unique_ptr<Partitioner<T>>>(std::move(km));
 }
 
+}  // namespace
+
 SCANN_INSTANTIATE_SERIALIZED_PARTITIONER_FACTORY(, int8_t);
 SCANN_INSTANTIATE_SERIALIZED_PARTITIONER_FACTORY(, uint8_t);
 SCANN_INSTANTIATE_SERIALIZED_PARTITIONER_FACTORY(, int16_t);
@@ -30,9 +30,15 @@ PYBIND11_MODULE(scann_pybind, py_module) {
            std::optional<const research_scann::np_row_major_arr<float>>,
            std::optional<const research_scann::np_row_major_arr<float>>,
            const std::string&>())
-      .def(pybind11::init<const research_scann::np_row_major_arr<float>&,
-                          const std::string&, int>())
+      .def(pybind11::init<
+           const research_scann::np_row_major_arr<float>&, const std::string&,
+           int, std::optional<const std::vector<std::string>>>())
       .def("search", &research_scann::ScannNumpy::Search)
       .def("search_batched", &research_scann::ScannNumpy::SearchBatched)
-      .def("serialize", &research_scann::ScannNumpy::Serialize);
+      .def("serialize", &research_scann::ScannNumpy::Serialize)
+      .def("maintain_leaves", &research_scann::ScannNumpy::MaintainLeaves)
+      .def("fit_leaf_spilling_thresholds",
+           &research_scann::ScannNumpy::FitLeafSpillingThresholds)
+      .def("lookup_datapoint_index",
+           &research_scann::ScannNumpy::LookupDatapointIndex);
 }
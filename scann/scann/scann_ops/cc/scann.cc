@@ -15,16 +15,23 @@
 #include "scann/scann_ops/cc/scann.h"
 
 #include <cstdint>
+#include <cstdio>
 #include <fstream>
 #include <string>
 
 #include "absl/base/internal/sysinfo.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/container/node_hash_set.h"
+#include "scann/data_format/compressed_dense_dataset.h"
+#include "scann/data_format/docid_collection.h"
+#include "scann/distance_measures/distance_measure_factory.h"
+#include "scann/partitioning/leaf_spilling_thresholds.h"
 #include "scann/partitioning/partitioner.pb.h"
 #include "scann/proto/brute_force.pb.h"
 #include "scann/proto/centers.pb.h"
+#include "scann/tree_x_hybrid/tree_x_hybrid_smmd.h"
 #include "scann/tree_x_hybrid/tree_x_params.h"
+#include "scann/trees/kmeans_tree/kmeans_tree.h"
 #include "scann/utils/io_npy.h"
 #include "scann/utils/io_oss_wrapper.h"
 #include "scann/utils/scann_config_utils.h"
@@ -41,6 +48,13 @@ Status ParseTextProto(T* proto, const string& proto_str) {
   return OkStatus();
 }
 
+bool HasNonEmptyDocids(const DocidCollectionInterface& docids) {
+  for (size_t i : Seq(docids.size())) {
+    if (!docids.Get(i).empty()) return true;
+  }
+  return false;
+}
+
 unique_ptr<DenseDataset<float>> InitDataset(ConstSpan<float> dataset,
                                             DatapointIndex n_points) {
   if (dataset.empty()) return nullptr;
@@ -60,7 +74,23 @@ Status ScannInterface::Initialize(
   SCANN_RETURN_IF_ERROR(
       ReadProtobufFromFile(artifacts_dir + "/scann_config.pb", &config));
   SingleMachineFactoryOptions opts;
-  if (!hashed_dataset.empty()) {
+  const std::string hashed_dataset_path = artifacts_dir + "/hashed_dataset.npy";
+  if (hashed_dataset.empty() && std::ifstream(hashed_dataset_path).good()) {
+    MemoryMappedFileOptions mmap_opts;
+    mmap_opts.access_pattern = MmapAccessPattern::kRandom;
+    TF_ASSIGN_OR_RETURN(
+        DenseDataset<uint8_t> mmapped,
+        MmapNumpyDataset<uint8_t>(hashed_dataset_path, mmap_opts));
+    if (n_points == kInvalidDatapointIndex) n_points = mmapped.size();
+    if (mmapped.size() != n_points) {
+      return InvalidArgumentError(
+          absl::StrFormat("%s has %d datapoints but expected %d",
+                          hashed_dataset_path, mmapped.size(), n_points));
+    }
+    opts.hashed_dataset =
+        std::make_shared<DenseDataset<uint8_t>>(std::move(mmapped));
+  }
+  if (!hashed_dataset.empty() || opts.hashed_dataset) {
     opts.ah_codebook = std::make_shared<CentersForAllSubspaces>();
     SCANN_RETURN_IF_ERROR(ReadProtobufFromFile(
         artifacts_dir + "/ah_codebook.pb", opts.ah_codebook.get()));
@@ -71,6 +101,38 @@ Status ScannInterface::Initialize(
         ReadProtobufFromFile(artifacts_dir + "/serialized_partitioner.pb",
                              opts.serialized_partitioner.get()));
   }
+  const std::string docids_path = artifacts_dir + "/docids.bin";
+  if (std::ifstream(docids_path).good()) {
+    TF_ASSIGN_OR_RETURN(docids_, CompactDocidCollection::Mmap(docids_path));
+  }
+  const std::string compressed_path = artifacts_dir + "/compressed_dataset.bin";
+  if (std::ifstream(compressed_path).good()) {
+    const BlockCompression& compression =
+        config.exact_reordering().block_compression();
+    TF_ASSIGN_OR_RETURN(opts.compressed_reordering_dataset,
+                        CompressedDenseDataset::Mmap(
+                            compressed_path,
+                            compression.decoded_block_cache_size()));
+  }
+
+  const std::string dataset_path = artifacts_dir + "/dataset.npy";
+  if (dataset.empty() && std::ifstream(dataset_path).good()) {
+    MemoryMappedFileOptions mmap_opts;
+    mmap_opts.access_pattern = MmapAccessPattern::kRandom;
+    TF_ASSIGN_OR_RETURN(DenseDataset<float> mmapped,
+                        MmapNumpyDataset<float>(dataset_path, mmap_opts));
+    if (n_points == kInvalidDatapointIndex) n_points = mmapped.size();
+    if (mmapped.size() != n_points) {
+      return InvalidArgumentError(
+          absl::StrFormat("%s has %d datapoints but expected %d",
+                          dataset_path, mmapped.size(), n_points));
+    }
+    return Initialize(
+        config, opts,
+        std::make_shared<DenseDataset<float>>(std::move(mmapped)),
+        datapoint_to_token, hashed_dataset, int8_dataset, int8_multipliers,
+        dp_norms, n_points);
+  }
   return Initialize(config, opts, dataset, datapoint_to_token, hashed_dataset,
                     int8_dataset, int8_multipliers, dp_norms, n_points);
 }
@@ -81,8 +143,19 @@ Status ScannInterface::Initialize(
     ConstSpan<uint8_t> hashed_dataset, ConstSpan<int8_t> int8_dataset,
     ConstSpan<float> int8_multipliers, ConstSpan<float> dp_norms,
     DatapointIndex n_points) {
+  return Initialize(config, opts, InitDataset(dataset, n_points),
+                    datapoint_to_token, hashed_dataset, int8_dataset,
+                    int8_multipliers, dp_norms, n_points);
+}
+
+Status ScannInterface::Initialize(
+    ScannConfig config, SingleMachineFactoryOptions opts,
+    shared_ptr<DenseDataset<float>> dataset,
+    ConstSpan<int32_t> datapoint_to_token, ConstSpan<uint8_t> hashed_dataset,
+    ConstSpan<int8_t> int8_dataset, ConstSpan<float> int8_multipliers,
+    ConstSpan<float> dp_norms, DatapointIndex n_points) {
   config_ = config;
-  if (opts.ah_codebook != nullptr) {
+  if (opts.ah_codebook != nullptr && !opts.hashed_dataset) {
     vector<uint8_t> hashed_db(hashed_dataset.data(),
                               hashed_dataset.data() + hashed_dataset.size());
     opts.hashed_dataset =
@@ -111,18 +184,34 @@ Status ScannInterface::Initialize(
 
     int8_data->squared_l2_norm_by_datapoint =
         make_shared<vector<float>>(dp_norms.begin(), dp_norms.end());
+    int8_data->transposed_simd_block_size =
+        config.brute_force().fixed_point().transposed_simd_block_size();
     opts.pre_quantized_fixed_point = int8_data;
   }
-  return Initialize(InitDataset(dataset, n_points), opts);
+  return Initialize(std::move(dataset), opts);
 }
 
 Status ScannInterface::Initialize(ConstSpan<float> dataset,
                                   DatapointIndex n_points,
                                   const std::string& config,
-                                  int training_threads) {
+                                  int training_threads,
+                                  ConstSpan<std::string> docids) {
   SCANN_RETURN_IF_ERROR(ParseTextProto(&config_, config));
   if (training_threads < 0)
     return InvalidArgumentError("training_threads must be non-negative");
+  if (!docids.empty()) {
+    if (docids.size() != n_points) {
+      return InvalidArgumentError("Got %d docids but expected %d.",
+                                  docids.size(), n_points);
+    }
+    VariableLengthDocidCollection docid_collection;
+    docid_collection.Reserve(docids.size());
+    for (const std::string& docid : docids) {
+      SCANN_RETURN_IF_ERROR(docid_collection.Append(docid));
+    }
+    TF_ASSIGN_OR_RETURN(docids_,
+                        CompactDocidCollection::Create(docid_collection));
+  }
   if (training_threads == 0) training_threads = GetNumCPUs();
   SingleMachineFactoryOptions opts;
 
@@ -136,6 +225,22 @@ Status ScannInterface::Initialize(shared_ptr<DenseDataset<float>> dataset,
   TF_ASSIGN_OR_RETURN(dimensionality_, opts.ComputeConsistentDimensionality(
                                            config_.hash(), dataset.get()));
   TF_ASSIGN_OR_RETURN(n_points_, opts.ComputeConsistentSize(dataset.get()));
+  if (docids_) {
+    if (docids_->size() != n_points_) {
+      return InvalidArgumentError("Got %d docids but expected %d.",
+                                  docids_->size(), n_points_);
+    }
+    if (dataset) SCANN_RETURN_IF_ERROR(dataset->set_docids(docids_));
+    if (opts.hashed_dataset) {
+      SCANN_RETURN_IF_ERROR(opts.hashed_dataset->set_docids(docids_));
+    }
+    if (opts.pre_quantized_fixed_point &&
+        opts.pre_quantized_fixed_point->fixed_point_dataset) {
+      SCANN_RETURN_IF_ERROR(
+          opts.pre_quantized_fixed_point->fixed_point_dataset->set_docids(
+              docids_));
+    }
+  }
 
   if (dataset && config_.has_partitioning() &&
       config_.partitioning().partitioning_type() ==
@@ -143,6 +248,12 @@ Status ScannInterface::Initialize(shared_ptr<DenseDataset<float>> dataset,
     dataset->set_normalization_tag(research_scann::UNITL2NORM);
   TF_ASSIGN_OR_RETURN(scann_, SingleMachineFactoryScann<float>(
                                   config_, dataset, std::move(opts)));
+  if (docids_ && !scann_->docids()) {
+    SCANN_RETURN_IF_ERROR(scann_->set_docids(docids_));
+  }
+  if (config_.exact_reordering().block_compression().enabled()) {
+    scann_->MaybeReleaseDataset();
+  }
 
   const std::string& distance = config_.distance_measure().distance_measure();
   const absl::flat_hash_set<std::string> negated_distances{
@@ -260,8 +371,15 @@ Status ScannInterface::SearchBatchedParallel(const DenseDataset<float>& queries,
 Status ScannInterface::Serialize(std::string path) {
   TF_ASSIGN_OR_RETURN(auto opts, scann_->ExtractSingleMachineFactoryOptions());
 
-  SCANN_RETURN_IF_ERROR(
-      WriteProtobufToFile(path + "/scann_config.pb", &config_));
+  ScannConfig config = config_;
+  if (opts.pre_quantized_fixed_point != nullptr &&
+      opts.pre_quantized_fixed_point->transposed_simd_block_size != 0) {
+    config.mutable_brute_force()
+        ->mutable_fixed_point()
+        ->set_transposed_simd_block_size(
+            opts.pre_quantized_fixed_point->transposed_simd_block_size);
+  }
+  SCANN_RETURN_IF_ERROR(WriteProtobufToFile(path + "/scann_config.pb", &config));
   if (opts.ah_codebook != nullptr)
     SCANN_RETURN_IF_ERROR(
         WriteProtobufToFile(path + "/ah_codebook.pb", opts.ah_codebook.get()));
@@ -270,15 +388,27 @@ Status ScannInterface::Serialize(std::string path) {
         WriteProtobufToFile(path + "/serialized_partitioner.pb",
                             opts.serialized_partitioner.get()));
   if (opts.datapoints_by_token != nullptr) {
-    vector<int32_t> datapoint_to_token(n_points_);
-    for (const auto& [token_idx, dps] : Enumerate(*opts.datapoints_by_token))
-      for (auto dp_idx : dps) datapoint_to_token[dp_idx] = token_idx;
+    vector<int32_t> datapoint_to_token(n_points_, -1);
+    for (const auto& [token_idx, dps] : Enumerate(*opts.datapoints_by_token)) {
+      for (auto dp_idx : dps) {
+        if (datapoint_to_token[dp_idx] != -1) {
+          return UnimplementedError(
+              "Datapoint %d is assigned to more than one partition; "
+              "serializing spilled database assignments is not supported.",
+              dp_idx);
+        }
+        datapoint_to_token[dp_idx] = token_idx;
+      }
+    }
     SCANN_RETURN_IF_ERROR(
         VectorToNumpy(path + "/datapoint_to_token.npy", datapoint_to_token));
   }
   if (opts.hashed_dataset != nullptr) {
+    const std::string hashed_path = path + "/hashed_dataset.npy";
     SCANN_RETURN_IF_ERROR(
-        DatasetToNumpy(path + "/hashed_dataset.npy", *(opts.hashed_dataset)));
+        DatasetToNumpy(hashed_path + ".tmp", *(opts.hashed_dataset)));
+    if (std::rename((hashed_path + ".tmp").c_str(), hashed_path.c_str()))
+      return InternalError("Failed to rename to " + hashed_path);
   }
   if (opts.pre_quantized_fixed_point != nullptr) {
     auto fixed_point = opts.pre_quantized_fixed_point;
@@ -297,9 +427,35 @@ Status ScannInterface::Serialize(std::string path) {
       SCANN_RETURN_IF_ERROR(VectorToNumpy(path + "/dp_norms.npy", *norms));
     }
   }
+  if (opts.compressed_reordering_dataset != nullptr) {
+    const std::string compressed_path = path + "/compressed_dataset.bin";
+    SCANN_RETURN_IF_ERROR(opts.compressed_reordering_dataset->WriteToFile(
+        compressed_path + ".tmp"));
+    if (std::rename((compressed_path + ".tmp").c_str(),
+                    compressed_path.c_str()))
+      return InternalError("Failed to rename to " + compressed_path);
+  }
+  shared_ptr<const CompactDocidCollection> compact_docids = docids_;
+  shared_ptr<const DocidCollectionInterface> docids = scann_->docids();
+  if (!compact_docids && docids != nullptr && HasNonEmptyDocids(*docids)) {
+    TF_ASSIGN_OR_RETURN(compact_docids,
+                        CompactDocidCollection::Create(*docids));
+  }
+  if (compact_docids) {
+    const std::string docids_path = path + "/docids.bin";
+    SCANN_RETURN_IF_ERROR(compact_docids->WriteToFile(docids_path + ".tmp"));
+    if (std::rename((docids_path + ".tmp").c_str(), docids_path.c_str()))
+      return InternalError("Failed to rename to " + docids_path);
+  }
   TF_ASSIGN_OR_RETURN(auto dataset, Float32DatasetIfNeeded());
-  if (dataset != nullptr)
+  if (dataset != nullptr && dataset->IsMemoryMapped()) {
+    const std::string dataset_path = path + "/dataset.npy";
+    SCANN_RETURN_IF_ERROR(DatasetToNumpy(dataset_path + ".tmp", *dataset));
+    if (std::rename((dataset_path + ".tmp").c_str(), dataset_path.c_str()))
+      return InternalError("Failed to rename to " + dataset_path);
+  } else if (dataset != nullptr) {
     SCANN_RETURN_IF_ERROR(DatasetToNumpy(path + "/dataset.npy", *dataset));
+  }
   return OkStatus();
 }
 
@@ -307,4 +463,91 @@ StatusOr<SingleMachineFactoryOptions> ScannInterface::ExtractOptions() {
   return scann_->ExtractSingleMachineFactoryOptions();
 }
 
+StatusOr<DatapointIndex> ScannInterface::LookupDatapointIndex(
+    string_view docid) const {
+  if (!docids_) {
+    return FailedPreconditionError(
+        "Docid lookup requires a searcher built or loaded with docids.");
+  }
+  DatapointIndex index;
+  if (!docids_->LookupDatapointIndex(docid, &index)) {
+    return NotFoundError("Docid %s is not found.", docid);
+  }
+  return index;
+}
+
+StatusOr<int32_t> ScannInterface::MaintainLeaves() {
+  auto* tree_x_hybrid = dynamic_cast<TreeXHybridSMMD<float>*>(scann_.get());
+  if (!tree_x_hybrid) {
+    return FailedPreconditionError(
+        "Leaf maintenance is only supported for non-residual tree-X hybrid "
+        "searchers.");
+  }
+  return tree_x_hybrid->MaintainLeaves();
+}
+
+Status ScannInterface::FitLeafSpillingThresholds(
+    const DenseDataset<float>& queries, ConstSpan<DatapointIndex> neighbors,
+    double target_recall, QuerySpillingConfig::SpillingType spilling_type) {
+  if (!config_.has_partitioning() ||
+      config_.partitioning().max_num_levels() != 1) {
+    return FailedPreconditionError(
+        "Leaf spilling thresholds can only be fit for searchers partitioned "
+        "by a one-level KMeansTree.");
+  }
+  if (queries.empty() || neighbors.size() % queries.size() != 0) {
+    return InvalidArgumentError(
+        "Expected the same number of ground truth neighbors for each of the "
+        "%d queries (got %d in total).",
+        queries.size(), neighbors.size());
+  }
+  TF_ASSIGN_OR_RETURN(auto opts, scann_->ExtractSingleMachineFactoryOptions());
+  if (!opts.serialized_partitioner ||
+      !opts.serialized_partitioner->has_kmeans() ||
+      !opts.datapoints_by_token) {
+    return FailedPreconditionError(
+        "Leaf spilling thresholds require a KMeansTree-partitioned searcher.");
+  }
+  KMeansTree tree(opts.serialized_partitioner->kmeans().kmeans_tree());
+
+  const PartitioningConfig& partitioning = config_.partitioning();
+  TF_ASSIGN_OR_RETURN(
+      auto query_dist,
+      GetDistanceMeasure(
+          partitioning.has_query_tokenization_distance_override()
+              ? partitioning.query_tokenization_distance_override()
+              : partitioning.partitioning_distance()));
+  const size_t neighbors_per_query = neighbors.size() / queries.size();
+  vector<std::vector<DatapointIndex>> ground_truth(queries.size());
+  for (size_t i : IndicesOf(ground_truth)) {
+    auto row = neighbors.begin() + i * neighbors_per_query;
+    ground_truth[i].assign(row, row + neighbors_per_query);
+  }
+
+  LeafSpillingThresholdOptions fit_opts;
+  fit_opts.spilling_type = spilling_type;
+  fit_opts.target_recall = target_recall;
+  auto pool = StartThreadPool("scann_threadpool", GetNumCPUs() - 1);
+  fit_opts.parallelization_pool = pool.get();
+  TF_ASSIGN_OR_RETURN(
+      vector<double> thresholds,
+      research_scann::FitLeafSpillingThresholds(
+          tree, *query_dist, queries, ground_truth, *opts.datapoints_by_token,
+          fit_opts));
+  SCANN_RETURN_IF_ERROR(tree.SetLeafQuerySpillingThresholds(thresholds));
+  tree.SerializeWithoutIndices(
+      opts.serialized_partitioner->mutable_kmeans()->mutable_kmeans_tree());
+
+  ScannConfig old_config = config_;
+  QuerySpillingConfig* query_spilling =
+      config_.mutable_partitioning()->mutable_query_spilling();
+  query_spilling->set_spilling_type(spilling_type);
+  query_spilling->set_use_leaf_spilling_thresholds(true);
+  TF_ASSIGN_OR_RETURN(auto dataset, Float32DatasetIfNeeded());
+  Status status = Initialize(
+      std::const_pointer_cast<DenseDataset<float>>(dataset), std::move(opts));
+  if (!status.ok()) config_ = std::move(old_config);
+  return status;
+}
+
 }  // namespace research_scann
@@ -26,8 +26,10 @@
 #include "scann/base/single_machine_base.h"
 #include "scann/base/single_machine_factory_options.h"
 #include "scann/base/single_machine_factory_scann.h"
+#include "scann/data_format/compact_docid_collection.h"
 #include "scann/data_format/dataset.h"
 #include "scann/oss_wrappers/scann_status.h"
+#include "scann/proto/partitioning.pb.h"
 #include "scann/utils/threads.h"
 
 namespace research_scann {
@@ -49,7 +51,8 @@ class ScannInterface {
                     ConstSpan<float> int8_multipliers,
                     ConstSpan<float> dp_norms, DatapointIndex n_points);
   Status Initialize(ConstSpan<float> dataset, DatapointIndex n_points,
-                    const std::string& config, int training_threads);
+                    const std::string& config, int training_threads,
+                    ConstSpan<std::string> docids = {});
   Status Initialize(
       shared_ptr<DenseDataset<float>> dataset,
       SingleMachineFactoryOptions opts = SingleMachineFactoryOptions());
@@ -64,6 +67,11 @@ class ScannInterface {
                                int pre_reorder_nn, int leaves) const;
   Status Serialize(std::string path);
   StatusOr<SingleMachineFactoryOptions> ExtractOptions();
+  StatusOr<int32_t> MaintainLeaves();
+  Status FitLeafSpillingThresholds(
+      const DenseDataset<float>& queries, ConstSpan<DatapointIndex> neighbors,
+      double target_recall, QuerySpillingConfig::SpillingType spilling_type);
+  StatusOr<DatapointIndex> LookupDatapointIndex(string_view docid) const;
 
   template <typename T_idx>
   void ReshapeNNResult(const NNResultsVector& res, T_idx* indices,
@@ -81,6 +89,14 @@ class ScannInterface {
   const ScannConfig* config() const { return &config_; }
 
  private:
+  Status Initialize(ScannConfig config, SingleMachineFactoryOptions opts,
+                    shared_ptr<DenseDataset<float>> dataset,
+                    ConstSpan<int32_t> datapoint_to_token,
+                    ConstSpan<uint8_t> hashed_dataset,
+                    ConstSpan<int8_t> int8_dataset,
+                    ConstSpan<float> int8_multipliers,
+                    ConstSpan<float> dp_norms, DatapointIndex n_points);
+
   SearchParameters GetSearchParameters(int final_nn, int pre_reorder_nn,
                                        int leaves) const;
   vector<SearchParameters> GetSearchParametersBatched(
@@ -91,6 +107,8 @@ class ScannInterface {
   std::unique_ptr<SingleMachineSearcherBase<float>> scann_;
   ScannConfig config_;
 
+  shared_ptr<CompactDocidCollection> docids_;
+
   float result_multiplier_;
 
   size_t min_batch_size_;
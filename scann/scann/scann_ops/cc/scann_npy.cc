@@ -89,13 +89,16 @@ ScannNumpy::ScannNumpy(
 }
 
 ScannNumpy::ScannNumpy(const np_row_major_arr<float>& np_dataset,
-                       const std::string& config, int training_threads) {
+                       const std::string& config, int training_threads,
+                       std::optional<const std::vector<std::string>> docids) {
   if (np_dataset.ndim() != 2)
     throw std::invalid_argument("Dataset input must be two-dimensional");
   ConstSpan<float> dataset(np_dataset.data(), np_dataset.size());
+  ConstSpan<std::string> docid_span;
+  if (docids) docid_span = *docids;
   RuntimeErrorIfNotOk("Error initializing searcher: ",
                       scann_.Initialize(dataset, np_dataset.shape()[0], config,
-                                        training_threads));
+                                        training_threads, docid_span));
 }
 
 std::pair<pybind11::array_t<DatapointIndex>, pybind11::array_t<float>>
@@ -154,4 +157,37 @@ void ScannNumpy::Serialize(std::string path) {
                       status);
 }
 
+int32_t ScannNumpy::MaintainLeaves() {
+  auto num_edits = scann_.MaintainLeaves();
+  RuntimeErrorIfNotOk("Error maintaining leaves: ", num_edits.status());
+  return num_edits.ValueOrDie();
+}
+
+void ScannNumpy::FitLeafSpillingThresholds(
+    const np_row_major_arr<float>& queries,
+    const np_row_major_arr<DatapointIndex>& neighbors, double target_recall,
+    const std::string& spilling_type) {
+  if (queries.ndim() != 2)
+    throw std::invalid_argument("Queries must be in two-dimensional array");
+  if (neighbors.ndim() != 2 || neighbors.shape()[0] != queries.shape()[0])
+    throw std::invalid_argument(
+        "Neighbors must be a two-dimensional array with one row per query");
+  QuerySpillingConfig::SpillingType type;
+  if (!QuerySpillingConfig::SpillingType_Parse(spilling_type, &type))
+    throw std::invalid_argument("Unknown spilling type " + spilling_type);
+
+  vector<float> queries_vec(queries.data(), queries.data() + queries.size());
+  auto query_dataset = DenseDataset<float>(queries_vec, queries.shape()[0]);
+  ConstSpan<DatapointIndex> neighbors_span(neighbors.data(), neighbors.size());
+  RuntimeErrorIfNotOk("Error fitting leaf spilling thresholds: ",
+                      scann_.FitLeafSpillingThresholds(
+                          query_dataset, neighbors_span, target_recall, type));
+}
+
+DatapointIndex ScannNumpy::LookupDatapointIndex(const std::string& docid) {
+  auto index = scann_.LookupDatapointIndex(docid);
+  RuntimeErrorIfNotOk("Error looking up docid: ", index.status());
+  return index.ValueOrDie();
+}
+
 }  // namespace research_scann
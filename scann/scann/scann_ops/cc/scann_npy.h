@@ -19,6 +19,8 @@
 #include <limits>
 #include <optional>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "absl/types/span.h"
 #include "pybind11/numpy.h"
@@ -43,7 +45,8 @@ class ScannNumpy {
              std::optional<const np_row_major_arr<float>> dp_norms,
              const std::string& artifacts_dir);
   ScannNumpy(const np_row_major_arr<float>& np_dataset,
-             const std::string& config, int training_threads);
+             const std::string& config, int training_threads,
+             std::optional<const std::vector<std::string>> docids);
   std::pair<pybind11::array_t<DatapointIndex>, pybind11::array_t<float>> Search(
       const np_row_major_arr<float>& query, int final_nn, int pre_reorder_nn,
       int leaves);
@@ -51,6 +54,12 @@ class ScannNumpy {
   SearchBatched(const np_row_major_arr<float>& queries, int final_nn,
                 int pre_reorder_nn, int leaves, bool parallel = false);
   void Serialize(std::string path);
+  int32_t MaintainLeaves();
+  void FitLeafSpillingThresholds(
+      const np_row_major_arr<float>& queries,
+      const np_row_major_arr<DatapointIndex>& neighbors, double target_recall,
+      const std::string& spilling_type);
+  DatapointIndex LookupDatapointIndex(const std::string& docid);
 
  private:
   ScannInterface scann_;
@@ -176,13 +176,25 @@ class ScannBuilder(object):
     """
 
   @_factory_decorator("reorder")
-  def reorder(self, reordering_num_neighbors, quantize=False):
+  def reorder(self,
+              reordering_num_neighbors,
+              quantize=False,
+              quantized_reordering_num_neighbors=None):
+    intermediate_stages = ""
+    if quantized_reordering_num_neighbors is not None:
+      intermediate_stages = f"""
+        intermediate_stages {{
+          num_neighbors: {quantized_reordering_num_neighbors}
+          fixed_point {{
+            enabled: True
+          }}
+        }}"""
     return f"""
       exact_reordering {{
         approx_num_neighbors: {reordering_num_neighbors}
         fixed_point {{
           enabled: {quantize}
-        }}
+        }}{intermediate_stages}
       }}
     """
 
@@ -71,6 +71,30 @@ class ScannSearcher(object):
   def serialize(self, artifacts_dir):
     self.searcher.serialize(artifacts_dir)
 
+  def maintain_leaves(self):
+    return self.searcher.maintain_leaves()
+
+  def fit_leaf_spilling_thresholds(self,
+                                   queries,
+                                   neighbors,
+                                   target_recall=0.95,
+                                   spilling_type="MULTIPLICATIVE"):
+    """Fits one query spilling threshold per leaf and rebuilds the searcher.
+
+    Args:
+      queries: sample queries, one per row.
+      neighbors: ground-truth neighbor indices, one row per query.
+      target_recall: fraction of ground-truth neighbors whose leaf should be
+        searched.
+      spilling_type: MULTIPLICATIVE, ADDITIVE or ABSOLUTE_DISTANCE.
+    """
+    self.searcher.fit_leaf_spilling_thresholds(queries, neighbors,
+                                               target_recall, spilling_type)
+
+  def lookup_datapoint_index(self, docid):
+    """Returns the index of the datapoint with the given docid."""
+    return self.searcher.lookup_datapoint_index(docid)
+
 
 def builder(db, num_neighbors, distance_measure):
   """pybind analogue of builder() in scann_ops.py; see docstring there."""
@@ -82,21 +106,28 @@ def builder(db, num_neighbors, distance_measure):
       db, num_neighbors, distance_measure).set_builder_lambda(builder_lambda)
 
 
-def create_searcher(db, scann_config, training_threads=0):
+def create_searcher(db, scann_config, training_threads=0, docids=None):
   return ScannSearcher(
-      scann_pybind.ScannNumpy(db, scann_config, training_threads))
+      scann_pybind.ScannNumpy(db, scann_config, training_threads, docids))
+
 
+def load_searcher(artifacts_dir, mmap_dataset=False):
+  """Loads searcher assets from artifacts_dir and returns a ScaNN searcher.
 
-def load_searcher(artifacts_dir):
-  """Loads searcher assets from artifacts_dir and returns a ScaNN searcher."""
+  Args:
+    artifacts_dir: directory containing the serialized searcher.
+    mmap_dataset: if True, dataset.npy and hashed_dataset.npy are
+      memory-mapped read-only instead of being copied into memory, so
+      processes loading the same artifacts share one physical copy of them.
+  """
 
   def load_if_exists(filename):
     path = os.path.join(artifacts_dir, filename)
     return np.load(path) if os.path.isfile(path) else None
 
-  db = load_if_exists("dataset.npy")
+  db = None if mmap_dataset else load_if_exists("dataset.npy")
   tokenization = load_if_exists("datapoint_to_token.npy")
-  hashed_db = load_if_exists("hashed_dataset.npy")
+  hashed_db = None if mmap_dataset else load_if_exists("hashed_dataset.npy")
   int8_db = load_if_exists("int8_dataset.npy")
   int8_multipliers = load_if_exists("int8_multipliers.npy")
   db_norms = load_if_exists("dp_norms.npy")
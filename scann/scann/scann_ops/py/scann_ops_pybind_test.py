@@ -223,6 +223,33 @@ class ScannTest(parameterized.TestCase):
         80, 10, spherical=True).score_ah(2).build()
     self.verify_serialization(s, n_dims, 20)
 
+  def test_fit_leaf_spilling_thresholds(self):
+    n_dims = 50
+    k = 10
+    ds = np.random.rand(12345, n_dims).astype(np.float32)
+    qs = np.random.rand(500, n_dims).astype(np.float32)
+    squared_l2 = np.sum(np.square(ds), axis=1) - 2 * np.matmul(qs, ds.T)
+    gt_idx = np.argsort(squared_l2, axis=1)[:, :k]
+    s = scann_ops_pybind.builder(ds, k, "squared_l2").tree(
+        100, 10).score_brute_force(False).build()
+    s.fit_leaf_spilling_thresholds(qs, gt_idx.astype(np.uint32))
+    self.assertEqual(s.search_batched(qs)[0].shape, (500, k))
+    self.verify_serialization(s, n_dims, 5)
+
+  def test_docid_lookup(self):
+    n_dims = 10
+    ds = np.random.rand(1000, n_dims).astype(np.float32)
+    docids = ["doc%d" % i for i in range(len(ds))]
+    s = scann_ops_pybind.builder(ds, 10, "dot_product").tree(
+        10, 5).score_ah(2).build(docids=docids)
+    self.assertEqual(s.lookup_datapoint_index("doc123"), 123)
+    with tempfile.TemporaryDirectory() as tmpdir:
+      s.serialize(tmpdir)
+      s2 = scann_ops_pybind.load_searcher(tmpdir)
+      self.assertEqual(s2.lookup_datapoint_index("doc456"), 456)
+      with self.assertRaises(RuntimeError):
+        s2.lookup_datapoint_index("missing")
+
 
 if __name__ == "__main__":
   absltest.main()
@@ -47,9 +47,9 @@ void AddLeafResultsToTopN(ConstSpan<DatapointIndex> local_to_global_index,
   for (const auto& result : leaf_results) {
     float dist = result.second * cluster_stdev_adjustment +
                  distance_to_center_adjustment;
-    if (dist <= epsilon) {
-      if (ABSL_PREDICT_FALSE(
-              mutator->Push(local_to_global_index[result.first], dist))) {
+    const DatapointIndex global_index = local_to_global_index[result.first];
+    if (dist <= epsilon && global_index != kInvalidDatapointIndex) {
+      if (ABSL_PREDICT_FALSE(mutator->Push(global_index, dist))) {
         mutator->GarbageCollect();
         epsilon = mutator->epsilon();
       }
@@ -75,7 +75,7 @@ StatusOr<vector<T>> CombineLeafDatasets(
 
 template <template <class> class V, typename T>
 StatusOr<SingleMachineFactoryOptions> MergeAHLeafOptions(
-    const vector<unique_ptr<V<T>>>& leaf_searchers,
+    const vector<shared_ptr<V<T>>>& leaf_searchers,
     ConstSpan<std::vector<DatapointIndex>> datapoints_by_token,
     const int expected_size) {
   const int n_leaves = leaf_searchers.size();
@@ -0,0 +1,193 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/tree_x_hybrid/lazy_leaf_cache.h"
+
+#include <cstdint>
+#include <utility>
+
+#include "absl/time/clock.h"
+#include "scann/utils/common.h"
+
+namespace research_scann {
+
+template <typename T>
+LazyLeafCache<T>::LazyLeafCache(size_t num_leaves, size_t max_resident_bytes,
+                                LeafBuilder leaf_builder)
+    : num_leaves_(num_leaves),
+      max_resident_bytes_(max_resident_bytes),
+      leaf_builder_(std::move(leaf_builder)),
+      slots_(new Slot[num_leaves]) {}
+
+template <typename T>
+StatusOr<shared_ptr<SingleMachineSearcherBase<T>>> LazyLeafCache<T>::Get(
+    int32_t token) {
+  if (token < 0 || token >= num_leaves_) {
+    return OutOfRangeError("Leaf token %d out of range [0, %d).", token,
+                           num_leaves_);
+  }
+  Slot& slot = slots_[token];
+
+  const uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+  if (slot.last_access.load(std::memory_order_relaxed) != epoch) {
+    slot.last_access.store(epoch, std::memory_order_relaxed);
+  }
+  {
+    absl::ReaderMutexLock lock(&slot.mutex);
+    if (slot.searcher) return slot.searcher;
+  }
+
+  vector<int32_t> victims;
+  shared_ptr<SingleMachineSearcherBase<T>> result;
+  {
+    absl::MutexLock slot_lock(&slot.mutex);
+    if (slot.searcher) return slot.searcher;
+
+    const absl::Time build_start = absl::Now();
+    TF_ASSIGN_OR_RETURN(unique_ptr<SingleMachineSearcherBase<T>> leaf,
+                        leaf_builder_(token));
+    shared_ptr<const MemoryPolicy> memory_policy;
+    {
+      absl::ReaderMutexLock lock(&mutex_);
+      memory_policy = memory_policy_;
+    }
+    if (memory_policy) {
+      SCANN_RETURN_IF_ERROR(leaf->ApplyMemoryPolicy(*memory_policy));
+    }
+    const size_t bytes = leaf->MemoryUsageBreakdown().TotalBytes();
+    VLOG(1) << "Materialized leaf searcher " << token << " ("
+            << static_cast<double>(bytes) / kBytesInMb << " MB) in "
+            << absl::ToDoubleSeconds(absl::Now() - build_start) << " sec.";
+
+    result = std::move(leaf);
+    slot.searcher = result;
+    slot.bytes = bytes;
+    slot.last_access.store(epoch_.fetch_add(1, std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+
+    absl::MutexLock lock(&mutex_);
+    resident_.push_back(token);
+    resident_bytes_ += bytes;
+    victims = EvictLocked(token);
+  }
+  ReleaseEvicted(victims);
+  return result;
+}
+
+template <typename T>
+vector<int32_t> LazyLeafCache<T>::EvictLocked(int32_t keep) {
+  vector<int32_t> victims;
+  if (max_resident_bytes_ == 0) return victims;
+  while (resident_bytes_ > max_resident_bytes_ && resident_.size() > 1) {
+    size_t victim_pos = resident_.size();
+    uint64_t oldest = numeric_limits<uint64_t>::max();
+    for (size_t i : IndicesOf(resident_)) {
+      if (resident_[i] == keep) continue;
+      const uint64_t last_access =
+          slots_[resident_[i]].last_access.load(std::memory_order_relaxed);
+      if (last_access < oldest) {
+        oldest = last_access;
+        victim_pos = i;
+      }
+    }
+    DCHECK_LT(victim_pos, resident_.size());
+    const int32_t victim = resident_[victim_pos];
+    resident_[victim_pos] = resident_.back();
+    resident_.pop_back();
+    resident_bytes_ -= slots_[victim].bytes;
+    victims.push_back(victim);
+  }
+  return victims;
+}
+
+template <typename T>
+void LazyLeafCache<T>::ReleaseEvicted(ConstSpan<int32_t> victims) {
+  for (int32_t victim : victims) {
+    shared_ptr<SingleMachineSearcherBase<T>> evicted;
+    {
+      absl::MutexLock lock(&slots_[victim].mutex);
+      evicted = std::move(slots_[victim].searcher);
+    }
+    VLOG(1) << "Evicted leaf searcher " << victim << ".";
+  }
+}
+
+template <typename T>
+Status LazyLeafCache<T>::ForEachResident(
+    const std::function<Status(int32_t token,
+                               SingleMachineSearcherBase<T>* leaf)>& fn) {
+  vector<int32_t> resident;
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    resident = resident_;
+  }
+  for (int32_t token : resident) {
+    shared_ptr<SingleMachineSearcherBase<T>> leaf;
+    {
+      absl::ReaderMutexLock lock(&slots_[token].mutex);
+      leaf = slots_[token].searcher;
+    }
+    if (leaf) SCANN_RETURN_IF_ERROR(fn(token, leaf.get()));
+  }
+  return OkStatus();
+}
+
+template <typename T>
+Status LazyLeafCache<T>::ApplyMemoryPolicy(const MemoryPolicy& policy) {
+  {
+    absl::MutexLock lock(&mutex_);
+    memory_policy_ = make_shared<MemoryPolicy>(policy);
+  }
+  return ForEachResident(
+      [&policy](int32_t token, SingleMachineSearcherBase<T>* leaf) {
+        return leaf->ApplyMemoryPolicy(policy);
+      });
+}
+
+template <typename T>
+size_t LazyLeafCache<T>::num_resident() const {
+  absl::ReaderMutexLock lock(&mutex_);
+  return resident_.size();
+}
+
+template <typename T>
+size_t LazyLeafCache<T>::resident_bytes() const {
+  absl::ReaderMutexLock lock(&mutex_);
+  return resident_bytes_;
+}
+
+template <typename T>
+MemoryUsageReport LazyLeafCache<T>::MemoryUsageBreakdown() const {
+  vector<int32_t> resident;
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    resident = resident_;
+  }
+  MemoryUsageReport report(
+      "lazy_leaf_searchers",
+      num_leaves_ * sizeof(Slot) + VectorStorage(resident));
+  for (int32_t token : resident) {
+    shared_ptr<SingleMachineSearcherBase<T>> leaf;
+    {
+      absl::ReaderMutexLock lock(&slots_[token].mutex);
+      leaf = slots_[token].searcher;
+    }
+    if (leaf) report.MergeFrom(leaf->MemoryUsageBreakdown());
+  }
+  return report;
+}
+
+SCANN_INSTANTIATE_TYPED_CLASS(, LazyLeafCache);
+
+}  // namespace research_scann
@@ -0,0 +1,95 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_TREE_X_HYBRID_LAZY_LEAF_CACHE_H_
+#define SCANN_TREE_X_HYBRID_LAZY_LEAF_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#include "absl/synchronization/mutex.h"
+#include "scann/base/single_machine_base.h"
+#include "scann/utils/memory_logging.h"
+#include "scann/utils/memory_policy.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+template <typename T>
+class LazyLeafCache {
+ public:
+  using LeafBuilder =
+      std::function<StatusOr<unique_ptr<SingleMachineSearcherBase<T>>>(
+          int32_t token)>;
+
+  LazyLeafCache(size_t num_leaves, size_t max_resident_bytes,
+                LeafBuilder leaf_builder);
+
+  size_t num_leaves() const { return num_leaves_; }
+
+  StatusOr<shared_ptr<SingleMachineSearcherBase<T>>> Get(int32_t token);
+
+  Status ForEachResident(
+      const std::function<Status(int32_t token,
+                                 SingleMachineSearcherBase<T>* leaf)>& fn);
+
+  Status ApplyMemoryPolicy(const MemoryPolicy& policy);
+
+  size_t num_resident() const;
+
+  size_t resident_bytes() const;
+
+  MemoryUsageReport MemoryUsageBreakdown() const;
+
+ private:
+  struct Slot {
+    absl::Mutex mutex;
+
+    shared_ptr<SingleMachineSearcherBase<T>> searcher ABSL_GUARDED_BY(mutex);
+
+    std::atomic<uint64_t> last_access{0};
+
+    size_t bytes = 0;
+  };
+
+  vector<int32_t> EvictLocked(int32_t keep)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  void ReleaseEvicted(ConstSpan<int32_t> victims);
+
+  const size_t num_leaves_;
+
+  const size_t max_resident_bytes_;
+
+  const LeafBuilder leaf_builder_;
+
+  unique_ptr<Slot[]> slots_;
+
+  std::atomic<uint64_t> epoch_{0};
+
+  mutable absl::Mutex mutex_;
+
+  vector<int32_t> resident_ ABSL_GUARDED_BY(mutex_);
+
+  size_t resident_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  shared_ptr<const MemoryPolicy> memory_policy_ ABSL_GUARDED_BY(mutex_);
+};
+
+SCANN_INSTANTIATE_TYPED_CLASS(extern, LazyLeafCache);
+
+}  // namespace research_scann
+
+#endif
@@ -17,9 +17,11 @@
 #include "scann/tree_x_hybrid/tree_ah_hybrid_residual.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <numeric>
 #include <unordered_set>
+#include <utility>
 
 #include "absl/flags/flag.h"
 #include "absl/synchronization/mutex.h"
@@ -42,8 +44,10 @@
 #include "scann/tree_x_hybrid/internal/batching.h"
 #include "scann/tree_x_hybrid/internal/utils.h"
 #include "scann/tree_x_hybrid/tree_x_params.h"
+#include "scann/utils/datapoint_utils.h"
 #include "scann/utils/fast_top_neighbors.h"
 #include "scann/utils/types.h"
+#include "scann/utils/util_functions.h"
 #include "tensorflow/core/lib/core/errors.h"
 
 namespace research_scann {
@@ -52,20 +56,21 @@ using asymmetric_hashing2::AsymmetricHashingOptionalParameters;
 
 Status TreeAHHybridResidual::EnableCrowdingImpl(
     ConstSpan<int64_t> datapoint_index_to_crowding_attribute) {
-  if (leaf_searchers_.empty()) return OkStatus();
-  for (size_t token = 0; token < leaf_searchers_.size(); ++token) {
-    ConstSpan<DatapointIndex> cur_leaf_datapoints = datapoints_by_token_[token];
+  if (leaves_.empty()) return OkStatus();
+  for (size_t token = 0; token < leaves_.size(); ++token) {
+    ConstSpan<DatapointIndex> cur_leaf_datapoints = leaves_[token]->datapoints;
     vector<int64_t> leaf_datapoint_index_to_crowding_attribute(
         cur_leaf_datapoints.size());
     for (size_t i = 0; i < cur_leaf_datapoints.size(); ++i) {
+      if (cur_leaf_datapoints[i] == kInvalidDatapointIndex) continue;
       leaf_datapoint_index_to_crowding_attribute[i] =
           datapoint_index_to_crowding_attribute[cur_leaf_datapoints[i]];
     }
-    Status status = leaf_searchers_[token]->EnableCrowding(
+    Status status = leaves_[token]->searcher->EnableCrowding(
         std::move(leaf_datapoint_index_to_crowding_attribute));
     if (!status.ok()) {
       for (size_t i = 0; i <= token; ++i) {
-        leaf_searchers_[i]->DisableCrowding();
+        leaves_[i]->searcher->DisableCrowding();
       }
     }
   }
@@ -73,15 +78,15 @@ Status TreeAHHybridResidual::EnableCrowdingImpl(
 }
 
 void TreeAHHybridResidual::DisableCrowdingImpl() {
-  for (auto& ls : leaf_searchers_) {
-    ls->DisableCrowding();
+  for (auto& leaf : leaves_) {
+    leaf->searcher->DisableCrowding();
   }
 }
 
 Status TreeAHHybridResidual::CheckBuildLeafSearchersPreconditions(
     const AsymmetricHasherConfig& config,
     const KMeansTreeLikePartitioner<float>& partitioner) const {
-  if (!leaf_searchers_.empty()) {
+  if (!leaves_.empty()) {
     return FailedPreconditionErrorBuilder().LogError()
            << "BuildLeafSearchers must not be called more than once per "
               "instance.";
@@ -131,16 +136,22 @@ StatusOr<DenseDataset<float>> ComputeResidualsImpl(
   const size_t dimensionality = dataset.dimensionality();
 
   vector<uint32_t> tokens_by_datapoint(dataset.size());
+  vector<bool> is_assigned(dataset.size(), false);
+  vector<pair<DatapointIndex, uint32_t>> spilled_assignments;
   for (uint32_t token : Seq(datapoints_by_token.size())) {
     for (DatapointIndex dp_idx : datapoints_by_token[token]) {
-      DCHECK_EQ(tokens_by_datapoint[dp_idx], 0);
-      tokens_by_datapoint[dp_idx] = token;
+      if (is_assigned[dp_idx]) {
+        spilled_assignments.emplace_back(dp_idx, token);
+      } else {
+        is_assigned[dp_idx] = true;
+        tokens_by_datapoint[dp_idx] = token;
+      }
     }
   }
 
   DenseDataset<float> residuals;
   residuals.set_dimensionality(dimensionality);
-  residuals.Reserve(dataset.size());
+  residuals.Reserve(dataset.size() + spilled_assignments.size());
 
   for (size_t dp_idx : Seq(dataset.size())) {
     const uint32_t token = tokens_by_datapoint[dp_idx];
@@ -148,6 +159,11 @@ StatusOr<DenseDataset<float>> ComputeResidualsImpl(
     residuals.AppendOrDie(residual, "");
   }
 
+  for (const auto& [dp_idx, token] : spilled_assignments) {
+    TF_ASSIGN_OR_RETURN(auto residual, get_residual(dataset[dp_idx], token));
+    residuals.AppendOrDie(residual, "");
+  }
+
   return residuals;
 }
 
@@ -274,8 +290,26 @@ Status TreeAHHybridResidual::BuildLeafSearchers(
 
   const bool normalize_residual_by_cluster_stdev =
       config.use_normalized_residual_quantization();
+  normalize_residual_by_cluster_stdev_ = normalize_residual_by_cluster_stdev;
 
   if (hashed_dataset) {
+    vector<uint8_t> assigned(hashed_dataset->size());
+    for (const auto& vec : datapoints_by_token) {
+      for (DatapointIndex dp_idx : vec) {
+        if (dp_idx >= assigned.size()) {
+          return InvalidArgumentError(
+              "Datapoint %d is out of range for a hashed dataset of size %d.",
+              dp_idx, hashed_dataset->size());
+        }
+        if (assigned[dp_idx]) {
+          return InvalidArgumentError(
+              "A precomputed hashed dataset holds one code per datapoint, but "
+              "datapoint %d is assigned to more than one partition.",
+              dp_idx);
+        }
+        assigned[dp_idx] = 1;
+      }
+    }
     get_hashed_datapoint = [hashed_dataset](DatapointIndex i, int32_t token,
                                             Datapoint<uint8_t>* storage)
         -> StatusOr<DatapointPtr<uint8_t>> { return (*hashed_dataset)[i]; };
@@ -310,7 +344,7 @@ Status TreeAHHybridResidual::BuildLeafSearchers(
   asymmetric_queryer_ =
       std::make_shared<asymmetric_hashing2::AsymmetricQueryer<float>>(
           projector, lookup_distance, ah_model);
-  leaf_searchers_ = vector<unique_ptr<asymmetric_hashing2::Searcher<float>>>(
+  vector<shared_ptr<asymmetric_hashing2::Searcher<float>>> leaf_searchers(
       datapoints_by_token.size());
   Status status = OkStatus();
   absl::Mutex status_mutex;
@@ -345,12 +379,12 @@ Status TreeAHHybridResidual::BuildLeafSearchers(
                                                      indexer);
     opts.set_asymmetric_lookup_type(lookup_type_tag_);
     opts.set_noise_shaping_threshold(config.noise_shaping_threshold());
-    leaf_searchers_[token] = make_unique<asymmetric_hashing2::Searcher<float>>(
+    leaf_searchers[token] = make_shared<asymmetric_hashing2::Searcher<float>>(
         nullptr, std::move(hashed_partition), std::move(opts),
         default_pre_reordering_num_neighbors(),
         default_pre_reordering_epsilon());
-    if (!leaf_searchers_[token]->needs_hashed_dataset()) {
-      leaf_searchers_[token]->ReleaseHashedDataset();
+    if (!leaf_searchers[token]->needs_hashed_dataset()) {
+      leaf_searchers[token]->ReleaseHashedDataset();
     }
     VLOG(1) << "Built leaf searcher " << token + 1 << " of "
             << datapoints_by_token.size()
@@ -364,8 +398,25 @@ Status TreeAHHybridResidual::BuildLeafSearchers(
       num_datapoints_ = std::max(token + 1, num_datapoints_);
     }
   }
+  vector<uint8_t> assignment_counts(num_datapoints_);
+  max_assignments_per_datapoint_ = 1;
+  for (auto& vec : datapoints_by_token) {
+    for (DatapointIndex dp_idx : vec) {
+      uint8_t& count = assignment_counts[dp_idx];
+      if (count < numeric_limits<uint8_t>::max()) ++count;
+      max_assignments_per_datapoint_ =
+          std::max<int32_t>(max_assignments_per_datapoint_, count);
+    }
+  }
+  disjoint_leaf_partitions_ = max_assignments_per_datapoint_ == 1;
 
-  datapoints_by_token_ = std::move(datapoints_by_token);
+  leaves_.resize(datapoints_by_token.size());
+  for (size_t token : IndicesOf(datapoints_by_token)) {
+    auto leaf = make_shared<Leaf>();
+    leaf->searcher = std::move(leaf_searchers[token]);
+    leaf->datapoints = std::move(datapoints_by_token[token]);
+    leaves_[token] = std::move(leaf);
+  }
   leaf_tokens_by_norm_ = OrderLeafTokensByCenterNorm(*partitioner);
   partitioner->set_tokenization_mode(UntypedPartitioner::QUERY);
   query_tokenizer_ = std::move(partitioner);
@@ -375,6 +426,68 @@ Status TreeAHHybridResidual::BuildLeafSearchers(
   return OkStatus();
 }
 
+Status TreeAHHybridResidual::FindNeighbors(const DatapointPtr<float>& query,
+                                           const SearchParameters& params,
+                                           NNResultsVector* result) const {
+  SCANN_RET_CHECK(query.IsFinite())
+      << "Cannot query ScaNN with vectors that contain NaNs or infinity.";
+  DCHECK(result);
+  SCANN_RETURN_IF_ERROR(
+      FindNeighborsNoSortNoExactReorder(query, params, result));
+  if (this->reordering_enabled()) {
+    absl::ReaderMutexLock lock(&dataset_mutex_);
+    DropRemovedNeighbors(result);
+    SCANN_RETURN_IF_ERROR(this->ReorderResults(query, params, result));
+  }
+  return this->SortAndDropResults(result, params);
+}
+
+Status TreeAHHybridResidual::FindNeighborsBatched(
+    const TypedDataset<float>& queries, ConstSpan<SearchParameters> params,
+    MutableSpan<NNResultsVector> results) const {
+  SCANN_RETURN_IF_ERROR(
+      FindNeighborsBatchedNoSortNoExactReorder(queries, params, results));
+  if (this->reordering_enabled()) {
+    absl::ReaderMutexLock lock(&dataset_mutex_);
+    for (DatapointIndex i = 0; i < queries.size(); ++i) {
+      DropRemovedNeighbors(&results[i]);
+      SCANN_RETURN_IF_ERROR(
+          this->ReorderResults(queries[i], params[i], &results[i]));
+    }
+  }
+  for (DatapointIndex i = 0; i < results.size(); ++i) {
+    SCANN_RETURN_IF_ERROR(this->SortAndDropResults(&results[i], params[i]));
+  }
+  return OkStatus();
+}
+
+void TreeAHHybridResidual::DropRemovedNeighbors(NNResultsVector* result) const {
+  const DatapointIndex num_datapoints = num_datapoints_;
+  result->erase(
+      std::remove_if(result->begin(), result->end(),
+                     [num_datapoints](const pair<DatapointIndex, float>& r) {
+                       return r.first >= num_datapoints;
+                     }),
+      result->end());
+}
+
+shared_ptr<const TreeAHHybridResidual::Leaf>
+TreeAHHybridResidual::SnapshotLeaf(int32_t token) const {
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
+  return leaves_[token];
+}
+
+vector<shared_ptr<const TreeAHHybridResidual::Leaf>>
+TreeAHHybridResidual::SnapshotLeaves(
+    ConstSpan<KMeansTreeSearchResult> centers_to_search) const {
+  vector<shared_ptr<const Leaf>> result(centers_to_search.size());
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
+  for (size_t i : IndicesOf(centers_to_search)) {
+    result[i] = leaves_[centers_to_search[i].node->LeafId()];
+  }
+  return result;
+}
+
 Status TreeAHHybridResidual::FindNeighborsImpl(const DatapointPtr<float>& query,
                                                const SearchParameters& params,
                                                NNResultsVector* result) const {
@@ -423,6 +536,17 @@ inline void AssignResults(TopN* top_n, NNResultsVector* results) {
   top_n->FinishUnsorted(results);
 }
 
+void RemoveSpilledDuplicates(int32_t num_neighbors, NNResultsVector* results) {
+  std::sort(results->begin(), results->end());
+  results->erase(std::unique(results->begin(), results->end(),
+                             [](const pair<DatapointIndex, float>& a,
+                                const pair<DatapointIndex, float>& b) {
+                               return a.first == b.first;
+                             }),
+                 results->end());
+  RemoveNeighborsPastLimit(num_neighbors, results);
+}
+
 }  // namespace
 
 Status TreeAHHybridResidual::FindNeighborsBatchedImpl(
@@ -452,9 +576,10 @@ Status TreeAHHybridResidual::FindNeighborsBatchedImpl(
     SCANN_RETURN_IF_ERROR(
         query_tokenizer_->TokensForDatapointWithSpillingBatched(
             queries, vector<int32_t>(), MakeMutableSpan(centers_to_search)));
+  const shared_ptr<const Leaf> first_leaf = SnapshotLeaf(0);
   if (!tree_x_internal::SupportsLowLevelBatching(queries, params) ||
-      !leaf_searchers_[0]->lut16_ ||
-      leaf_searchers_[0]->opts_.quantization_scheme() ==
+      !first_leaf->searcher->lut16_ ||
+      first_leaf->searcher->opts_.quantization_scheme() ==
           AsymmetricHasherConfig::PRODUCT_AND_BIAS) {
     for (size_t i = 0; i < centers_to_search.size(); ++i) {
       SCANN_RETURN_IF_ERROR(FindNeighborsInternal1(
@@ -464,6 +589,13 @@ Status TreeAHHybridResidual::FindNeighborsBatchedImpl(
   }
   auto queries_by_leaf =
       InvertCentersToSearch(centers_to_search, query_tokenizer_->n_tokens());
+  vector<shared_ptr<const Leaf>> leaves(queries_by_leaf.size());
+  {
+    absl::ReaderMutexLock lock(&leaf_update_mutex_);
+    for (size_t token : IndicesOf(queries_by_leaf)) {
+      if (!queries_by_leaf[token].empty()) leaves[token] = leaves_[token];
+    }
+  }
   vector<shared_ptr<const SearcherSpecificOptionalParameters>> lookup_tables(
       queries.size());
   for (size_t i : IndicesOf(queries)) {
@@ -476,7 +608,7 @@ Status TreeAHHybridResidual::FindNeighborsBatchedImpl(
   vector<FastTopNeighbors<float>::Mutator> mutators(params.size());
   top_ns.reserve(params.size());
   for (const auto& [idx, p] : Enumerate(params)) {
-    top_ns.emplace_back(p.pre_reordering_num_neighbors(),
+    top_ns.emplace_back(SpilledNumNeighbors(p.pre_reordering_num_neighbors()),
                         p.pre_reordering_epsilon());
     top_ns[idx].AcquireMutator(&mutators[idx]);
   }
@@ -484,9 +616,16 @@ Status TreeAHHybridResidual::FindNeighborsBatchedImpl(
   for (size_t leaf_token : leaf_tokens_by_norm_) {
     ConstSpan<QueryForLeaf> queries_for_cur_leaf = queries_by_leaf[leaf_token];
     if (queries_for_cur_leaf.empty()) continue;
+    const Leaf& leaf = *leaves[leaf_token];
     vector<SearchParameters> leaf_params =
         tree_x_internal::CreateParamsSubsetForLeaf<QueryForLeaf>(
             params, mutators, lookup_tables, queries_for_cur_leaf);
+    if (leaf.num_tombstones > 0) {
+      for (SearchParameters& p : leaf_params) {
+        p.set_pre_reordering_num_neighbors(p.pre_reordering_num_neighbors() +
+                                           leaf.num_tombstones);
+      }
+    }
     auto get_query = [&queries, &queries_for_cur_leaf](DatapointIndex i) {
       return queries[queries_for_cur_leaf[i].query_index];
     };
@@ -495,13 +634,11 @@ Status TreeAHHybridResidual::FindNeighborsBatchedImpl(
     using asymmetric_hashing_internal::IdentityPostprocessFunctor;
     IdentityPostprocessFunctor postprocess;
     SCANN_RETURN_IF_ERROR(
-        leaf_searchers_[leaf_token]
-            ->FindNeighborsBatchedInternal<IdentityPostprocessFunctor>(
-                get_query, leaf_params, postprocess,
-                MakeMutableSpan(leaf_results)));
+        leaf.searcher->FindNeighborsBatchedInternal<IdentityPostprocessFunctor>(
+            get_query, leaf_params, postprocess,
+            MakeMutableSpan(leaf_results)));
 
-    ConstSpan<DatapointIndex> local_to_global_index =
-        datapoints_by_token_[leaf_token];
+    ConstSpan<DatapointIndex> local_to_global_index = leaf.datapoints;
     auto status_or_partition_stdev =
         query_tokenizer_->ResidualStdevForToken(leaf_token);
     const float partition_stdev = status_or_partition_stdev.ok()
@@ -518,6 +655,10 @@ Status TreeAHHybridResidual::FindNeighborsBatchedImpl(
   for (size_t query_index = 0; query_index < results.size(); ++query_index) {
     mutators[query_index].Release();
     top_ns[query_index].FinishUnsorted(&results[query_index]);
+    if (!disjoint_leaf_partitions_) {
+      RemoveSpilledDuplicates(params[query_index].pre_reordering_num_neighbors(),
+                              &results[query_index]);
+    }
   }
   return OkStatus();
 }
@@ -528,9 +669,18 @@ Status TreeAHHybridResidual::FindNeighborsInternal1(
     NNResultsVector* result) const {
   if (params.pre_reordering_crowding_enabled()) {
     return FailedPreconditionError("Crowding is not supported.");
-  } else if (enable_global_topn_) {
-    FastTopNeighbors<float> top_n(params.pre_reordering_num_neighbors(),
-                                  params.pre_reordering_epsilon());
+  }
+  const vector<shared_ptr<const Leaf>> leaves =
+      SnapshotLeaves(centers_to_search);
+  if (enable_global_topn_) {
+    DatapointIndex num_tombstones = 0;
+    for (const auto& leaf : leaves) {
+      num_tombstones += leaf->num_tombstones;
+    }
+    FastTopNeighbors<float> top_n(
+        SpilledNumNeighbors(params.pre_reordering_num_neighbors()) +
+            num_tombstones,
+        params.pre_reordering_epsilon());
     DCHECK(result);
     SearchParameters leaf_params;
     leaf_params.set_pre_reordering_num_neighbors(
@@ -558,15 +708,14 @@ Status TreeAHHybridResidual::FindNeighborsInternal1(
     NNResultsVector unused_leaf_results;
 
     for (size_t i = 0; i < centers_to_search.size(); ++i) {
-      const uint32_t token = centers_to_search[i].node->LeafId();
       const float distance_to_center = centers_to_search[i].distance_to_center;
-      leaf_specific_params->SetIndexAndBias(token << global_topn_shift_,
+      leaf_specific_params->SetIndexAndBias(i << global_topn_shift_,
                                             distance_to_center);
 
-      TranslateGlobalToLeafLocalWhitelist(params, datapoints_by_token_[token],
+      TranslateGlobalToLeafLocalWhitelist(params, leaves[i]->datapoints,
                                           &leaf_params);
       SCANN_RETURN_IF_ERROR(
-          leaf_searchers_[token]->FindNeighborsNoSortNoExactReorder(
+          leaves[i]->searcher->FindNeighborsNoSortNoExactReorder(
               query, leaf_params, &unused_leaf_results));
     }
 
@@ -574,28 +723,42 @@ Status TreeAHHybridResidual::FindNeighborsInternal1(
 
     const uint32_t local_idx_mask = (1u << global_topn_shift_) - 1;
     for (pair<DatapointIndex, float>& idx_dis : *result) {
-      uint32_t partition_idx = idx_dis.first >> global_topn_shift_;
+      uint32_t center_idx = idx_dis.first >> global_topn_shift_;
       uint32_t local_idx = idx_dis.first & local_idx_mask;
-      idx_dis.first = datapoints_by_token_[partition_idx][local_idx];
+      idx_dis.first = leaves[center_idx]->datapoints[local_idx];
+    }
+    result->erase(std::remove_if(result->begin(), result->end(),
+                                 [](const pair<DatapointIndex, float>& r) {
+                                   return r.first == kInvalidDatapointIndex;
+                                 }),
+                  result->end());
+    if (!disjoint_leaf_partitions_) {
+      RemoveSpilledDuplicates(params.pre_reordering_num_neighbors(), result);
+    } else if (num_tombstones > 0) {
+      RemoveNeighborsPastLimit(params.pre_reordering_num_neighbors(), result);
     }
     return OkStatus();
   } else {
-    FastTopNeighbors<float> top_n(params.pre_reordering_num_neighbors(),
-                                  params.pre_reordering_epsilon());
-    return FindNeighborsInternal2(query, params, centers_to_search,
-                                  std::move(top_n), result);
+    FastTopNeighbors<float> top_n(
+        SpilledNumNeighbors(params.pre_reordering_num_neighbors()),
+        params.pre_reordering_epsilon());
+    SCANN_RETURN_IF_ERROR(FindNeighborsInternal2(
+        query, params, centers_to_search, leaves, std::move(top_n), result));
+    if (!disjoint_leaf_partitions_) {
+      RemoveSpilledDuplicates(params.pre_reordering_num_neighbors(), result);
+    }
+    return OkStatus();
   }
 }
 
 template <typename TopN>
 Status TreeAHHybridResidual::FindNeighborsInternal2(
     const DatapointPtr<float>& query, const SearchParameters& params,
-    ConstSpan<KMeansTreeSearchResult> centers_to_search, TopN top_n,
+    ConstSpan<KMeansTreeSearchResult> centers_to_search,
+    ConstSpan<shared_ptr<const Leaf>> leaves, TopN top_n,
     NNResultsVector* result) const {
   DCHECK(result);
   SearchParameters leaf_params;
-  leaf_params.set_pre_reordering_num_neighbors(
-      params.pre_reordering_num_neighbors());
   leaf_params.set_per_crowding_attribute_pre_reordering_num_neighbors(
       params.per_crowding_attribute_pre_reordering_num_neighbors());
   auto query_preprocessing_results =
@@ -616,19 +779,19 @@ Status TreeAHHybridResidual::FindNeighborsInternal2(
   typename TopN::Mutator mutator;
   top_n.AcquireMutator(&mutator);
   for (size_t i = 0; i < centers_to_search.size(); ++i) {
-    const int32_t token = centers_to_search[i].node->LeafId();
+    const Leaf& leaf = *leaves[i];
     NNResultsVector leaf_results;
     const float distance_to_center = centers_to_search[i].distance_to_center;
     leaf_params.set_pre_reordering_epsilon(mutator.epsilon() -
                                            distance_to_center);
-    TranslateGlobalToLeafLocalWhitelist(params, datapoints_by_token_[token],
-                                        &leaf_params);
-    SCANN_RETURN_IF_ERROR(
-        leaf_searchers_[token]->FindNeighborsNoSortNoExactReorder(
-            query, leaf_params, &leaf_results));
+    leaf_params.set_pre_reordering_num_neighbors(
+        params.pre_reordering_num_neighbors() + leaf.num_tombstones);
+    TranslateGlobalToLeafLocalWhitelist(params, leaf.datapoints, &leaf_params);
+    SCANN_RETURN_IF_ERROR(leaf.searcher->FindNeighborsNoSortNoExactReorder(
+        query, leaf_params, &leaf_results));
     float cluster_stdev_adjustment = centers_to_search[i].residual_stdev;
     tree_x_internal::AddLeafResultsToTopN(
-        datapoints_by_token_[token], distance_to_center,
+        leaf.datapoints, distance_to_center,
         cluster_stdev_adjustment, leaf_results, &mutator);
   }
   mutator.Release();
@@ -643,6 +806,13 @@ TreeAHHybridResidual::TokenizeAndMaybeResidualize(
   KMeansTreeSearchResult token_storage;
   SCANN_RETURN_IF_ERROR(
       database_tokenizer_->TokenForDatapoint(dptr, &token_storage));
+  const int32_t token = token_storage.node->LeafId();
+  if (normalize_residual_by_cluster_stdev_) {
+    TF_ASSIGN_OR_RETURN(*residual_storage,
+                        database_tokenizer_->ResidualizeToFloat(
+                            dptr, token, normalize_residual_by_cluster_stdev_));
+    return std::make_pair(token, residual_storage->ToPtr());
+  }
   residual_storage->clear();
   auto& vals = *residual_storage->mutable_values();
   vals.resize(dptr.values_slice().size());
@@ -650,8 +820,7 @@ TreeAHHybridResidual::TokenizeAndMaybeResidualize(
   for (size_t i : IndicesOf(vals)) {
     vals[i] = dptr.values()[i] - center.values()[i];
   }
-  return std::make_pair(token_storage.node->LeafId(),
-                        residual_storage->ToPtr());
+  return std::make_pair(token, residual_storage->ToPtr());
 }
 
 StatusOr<vector<pair<int32_t, DatapointPtr<float>>>>
@@ -677,19 +846,74 @@ TreeAHHybridResidual::TokenizeAndMaybeResidualize(
   return result;
 }
 
+Status TreeAHHybridResidual::ApplyMemoryPolicy(const MemoryPolicy& policy) {
+  SCANN_RETURN_IF_ERROR(
+      SingleMachineSearcherBase<float>::ApplyMemoryPolicy(policy));
+  absl::MutexLock lock(&mutation_mutex_);
+  for (const auto& leaf : leaves_) {
+    SCANN_RETURN_IF_ERROR(leaf->searcher->ApplyMemoryPolicy(policy));
+    SCANN_RETURN_IF_ERROR(research_scann::ApplyMemoryPolicy(
+        policy, MakeConstSpan(leaf->datapoints)));
+  }
+  return OkStatus();
+}
+
+MemoryUsageReport TreeAHHybridResidual::MemoryUsageBreakdown() const {
+  absl::MutexLock lock(&mutation_mutex_);
+  absl::ReaderMutexLock dataset_lock(&dataset_mutex_);
+  MemoryUsageReport report =
+      SingleMachineSearcherBase<float>::MemoryUsageBreakdown();
+  report.set_name("TreeAHHybridResidual");
+  size_t datapoints_by_token_bytes = 0;
+  for (const auto& leaf : leaves_) {
+    datapoints_by_token_bytes += VectorStorage(leaf->datapoints);
+  }
+  report.AddChild("datapoints_by_token", datapoints_by_token_bytes);
+  report.AddChild("leaf_tokens_by_norm", VectorStorage(leaf_tokens_by_norm_));
+  if (query_tokenizer_) {
+    report.AddChild(query_tokenizer_->MemoryUsageBreakdown())
+        .set_name("query_tokenizer");
+  }
+  if (database_tokenizer_) {
+    report.AddSharedChild("database_tokenizer", database_tokenizer_.get(), 0)
+        .MergeFrom(database_tokenizer_->MemoryUsageBreakdown());
+  }
+  MemoryUsageReport leaves("leaf_searchers", VectorStorage(leaves_));
+  for (const auto& leaf : leaves_) {
+    leaves.MergeFrom(leaf->searcher->MemoryUsageBreakdown());
+  }
+  report.AddChild("mutation_state", VectorStorage(leaf_slot_by_datapoint_));
+  report.AddChild(std::move(leaves));
+  return report;
+}
+
 StatusOr<SingleMachineFactoryOptions>
 TreeAHHybridResidual::ExtractSingleMachineFactoryOptions() {
+  {
+    absl::MutexLock lock(&mutation_mutex_);
+    for (size_t token : IndicesOf(leaves_)) {
+      if (leaves_[token]->num_tombstones > 0) {
+        SCANN_RETURN_IF_ERROR(CompactLeafLocked(token));
+      }
+    }
+  }
   TF_ASSIGN_OR_RETURN(const int dataset_size,
                       UntypedSingleMachineSearcherBase::DatasetSize());
+  vector<shared_ptr<asymmetric_hashing2::Searcher<float>>> leaf_searchers;
+  leaf_searchers.reserve(leaves_.size());
+  for (const auto& leaf : leaves_) {
+    leaf_searchers.push_back(leaf->searcher);
+  }
+  auto datapoints_by_token =
+      std::make_shared<vector<std::vector<DatapointIndex>>>(
+          DatapointsByToken());
   TF_ASSIGN_OR_RETURN(
       SingleMachineFactoryOptions leaf_opts,
-      MergeAHLeafOptions(leaf_searchers_, datapoints_by_token_, dataset_size));
+      MergeAHLeafOptions(leaf_searchers, *datapoints_by_token, dataset_size));
   TF_ASSIGN_OR_RETURN(
       auto opts,
       SingleMachineSearcherBase<float>::ExtractSingleMachineFactoryOptions());
-  opts.datapoints_by_token =
-      std::make_shared<vector<std::vector<DatapointIndex>>>(
-          datapoints_by_token_);
+  opts.datapoints_by_token = std::move(datapoints_by_token);
   opts.serialized_partitioner = std::make_shared<SerializedPartitioner>();
   query_tokenizer_->CopyToProto(opts.serialized_partitioner.get());
 
@@ -700,14 +924,24 @@ TreeAHHybridResidual::ExtractSingleMachineFactoryOptions() {
   return opts;
 }
 
+vector<std::vector<DatapointIndex>> TreeAHHybridResidual::DatapointsByToken()
+    const {
+  vector<std::vector<DatapointIndex>> result;
+  result.reserve(leaves_.size());
+  for (const auto& leaf : leaves_) {
+    result.push_back(leaf->datapoints);
+  }
+  return result;
+}
+
 void TreeAHHybridResidual::AttemptEnableGlobalTopN() {
-  if (datapoints_by_token_.empty()) {
-    LOG(ERROR) << "datapoints_by_token_ is empty. EnableGlobalTopN() should be "
+  if (leaves_.empty()) {
+    LOG(ERROR) << "leaves_ is empty. EnableGlobalTopN() should be "
                   "called after all leaves are trained and initialized.";
     return;
   }
   StatusOr<uint8_t> status_or_shift =
-      ComputeGlobalTopNShift(datapoints_by_token_);
+      ComputeGlobalTopNShift(DatapointsByToken());
   if (!status_or_shift.ok()) {
     LOG(ERROR) << "Cannot enable global top-N: " << status_or_shift.status();
     return;
@@ -716,4 +950,399 @@ void TreeAHHybridResidual::AttemptEnableGlobalTopN() {
   enable_global_topn_ = true;
 }
 
+Status TreeAHHybridResidual::InitializeMutationLocked() {
+  if (this->crowding_enabled()) {
+    return FailedPreconditionError(
+        "TreeAHHybridResidual does not support mutation with crowding.");
+  }
+  if (mutation_initialized_) return OkStatus();
+  if (leaves_.empty()) {
+    return FailedPreconditionError(
+        "BuildLeafSearchers must be called before mutating a "
+        "TreeAHHybridResidual.");
+  }
+  if (!disjoint_leaf_partitions_) {
+    return FailedPreconditionError(
+        "TreeAHHybridResidual mutation requires disjoint (non-spilled) "
+        "database partitions.");
+  }
+  for (const auto& leaf : leaves_) {
+    const auto& searcher = *leaf->searcher;
+    if (searcher.opts_.quantization_scheme() !=
+            AsymmetricHasherConfig::PRODUCT ||
+        searcher.limited_inner_product_ || !searcher.bias_.empty()) {
+      return UnimplementedError(
+          "TreeAHHybridResidual mutation only supports PRODUCT quantization "
+          "without limited inner product.");
+    }
+    if (!searcher.opts_.indexer()) {
+      return FailedPreconditionError(
+          "Leaf searchers must have an Indexer for mutation.");
+    }
+  }
+  if (this->dataset() && this->dataset()->size() != num_datapoints_) {
+    return FailedPreconditionError(
+        "Dataset has %d datapoints but the leaf searchers index %d.",
+        this->dataset()->size(), num_datapoints_);
+  }
+  if (this->reordering_enabled() &&
+      this->reordering_helper().owns_mutation_data_structures()) {
+    SCANN_RETURN_IF_ERROR(this->reordering_helper().GetMutator().status());
+  }
+
+  leaf_slot_by_datapoint_.assign(num_datapoints_,
+                                 {-1, kInvalidDatapointIndex});
+  for (const auto& [token, leaf] : Enumerate(leaves_)) {
+    for (const auto& [local_index, dp_index] : Enumerate(leaf->datapoints)) {
+      if (dp_index == kInvalidDatapointIndex) continue;
+      leaf_slot_by_datapoint_[dp_index] = {token, local_index};
+    }
+  }
+  mutation_initialized_ = true;
+  return OkStatus();
+}
+
+StatusOr<pair<int32_t, Datapoint<uint8_t>>>
+TreeAHHybridResidual::TokenizeAndHash(const DatapointPtr<float>& dptr) {
+  if (!database_tokenizer_) {
+    return FailedPreconditionError(
+        "A database tokenizer is required to mutate a TreeAHHybridResidual.");
+  }
+  Datapoint<float> residual_storage;
+  TF_ASSIGN_OR_RETURN(auto token_and_residual,
+                      TokenizeAndMaybeResidualize(dptr, &residual_storage));
+  const int32_t token = token_and_residual.first;
+  if (token < 0 || token >= leaves_.size()) {
+    return FailedPreconditionError(
+        "Database tokenizer returned token %d but there are %d leaves.",
+        token, leaves_.size());
+  }
+  const shared_ptr<const Leaf> leaf = SnapshotLeaf(token);
+  const auto& opts = leaf->searcher->opts_;
+  Datapoint<uint8_t> hashed;
+  if (std::isnan(opts.noise_shaping_threshold())) {
+    SCANN_RETURN_IF_ERROR(
+        opts.indexer()->Hash(token_and_residual.second, &hashed));
+  } else {
+    SCANN_RETURN_IF_ERROR(opts.indexer()->HashWithNoiseShaping(
+        token_and_residual.second, dptr, &hashed,
+        opts.noise_shaping_threshold()));
+  }
+  return std::make_pair(token, std::move(hashed));
+}
+
+shared_ptr<asymmetric_hashing2::Searcher<float>>
+TreeAHHybridResidual::MakeLeafSearcher(
+    const asymmetric_hashing2::Searcher<float>& prototype,
+    shared_ptr<DenseDataset<uint8_t>> hashed_dataset,
+    asymmetric_hashing2::PackedDataset packed_dataset) {
+  const bool has_hashed_dataset = hashed_dataset != nullptr;
+  if (!has_hashed_dataset) {
+    hashed_dataset = make_shared<DenseDataset<uint8_t>>();
+  }
+  auto result = make_shared<asymmetric_hashing2::Searcher<float>>(
+      nullptr, std::move(hashed_dataset), prototype.opts_,
+      prototype.default_pre_reordering_num_neighbors(),
+      prototype.default_pre_reordering_epsilon());
+  if (result->lut16_ && !has_hashed_dataset) {
+    result->SetPackedDataset(std::move(packed_dataset));
+  }
+  if (!result->needs_hashed_dataset()) {
+    result->ReleaseHashedDataset();
+  }
+  return result;
+}
+
+StatusOr<shared_ptr<asymmetric_hashing2::Searcher<float>>>
+TreeAHHybridResidual::CopyLeafSearcherWithCode(
+    const asymmetric_hashing2::Searcher<float>& leaf,
+    const Datapoint<uint8_t>& hashed, DatapointIndex local_index) {
+  shared_ptr<DenseDataset<uint8_t>> hashed_dataset;
+  asymmetric_hashing2::PackedDataset packed;
+  if (leaf.hashed_dataset()) {
+    hashed_dataset =
+        make_shared<DenseDataset<uint8_t>>(leaf.hashed_dataset()->Copy());
+    TF_ASSIGN_OR_RETURN(auto* hashed_mutator, hashed_dataset->GetMutator());
+    if (local_index == hashed_dataset->size()) {
+      SCANN_RETURN_IF_ERROR(hashed_mutator->AddDatapoint(hashed.ToPtr(), ""));
+    } else {
+      SCANN_RETURN_IF_ERROR(
+          hashed_mutator->UpdateDatapoint(hashed.ToPtr(), local_index));
+    }
+  } else if (leaf.lut16_) {
+    const asymmetric_hashing2::PackedDataset& old_packed = leaf.packed_dataset_;
+    packed.num_blocks = old_packed.num_blocks;
+    packed.num_datapoints = old_packed.num_datapoints;
+    packed.bit_packed_data.reserve(old_packed.bit_packed_data.size() +
+                                   16 * hashed.nonzero_entries());
+    packed.bit_packed_data.assign(old_packed.bit_packed_data.begin(),
+                                  old_packed.bit_packed_data.end());
+    if (local_index == packed.num_datapoints) {
+      asymmetric_hashing2::AppendPackedDatapoint(hashed.values(), &packed);
+    } else {
+      asymmetric_hashing2::SetPackedDatapoint(hashed.values(), local_index,
+                                              &packed);
+    }
+  }
+  return MakeLeafSearcher(leaf, std::move(hashed_dataset), std::move(packed));
+}
+
+TreeAHHybridResidual::Leaf& TreeAHHybridResidual::PendingLeafLocked(
+    int32_t token, PendingLeaves* pending) const {
+  for (auto& [pending_token, leaf] : *pending) {
+    if (pending_token == token) return *leaf;
+  }
+  pending->emplace_back(token, make_shared<Leaf>(*leaves_[token]));
+  return *pending->back().second;
+}
+
+void TreeAHHybridResidual::PublishLeavesLocked(PendingLeaves* pending) {
+  vector<shared_ptr<const Leaf>> retired;
+  retired.reserve(pending->size());
+  absl::MutexLock lock(&leaf_update_mutex_);
+  for (auto& [token, leaf] : *pending) {
+    retired.push_back(std::exchange(leaves_[token], std::move(leaf)));
+  }
+}
+
+StatusOr<DatapointIndex> TreeAHHybridResidual::AppendToLeafLocked(
+    int32_t token, const Datapoint<uint8_t>& hashed, DatapointIndex dp_index,
+    PendingLeaves* pending) {
+  Leaf& leaf = PendingLeafLocked(token, pending);
+  const DatapointIndex local_index = leaf.datapoints.size();
+  TF_ASSIGN_OR_RETURN(leaf.searcher, CopyLeafSearcherWithCode(
+                                         *leaf.searcher, hashed, local_index));
+  if (dp_index < leaf_slot_by_datapoint_.size()) {
+    const auto [old_token, old_local_index] = leaf_slot_by_datapoint_[dp_index];
+    if (old_token >= 0) {
+      Leaf& old_leaf = PendingLeafLocked(old_token, pending);
+      old_leaf.datapoints[old_local_index] = kInvalidDatapointIndex;
+      ++old_leaf.num_tombstones;
+    }
+  }
+  leaf.datapoints.push_back(dp_index);
+  return local_index;
+}
+
+StatusOr<DatapointIndex> TreeAHHybridResidual::AddDatapoint(
+    const DatapointPtr<float>& dptr, string_view docid) {
+  TF_ASSIGN_OR_RETURN(auto token_and_hashed, TokenizeAndHash(dptr));
+  const int32_t token = token_and_hashed.first;
+  absl::MutexLock mutation_lock(&mutation_mutex_);
+  SCANN_RETURN_IF_ERROR(InitializeMutationLocked());
+  if (enable_global_topn_ &&
+      leaves_[token]->datapoints.size() >= (1ull << global_topn_shift_)) {
+    return FailedPreconditionError(
+        "Leaf %d has too many datapoints to be supported with global top-N.",
+        token);
+  }
+
+  const DatapointIndex dp_index = num_datapoints_;
+  PendingLeaves pending;
+  TF_ASSIGN_OR_RETURN(
+      const DatapointIndex local_index,
+      AppendToLeafLocked(token, token_and_hashed.second, dp_index, &pending));
+  {
+    absl::MutexLock dataset_lock(&dataset_mutex_);
+    TypedDataset<float>::Mutator* dataset_mutator = nullptr;
+    if (this->dataset()) {
+      TF_ASSIGN_OR_RETURN(dataset_mutator, this->dataset()->GetMutator());
+      SCANN_RETURN_IF_ERROR(dataset_mutator->AddDatapoint(dptr, docid));
+    }
+    if (this->reordering_enabled() &&
+        this->reordering_helper().owns_mutation_data_structures()) {
+      auto reordering_mutator = this->reordering_helper().GetMutator();
+      Status status = reordering_mutator.status();
+      if (status.ok()) {
+        status = reordering_mutator.ValueOrDie()->AddDatapoint(dptr).status();
+      }
+      if (!status.ok()) {
+        if (dataset_mutator) {
+          SCANN_RETURN_IF_ERROR(dataset_mutator->RemoveDatapoint(dp_index));
+        }
+        return status;
+      }
+    }
+    ++num_datapoints_;
+  }
+  PublishLeavesLocked(&pending);
+  leaf_slot_by_datapoint_.emplace_back(token, local_index);
+  return dp_index;
+}
+
+StatusOr<DatapointIndex> TreeAHHybridResidual::RemoveDatapoint(
+    DatapointIndex index) {
+  absl::MutexLock mutation_lock(&mutation_mutex_);
+  SCANN_RETURN_IF_ERROR(InitializeMutationLocked());
+  if (index >= num_datapoints_) {
+    return OutOfRangeError(
+        "Removing a datapoint out of bound: index = %d, but size() = %d.",
+        index, num_datapoints_);
+  }
+  const DatapointIndex last = num_datapoints_ - 1;
+  const auto [token, local_index] = leaf_slot_by_datapoint_[index];
+  const auto [last_token, last_local_index] = leaf_slot_by_datapoint_[last];
+  PendingLeaves pending;
+  if (token >= 0) {
+    Leaf& leaf = PendingLeafLocked(token, &pending);
+    leaf.datapoints[local_index] = kInvalidDatapointIndex;
+    ++leaf.num_tombstones;
+  }
+  if (index != last && last_token >= 0) {
+    PendingLeafLocked(last_token, &pending).datapoints[last_local_index] =
+        index;
+  }
+  {
+    absl::MutexLock dataset_lock(&dataset_mutex_);
+    if (this->dataset()) {
+      TF_ASSIGN_OR_RETURN(auto* dataset_mutator,
+                          this->dataset()->GetMutator());
+      SCANN_RETURN_IF_ERROR(dataset_mutator->RemoveDatapoint(index));
+    }
+    if (this->reordering_enabled() &&
+        this->reordering_helper().owns_mutation_data_structures()) {
+      TF_ASSIGN_OR_RETURN(auto* reordering_mutator,
+                          this->reordering_helper().GetMutator());
+      SCANN_RETURN_IF_ERROR(
+          reordering_mutator->RemoveDatapoint(index).status());
+    }
+    --num_datapoints_;
+  }
+  PublishLeavesLocked(&pending);
+  leaf_slot_by_datapoint_[index] = leaf_slot_by_datapoint_[last];
+  leaf_slot_by_datapoint_.pop_back();
+  return index == last ? kInvalidDatapointIndex : last;
+}
+
+Status TreeAHHybridResidual::UpdateDatapoint(const DatapointPtr<float>& dptr,
+                                             DatapointIndex index) {
+  TF_ASSIGN_OR_RETURN(auto token_and_hashed, TokenizeAndHash(dptr));
+  const auto& [token, hashed] = token_and_hashed;
+  absl::MutexLock mutation_lock(&mutation_mutex_);
+  SCANN_RETURN_IF_ERROR(InitializeMutationLocked());
+  if (index >= num_datapoints_) {
+    return OutOfRangeError(
+        "Updating a datapoint out of bound: index = %d, but size() = %d.",
+        index, num_datapoints_);
+  }
+  const auto [old_token, old_local_index] = leaf_slot_by_datapoint_[index];
+  if (token != old_token && enable_global_topn_ &&
+      leaves_[token]->datapoints.size() >= (1ull << global_topn_shift_)) {
+    return FailedPreconditionError(
+        "Leaf %d has too many datapoints to be supported with global top-N.",
+        token);
+  }
+  PendingLeaves pending;
+  DatapointIndex local_index = old_local_index;
+  if (token != old_token) {
+    TF_ASSIGN_OR_RETURN(local_index,
+                        AppendToLeafLocked(token, hashed, index, &pending));
+  } else {
+    Leaf& leaf = PendingLeafLocked(token, &pending);
+    TF_ASSIGN_OR_RETURN(leaf.searcher,
+                        CopyLeafSearcherWithCode(*leaf.searcher, hashed,
+                                                 old_local_index));
+  }
+  Datapoint<float> old_dp;
+  if (this->dataset()) {
+    CopyToDatapoint((*this->dataset())[index], &old_dp);
+  }
+  {
+    absl::MutexLock dataset_lock(&dataset_mutex_);
+    TypedDataset<float>::Mutator* dataset_mutator = nullptr;
+    if (this->dataset()) {
+      TF_ASSIGN_OR_RETURN(dataset_mutator, this->dataset()->GetMutator());
+      SCANN_RETURN_IF_ERROR(dataset_mutator->UpdateDatapoint(dptr, index));
+    }
+    if (this->reordering_enabled() &&
+        this->reordering_helper().owns_mutation_data_structures()) {
+      auto reordering_mutator = this->reordering_helper().GetMutator();
+      Status status = reordering_mutator.status();
+      if (status.ok()) {
+        status = reordering_mutator.ValueOrDie()->UpdateDatapoint(dptr, index);
+      }
+      if (!status.ok()) {
+        if (dataset_mutator) {
+          SCANN_RETURN_IF_ERROR(
+              dataset_mutator->UpdateDatapoint(old_dp.ToPtr(), index));
+        }
+        return status;
+      }
+    }
+  }
+  PublishLeavesLocked(&pending);
+  leaf_slot_by_datapoint_[index] = {token, local_index};
+  return OkStatus();
+}
+
+Status TreeAHHybridResidual::CompactLeafLocked(int32_t token) {
+  const shared_ptr<const Leaf> old_leaf = leaves_[token];
+  const auto& searcher = *old_leaf->searcher;
+  ConstSpan<DatapointIndex> old_dp_indices = old_leaf->datapoints;
+  vector<DatapointIndex> removed_local_indices;
+  vector<DatapointIndex> order(old_dp_indices.size());
+  std::iota(order.begin(), order.end(), 0);
+  for (DatapointIndex local_index = old_dp_indices.size(); local_index-- > 0;) {
+    if (old_dp_indices[local_index] != kInvalidDatapointIndex) continue;
+    removed_local_indices.push_back(local_index);
+    order[local_index] = order.back();
+    order.pop_back();
+  }
+  auto new_leaf = make_shared<Leaf>();
+  new_leaf->datapoints.resize(order.size());
+  for (size_t j : IndicesOf(order)) {
+    new_leaf->datapoints[j] = old_dp_indices[order[j]];
+  }
+
+  shared_ptr<DenseDataset<uint8_t>> new_hashed;
+  asymmetric_hashing2::PackedDataset new_packed;
+  if (searcher.hashed_dataset()) {
+    new_hashed =
+        make_shared<DenseDataset<uint8_t>>(searcher.hashed_dataset()->Copy());
+    TF_ASSIGN_OR_RETURN(auto* hashed_mutator, new_hashed->GetMutator());
+    for (DatapointIndex local_index : removed_local_indices) {
+      SCANN_RETURN_IF_ERROR(hashed_mutator->RemoveDatapoint(local_index));
+    }
+  } else if (searcher.lut16_) {
+    const asymmetric_hashing2::PackedDataset& packed = searcher.packed_dataset_;
+    new_packed.num_blocks = packed.num_blocks;
+    new_packed.bit_packed_data.reserve(16 * packed.num_blocks *
+                                       DivRoundUp(order.size(), 32));
+    vector<uint8_t> codes(packed.num_blocks);
+    for (DatapointIndex local_index : order) {
+      asymmetric_hashing2::GetPackedDatapoint(packed, local_index,
+                                              MakeMutableSpan(codes));
+      asymmetric_hashing2::AppendPackedDatapoint(codes, &new_packed);
+    }
+  }
+  new_leaf->searcher = MakeLeafSearcher(searcher, std::move(new_hashed),
+                                        std::move(new_packed));
+
+  PendingLeaves pending;
+  pending.emplace_back(token, new_leaf);
+  PublishLeavesLocked(&pending);
+  for (const auto& [local_index, dp_index] : Enumerate(new_leaf->datapoints)) {
+    leaf_slot_by_datapoint_[dp_index] = {token, local_index};
+  }
+  return OkStatus();
+}
+
+StatusOr<int32_t> TreeAHHybridResidual::CompactLeaves(
+    double min_tombstone_fraction) {
+  absl::MutexLock mutation_lock(&mutation_mutex_);
+  SCANN_RETURN_IF_ERROR(InitializeMutationLocked());
+  int32_t num_compacted = 0;
+  for (size_t token : IndicesOf(leaves_)) {
+    const Leaf& leaf = *leaves_[token];
+    if (leaf.num_tombstones == 0 ||
+        leaf.num_tombstones <
+            min_tombstone_fraction * leaf.datapoints.size()) {
+      continue;
+    }
+    SCANN_RETURN_IF_ERROR(CompactLeafLocked(token));
+    ++num_compacted;
+  }
+  return num_compacted;
+}
+
 }  // namespace research_scann
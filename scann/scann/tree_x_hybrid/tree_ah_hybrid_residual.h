@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <functional>
 
+#include "absl/synchronization/mutex.h"
 #include "scann/base/search_parameters.h"
 #include "scann/base/single_machine_base.h"
 #include "scann/data_format/datapoint.h"
@@ -57,6 +58,17 @@ class TreeAHHybridResidual final : public SingleMachineSearcherBase<float> {
 
   bool supports_crowding() const final { return true; }
 
+  using SingleMachineSearcherBase<float>::FindNeighbors;
+  using SingleMachineSearcherBase<float>::FindNeighborsBatched;
+
+  Status FindNeighbors(const DatapointPtr<float>& query,
+                       const SearchParameters& params,
+                       NNResultsVector* result) const final;
+
+  Status FindNeighborsBatched(const TypedDataset<float>& queries,
+                              ConstSpan<SearchParameters> params,
+                              MutableSpan<NNResultsVector> results) const final;
+
   static StatusOr<DenseDataset<float>> ComputeResiduals(
       const DenseDataset<float>& dataset,
       const KMeansTreeLikePartitioner<float>* partitioner,
@@ -78,14 +90,26 @@ class TreeAHHybridResidual final : public SingleMachineSearcherBase<float> {
   StatusOr<SingleMachineFactoryOptions> ExtractSingleMachineFactoryOptions()
       override;
 
+  Status ApplyMemoryPolicy(const MemoryPolicy& policy) final;
+
+  MemoryUsageReport MemoryUsageBreakdown() const final;
+
   void AttemptEnableGlobalTopN();
 
+  StatusOr<DatapointIndex> AddDatapoint(const DatapointPtr<float>& dptr,
+                                        string_view docid);
+
+  StatusOr<DatapointIndex> RemoveDatapoint(DatapointIndex index);
+
+  Status UpdateDatapoint(const DatapointPtr<float>& dptr,
+                         DatapointIndex index);
+
+  StatusOr<int32_t> CompactLeaves(double min_tombstone_fraction);
+
  protected:
-  bool impl_needs_dataset() const final { return leaf_searchers_.empty(); }
+  bool impl_needs_dataset() const final { return leaves_.empty(); }
 
-  bool impl_needs_hashed_dataset() const final {
-    return leaf_searchers_.empty();
-  }
+  bool impl_needs_hashed_dataset() const final { return leaves_.empty(); }
 
   Status FindNeighborsImpl(const DatapointPtr<float>& query,
                            const SearchParameters& params,
@@ -100,6 +124,14 @@ class TreeAHHybridResidual final : public SingleMachineSearcherBase<float> {
   void DisableCrowdingImpl() final;
 
  private:
+  struct Leaf {
+    shared_ptr<asymmetric_hashing2::Searcher<float>> searcher;
+    std::vector<DatapointIndex> datapoints;
+    DatapointIndex num_tombstones = 0;
+  };
+
+  using PendingLeaves = vector<pair<int32_t, shared_ptr<Leaf>>>;
+
   class UnlockedTreeAHHybridResidualPreprocessingResults
       : public SearchParameters::UnlockedQueryPreprocessingResults {
    public:
@@ -135,9 +167,20 @@ class TreeAHHybridResidual final : public SingleMachineSearcherBase<float> {
   template <typename TopN>
   Status FindNeighborsInternal2(
       const DatapointPtr<float>& query, const SearchParameters& params,
-      ConstSpan<KMeansTreeSearchResult> centers_to_search, TopN top_n,
+      ConstSpan<KMeansTreeSearchResult> centers_to_search,
+      ConstSpan<shared_ptr<const Leaf>> leaves, TopN top_n,
       NNResultsVector* result) const;
 
+  shared_ptr<const Leaf> SnapshotLeaf(int32_t token) const;
+
+  vector<shared_ptr<const Leaf>> SnapshotLeaves(
+      ConstSpan<KMeansTreeSearchResult> centers_to_search) const;
+
+  void DropRemovedNeighbors(NNResultsVector* result) const
+      ABSL_SHARED_LOCKS_REQUIRED(dataset_mutex_);
+
+  vector<std::vector<DatapointIndex>> DatapointsByToken() const;
+
   Status CheckBuildLeafSearchersPreconditions(
       const AsymmetricHasherConfig& config,
       const KMeansTreeLikePartitioner<float>& partitioner) const;
@@ -145,11 +188,49 @@ class TreeAHHybridResidual final : public SingleMachineSearcherBase<float> {
   StatusOr<pair<int32_t, DatapointPtr<float>>> TokenizeAndMaybeResidualize(
       const DatapointPtr<float>& dptr, Datapoint<float>* residual_storage);
 
+  int32_t SpilledNumNeighbors(int32_t num_neighbors) const {
+    if (disjoint_leaf_partitions_) return num_neighbors;
+    const int64_t result =
+        static_cast<int64_t>(num_neighbors) * max_assignments_per_datapoint_;
+    return std::min<int64_t>(result, numeric_limits<int32_t>::max());
+  }
+
   StatusOr<vector<pair<int32_t, DatapointPtr<float>>>>
   TokenizeAndMaybeResidualize(const TypedDataset<float>& dps,
                               MutableSpan<Datapoint<float>*> residual_storage);
 
-  vector<unique_ptr<asymmetric_hashing2::Searcher<float>>> leaf_searchers_;
+  Status InitializeMutationLocked()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutation_mutex_);
+
+  StatusOr<pair<int32_t, Datapoint<uint8_t>>> TokenizeAndHash(
+      const DatapointPtr<float>& dptr);
+
+  static shared_ptr<asymmetric_hashing2::Searcher<float>> MakeLeafSearcher(
+      const asymmetric_hashing2::Searcher<float>& prototype,
+      shared_ptr<DenseDataset<uint8_t>> hashed_dataset,
+      asymmetric_hashing2::PackedDataset packed_dataset);
+
+  static StatusOr<shared_ptr<asymmetric_hashing2::Searcher<float>>>
+  CopyLeafSearcherWithCode(const asymmetric_hashing2::Searcher<float>& leaf,
+                           const Datapoint<uint8_t>& hashed,
+                           DatapointIndex local_index);
+
+  Leaf& PendingLeafLocked(int32_t token, PendingLeaves* pending) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutation_mutex_);
+
+  void PublishLeavesLocked(PendingLeaves* pending)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutation_mutex_);
+
+  StatusOr<DatapointIndex> AppendToLeafLocked(int32_t token,
+                                              const Datapoint<uint8_t>& hashed,
+                                              DatapointIndex dp_index,
+                                              PendingLeaves* pending)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutation_mutex_);
+
+  Status CompactLeafLocked(int32_t token)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutation_mutex_);
+
+  vector<shared_ptr<const Leaf>> leaves_;
 
   shared_ptr<const asymmetric_hashing2::AsymmetricQueryer<float>>
       asymmetric_queryer_;
@@ -157,8 +238,6 @@ class TreeAHHybridResidual final : public SingleMachineSearcherBase<float> {
   unique_ptr<KMeansTreeLikePartitioner<float>> query_tokenizer_;
   shared_ptr<const KMeansTreeLikePartitioner<float>> database_tokenizer_;
 
-  vector<std::vector<DatapointIndex>> datapoints_by_token_;
-
   DatapointIndex num_datapoints_ = 0;
 
   vector<uint32_t> leaf_tokens_by_norm_;
@@ -168,10 +247,25 @@ class TreeAHHybridResidual final : public SingleMachineSearcherBase<float> {
 
   bool disjoint_leaf_partitions_ = true;
 
+  int32_t max_assignments_per_datapoint_ = 1;
+
   bool enable_global_topn_ = false;
 
   uint8_t global_topn_shift_ = 0;
 
+  bool normalize_residual_by_cluster_stdev_ = false;
+
+  mutable absl::Mutex dataset_mutex_;
+
+  mutable absl::Mutex leaf_update_mutex_;
+
+  mutable absl::Mutex mutation_mutex_;
+
+  vector<pair<int32_t, DatapointIndex>> leaf_slot_by_datapoint_
+      ABSL_GUARDED_BY(mutation_mutex_);
+
+  bool mutation_initialized_ ABSL_GUARDED_BY(mutation_mutex_) = false;
+
   FRIEND_TEST(TreeAHHybridResidualTest, CrowdingMutation);
 };
 
@@ -21,6 +21,7 @@
 #include <unordered_set>
 
 #include "absl/base/casts.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/container/node_hash_map.h"
 #include "absl/memory/memory.h"
@@ -57,6 +58,7 @@ TreeXHybridSMMD<T>::TreeXHybridSMMD(
                                    default_pre_reordering_epsilon) {}
 template <typename T>
 DatapointIndex TreeXHybridSMMD<T>::optimal_batch_size() const {
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
   auto kmeans_partitioner =
       dynamic_cast<const KMeansTreePartitioner<T>*>(query_tokenizer_.get());
   if (!kmeans_partitioner) return 1;
@@ -199,36 +201,24 @@ Status TreeXHybridSMMD<T>::BuildLeafSearchers(
   VLOG(1) << "Original dataset size = " << dataset_size
           << ", sum of leaf partition sizes = " << total_leaf_partition_size;
 
-  const TypedDataset<T>* dataset = this->dataset();
-  const DenseDataset<uint8_t>* hashed_dataset = this->hashed_dataset();
   const DatapointIndex n_tokens = datapoints_by_token.size();
   leaf_searchers_.resize(n_tokens);
+  if (lazy_leaves_enabled_) {
+    datapoints_by_token_ = std::move(datapoints_by_token);
+    lazy_leaves_ = make_unique<LazyLeafCache<T>>(
+        n_tokens, lazy_leaf_max_resident_bytes_,
+        [this, leaf_searcher_builder](int32_t token) {
+          return BuildLazyLeafSearcher(token, leaf_searcher_builder);
+        });
+    VLOG(1) << "Deferred construction of " << n_tokens
+            << " leaf searchers until first access.";
+    return OkStatus();
+  }
   for (int32_t token = 0; token < n_tokens; ++token) {
     const absl::Time token_start = absl::Now();
-    if (!hashed_dataset) {
-      shared_ptr<TypedDataset<T>> dataset_partition(
-          PartitionDataset(*dataset, datapoints_by_token[token]));
-      TF_ASSIGN_OR_RETURN(
-          unique_ptr<SingleMachineSearcherBase<T>> leaf_searcher,
-          leaf_searcher_builder(dataset_partition, nullptr, token));
-
-      if (!leaf_searcher->needs_dataset()) {
-        leaf_searcher->ReleaseDatasetAndDocids();
-      }
-
-      leaf_searchers_[token] = std::move(leaf_searcher);
-    } else {
-      shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition(
-          down_cast<DenseDataset<uint8_t>*>(
-              PartitionDataset(*hashed_dataset, datapoints_by_token[token])));
-      TF_ASSIGN_OR_RETURN(
-          unique_ptr<SingleMachineSearcherBase<T>> leaf_searcher,
-          leaf_searcher_builder(nullptr, hashed_dataset_partition, token));
-      if (!leaf_searcher->needs_hashed_dataset()) {
-        leaf_searcher->ReleaseHashedDataset();
-      }
-      leaf_searchers_[token] = std::move(leaf_searcher);
-    }
+    TF_ASSIGN_OR_RETURN(leaf_searchers_[token],
+                        BuildLeafSearcher(datapoints_by_token[token], token,
+                                          leaf_searcher_builder));
 
     VLOG(1) << "Built leaf searcher " << token + 1 << " of " << n_tokens
             << " (size = " << datapoints_by_token[token].size() << " DPs) in "
@@ -242,6 +232,63 @@ Status TreeXHybridSMMD<T>::BuildLeafSearchers(
   return OkStatus();
 }
 
+template <typename T>
+StatusOr<unique_ptr<SingleMachineSearcherBase<T>>>
+TreeXHybridSMMD<T>::BuildLeafSearcher(
+    ConstSpan<DatapointIndex> leaf_datapoints, int32_t token,
+    const std::function<StatusOrSearcher(
+        shared_ptr<TypedDataset<T>> dataset_partition,
+        shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+        int32_t token)>& leaf_searcher_builder) const {
+  const TypedDataset<T>* dataset = this->dataset();
+  const DenseDataset<uint8_t>* hashed_dataset = this->hashed_dataset();
+  if (!hashed_dataset) {
+    if (!dataset) {
+      return FailedPreconditionError(
+          "Cannot build a leaf searcher without the original dataset.");
+    }
+    shared_ptr<TypedDataset<T>> dataset_partition(
+        PartitionDataset(*dataset, leaf_datapoints));
+    TF_ASSIGN_OR_RETURN(
+        unique_ptr<SingleMachineSearcherBase<T>> leaf_searcher,
+        leaf_searcher_builder(dataset_partition, nullptr, token));
+    if (!leaf_searcher->needs_dataset()) {
+      leaf_searcher->ReleaseDatasetAndDocids();
+    }
+    return leaf_searcher;
+  }
+
+  shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition(
+      down_cast<DenseDataset<uint8_t>*>(
+          PartitionDataset(*hashed_dataset, leaf_datapoints)));
+  TF_ASSIGN_OR_RETURN(
+      unique_ptr<SingleMachineSearcherBase<T>> leaf_searcher,
+      leaf_searcher_builder(nullptr, hashed_dataset_partition, token));
+  if (!leaf_searcher->needs_hashed_dataset()) {
+    leaf_searcher->ReleaseHashedDataset();
+  }
+  return leaf_searcher;
+}
+
+template <typename T>
+StatusOr<unique_ptr<SingleMachineSearcherBase<T>>>
+TreeXHybridSMMD<T>::BuildLazyLeafSearcher(
+    int32_t token,
+    const std::function<StatusOrSearcher(
+        shared_ptr<TypedDataset<T>> dataset_partition,
+        shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+        int32_t token)>& leaf_searcher_builder) const {
+  TF_ASSIGN_OR_RETURN(
+      unique_ptr<SingleMachineSearcherBase<T>> leaf_searcher,
+      BuildLeafSearcher(datapoints_by_token_[token], token,
+                        leaf_searcher_builder));
+  if (this->crowding_enabled()) {
+    SCANN_RETURN_IF_ERROR(leaf_searcher->EnableCrowding(LeafCrowdingAttributes(
+        token, this->datapoint_index_to_crowding_attribute())));
+  }
+  return leaf_searcher;
+}
+
 template <typename T>
 Status TreeXHybridSMMD<T>::BuildPretrainedScalarQuantizationLeafSearchers(
     vector<std::vector<DatapointIndex>> datapoints_by_token,
@@ -287,6 +334,323 @@ Status TreeXHybridSMMD<T>::BuildPretrainedScalarQuantizationLeafSearchers(
 
 namespace {
 
+template <typename T>
+StatusOr<shared_ptr<const Partitioner<T>>> CloneTokenizerWithTree(
+    const Partitioner<T>& tokenizer, shared_ptr<const KMeansTree> tree) {
+  const auto* kmeans_tokenizer =
+      dynamic_cast<const KMeansTreePartitioner<T>*>(&tokenizer);
+  if (!kmeans_tokenizer) {
+    return FailedPreconditionError(
+        "Leaf maintenance requires KMeansTreePartitioner tokenizers.");
+  }
+  TF_ASSIGN_OR_RETURN(auto result,
+                      kmeans_tokenizer->CloneWithTree(std::move(tree)));
+  return shared_ptr<const Partitioner<T>>(std::move(result));
+}
+
+}  // namespace
+
+template <typename T>
+Status TreeXHybridSMMD<T>::SplitLeaf(
+    int32_t token, const GmmUtils::Options& gmm_options,
+    std::function<StatusOrSearcher(
+        shared_ptr<TypedDataset<T>> dataset_partition,
+        shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+        int32_t token)>
+        leaf_searcher_builder) {
+  absl::MutexLock lock(&leaf_maintenance_mutex_);
+  TF_ASSIGN_OR_RETURN(
+      const bool split,
+      SplitLeafLocked(token, gmm_options, leaf_searcher_builder));
+  if (!split) {
+    return FailedPreconditionError(
+        "Leaf %d could not be split into two non-empty partitions.", token);
+  }
+  return OkStatus();
+}
+
+template <typename T>
+Status TreeXHybridSMMD<T>::RemoveLeaf(
+    int32_t token,
+    std::function<StatusOrSearcher(
+        shared_ptr<TypedDataset<T>> dataset_partition,
+        shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+        int32_t token)>
+        leaf_searcher_builder) {
+  absl::MutexLock lock(&leaf_maintenance_mutex_);
+  return RemoveLeafLocked(token, leaf_searcher_builder);
+}
+
+template <typename T>
+StatusOr<int32_t> TreeXHybridSMMD<T>::MaintainLeaves(
+    const IncrementalUpdateConfig::Reindexing& config,
+    std::function<StatusOrSearcher(
+        shared_ptr<TypedDataset<T>> dataset_partition,
+        shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+        int32_t token)>
+        leaf_searcher_builder) {
+  if (!config.enable_manual_retraining_and_reindexing()) {
+    return FailedPreconditionError(
+        "Leaf maintenance requires enable_manual_retraining_and_reindexing.");
+  }
+  absl::MutexLock lock(&leaf_maintenance_mutex_);
+  int32_t num_edits = 0;
+
+  if (config.max_leaf_size() > 0) {
+    for (int32_t token = 0; token < datapoints_by_token_.size();) {
+      if (datapoints_by_token_[token].size() <= config.max_leaf_size()) {
+        ++token;
+        continue;
+      }
+
+      TF_ASSIGN_OR_RETURN(
+          const bool split,
+          SplitLeafLocked(token, GmmUtils::Options(), leaf_searcher_builder));
+      if (split) {
+        ++num_edits;
+      } else {
+        ++token;
+      }
+    }
+  }
+
+  const DatapointIndex min_leaf_size =
+      std::max<DatapointIndex>(config.min_leaf_size(), 1);
+  for (int32_t token = 0; token < datapoints_by_token_.size() &&
+                          datapoints_by_token_.size() > 1;) {
+    if (datapoints_by_token_[token].size() >= min_leaf_size) {
+      ++token;
+      continue;
+    }
+    SCANN_RETURN_IF_ERROR(RemoveLeafLocked(token, leaf_searcher_builder));
+    ++num_edits;
+  }
+  return num_edits;
+}
+
+template <typename T>
+void TreeXHybridSMMD<T>::EnableLeafMaintenance(
+    const IncrementalUpdateConfig::Reindexing& config,
+    std::function<StatusOrSearcher(
+        shared_ptr<TypedDataset<T>> dataset_partition,
+        shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+        int32_t token)>
+        leaf_searcher_builder) {
+  reindexing_config_ = config;
+  maintenance_leaf_searcher_builder_ = std::move(leaf_searcher_builder);
+}
+
+template <typename T>
+StatusOr<int32_t> TreeXHybridSMMD<T>::MaintainLeaves() {
+  if (!maintenance_leaf_searcher_builder_) {
+    return FailedPreconditionError(
+        "Leaf maintenance was not enabled by partitioning.reindexing.");
+  }
+  return MaintainLeaves(reindexing_config_, maintenance_leaf_searcher_builder_);
+}
+
+template <typename T>
+StatusOr<const KMeansTreePartitioner<T>*>
+TreeXHybridSMMD<T>::MaintainableTokenizer() const {
+  if (leaf_searchers_.empty()) {
+    return FailedPreconditionError("BuildLeafSearchers not called yet.");
+  }
+  if (lazy_leaves_) {
+    return FailedPreconditionError(
+        "Leaf maintenance is not supported with lazily built leaves.");
+  }
+  if (!disjoint_leaf_partitions_) {
+    return FailedPreconditionError(
+        "Leaf maintenance requires disjoint leaf partitions.");
+  }
+  if (!query_tokenizer_ || !database_tokenizer_) {
+    return FailedPreconditionError(
+        "Leaf maintenance requires both query and database tokenizers.");
+  }
+  const auto* kmeans_tokenizer =
+      dynamic_cast<const KMeansTreePartitioner<T>*>(database_tokenizer_.get());
+  if (!kmeans_tokenizer) {
+    return FailedPreconditionError(
+        "Leaf maintenance requires KMeansTreePartitioner tokenizers.");
+  }
+  return kmeans_tokenizer;
+}
+
+template <typename T>
+StatusOr<bool> TreeXHybridSMMD<T>::SplitLeafLocked(
+    int32_t token, const GmmUtils::Options& gmm_options,
+    const std::function<StatusOrSearcher(
+        shared_ptr<TypedDataset<T>> dataset_partition,
+        shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+        int32_t token)>& leaf_searcher_builder) {
+  TF_ASSIGN_OR_RETURN(const KMeansTreePartitioner<T>* tokenizer,
+                      MaintainableTokenizer());
+  if (token < 0 || token >= datapoints_by_token_.size()) {
+    return OutOfRangeError("Token %d is out of range [0, %d).", token,
+                           datapoints_by_token_.size());
+  }
+  if (!this->dataset()) {
+    return FailedPreconditionError(
+        "Splitting a leaf requires the original dataset.");
+  }
+  ConstSpan<DatapointIndex> leaf_datapoints = datapoints_by_token_[token];
+  if (leaf_datapoints.size() < 2) return false;
+
+  const shared_ptr<const DistanceMeasure>& dist =
+      tokenizer->database_tokenization_distance();
+  GmmUtils gmm(dist, gmm_options);
+  DenseDataset<double> centers;
+  vector<vector<DatapointIndex>> partitions;
+  const auto tag = dist->specially_optimized_distance_tag();
+  if (tag == DistanceMeasure::DOT_PRODUCT || tag == DistanceMeasure::COSINE) {
+    SCANN_RETURN_IF_ERROR(gmm.SphericalKmeans(*this->dataset(), leaf_datapoints,
+                                              2, &centers, &partitions));
+  } else {
+    SCANN_RETURN_IF_ERROR(gmm.GenericKmeans(*this->dataset(), leaf_datapoints,
+                                            2, &centers, &partitions));
+  }
+  if (partitions.size() != 2 || partitions[0].empty() ||
+      partitions[1].empty()) {
+    return false;
+  }
+
+  DenseDataset<float> float_centers;
+  centers.ConvertType(&float_centers);
+  shared_ptr<KMeansTree> edited_tree = tokenizer->kmeans_tree()->Clone();
+  TF_ASSIGN_OR_RETURN(vector<int32_t> previous_tokens,
+                      edited_tree->SplitLeaf(token, float_centers));
+  TF_ASSIGN_OR_RETURN(auto query_tokenizer,
+                      CloneTokenizerWithTree(*query_tokenizer_, edited_tree));
+  TF_ASSIGN_OR_RETURN(
+      auto database_tokenizer,
+      CloneTokenizerWithTree(*database_tokenizer_, edited_tree));
+
+  vector<pair<int32_t, std::vector<DatapointIndex>>> rebuilt_leaves;
+  for (const auto& [new_token, previous_token] : Enumerate(previous_tokens)) {
+    if (previous_token != token && previous_token >= 0) continue;
+    DCHECK_LT(rebuilt_leaves.size(), partitions.size());
+    rebuilt_leaves.emplace_back(new_token,
+                                std::move(partitions[rebuilt_leaves.size()]));
+  }
+  SCANN_RETURN_IF_ERROR(InstallEditedTree(
+      std::move(query_tokenizer), std::move(database_tokenizer),
+      previous_tokens, std::move(rebuilt_leaves), leaf_searcher_builder));
+  return true;
+}
+
+template <typename T>
+Status TreeXHybridSMMD<T>::RemoveLeafLocked(
+    int32_t token,
+    const std::function<StatusOrSearcher(
+        shared_ptr<TypedDataset<T>> dataset_partition,
+        shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+        int32_t token)>& leaf_searcher_builder) {
+  TF_ASSIGN_OR_RETURN(const KMeansTreePartitioner<T>* tokenizer,
+                      MaintainableTokenizer());
+  if (token < 0 || token >= datapoints_by_token_.size()) {
+    return OutOfRangeError("Token %d is out of range [0, %d).", token,
+                           datapoints_by_token_.size());
+  }
+  ConstSpan<DatapointIndex> leaf_datapoints = datapoints_by_token_[token];
+  if (!leaf_datapoints.empty() && !this->dataset()) {
+    return FailedPreconditionError(
+        "Removing a non-empty leaf requires the original dataset.");
+  }
+
+  shared_ptr<KMeansTree> edited_tree = tokenizer->kmeans_tree()->Clone();
+  TF_ASSIGN_OR_RETURN(vector<int32_t> previous_tokens,
+                      edited_tree->RemoveLeaf(token));
+  TF_ASSIGN_OR_RETURN(auto query_tokenizer,
+                      CloneTokenizerWithTree(*query_tokenizer_, edited_tree));
+  TF_ASSIGN_OR_RETURN(
+      auto database_tokenizer,
+      CloneTokenizerWithTree(*database_tokenizer_, edited_tree));
+
+  vector<int32_t> new_tokens;
+  if (!leaf_datapoints.empty()) {
+    unique_ptr<TypedDataset<T>> removed_datapoints(
+        PartitionDataset(*this->dataset(), leaf_datapoints));
+    SCANN_RETURN_IF_ERROR(database_tokenizer->TokenForDatapointBatched(
+        *removed_datapoints, &new_tokens));
+  }
+
+  absl::flat_hash_map<int32_t, std::vector<DatapointIndex>> moved_by_token;
+  for (const auto& [i, new_token] : Enumerate(new_tokens)) {
+    if (new_token < 0 || new_token >= previous_tokens.size()) {
+      return InternalError("Datapoint %d was reassigned to invalid token %d.",
+                           leaf_datapoints[i], new_token);
+    }
+    moved_by_token[new_token].push_back(leaf_datapoints[i]);
+  }
+
+  vector<pair<int32_t, std::vector<DatapointIndex>>> rebuilt_leaves;
+  rebuilt_leaves.reserve(moved_by_token.size());
+  for (auto& [new_token, moved] : moved_by_token) {
+    ConstSpan<DatapointIndex> existing =
+        datapoints_by_token_[previous_tokens[new_token]];
+    std::vector<DatapointIndex> merged;
+    merged.reserve(existing.size() + moved.size());
+    std::merge(existing.begin(), existing.end(), moved.begin(), moved.end(),
+               std::back_inserter(merged));
+    rebuilt_leaves.emplace_back(new_token, std::move(merged));
+  }
+  return InstallEditedTree(std::move(query_tokenizer),
+                           std::move(database_tokenizer), previous_tokens,
+                           std::move(rebuilt_leaves), leaf_searcher_builder);
+}
+
+template <typename T>
+Status TreeXHybridSMMD<T>::InstallEditedTree(
+    shared_ptr<const Partitioner<T>> query_tokenizer,
+    shared_ptr<const Partitioner<T>> database_tokenizer,
+    ConstSpan<int32_t> previous_tokens,
+    vector<pair<int32_t, std::vector<DatapointIndex>>> rebuilt_leaves,
+    const std::function<StatusOrSearcher(
+        shared_ptr<TypedDataset<T>> dataset_partition,
+        shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+        int32_t token)>& leaf_searcher_builder) {
+  const size_t n_tokens = previous_tokens.size();
+  vector<unique_ptr<SingleMachineSearcherBase<T>>> leaf_searchers(n_tokens);
+  vector<std::vector<DatapointIndex>> datapoints_by_token(n_tokens);
+  for (auto& [token, leaf_datapoints] : rebuilt_leaves) {
+    TF_ASSIGN_OR_RETURN(
+        leaf_searchers[token],
+        BuildLeafSearcher(leaf_datapoints, token, leaf_searcher_builder));
+    if (this->crowding_enabled()) {
+      ConstSpan<int64_t> crowding_attributes =
+          this->datapoint_index_to_crowding_attribute();
+      vector<int64_t> leaf_crowding_attributes;
+      leaf_crowding_attributes.reserve(leaf_datapoints.size());
+      for (DatapointIndex dp_idx : leaf_datapoints) {
+        leaf_crowding_attributes.push_back(crowding_attributes[dp_idx]);
+      }
+      SCANN_RETURN_IF_ERROR(leaf_searchers[token]->EnableCrowding(
+          std::move(leaf_crowding_attributes)));
+    }
+    datapoints_by_token[token] = std::move(leaf_datapoints);
+  }
+
+  {
+    absl::MutexLock lock(&leaf_update_mutex_);
+    for (size_t token : Seq(n_tokens)) {
+      if (leaf_searchers[token]) continue;
+      const int32_t previous_token = previous_tokens[token];
+      DCHECK_GE(previous_token, 0);
+      leaf_searchers[token] = std::move(leaf_searchers_[previous_token]);
+      datapoints_by_token[token] =
+          std::move(datapoints_by_token_[previous_token]);
+    }
+    leaf_searchers_.swap(leaf_searchers);
+    datapoints_by_token_.swap(datapoints_by_token);
+    query_tokenizer_.swap(query_tokenizer);
+    database_tokenizer_.swap(database_tokenizer);
+    ++leaf_generation_;
+  }
+  return OkStatus();
+}
+
+namespace {
+
 void RemapToGlobalDatapointIndices(
     MutableSpan<pair<DatapointIndex, float>> partition_leaf_result,
     ConstSpan<DatapointIndex> local_to_global_datapoint_indices) {
@@ -328,20 +692,34 @@ inline bool PreTokenizationEnabled(const SearchParameters& params) {
 
 }  // namespace
 
+template <typename T>
+vector<int64_t> TreeXHybridSMMD<T>::LeafCrowdingAttributes(
+    int32_t token,
+    ConstSpan<int64_t> datapoint_index_to_crowding_attribute) const {
+  ConstSpan<DatapointIndex> cur_leaf_datapoints = datapoints_by_token_[token];
+  vector<int64_t> leaf_datapoint_index_to_crowding_attribute(
+      cur_leaf_datapoints.size());
+  for (size_t i = 0; i < cur_leaf_datapoints.size(); ++i) {
+    leaf_datapoint_index_to_crowding_attribute[i] =
+        datapoint_index_to_crowding_attribute[cur_leaf_datapoints[i]];
+  }
+  return leaf_datapoint_index_to_crowding_attribute;
+}
+
 template <typename T>
 Status TreeXHybridSMMD<T>::EnableCrowdingImpl(
     ConstSpan<int64_t> datapoint_index_to_crowding_attribute) {
   if (leaf_searchers_.empty()) return OkStatus();
+  if (lazy_leaves_) {
+    return lazy_leaves_->ForEachResident(
+        [&](int32_t token, SingleMachineSearcherBase<T>* leaf) {
+          return leaf->EnableCrowding(LeafCrowdingAttributes(
+              token, datapoint_index_to_crowding_attribute));
+        });
+  }
   for (size_t token = 0; token < leaf_searchers_.size(); ++token) {
-    ConstSpan<DatapointIndex> cur_leaf_datapoints = datapoints_by_token_[token];
-    vector<int64_t> leaf_datapoint_index_to_crowding_attribute(
-        cur_leaf_datapoints.size());
-    for (size_t i = 0; i < cur_leaf_datapoints.size(); ++i) {
-      leaf_datapoint_index_to_crowding_attribute[i] =
-          datapoint_index_to_crowding_attribute[cur_leaf_datapoints[i]];
-    }
     Status status = leaf_searchers_[token]->EnableCrowding(
-        std::move(leaf_datapoint_index_to_crowding_attribute));
+        LeafCrowdingAttributes(token, datapoint_index_to_crowding_attribute));
     if (!status.ok()) {
       for (size_t i = 0; i <= token; ++i) {
         leaf_searchers_[i]->DisableCrowding();
@@ -353,6 +731,14 @@ Status TreeXHybridSMMD<T>::EnableCrowdingImpl(
 
 template <typename T>
 void TreeXHybridSMMD<T>::DisableCrowdingImpl() {
+  if (lazy_leaves_) {
+    TF_CHECK_OK(lazy_leaves_->ForEachResident(
+        [](int32_t token, SingleMachineSearcherBase<T>* leaf) {
+          leaf->DisableCrowding();
+          return OkStatus();
+        }));
+    return;
+  }
   for (auto& ls : leaf_searchers_) {
     ls->DisableCrowding();
   }
@@ -362,17 +748,19 @@ template <typename T>
 Status TreeXHybridSMMD<T>::FindNeighborsImpl(const DatapointPtr<T>& query,
                                              const SearchParameters& params,
                                              NNResultsVector* result) const {
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
   SCANN_RETURN_IF_ERROR(CheckReadyToQuery(params));
   auto tree_x_params =
       params.searcher_specific_optional_parameters<TreeXOptionalParameters>();
+  const auto* unlocked_preprocessing =
+      params.unlocked_query_preprocessing_results<CentersToSearch>();
   vector<int32_t> query_tokens_storage;
   ConstSpan<int32_t> query_tokens;
   if (PreTokenizationEnabled(tree_x_params)) {
     query_tokens = tree_x_params->leaf_tokens_to_search();
-  } else if (params.unlocked_query_preprocessing_results<CentersToSearch>()) {
-    query_tokens =
-        params.unlocked_query_preprocessing_results<CentersToSearch>()
-            ->centers_to_search();
+  } else if (unlocked_preprocessing &&
+             unlocked_preprocessing->leaf_generation() == leaf_generation_) {
+    query_tokens = unlocked_preprocessing->centers_to_search();
   } else {
     bool override = false;
 
@@ -422,6 +810,7 @@ Status TreeXHybridSMMD<T>::FindNeighborsBatchedImpl(
     DCHECK_EQ(results.size(), 0);
     return OkStatus();
   }
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
 
   SCANN_RETURN_IF_ERROR(CheckReadyToQuery(params[0]));
 
@@ -450,6 +839,17 @@ Status TreeXHybridSMMD<T>::FindNeighborsBatchedImpl(
     }
   }
 
+  bool use_unlocked_preprocessing = has_unlocked_preprocessing;
+  if (has_unlocked_preprocessing && !pre_tokenized) {
+    for (const SearchParameters& p : params) {
+      if (p.unlocked_query_preprocessing_results<CentersToSearch>()
+              ->leaf_generation() != leaf_generation_) {
+        use_unlocked_preprocessing = false;
+        break;
+      }
+    }
+  }
+
   vector<vector<int32_t>> query_tokens_storage;
   vector<ConstSpan<int32_t>> query_tokens(queries.size());
   if (pre_tokenized) {
@@ -459,7 +859,7 @@ Status TreeXHybridSMMD<T>::FindNeighborsBatchedImpl(
               .searcher_specific_optional_parameters<TreeXOptionalParameters>();
       query_tokens[i] = tree_x_params->leaf_tokens_to_search();
     }
-  } else if (has_unlocked_preprocessing) {
+  } else if (use_unlocked_preprocessing) {
     for (size_t i : IndicesOf(queries)) {
       auto unlocked_preprocessing =
           params[i].unlocked_query_preprocessing_results<CentersToSearch>();
@@ -611,8 +1011,9 @@ Status TreeXHybridSMMD<T>::FindNeighborsPreTokenizedBatchedOptimizedImpl(
             params, mutators, leaf_optional_params, query_idxs);
     leaf_results.resize(0);
     leaf_results.resize(leaf_params.size());
+    TF_ASSIGN_OR_RETURN(auto leaf_searcher, GetLeafSearcher(leaf_idx));
     SCANN_RETURN_IF_ERROR(
-        leaf_searchers_[leaf_idx]->FindNeighborsBatchedNoSortNoExactReorder(
+        leaf_searcher->FindNeighborsBatchedNoSortNoExactReorder(
             leaf_dataset, leaf_params, MakeMutableSpan(leaf_results)));
     backing_storage = leaf_dataset.ClearRecyclingDataVector();
 
@@ -649,6 +1050,19 @@ Status TreeXHybridSMMD<T>::CheckReadyToQuery(
   return OkStatus();
 }
 
+template <typename T>
+StatusOr<shared_ptr<const SingleMachineSearcherBase<T>>>
+TreeXHybridSMMD<T>::GetLeafSearcher(int32_t token) const {
+  if (lazy_leaves_) {
+    TF_ASSIGN_OR_RETURN(shared_ptr<SingleMachineSearcherBase<T>> leaf,
+                        lazy_leaves_->Get(token));
+    return shared_ptr<const SingleMachineSearcherBase<T>>(std::move(leaf));
+  }
+  return shared_ptr<const SingleMachineSearcherBase<T>>(
+      shared_ptr<const SingleMachineSearcherBase<T>>(),
+      leaf_searchers_[token].get());
+}
+
 template <typename T>
 Status TreeXHybridSMMD<T>::ValidateTokenList(ConstSpan<int32_t> token_list,
                                              bool check_oob) const {
@@ -770,7 +1184,8 @@ Status TreeXHybridSMMD<T>::FindNeighborsPreTokenizedImpl(
 
     TranslateGlobalToLeafLocalWhitelist(params, datapoints_by_token_[token],
                                         &leaf_params);
-    Status status = leaf_searchers_[token]->FindNeighborsNoSortNoExactReorder(
+    TF_ASSIGN_OR_RETURN(auto leaf_searcher, GetLeafSearcher(token));
+    Status status = leaf_searcher->FindNeighborsNoSortNoExactReorder(
         query, leaf_params, result);
     if (!status.ok()) return status;
     RemapToGlobalDatapointIndices(MakeMutableSpan(*result),
@@ -791,9 +1206,9 @@ Status TreeXHybridSMMD<T>::FindNeighborsPreTokenizedImpl(
       TranslateGlobalToLeafLocalWhitelist(params, datapoints_by_token_[token],
                                           &leaf_params);
       NNResultsVector leaf_results;
-      SCANN_RETURN_IF_ERROR(
-          leaf_searchers_[token]->FindNeighborsNoSortNoExactReorder(
-              query, leaf_params, &leaf_results));
+      TF_ASSIGN_OR_RETURN(auto leaf_searcher, GetLeafSearcher(token));
+      SCANN_RETURN_IF_ERROR(leaf_searcher->FindNeighborsNoSortNoExactReorder(
+          query, leaf_params, &leaf_results));
       RemapToGlobalDatapointIndices(MakeMutableSpan(leaf_results),
                                     datapoints_by_token_[token]);
       for (const auto& result : leaf_results) {
@@ -819,7 +1234,8 @@ Status TreeXHybridSMMD<T>::FindNeighborsPreTokenizedImpl(
 
       TranslateGlobalToLeafLocalWhitelist(params, datapoints_by_token_[token],
                                           &leaf_params);
-      Status status = leaf_searchers_[token]->FindNeighborsNoSortNoExactReorder(
+      TF_ASSIGN_OR_RETURN(auto leaf_searcher, GetLeafSearcher(token));
+      Status status = leaf_searcher->FindNeighborsNoSortNoExactReorder(
           query, leaf_params, &leaf_results[i]);
       if (!status.ok()) return status;
       RemapToGlobalDatapointIndices(MakeMutableSpan(leaf_results[i]),
@@ -860,9 +1276,50 @@ TreeXHybridSMMD<T>::TokenizeAndMaybeResidualize(const TypedDataset<T>& dps,
   return result;
 }
 
+template <typename T>
+Status TreeXHybridSMMD<T>::ApplyMemoryPolicy(const MemoryPolicy& policy) {
+  SCANN_RETURN_IF_ERROR(
+      SingleMachineSearcherBase<T>::ApplyMemoryPolicy(policy));
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
+  for (auto& leaf : leaf_searchers_) {
+    if (leaf) SCANN_RETURN_IF_ERROR(leaf->ApplyMemoryPolicy(policy));
+  }
+  if (lazy_leaves_) {
+    SCANN_RETURN_IF_ERROR(lazy_leaves_->ApplyMemoryPolicy(policy));
+  }
+  return research_scann::ApplyMemoryPolicy(
+      policy, MakeConstSpan(datapoints_by_token_));
+}
+
+template <typename T>
+MemoryUsageReport TreeXHybridSMMD<T>::MemoryUsageBreakdown() const {
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
+  MemoryUsageReport report =
+      SingleMachineSearcherBase<T>::MemoryUsageBreakdown();
+  report.set_name("TreeXHybridSMMD");
+  report.AddChild("datapoints_by_token",
+                  TwoDimensionalVectorStorage(datapoints_by_token_));
+  if (query_tokenizer_) {
+    report.AddSharedChild("query_tokenizer", query_tokenizer_.get(), 0)
+        .MergeFrom(query_tokenizer_->MemoryUsageBreakdown());
+  }
+  if (database_tokenizer_) {
+    report.AddSharedChild("database_tokenizer", database_tokenizer_.get(), 0)
+        .MergeFrom(database_tokenizer_->MemoryUsageBreakdown());
+  }
+  MemoryUsageReport leaves("leaf_searchers", VectorStorage(leaf_searchers_));
+  for (const auto& leaf : leaf_searchers_) {
+    if (leaf) leaves.MergeFrom(leaf->MemoryUsageBreakdown());
+  }
+  report.AddChild(std::move(leaves));
+  if (lazy_leaves_) report.AddChild(lazy_leaves_->MemoryUsageBreakdown());
+  return report;
+}
+
 template <typename T>
 StatusOr<SingleMachineFactoryOptions>
 TreeXHybridSMMD<T>::ExtractSingleMachineFactoryOptions() {
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
   TF_ASSIGN_OR_RETURN(const int dataset_size,
                       UntypedSingleMachineSearcherBase::DatasetSize());
   auto int8_query_processor = std::dynamic_pointer_cast<
@@ -871,9 +1328,20 @@ TreeXHybridSMMD<T>::ExtractSingleMachineFactoryOptions() {
   ConstSpan<float> int8_multipliers;
   if (int8_query_processor)
     int8_multipliers = int8_query_processor->inverse_multipliers();
-  TF_ASSIGN_OR_RETURN(
-      SingleMachineFactoryOptions leaf_opts,
-      MergeAHLeafOptions(leaf_searchers_, datapoints_by_token_, dataset_size));
+  SingleMachineFactoryOptions leaf_opts;
+  if (lazy_leaves_) {
+    if (this->hashed_dataset() && !datapoints_by_token_.empty()) {
+      TF_ASSIGN_OR_RETURN(shared_ptr<SingleMachineSearcherBase<T>> leaf,
+                          lazy_leaves_->Get(0));
+      TF_ASSIGN_OR_RETURN(SingleMachineFactoryOptions first_leaf_opts,
+                          leaf->ExtractSingleMachineFactoryOptions());
+      leaf_opts.ah_codebook = first_leaf_opts.ah_codebook;
+    }
+  } else {
+    TF_ASSIGN_OR_RETURN(leaf_opts,
+                        MergeAHLeafOptions(leaf_searchers_,
+                                           datapoints_by_token_, dataset_size));
+  }
 
   TF_ASSIGN_OR_RETURN(
       auto opts,
@@ -886,7 +1354,7 @@ TreeXHybridSMMD<T>::ExtractSingleMachineFactoryOptions() {
 
   if (leaf_opts.ah_codebook != nullptr) {
     opts.ah_codebook = leaf_opts.ah_codebook;
-    opts.hashed_dataset = leaf_opts.hashed_dataset;
+    if (!lazy_leaves_) opts.hashed_dataset = leaf_opts.hashed_dataset;
   }
   if (leaf_opts.pre_quantized_fixed_point && !int8_multipliers.empty()) {
     opts.pre_quantized_fixed_point = make_shared<PreQuantizedFixedPoint>();
@@ -904,6 +1372,10 @@ TreeXHybridSMMD<T>::ExtractSingleMachineFactoryOptions() {
 template <typename T>
 StatusOr<shared_ptr<const DenseDataset<float>>>
 TreeXHybridSMMD<T>::SharedFloatDatasetIfNeeded() {
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
+  if (lazy_leaves_) {
+    return SingleMachineSearcherBase<T>::SharedFloatDatasetIfNeeded();
+  }
   vector<const DenseDataset<float>*> datasets(datapoints_by_token_.size());
   for (int i = 0; i < datasets.size(); i++) {
     auto ptr_or = leaf_searchers_[i]->SharedFloatDatasetIfNeeded();
@@ -924,6 +1396,7 @@ TreeXHybridSMMD<T>::SharedFloatDatasetIfNeeded() {
 template <typename T>
 Status TreeXHybridSMMD<T>::PreprocessQueryIntoParamsUnlocked(
     const DatapointPtr<T>& query, SearchParameters& search_params) const {
+  absl::ReaderMutexLock lock(&leaf_update_mutex_);
   const auto& params =
       search_params
           .searcher_specific_optional_parameters<TreeXOptionalParameters>();
@@ -946,7 +1419,8 @@ Status TreeXHybridSMMD<T>::PreprocessQueryIntoParamsUnlocked(
   }
 
   search_params.set_unlocked_query_preprocessing_results(
-      {make_unique<CentersToSearch>(std::move(centers_to_search))});
+      {make_unique<CentersToSearch>(std::move(centers_to_search),
+                                    leaf_generation_)});
   return OkStatus();
 }
 
@@ -26,8 +26,12 @@
 #include "scann/base/single_machine_base.h"
 #include "scann/data_format/datapoint.h"
 #include "scann/data_format/dataset.h"
+#include "scann/partitioning/kmeans_tree_partitioner.h"
 #include "scann/partitioning/partitioner_base.h"
+#include "scann/proto/incremental_updates.pb.h"
+#include "scann/tree_x_hybrid/lazy_leaf_cache.h"
 #include "scann/tree_x_hybrid/leaf_searcher_optional_parameter_creator.h"
+#include "scann/utils/gmm_utils.h"
 #include "scann/utils/types.h"
 
 namespace research_scann {
@@ -47,6 +51,13 @@ class TreeXHybridSMMD : public SingleMachineSearcherBase<T> {
 
   DatapointIndex optimal_batch_size() const final;
 
+  void EnableLazyLeafSearchers(size_t max_resident_bytes) {
+    lazy_leaves_enabled_ = true;
+    lazy_leaf_max_resident_bytes_ = max_resident_bytes;
+  }
+
+  bool lazy_leaves_enabled() const { return lazy_leaves_enabled_; }
+
   Status BuildLeafSearchers(
       const Partitioner<T>& database_tokenizer,
       std::function<StatusOrSearcher(
@@ -84,6 +95,40 @@ class TreeXHybridSMMD : public SingleMachineSearcherBase<T> {
                            vector<float> squared_l2_norms)>
           leaf_searcher_builder);
 
+  Status SplitLeaf(
+      int32_t token, const GmmUtils::Options& gmm_options,
+      std::function<StatusOrSearcher(
+          shared_ptr<TypedDataset<T>> dataset_partition,
+          shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+          int32_t token)>
+          leaf_searcher_builder);
+
+  Status RemoveLeaf(
+      int32_t token,
+      std::function<StatusOrSearcher(
+          shared_ptr<TypedDataset<T>> dataset_partition,
+          shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+          int32_t token)>
+          leaf_searcher_builder);
+
+  StatusOr<int32_t> MaintainLeaves(
+      const IncrementalUpdateConfig::Reindexing& config,
+      std::function<StatusOrSearcher(
+          shared_ptr<TypedDataset<T>> dataset_partition,
+          shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+          int32_t token)>
+          leaf_searcher_builder);
+
+  void EnableLeafMaintenance(
+      const IncrementalUpdateConfig::Reindexing& config,
+      std::function<StatusOrSearcher(
+          shared_ptr<TypedDataset<T>> dataset_partition,
+          shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+          int32_t token)>
+          leaf_searcher_builder);
+
+  StatusOr<int32_t> MaintainLeaves();
+
   void set_query_tokenizer(shared_ptr<const Partitioner<T>> query_tokenizer) {
     query_tokenizer_ = query_tokenizer;
   }
@@ -122,14 +167,22 @@ class TreeXHybridSMMD : public SingleMachineSearcherBase<T> {
   StatusOr<SingleMachineFactoryOptions> ExtractSingleMachineFactoryOptions()
       override;
 
+  Status ApplyMemoryPolicy(const MemoryPolicy& policy) override;
+
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
   StatusOr<shared_ptr<const DenseDataset<float>>> SharedFloatDatasetIfNeeded()
       override;
 
  protected:
-  bool impl_needs_dataset() const final { return leaf_searchers_.empty(); }
+  bool impl_needs_dataset() const final {
+    return leaf_searchers_.empty() ||
+           (lazy_leaves_ && !this->hashed_dataset()) ||
+           maintenance_leaf_searcher_builder_ != nullptr;
+  }
 
   bool impl_needs_hashed_dataset() const final {
-    return leaf_searchers_.empty();
+    return leaf_searchers_.empty() || lazy_leaves_ != nullptr;
   }
 
   Status EnableCrowdingImpl(
@@ -148,17 +201,30 @@ class TreeXHybridSMMD : public SingleMachineSearcherBase<T> {
   class CentersToSearch
       : public SearchParameters::UnlockedQueryPreprocessingResults {
    public:
-    explicit CentersToSearch(vector<int32_t> centers_to_search)
-        : centers_to_search_(std::move(centers_to_search)) {}
+    CentersToSearch(vector<int32_t> centers_to_search,
+                    uint64_t leaf_generation)
+        : centers_to_search_(std::move(centers_to_search)),
+          leaf_generation_(leaf_generation) {}
 
     ConstSpan<int32_t> centers_to_search() const { return centers_to_search_; }
 
+    uint64_t leaf_generation() const { return leaf_generation_; }
+
    private:
     vector<int32_t> centers_to_search_;
+
+    uint64_t leaf_generation_;
   };
 
   Status CheckReadyToQuery(const SearchParameters& params) const;
 
+  StatusOr<shared_ptr<const SingleMachineSearcherBase<T>>> GetLeafSearcher(
+      int32_t token) const;
+
+  vector<int64_t> LeafCrowdingAttributes(
+      int32_t token,
+      ConstSpan<int64_t> datapoint_index_to_crowding_attribute) const;
+
   Status ValidateTokenList(ConstSpan<int32_t> token_list, bool check_oob) const;
 
   template <typename TopN>
@@ -188,8 +254,57 @@ class TreeXHybridSMMD : public SingleMachineSearcherBase<T> {
   CreateLeafOptionalParameters(const DatapointPtr<T>& query,
                                const SearchParameters& top_level_params) const;
 
+  StatusOr<unique_ptr<SingleMachineSearcherBase<T>>> BuildLeafSearcher(
+      ConstSpan<DatapointIndex> leaf_datapoints, int32_t token,
+      const std::function<StatusOrSearcher(
+          shared_ptr<TypedDataset<T>> dataset_partition,
+          shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+          int32_t token)>& leaf_searcher_builder) const;
+
+  StatusOr<unique_ptr<SingleMachineSearcherBase<T>>> BuildLazyLeafSearcher(
+      int32_t token,
+      const std::function<StatusOrSearcher(
+          shared_ptr<TypedDataset<T>> dataset_partition,
+          shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+          int32_t token)>& leaf_searcher_builder) const;
+
+  StatusOr<const KMeansTreePartitioner<T>*> MaintainableTokenizer() const;
+
+  StatusOr<bool> SplitLeafLocked(
+      int32_t token, const GmmUtils::Options& gmm_options,
+      const std::function<StatusOrSearcher(
+          shared_ptr<TypedDataset<T>> dataset_partition,
+          shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+          int32_t token)>& leaf_searcher_builder)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(leaf_maintenance_mutex_);
+
+  Status RemoveLeafLocked(
+      int32_t token,
+      const std::function<StatusOrSearcher(
+          shared_ptr<TypedDataset<T>> dataset_partition,
+          shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+          int32_t token)>& leaf_searcher_builder)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(leaf_maintenance_mutex_);
+
+  Status InstallEditedTree(
+      shared_ptr<const Partitioner<T>> query_tokenizer,
+      shared_ptr<const Partitioner<T>> database_tokenizer,
+      ConstSpan<int32_t> previous_tokens,
+      vector<pair<int32_t, std::vector<DatapointIndex>>> rebuilt_leaves,
+      const std::function<StatusOrSearcher(
+          shared_ptr<TypedDataset<T>> dataset_partition,
+          shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+          int32_t token)>& leaf_searcher_builder)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(leaf_maintenance_mutex_);
+
   vector<unique_ptr<SingleMachineSearcherBase<T>>> leaf_searchers_;
 
+  unique_ptr<LazyLeafCache<T>> lazy_leaves_;
+
+  bool lazy_leaves_enabled_ = false;
+
+  size_t lazy_leaf_max_resident_bytes_ = 0;
+
   shared_ptr<const Partitioner<T>> query_tokenizer_;
   shared_ptr<const Partitioner<T>> database_tokenizer_;
 
@@ -200,8 +315,22 @@ class TreeXHybridSMMD : public SingleMachineSearcherBase<T> {
 
   bool disjoint_leaf_partitions_ = true;
 
+  IncrementalUpdateConfig::Reindexing reindexing_config_;
+
+  std::function<StatusOrSearcher(
+      shared_ptr<TypedDataset<T>> dataset_partition,
+      shared_ptr<DenseDataset<uint8_t>> hashed_dataset_partition,
+      int32_t token)>
+      maintenance_leaf_searcher_builder_;
+
   DatapointIndex num_datapoints_ = 0;
 
+  uint64_t leaf_generation_ = 0;
+
+  mutable absl::Mutex leaf_update_mutex_;
+
+  absl::Mutex leaf_maintenance_mutex_;
+
   template <typename U>
   friend class DisjointRestrictTokenSearcher;
 };
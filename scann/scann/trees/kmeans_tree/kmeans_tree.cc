@@ -14,9 +14,15 @@
 
 #include "scann/trees/kmeans_tree/kmeans_tree.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <numeric>
+#include <type_traits>
+#include <utility>
 
+#include "scann/distance_measures/many_to_many/many_to_many.h"
+#include "scann/distance_measures/one_to_many/one_to_many.h"
+#include "scann/distance_measures/one_to_one/dot_product.h"
 #include "scann/oss_wrappers/scann_aligned_malloc.h"
 #include "scann/utils/zip_sort.h"
 #include "tensorflow/core/platform/prefetch.h"
@@ -38,6 +44,129 @@ int32_t CountLeaves(const KMeansTreeNode& node) {
   }
 }
 
+constexpr size_t kMinQueriesForDequantizedCenters = 8;
+
+struct FrontierEntry {
+  const KMeansTreeNode* node;
+  DatapointIndex query_idx;
+};
+
+struct BatchedTokenizationScratch {
+  vector<FrontierEntry> frontier;
+  vector<FrontierEntry> next_frontier;
+  vector<float> distances;
+  vector<float> gathered_queries;
+  vector<float> dequantized_centers;
+  vector<float> adjusted_query;
+  vector<float> query_squared_norms;
+  vector<pair<DatapointIndex, float>> children;
+  FastTopNeighbors<float> top_n;
+};
+
+void GroupManyToMany(const DistanceMeasure& dist,
+                     const DenseDataset<float>& queries,
+                     ConstSpan<FrontierEntry> group,
+                     const DenseDataset<float>& centers, ThreadPool* pool,
+                     BatchedTokenizationScratch* scratch) {
+  const size_t num_centers = centers.size();
+  float* distances = scratch->distances.data();
+  auto copy_block = [distances, num_centers](MutableSpan<float> block,
+                                             DatapointIndex first_center_idx,
+                                             DatapointIndex group_idx) {
+    std::copy(block.begin(), block.end(),
+              distances + group_idx * num_centers + first_center_idx);
+  };
+
+  if (group.size() == queries.size()) {
+    DenseDistanceManyToMany<float>(dist, queries, centers, pool, copy_block);
+    return;
+  }
+
+  const DimensionIndex dims = queries.dimensionality();
+  scratch->gathered_queries.resize(group.size() * dims);
+  for (size_t i : IndicesOf(group)) {
+    ConstSpan<float> query = queries.data(group[i].query_idx);
+    std::copy(query.begin(), query.end(),
+              scratch->gathered_queries.begin() + i * dims);
+  }
+  DenseDataset<float> gathered(std::move(scratch->gathered_queries),
+                               group.size());
+  DenseDistanceManyToMany<float>(dist, gathered, centers, pool, copy_block);
+  scratch->gathered_queries = gathered.ClearRecyclingDataVector();
+}
+
+void ComputeGroupDistances(const DistanceMeasure& dist,
+                           const DenseDataset<float>& queries,
+                           ConstSpan<FrontierEntry> group,
+                           const DenseDataset<float>& centers,
+                           ConstSpan<float> center_sq_l2_norms,
+                           ConstSpan<float> inv_int8_multipliers,
+                           ThreadPool* pool,
+                           BatchedTokenizationScratch* scratch) {
+  if (group.size() == 1) {
+    DenseDistanceOneToMany<float, float>(
+        dist, queries[group[0].query_idx], centers,
+        MakeMutableSpan(scratch->distances));
+    return;
+  }
+  GroupManyToMany(dist, queries, group, centers, pool, scratch);
+}
+
+void ComputeGroupDistances(const DistanceMeasure& dist,
+                           const DenseDataset<float>& queries,
+                           ConstSpan<FrontierEntry> group,
+                           const DenseDataset<int8_t>& centers,
+                           ConstSpan<float> center_sq_l2_norms,
+                           ConstSpan<float> inv_int8_multipliers,
+                           ThreadPool* pool,
+                           BatchedTokenizationScratch* scratch) {
+  const bool is_sq_l2 =
+      dist.specially_optimized_distance_tag() == DistanceMeasure::SQUARED_L2;
+  const float multiplier_scale = is_sq_l2 ? 2.0f : 1.0f;
+  const size_t num_centers = centers.size();
+  const DimensionIndex dims = centers.dimensionality();
+
+  if (group.size() >= kMinQueriesForDequantizedCenters) {
+    scratch->dequantized_centers.resize(num_centers * dims);
+    for (size_t center_idx : Seq(num_centers)) {
+      ConstSpan<int8_t> center = centers.data(center_idx);
+      float* dst = scratch->dequantized_centers.data() + center_idx * dims;
+      for (DimensionIndex d : Seq(dims)) {
+        dst[d] = center[d] * inv_int8_multipliers[d] * multiplier_scale;
+      }
+    }
+    DenseDataset<float> dequantized(std::move(scratch->dequantized_centers),
+                                    num_centers);
+    GroupManyToMany(DotProductDistance(), queries, group, dequantized, pool,
+                    scratch);
+    scratch->dequantized_centers = dequantized.ClearRecyclingDataVector();
+  } else {
+    scratch->adjusted_query.resize(dims);
+    for (size_t i : IndicesOf(group)) {
+      ConstSpan<float> query = queries.data(group[i].query_idx);
+      for (DimensionIndex d : Seq(dims)) {
+        scratch->adjusted_query[d] =
+            query[d] * inv_int8_multipliers[d] * multiplier_scale;
+      }
+      DenseDotProductDistanceOneToManyInt8Float(
+          MakeDatapointPtr(scratch->adjusted_query.data(), dims), centers,
+          MakeMutableSpan(scratch->distances.data() + i * num_centers,
+                          num_centers));
+    }
+  }
+
+  if (is_sq_l2) {
+    DCHECK_EQ(center_sq_l2_norms.size(), num_centers);
+    for (size_t i : IndicesOf(group)) {
+      const float query_norm = scratch->query_squared_norms[group[i].query_idx];
+      float* row = scratch->distances.data() + i * num_centers;
+      for (size_t center_idx : Seq(num_centers)) {
+        row[center_idx] += query_norm + center_sq_l2_norms[center_idx];
+      }
+    }
+  }
+}
+
 }  // namespace
 
 KMeansTree::KMeansTree() {}
@@ -70,6 +199,168 @@ Status KMeansTree::Train(const Dataset& training_data,
   return status;
 }
 
+Status KMeansTree::TrainFromSource(
+    StreamingDatasetSource* training_source,
+    const DistanceMeasure& training_distance, int32_t num_clusters,
+    KMeansTreeTrainingOptions* training_options) {
+  DCHECK(training_options);
+  if (training_options->max_num_levels != 1) {
+    return InvalidArgumentError(
+        "Streaming k-means tree training only supports one-level trees "
+        "(got max_num_levels = %d).",
+        training_options->max_num_levels);
+  }
+  SCANN_RETURN_IF_ERROR(root_.TrainFromSource(
+      training_source, training_distance, num_clusters, training_options));
+  n_tokens_ = root_.NumberLeaves(0);
+  root_.PopulateCurNodeCenters();
+  learned_spilling_type_ = training_options->learned_spilling_type;
+  max_spill_centers_ = training_options->max_spill_centers;
+  root_.CreateFixedPointCenters();
+  return OkStatus();
+}
+
+unique_ptr<KMeansTree> KMeansTree::Clone() const {
+  SerializedKMeansTree serialized;
+  SerializeWithoutIndices(&serialized);
+  auto result = make_unique<KMeansTree>(serialized);
+  result->max_spill_centers_ = max_spill_centers_;
+  return result;
+}
+
+StatusOr<vector<int32_t>> KMeansTree::SplitLeaf(
+    int32_t token, const DenseDataset<float>& centers) {
+  if (token < 0 || token >= n_tokens_) {
+    return OutOfRangeError("Token %d is out of range [0, %d).", token,
+                           n_tokens_);
+  }
+  if (centers.size() < 2) {
+    return InvalidArgumentError(
+        "At least two centers are required to split a leaf (got %d).",
+        centers.size());
+  }
+  if (root_.IsLeaf()) {
+    root_.SplitAsRoot(centers);
+    return RenumberLeaves();
+  }
+  if (centers.dimensionality() != root_.Centers().dimensionality()) {
+    return InvalidArgumentError(
+        "Split centers have dimensionality %d but the tree has dimensionality "
+        "%d.",
+        centers.dimensionality(), root_.Centers().dimensionality());
+  }
+
+  size_t child_idx = 0;
+  KMeansTreeNode* parent = FindLeafParent(token, &root_, &child_idx);
+  SCANN_RET_CHECK(parent);
+  parent->SplitChild(child_idx, centers);
+  return RenumberLeaves();
+}
+
+StatusOr<vector<int32_t>> KMeansTree::RemoveLeaf(int32_t token) {
+  if (token < 0 || token >= n_tokens_) {
+    return OutOfRangeError("Token %d is out of range [0, %d).", token,
+                           n_tokens_);
+  }
+  if (n_tokens_ == 1) {
+    return FailedPreconditionError(
+        "Cannot remove the only leaf of a KMeansTree.");
+  }
+
+  bool remove_root = false;
+  SCANN_RET_CHECK(RemoveLeafImpl(token, &root_, &remove_root));
+  DCHECK(!remove_root);
+  return RenumberLeaves();
+}
+
+bool KMeansTree::RemoveLeafImpl(int32_t token, KMeansTreeNode* node,
+                                bool* remove_node) {
+  for (size_t i : IndicesOf(node->children_)) {
+    KMeansTreeNode& child = node->children_[i];
+    bool remove_child = false;
+    if (child.IsLeaf()) {
+      if (child.LeafId() != token) continue;
+      remove_child = true;
+    } else if (!RemoveLeafImpl(token, &child, &remove_child)) {
+      continue;
+    }
+
+    if (remove_child) {
+      if (node->children_.size() == 1) {
+        *remove_node = true;
+      } else {
+        node->RemoveChild(i);
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+Status KMeansTree::SetLeafQuerySpillingThresholds(
+    ConstSpan<double> thresholds) {
+  if (!thresholds.empty() && thresholds.size() != n_tokens_) {
+    return InvalidArgumentError(
+        "Expected %d leaf query spilling thresholds (one per token), got %d.",
+        n_tokens_, thresholds.size());
+  }
+  SetLeafQuerySpillingThresholdsImpl(thresholds, &root_);
+  return OkStatus();
+}
+
+bool KMeansTree::has_leaf_query_spilling_thresholds() const {
+  std::vector<const KMeansTreeNode*> stack = {&root_};
+  while (!stack.empty()) {
+    const KMeansTreeNode* node = stack.back();
+    stack.pop_back();
+    if (!node->leaf_query_spilling_thresholds().empty()) return true;
+    for (const KMeansTreeNode& child : node->Children()) {
+      stack.push_back(&child);
+    }
+  }
+  return false;
+}
+
+void KMeansTree::SetLeafQuerySpillingThresholdsImpl(
+    ConstSpan<double> thresholds, KMeansTreeNode* node) {
+  node->leaf_query_spilling_thresholds_.clear();
+  if (node->IsLeaf()) return;
+  if (!thresholds.empty()) {
+    node->leaf_query_spilling_thresholds_.resize(node->children_.size(), NAN);
+  }
+  for (size_t i : IndicesOf(node->children_)) {
+    KMeansTreeNode& child = node->children_[i];
+    if (!child.IsLeaf()) {
+      SetLeafQuerySpillingThresholdsImpl(thresholds, &child);
+    } else if (!thresholds.empty()) {
+      node->leaf_query_spilling_thresholds_[i] = thresholds[child.LeafId()];
+    }
+  }
+}
+
+KMeansTreeNode* KMeansTree::FindLeafParent(int32_t token, KMeansTreeNode* node,
+                                           size_t* child_idx) {
+  for (size_t i : IndicesOf(node->children_)) {
+    KMeansTreeNode& child = node->children_[i];
+    if (child.IsLeaf()) {
+      if (child.LeafId() != token) continue;
+      *child_idx = i;
+      return node;
+    }
+    KMeansTreeNode* result = FindLeafParent(token, &child, child_idx);
+    if (result) return result;
+  }
+  return nullptr;
+}
+
+vector<int32_t> KMeansTree::RenumberLeaves() {
+  vector<int32_t> previous_tokens;
+  previous_tokens.reserve(n_tokens_ + 1);
+  root_.AppendLeafIds(&previous_tokens);
+  n_tokens_ = root_.NumberLeaves(0);
+  return previous_tokens;
+}
+
 void KMeansTree::Serialize(SerializedKMeansTree* result) const {
   CHECK(result != nullptr);
   result->set_learned_spilling_type(learned_spilling_type_);
@@ -82,4 +373,194 @@ void KMeansTree::SerializeWithoutIndices(SerializedKMeansTree* result) const {
   root_.CopyToProto(result->mutable_root(), false);
 }
 
+Status KMeansTree::TokenizeBatched(
+    const DenseDataset<float>& queries, const DistanceMeasure& dist,
+    const TokenizationOptions& opts,
+    MutableSpan<std::vector<KMeansTreeSearchResult>> results,
+    ConstSpan<int32_t> max_spilling_centers_override, ThreadPool* pool) const {
+  if (queries.size() != results.size()) {
+    return InvalidArgumentError(
+        "Number of queries (%d) does not match number of results (%d).",
+        queries.size(), results.size());
+  }
+  if (!max_spilling_centers_override.empty() &&
+      max_spilling_centers_override.size() != queries.size()) {
+    return InvalidArgumentError(
+        "The max_centers override must have the same size as batched "
+        "queries.");
+  }
+  if (queries.empty()) return OkStatus();
+  SCANN_RETURN_IF_ERROR(root_.CheckDimensionality(queries.dimensionality()));
+
+  const auto tag = dist.specially_optimized_distance_tag();
+  if (tag != DistanceMeasure::DOT_PRODUCT &&
+      tag != DistanceMeasure::SQUARED_L2) {
+    TokenizationOptions query_opts = opts;
+    for (DatapointIndex query_idx : IndicesOf(queries)) {
+      if (!max_spilling_centers_override.empty() &&
+          max_spilling_centers_override[query_idx] > 0) {
+        query_opts.max_spilling_centers =
+            max_spilling_centers_override[query_idx];
+      } else {
+        query_opts.max_spilling_centers = opts.max_spilling_centers;
+      }
+      SCANN_RETURN_IF_ERROR(
+          Tokenize(queries[query_idx], dist, query_opts, &results[query_idx]));
+    }
+    return OkStatus();
+  }
+
+  if (opts.tokenization_type == FLOAT) {
+    return TokenizeBatchedImpl<float>(queries, dist, opts, results,
+                                      max_spilling_centers_override, pool);
+  } else if (opts.tokenization_type == FIXED_POINT_INT8) {
+    return TokenizeBatchedImpl<int8_t>(queries, dist, opts, results,
+                                       max_spilling_centers_override, pool);
+  } else {
+    return InternalError(
+        absl::StrCat("Invalid tokenization type:  ", opts.tokenization_type));
+  }
+}
+
+template <typename CentersType>
+Status KMeansTree::TokenizeBatchedImpl(
+    const DenseDataset<float>& queries, const DistanceMeasure& dist,
+    const TokenizationOptions& opts,
+    MutableSpan<std::vector<KMeansTreeSearchResult>> results,
+    ConstSpan<int32_t> max_spilling_centers_override, ThreadPool* pool) const {
+  QuerySpillingConfig::SpillingType spilling_type;
+  double spilling_threshold = NAN;
+  int32_t max_centers = 1;
+  bool use_leaf_spilling_thresholds = false;
+  switch (opts.spilling_type) {
+    case TokenizationOptions::NONE:
+      spilling_type = QuerySpillingConfig::NO_SPILLING;
+      break;
+    case TokenizationOptions::LEARNED:
+      spilling_type =
+          static_cast<QuerySpillingConfig::SpillingType>(learned_spilling_type_);
+      max_centers = max_spill_centers_;
+      break;
+    case TokenizationOptions::USER_SPECIFIED:
+      spilling_type = opts.user_specified_spilling_type;
+      spilling_threshold = opts.spilling_threshold;
+      max_centers = opts.max_spilling_centers;
+      use_leaf_spilling_thresholds = opts.use_leaf_spilling_thresholds;
+      break;
+    default:
+      return InternalError(
+          absl::StrCat("Invalid spilling type:  ", opts.spilling_type));
+  }
+  const bool is_spilling = opts.spilling_type != TokenizationOptions::NONE;
+  const bool use_override =
+      opts.spilling_type == TokenizationOptions::USER_SPECIFIED &&
+      !max_spilling_centers_override.empty();
+
+  for (auto& query_results : results) query_results.clear();
+  if (root_.IsLeaf()) {
+    for (auto& query_results : results) {
+      query_results.push_back({&root_, NAN, 1.0});
+    }
+    return OkStatus();
+  }
+
+  BatchedTokenizationScratch scratch;
+  if (is_spilling) {
+    for (DatapointIndex query_idx : IndicesOf(queries)) {
+      SCANN_RET_CHECK(queries[query_idx].IsFinite());
+    }
+  }
+  if (std::is_same_v<CentersType, int8_t> &&
+      dist.specially_optimized_distance_tag() == DistanceMeasure::SQUARED_L2) {
+    scratch.query_squared_norms.resize(queries.size());
+    for (DatapointIndex query_idx : IndicesOf(queries)) {
+      scratch.query_squared_norms[query_idx] =
+          SquaredL2Norm(queries[query_idx]);
+    }
+  }
+
+  scratch.frontier.resize(queries.size());
+  for (DatapointIndex query_idx : IndicesOf(queries)) {
+    scratch.frontier[query_idx] = {&root_, query_idx};
+  }
+  while (!scratch.frontier.empty()) {
+    std::sort(scratch.frontier.begin(), scratch.frontier.end(),
+              [](const FrontierEntry& a, const FrontierEntry& b) {
+                return a.node != b.node ? a.node < b.node
+                                        : a.query_idx < b.query_idx;
+              });
+    scratch.next_frontier.clear();
+    for (size_t begin = 0; begin < scratch.frontier.size();) {
+      const KMeansTreeNode* node = scratch.frontier[begin].node;
+      size_t end = begin + 1;
+      while (end < scratch.frontier.size() &&
+             scratch.frontier[end].node == node) {
+        ++end;
+      }
+      ConstSpan<FrontierEntry> group(scratch.frontier.data() + begin,
+                                     end - begin);
+      begin = end;
+
+      const DenseDataset<CentersType>& centers =
+          node->GetCentersByTemplateType<CentersType>();
+      const size_t num_centers = centers.size();
+      scratch.distances.resize(group.size() * num_centers);
+      ComputeGroupDistances(dist, queries, group, centers,
+                            node->center_squared_l2_norms_,
+                            node->inv_int8_multipliers_, pool, &scratch);
+
+      const double node_spilling_threshold =
+          std::isnan(spilling_threshold) ? node->learned_spilling_threshold()
+                                         : spilling_threshold;
+      const ConstSpan<double> leaf_spilling_thresholds =
+          use_leaf_spilling_thresholds
+              ? node->leaf_query_spilling_thresholds()
+              : ConstSpan<double>();
+      ConstSpan<KMeansTreeNode> children = node->Children();
+      for (size_t i : IndicesOf(group)) {
+        const DatapointIndex query_idx = group[i].query_idx;
+        ConstSpan<float> distances(scratch.distances.data() + i * num_centers,
+                                   num_centers);
+        if (is_spilling) {
+          const int32_t query_max_centers =
+              (use_override && max_spilling_centers_override[query_idx] > 0)
+                  ? max_spilling_centers_override[query_idx]
+                  : max_centers;
+          SCANN_RETURN_IF_ERROR(kmeans_tree_internal::SelectChildrenWithSpilling(
+              distances, spilling_type, node_spilling_threshold,
+              leaf_spilling_thresholds, query_max_centers, &scratch.top_n,
+              &scratch.children));
+        } else {
+          auto min_it = std::min_element(distances.begin(), distances.end());
+          scratch.children.clear();
+          scratch.children.emplace_back(min_it - distances.begin(), *min_it);
+        }
+
+        for (const auto& [child_idx, distance_to_child] : scratch.children) {
+          const KMeansTreeNode& child = children[child_idx];
+          if (!child.IsLeaf()) {
+            scratch.next_frontier.push_back({&child, query_idx});
+            continue;
+          }
+          const double residual_stdev =
+              (opts.populate_residual_stdev &&
+               child_idx < node->residual_stdevs().size())
+                  ? node->residual_stdevs()[child_idx]
+                  : 1.0;
+          results[query_idx].push_back(
+              {&child, distance_to_child, residual_stdev});
+        }
+      }
+    }
+    std::swap(scratch.frontier, scratch.next_frontier);
+  }
+
+  if (is_spilling) {
+    for (auto& query_results : results) {
+      ZipSortBranchOptimized(query_results.begin(), query_results.end());
+    }
+  }
+  return OkStatus();
+}
+
 }  // namespace research_scann
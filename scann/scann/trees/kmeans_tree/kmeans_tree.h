@@ -30,6 +30,7 @@
 #include "scann/trees/kmeans_tree/kmeans_tree_node.h"
 #include "scann/trees/kmeans_tree/training_options.h"
 #include "scann/utils/datapoint_utils.h"
+#include "scann/utils/streaming_dataset_source.h"
 #include "scann/utils/types.h"
 #include "tensorflow/core/lib/core/errors.h"
 
@@ -87,6 +88,18 @@ class KMeansTree final : public KMeansTreeTrainerInterface,
                const DistanceMeasure& training_distance, int32_t k_per_level,
                KMeansTreeTrainingOptions* training_options) override;
 
+  Status TrainFromSource(StreamingDatasetSource* training_source,
+                         const DistanceMeasure& training_distance,
+                         int32_t num_clusters,
+                         KMeansTreeTrainingOptions* training_options);
+
+  unique_ptr<KMeansTree> Clone() const;
+
+  StatusOr<std::vector<int32_t>> SplitLeaf(int32_t token,
+                                           const DenseDataset<float>& centers);
+
+  StatusOr<std::vector<int32_t>> RemoveLeaf(int32_t token);
+
   enum TokenizationType {
     FLOAT = 1,
 
@@ -140,6 +153,8 @@ class KMeansTree final : public KMeansTreeTrainerInterface,
     double spilling_threshold = NAN;
     int32_t max_spilling_centers = -1;
 
+    bool use_leaf_spilling_thresholds = false;
+
     bool populate_residual_stdev = false;
 
     TokenizationType tokenization_type = FLOAT;
@@ -150,6 +165,13 @@ class KMeansTree final : public KMeansTreeTrainerInterface,
                   const TokenizationOptions& opts,
                   std::vector<KMeansTreeSearchResult>* result) const;
 
+  Status TokenizeBatched(
+      const DenseDataset<float>& queries, const DistanceMeasure& dist,
+      const TokenizationOptions& opts,
+      MutableSpan<std::vector<KMeansTreeSearchResult>> results,
+      ConstSpan<int32_t> max_spilling_centers_override = {},
+      ThreadPool* pool = nullptr) const;
+
   const KMeansTreeNode* root() const { return &root_; }
 
   void Serialize(SerializedKMeansTree* result) const override;
@@ -158,6 +180,10 @@ class KMeansTree final : public KMeansTreeTrainerInterface,
 
   int32_t n_tokens() const { return n_tokens_; }
 
+  Status SetLeafQuerySpillingThresholds(ConstSpan<double> thresholds);
+
+  bool has_leaf_query_spilling_thresholds() const;
+
   bool is_trained() const { return n_tokens_ > 0; }
 
   DatabaseSpillingConfig::SpillingType learned_spilling_type() const {
@@ -186,6 +212,17 @@ class KMeansTree final : public KMeansTreeTrainerInterface,
       std::vector<KMeansTreeSearchResult>* results) const;
 
  private:
+  static KMeansTreeNode* FindLeafParent(int32_t token, KMeansTreeNode* node,
+                                        size_t* child_idx);
+
+  static bool RemoveLeafImpl(int32_t token, KMeansTreeNode* node,
+                             bool* remove_node);
+
+  static void SetLeafQuerySpillingThresholdsImpl(ConstSpan<double> thresholds,
+                                                 KMeansTreeNode* node);
+
+  std::vector<int32_t> RenumberLeaves();
+
   template <typename CentersType>
   Status TokenizeImpl(const DatapointPtr<float>& query,
                       const DistanceMeasure& dist,
@@ -203,10 +240,17 @@ class KMeansTree final : public KMeansTreeTrainerInterface,
       const DatapointPtr<float>& query, const DistanceMeasure& dist,
       QuerySpillingConfig::SpillingType spilling_type,
       double spilling_threshold, int32_t max_centers,
-      const KMeansTreeNode* current_node,
+      bool use_leaf_spilling_thresholds, const KMeansTreeNode* current_node,
       std::vector<KMeansTreeSearchResult>* results,
       bool populate_residual_stdev = false) const;
 
+  template <typename CentersType>
+  Status TokenizeBatchedImpl(
+      const DenseDataset<float>& queries, const DistanceMeasure& dist,
+      const TokenizationOptions& opts,
+      MutableSpan<std::vector<KMeansTreeSearchResult>> results,
+      ConstSpan<int32_t> max_spilling_centers_override, ThreadPool* pool) const;
+
   template <typename CallbackType, typename RetValueType>
   pair<bool, RetValueType> NodeIteratingHelper(
       int32_t token, const KMeansTreeNode* node, CallbackType success_callback,
@@ -334,12 +378,13 @@ Status KMeansTree::TokenizeImpl(
           query, dist,
           static_cast<QuerySpillingConfig::SpillingType>(
               learned_spilling_type_),
-          NAN, max_spill_centers_, &root_, result,
+          NAN, max_spill_centers_, false, &root_, result,
           opts.populate_residual_stdev);
     case TokenizationOptions::USER_SPECIFIED:
       return TokenizeWithSpillingImpl<CentersType>(
           query, dist, opts.user_specified_spilling_type,
-          opts.spilling_threshold, opts.max_spilling_centers, &root_, result,
+          opts.spilling_threshold, opts.max_spilling_centers,
+          opts.use_leaf_spilling_thresholds, &root_, result,
           opts.populate_residual_stdev);
     default:
       return InternalError(
@@ -400,7 +445,8 @@ template <typename CentersType>
 Status KMeansTree::TokenizeWithSpillingImpl(
     const DatapointPtr<float>& query, const DistanceMeasure& dist,
     QuerySpillingConfig::SpillingType spilling_type, double spilling_threshold,
-    int32_t max_centers, const KMeansTreeNode* current_node,
+    int32_t max_centers, bool use_leaf_spilling_thresholds,
+    const KMeansTreeNode* current_node,
     std::vector<KMeansTreeSearchResult>* results,
     bool populate_residual_stdev) const {
   DCHECK(results);
@@ -425,6 +471,9 @@ Status KMeansTree::TokenizeWithSpillingImpl(
   Status status =
       kmeans_tree_internal::FindChildrenWithSpilling<float, CentersType>(
           query, spilling_type, possibly_learned_spilling_threshold,
+          use_leaf_spilling_thresholds
+              ? current_node->leaf_query_spilling_thresholds()
+              : ConstSpan<double>(),
           max_centers, dist, current_node_centers,
           current_node->center_squared_l2_norms_,
           current_node->inv_int8_multipliers_, &children_to_search);
@@ -446,8 +495,8 @@ Status KMeansTree::TokenizeWithSpillingImpl(
     } else {
       status = TokenizeWithSpillingImpl<CentersType>(
           query, dist, spilling_type, spilling_threshold, max_centers,
-          &current_node->Children()[child_index], results,
-          populate_residual_stdev);
+          use_leaf_spilling_thresholds, &current_node->Children()[child_index],
+          results, populate_residual_stdev);
       if (!status.ok()) return status;
     }
   }
@@ -25,12 +25,35 @@
 #include "scann/distance_measures/one_to_one/l2_distance.h"
 #include "scann/oss_wrappers/scann_random.h"
 #include "scann/utils/gmm_utils.h"
+#include "scann/utils/memory_logging.h"
 #include "scann/utils/parallel_for.h"
 #include "scann/utils/scalar_quantization_helpers.h"
+#include "scann/utils/streaming_dataset_source.h"
 #include "scann/utils/types.h"
 #include "scann/utils/util_functions.h"
 
 namespace research_scann {
+namespace {
+
+GmmUtils::Options MakeGmmOptions(const KMeansTreeTrainingOptions& opts) {
+  GmmUtils::Options gmm_opts;
+  gmm_opts.max_iterations = opts.max_iterations;
+  gmm_opts.epsilon = opts.convergence_epsilon;
+  gmm_opts.max_iteration_duration = opts.max_iteration_duration;
+  gmm_opts.seed = opts.seed + kDeterministicSeed;
+  gmm_opts.min_cluster_size = opts.min_cluster_size;
+  gmm_opts.max_cluster_size = opts.max_cluster_size;
+  gmm_opts.parallelization_pool = opts.training_parallelization_pool;
+  gmm_opts.partition_assignment_type = opts.balancing_type;
+  gmm_opts.center_reassignment_type = opts.reassignment_type;
+  gmm_opts.center_initialization_type = opts.center_initialization_type;
+  gmm_opts.kmeans_parallel_num_rounds = opts.kmeans_parallel_num_rounds;
+  gmm_opts.kmeans_parallel_oversampling_factor =
+      opts.kmeans_parallel_oversampling_factor;
+  return gmm_opts;
+}
+
+}  // namespace
 
 KMeansTreeNode::KMeansTreeNode() {}
 
@@ -40,6 +63,7 @@ void KMeansTreeNode::Reset() {
   indices_.clear();
   children_.clear();
   residual_stdevs_.clear();
+  leaf_query_spilling_thresholds_.clear();
 }
 
 void KMeansTreeNode::UnionIndices(vector<DatapointIndex>* result) const {
@@ -52,6 +76,24 @@ void KMeansTreeNode::UnionIndices(vector<DatapointIndex>* result) const {
   }
 }
 
+MemoryUsageReport KMeansTreeNode::MemoryUsageBreakdown() const {
+  MemoryUsageReport report("KMeansTree", VectorStorage(children_));
+  report.AddChild("centers", float_centers_.MemoryUsageExcludingDocids());
+  report.AddChild("fixed_point_centers",
+                  fixed_point_centers_.MemoryUsageExcludingDocids() +
+                      VectorStorage(inv_int8_multipliers_));
+  report.AddChild("center_squared_l2_norms",
+                  VectorStorage(center_squared_l2_norms_));
+  report.AddChild("residual_stdevs", VectorStorage(residual_stdevs_));
+  report.AddChild("leaf_spilling_thresholds",
+                  VectorStorage(leaf_query_spilling_thresholds_));
+  report.AddChild("datapoint_indices", VectorStorage(indices_));
+  for (const KMeansTreeNode& child : children_) {
+    report.MergeFrom(child.MemoryUsageBreakdown());
+  }
+  return report;
+}
+
 namespace {
 
 template <typename T>
@@ -93,6 +135,9 @@ void KMeansTreeNode::BuildFromProto(const SerializedKMeansTree::Node& proto) {
   residual_stdevs_.insert(residual_stdevs_.begin(),
                           proto.residual_stdevs().begin(),
                           proto.residual_stdevs().end());
+  leaf_query_spilling_thresholds_.assign(
+      proto.leaf_query_spilling_thresholds().begin(),
+      proto.leaf_query_spilling_thresholds().end());
   if (proto.children_size() == 0) {
     indices_.insert(indices_.begin(), proto.indices().begin(),
                     proto.indices().end());
@@ -118,21 +163,36 @@ Status KMeansTreeNode::Train(const Dataset& training_data,
     return OkStatus();
   }
 
-  GmmUtils::Options gmm_opts;
-  gmm_opts.max_iterations = opts->max_iterations;
-  gmm_opts.epsilon = opts->convergence_epsilon;
-  gmm_opts.max_iteration_duration = opts->max_iteration_duration;
-  gmm_opts.seed = opts->seed + kDeterministicSeed;
-  gmm_opts.min_cluster_size = opts->min_cluster_size;
-  gmm_opts.parallelization_pool = opts->training_parallelization_pool;
-  gmm_opts.partition_assignment_type = opts->balancing_type;
-  gmm_opts.center_reassignment_type = opts->reassignment_type;
-  gmm_opts.center_initialization_type = opts->center_initialization_type;
+  GmmUtils::Options gmm_opts = MakeGmmOptions(*opts);
+  if (opts->num_mini_batches > 1) {
+    if (opts->balancing_type != GmmUtils::Options::UNBALANCED) {
+      return InvalidArgumentError(
+          "Mini-batch k-means training only supports unbalanced "
+          "partitioning.");
+    }
+    gmm_opts.streaming_chunk_size =
+        DivRoundUp(indices_.size(), opts->num_mini_batches);
+  }
   GmmUtils gmm(MakeDummyShared(&training_distance), gmm_opts);
 
   vector<vector<DatapointIndex>> subpartitions;
   DenseDataset<double> centers;
-  if (opts->partitioning_type == PartitioningConfig::SPHERICAL) {
+  if (opts->num_mini_batches > 1) {
+    DatasetSubsetSource source(training_data, indices_);
+    if (opts->partitioning_type == PartitioningConfig::SPHERICAL) {
+      SCANN_RETURN_IF_ERROR(gmm.SphericalMiniBatchKmeans(
+          &source, k_per_level, &centers, &subpartitions));
+    } else {
+      DCHECK_EQ(opts->partitioning_type, PartitioningConfig::GENERIC);
+      SCANN_RETURN_IF_ERROR(gmm.GenericMiniBatchKmeans(
+          &source, k_per_level, &centers, &subpartitions));
+    }
+    for (auto& subpartition : subpartitions) {
+      for (DatapointIndex& dp_idx : subpartition) {
+        dp_idx = source.GetOriginalIndex(dp_idx);
+      }
+    }
+  } else if (opts->partitioning_type == PartitioningConfig::SPHERICAL) {
     SCANN_RETURN_IF_ERROR(gmm.SphericalKmeans(
         training_data, indices_, k_per_level, &centers, &subpartitions));
   } else {
@@ -164,9 +224,9 @@ Status KMeansTreeNode::Train(const Dataset& training_data,
           kmeans_tree_internal::FindChildrenWithSpilling<double, double>(
               double_dp.ToPtr(),
               static_cast<QuerySpillingConfig::SpillingType>(spilling_type),
-              learned_spilling_threshold_, opts->max_spill_centers,
-              training_distance, centers, ConstSpan<float>(),
-              ConstSpan<float>(), &spill_centers);
+              learned_spilling_threshold_, ConstSpan<double>(),
+              opts->max_spill_centers, training_distance, centers,
+              ConstSpan<float>(), ConstSpan<float>(), &spill_centers);
 
       SCANN_RETURN_IF_ERROR(status);
       for (const auto& center_index : spill_centers) {
@@ -229,6 +289,81 @@ Status KMeansTreeNode::Train(const Dataset& training_data,
   return OkStatus();
 }
 
+Status KMeansTreeNode::TrainFromSource(
+    StreamingDatasetSource* source, const DistanceMeasure& training_distance,
+    int32_t num_clusters, KMeansTreeTrainingOptions* opts) {
+  SCANN_RET_CHECK(source);
+  if (opts->balancing_type != GmmUtils::Options::UNBALANCED) {
+    return InvalidArgumentError(
+        "Streaming k-means tree training only supports unbalanced "
+        "partitioning.");
+  }
+  if (opts->learned_spilling_type != DatabaseSpillingConfig::NO_SPILLING &&
+      opts->per_node_spilling_factor > 1.0) {
+    return InvalidArgumentError(
+        "Streaming k-means tree training does not support database "
+        "spilling.");
+  }
+
+  GmmUtils::Options gmm_opts = MakeGmmOptions(*opts);
+  if (opts->num_mini_batches > 1) {
+    gmm_opts.streaming_chunk_size =
+        DivRoundUp(source->size(), opts->num_mini_batches);
+  }
+  GmmUtils gmm(MakeDummyShared(&training_distance), gmm_opts);
+
+  vector<vector<DatapointIndex>> subpartitions;
+  DenseDataset<double> centers;
+  if (opts->partitioning_type == PartitioningConfig::SPHERICAL) {
+    SCANN_RETURN_IF_ERROR(gmm.SphericalMiniBatchKmeans(
+        source, num_clusters, &centers, &subpartitions));
+  } else {
+    DCHECK_EQ(opts->partitioning_type, PartitioningConfig::GENERIC);
+    SCANN_RETURN_IF_ERROR(gmm.GenericMiniBatchKmeans(
+        source, num_clusters, &centers, &subpartitions));
+  }
+
+  if (opts->compute_residual_stdev) {
+    vector<int32_t> assignment(source->size());
+    for (const auto& [center_idx, subpartition] : Enumerate(subpartitions)) {
+      for (DatapointIndex dp_idx : subpartition) {
+        assignment[dp_idx] = center_idx;
+      }
+    }
+    vector<double> sq_residual_sums(centers.size());
+    SCANN_RETURN_IF_ERROR(source->IterateChunks(
+        gmm_opts.streaming_chunk_size,
+        [&](size_t offset, const DenseDataset<double>& chunk) -> Status {
+          for (size_t j : IndicesOf(chunk)) {
+            const int32_t center_idx = assignment[offset + j];
+            sq_residual_sums[center_idx] +=
+                SquaredL2DistanceBetween(chunk[j], centers[center_idx]);
+          }
+          return OkStatus();
+        }));
+    residual_stdevs_.resize(centers.size());
+    for (size_t i : IndicesOf(residual_stdevs_)) {
+      const uint32_t count = subpartitions[i].size();
+      const double sq_residual_sum = sq_residual_sums[i];
+      residual_stdevs_[i] = std::max(
+          count == 0   ? 1.0
+          : count == 1 ? std::sqrt(sq_residual_sum)
+                       : std::sqrt(sq_residual_sum / (count - 1)),
+          opts->residual_stdev_min_value);
+    }
+  }
+
+  FreeBackingStorage(&indices_);
+  children_ = vector<KMeansTreeNode>(centers.size());
+  for (size_t i = 0; i < children_.size(); ++i) {
+    children_[i].Reset();
+    children_[i].indices_ = std::move(subpartitions[i]);
+  }
+
+  centers.ConvertType(&float_centers_);
+  return OkStatus();
+}
+
 void KMeansTreeNode::CreateFixedPointCenters() {
   if (!fixed_point_centers_.empty()) return;
 
@@ -279,6 +414,102 @@ void KMeansTreeNode::PopulateCurNodeCenters() {
   }
 }
 
+void KMeansTreeNode::SplitChild(size_t child_idx,
+                                const DenseDataset<float>& centers) {
+  DCHECK_LT(child_idx, children_.size());
+  DCHECK(children_[child_idx].IsLeaf());
+  DCHECK_GE(centers.size(), 1);
+  const size_t num_added = centers.size() - 1;
+  const size_t num_centers = float_centers_.size() + num_added;
+
+  vector<float> storage;
+  storage.reserve(num_centers * float_centers_.dimensionality());
+  vector<KMeansTreeNode> children;
+  children.reserve(num_centers);
+  for (size_t i : IndicesOf(children_)) {
+    children.push_back(std::move(children_[i]));
+    if (i != child_idx) {
+      ConstSpan<float> center = float_centers_[i].values_slice();
+      storage.insert(storage.end(), center.begin(), center.end());
+      continue;
+    }
+    for (DatapointPtr<float> center : centers) {
+      storage.insert(storage.end(), center.values(),
+                     center.values() + center.dimensionality());
+    }
+    children.resize(children.size() + num_added);
+  }
+  if (!residual_stdevs_.empty()) {
+    residual_stdevs_.insert(residual_stdevs_.begin() + child_idx + 1, num_added,
+                            residual_stdevs_[child_idx]);
+  }
+  if (!leaf_query_spilling_thresholds_.empty()) {
+    leaf_query_spilling_thresholds_.insert(
+        leaf_query_spilling_thresholds_.begin() + child_idx + 1, num_added,
+        leaf_query_spilling_thresholds_[child_idx]);
+  }
+
+  float_centers_ = DenseDataset<float>(std::move(storage), num_centers);
+  children_ = std::move(children);
+  RefreshCenters();
+}
+
+void KMeansTreeNode::SplitAsRoot(const DenseDataset<float>& centers) {
+  DCHECK(IsLeaf());
+  vector<float> storage;
+  storage.reserve(centers.size() * centers.dimensionality());
+  for (DatapointPtr<float> center : centers) {
+    storage.insert(storage.end(), center.values(),
+                   center.values() + center.dimensionality());
+  }
+  float_centers_ = DenseDataset<float>(std::move(storage), centers.size());
+  children_ = vector<KMeansTreeNode>(centers.size());
+  children_.front().leaf_id_ = leaf_id_;
+  leaf_id_ = -1;
+  FreeBackingStorage(&indices_);
+  RefreshCenters();
+}
+
+void KMeansTreeNode::RemoveChild(size_t child_idx) {
+  DCHECK_LT(child_idx, children_.size());
+  DCHECK_GT(children_.size(), 1);
+  vector<float> storage;
+  storage.reserve((float_centers_.size() - 1) *
+                  float_centers_.dimensionality());
+  for (size_t i : IndicesOf(float_centers_)) {
+    if (i == child_idx) continue;
+    ConstSpan<float> center = float_centers_[i].values_slice();
+    storage.insert(storage.end(), center.begin(), center.end());
+  }
+  float_centers_ =
+      DenseDataset<float>(std::move(storage), children_.size() - 1);
+  children_.erase(children_.begin() + child_idx);
+  if (!residual_stdevs_.empty()) {
+    residual_stdevs_.erase(residual_stdevs_.begin() + child_idx);
+  }
+  if (!leaf_query_spilling_thresholds_.empty()) {
+    leaf_query_spilling_thresholds_.erase(
+        leaf_query_spilling_thresholds_.begin() + child_idx);
+  }
+  RefreshCenters();
+}
+
+void KMeansTreeNode::RefreshCenters() {
+  fixed_point_centers_.clear();
+  CreateFixedPointCenters();
+  PopulateCurNodeCenters();
+}
+
+void KMeansTreeNode::AppendLeafIds(vector<int32_t>* leaf_ids) const {
+  if (IsLeaf()) {
+    leaf_ids->push_back(leaf_id_);
+    return;
+  }
+  for (const KMeansTreeNode& child : children_) {
+    child.AppendLeafIds(leaf_ids);
+  }
+}
+
 void KMeansTreeNode::CopyToProto(SerializedKMeansTree::Node* proto,
                                  bool with_indices) const {
   CHECK(proto != nullptr);
@@ -297,6 +528,9 @@ void KMeansTreeNode::CopyToProto(SerializedKMeansTree::Node* proto,
   for (const double& residual_stdev : residual_stdevs_) {
     proto->add_residual_stdevs(residual_stdev);
   }
+  for (const double& threshold : leaf_query_spilling_thresholds_) {
+    proto->add_leaf_query_spilling_thresholds(threshold);
+  }
 
   if (IsLeaf() && with_indices) {
     for (const auto& index : indices_) {
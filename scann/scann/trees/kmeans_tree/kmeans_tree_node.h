@@ -29,6 +29,8 @@
 #include "scann/trees/kmeans_tree/training_options.h"
 #include "scann/utils/datapoint_utils.h"
 #include "scann/utils/fast_top_neighbors.h"
+#include "scann/utils/memory_logging.h"
+#include "scann/utils/streaming_dataset_source.h"
 #include "scann/utils/types.h"
 #include "scann/utils/zip_sort.h"
 #include "tensorflow/core/platform/macros.h"
@@ -49,6 +51,14 @@ class KMeansTreeNode {
 
   const DenseDataset<float>& Centers() const { return float_centers_; }
 
+  const DenseDataset<int8_t>& fixed_point_centers() const {
+    return fixed_point_centers_;
+  }
+
+  ConstSpan<float> inv_int8_multipliers() const {
+    return inv_int8_multipliers_;
+  }
+
   const std::vector<KMeansTreeNode>& Children() const { return children_; }
 
   const std::vector<DatapointIndex>& indices() const { return indices_; }
@@ -63,8 +73,14 @@ class KMeansTreeNode {
     return learned_spilling_threshold_;
   }
 
+  ConstSpan<double> leaf_query_spilling_thresholds() const {
+    return leaf_query_spilling_thresholds_;
+  }
+
   DatapointPtr<float> cur_node_center() const { return cur_node_center_; }
 
+  MemoryUsageReport MemoryUsageBreakdown() const;
+
  private:
   friend class KMeansTree;
 
@@ -72,6 +88,11 @@ class KMeansTreeNode {
                const DistanceMeasure& training_distance, int32_t k_per_level,
                int32_t current_level, KMeansTreeTrainingOptions* opts);
 
+  Status TrainFromSource(StreamingDatasetSource* source,
+                         const DistanceMeasure& training_distance,
+                         int32_t num_clusters,
+                         KMeansTreeTrainingOptions* opts);
+
   void CreateFixedPointCenters();
 
   void BuildFromProto(const SerializedKMeansTree::Node& proto);
@@ -84,6 +105,16 @@ class KMeansTreeNode {
 
   void PopulateCurNodeCenters();
 
+  void SplitChild(size_t child_idx, const DenseDataset<float>& centers);
+
+  void SplitAsRoot(const DenseDataset<float>& centers);
+
+  void RemoveChild(size_t child_idx);
+
+  void RefreshCenters();
+
+  void AppendLeafIds(std::vector<int32_t>* leaf_ids) const;
+
   template <typename Real>
   const DenseDataset<Real>& GetCentersByTemplateType() const;
 
@@ -105,6 +136,8 @@ class KMeansTreeNode {
 
   double learned_spilling_threshold_ = numeric_limits<double>::quiet_NaN();
 
+  std::vector<double> leaf_query_spilling_thresholds_ = {};
+
   int32_t leaf_id_ = -1;
 
   DatapointPtr<float> cur_node_center_;
@@ -214,12 +247,67 @@ inline StatusOr<Real> ComputeThreshold(
   return max_dist_to_consider;
 }
 
+inline Status SelectChildrenWithSpilling(
+    ConstSpan<float> distances, QuerySpillingConfig::SpillingType spilling_type,
+    double spilling_threshold, ConstSpan<double> per_child_thresholds,
+    int32_t max_centers, FastTopNeighbors<float>* top_n,
+    std::vector<pair<DatapointIndex, float>>* child_centers) {
+  float epsilon = std::numeric_limits<float>::infinity();
+  std::vector<float> masked_distances;
+  if (spilling_type != QuerySpillingConfig::NO_SPILLING &&
+      spilling_type != QuerySpillingConfig::FIXED_NUMBER_OF_CENTERS) {
+    const float nearest_center_distance =
+        *std::min_element(distances.begin(), distances.end());
+
+    using cast_ops::DoubleToFloat;
+
+    auto max_dist_for_threshold = [&](double threshold) -> StatusOr<float> {
+      float spill_thresh =
+          std::nextafter(DoubleToFloat(threshold),
+                         std::numeric_limits<float>::infinity());
+      return ComputeThreshold(nearest_center_distance, spill_thresh,
+                              spilling_type);
+    };
+    TF_ASSIGN_OR_RETURN(float max_dist_to_consider,
+                        max_dist_for_threshold(spilling_threshold));
+    if (!per_child_thresholds.empty()) {
+      DCHECK_EQ(per_child_thresholds.size(), distances.size());
+      masked_distances.assign(distances.begin(), distances.end());
+      float max_child_dist = nearest_center_distance;
+      for (size_t i : IndicesOf(masked_distances)) {
+        float child_max_dist = max_dist_to_consider;
+        if (!std::isnan(per_child_thresholds[i])) {
+          TF_ASSIGN_OR_RETURN(child_max_dist,
+                              max_dist_for_threshold(per_child_thresholds[i]));
+        }
+        child_max_dist = std::max(child_max_dist, nearest_center_distance);
+        if (masked_distances[i] > child_max_dist) {
+          masked_distances[i] = std::numeric_limits<float>::infinity();
+        } else {
+          max_child_dist = std::max(max_child_dist, masked_distances[i]);
+        }
+      }
+      distances = masked_distances;
+      max_dist_to_consider = max_child_dist;
+    }
+    epsilon = std::nextafter(max_dist_to_consider,
+                             std::numeric_limits<float>::infinity());
+  }
+  const int32_t max_results =
+      (spilling_type == QuerySpillingConfig::NO_SPILLING) ? 1 : max_centers;
+  top_n->Init(max_results, epsilon);
+  top_n->PushBlock(distances, 0);
+  top_n->FinishUnsorted(child_centers);
+  return OkStatus();
+}
+
 template <typename Real, typename DataType>
 Status FindChildrenWithSpilling(
     const DatapointPtr<Real>& query,
     QuerySpillingConfig::SpillingType spilling_type, double spilling_threshold,
-    int32_t max_centers, const DistanceMeasure& dist,
-    const DenseDataset<DataType>& centers, ConstSpan<float> center_sq_l2_norms,
+    ConstSpan<double> per_child_thresholds, int32_t max_centers,
+    const DistanceMeasure& dist, const DenseDataset<DataType>& centers,
+    ConstSpan<float> center_sq_l2_norms,
     ConstSpan<float> inv_int8_multipliers,
     std::vector<pair<DatapointIndex, float>>* child_centers) {
   DCHECK_GT(centers.size(), 0);
@@ -232,31 +320,10 @@ Status FindChildrenWithSpilling(
                                         center_sq_l2_norms,
                                         inv_int8_multipliers, &distances));
 
-  float epsilon = std::numeric_limits<float>::infinity();
-  if (spilling_type != QuerySpillingConfig::NO_SPILLING &&
-      spilling_type != QuerySpillingConfig::FIXED_NUMBER_OF_CENTERS) {
-    const size_t nearest_center_index =
-        std::distance(distances.begin(),
-                      std::min_element(distances.begin(), distances.end()));
-    const float nearest_center_distance = distances[nearest_center_index];
-
-    using cast_ops::DoubleToFloat;
-
-    float spill_thresh = std::nextafter(DoubleToFloat(spilling_threshold),
-                                        std::numeric_limits<float>::infinity());
-    TF_ASSIGN_OR_RETURN(
-        float max_dist_to_consider,
-        ComputeThreshold(nearest_center_distance, spill_thresh, spilling_type));
-    epsilon = std::nextafter(max_dist_to_consider,
-                             std::numeric_limits<float>::infinity());
-  }
-  const int32_t max_results =
-      (spilling_type == QuerySpillingConfig::NO_SPILLING) ? 1 : max_centers;
-  FastTopNeighbors<float> top_n(max_results, epsilon);
-  top_n.PushBlock(MakeConstSpan(distances), 0);
-  top_n.FinishUnsorted(child_centers);
-
-  return OkStatus();
+  FastTopNeighbors<float> top_n;
+  return SelectChildrenWithSpilling(distances, spilling_type,
+                                    spilling_threshold, per_child_thresholds,
+                                    max_centers, &top_n, child_centers);
 }
 
 }  // namespace kmeans_tree_internal
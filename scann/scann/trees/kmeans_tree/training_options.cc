@@ -32,11 +32,16 @@ KMeansTreeTrainingOptions::KMeansTreeTrainingOptions(
       per_node_spilling_factor(config.database_spilling().replication_factor()),
       max_spill_centers(config.database_spilling().max_spill_centers()),
       max_iterations(config.max_clustering_iterations()),
+      num_mini_batches(config.num_mini_batches()),
       convergence_epsilon(config.clustering_convergence_tolerance()),
       min_cluster_size(config.min_cluster_size()),
       seed(config.clustering_seed()),
       compute_residual_stdev(config.compute_residual_stdev()),
       residual_stdev_min_value(config.residual_stdev_min_value()) {
+  if (learned_spilling_type ==
+      DatabaseSpillingConfig::ORTHOGONALITY_AMPLIFIED_RESIDUAL) {
+    learned_spilling_type = DatabaseSpillingConfig::NO_SPILLING;
+  }
   switch (config.balancing_type()) {
     case PartitioningConfig::DEFAULT_UNBALANCED:
       balancing_type = GmmUtils::Options::UNBALANCED;
@@ -44,6 +49,12 @@ KMeansTreeTrainingOptions::KMeansTreeTrainingOptions(
     case PartitioningConfig::GREEDY_BALANCED:
       balancing_type = GmmUtils::Options::GREEDY_BALANCED;
       break;
+    case PartitioningConfig::MIN_COST_MAX_FLOW:
+      balancing_type = GmmUtils::Options::MIN_COST_MAX_FLOW;
+      break;
+  }
+  if (config.has_max_cluster_size()) {
+    max_cluster_size = config.max_cluster_size();
   }
   switch (config.trainer_type()) {
     case PartitioningConfig::DEFAULT_SAMPLING_TRAINER:
@@ -62,7 +73,13 @@ KMeansTreeTrainingOptions::KMeansTreeTrainingOptions(
     case PartitioningConfig::RANDOM_INITIALIZATION:
       center_initialization_type = GmmUtils::Options::RANDOM_INITIALIZATION;
       break;
+    case PartitioningConfig::KMEANS_PARALLEL:
+      center_initialization_type = GmmUtils::Options::KMEANS_PARALLEL;
+      break;
   }
+  kmeans_parallel_num_rounds = config.kmeans_parallel_num_rounds();
+  kmeans_parallel_oversampling_factor =
+      config.kmeans_parallel_oversampling_factor();
 }
 
 }  // namespace research_scann
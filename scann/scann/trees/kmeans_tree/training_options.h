@@ -43,6 +43,10 @@ struct KMeansTreeTrainingOptions {
   GmmUtils::Options::CenterInitializationType center_initialization_type =
       GmmUtils::Options::KMEANS_PLUS_PLUS;
 
+  int32_t kmeans_parallel_num_rounds = 5;
+
+  double kmeans_parallel_oversampling_factor = 2.0;
+
   shared_ptr<ThreadPool> training_parallelization_pool = nullptr;
 
   int32_t max_num_levels = 1;
@@ -58,12 +62,16 @@ struct KMeansTreeTrainingOptions {
 
   int32_t max_iterations = 10;
 
+  int32_t num_mini_batches = 1;
+
   absl::Duration max_iteration_duration = absl::InfiniteDuration();
 
   double convergence_epsilon = 1e-5;
 
   int32_t min_cluster_size = 1;
 
+  int32_t max_cluster_size = numeric_limits<int32_t>::max();
+
   int32_t seed = 0;
 
   bool compute_residual_stdev = false;
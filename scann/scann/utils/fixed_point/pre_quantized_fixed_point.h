@@ -30,6 +30,8 @@ struct PreQuantizedFixedPoint {
   shared_ptr<vector<float>> multiplier_by_dimension = nullptr;
 
   shared_ptr<vector<float>> squared_l2_norm_by_datapoint = nullptr;
+
+  uint8_t transposed_simd_block_size = 0;
 };
 
 inline PreQuantizedFixedPoint CreatePreQuantizedFixedPoint(
@@ -17,12 +17,15 @@
 #include <cfloat>
 #include <cstdint>
 #include <limits>
+#include <numeric>
+#include <queue>
 
 #include "Eigen/Core"
 #include "Eigen/Dense"
 #include "Eigen/SVD"
 #include "Eigen/StdVector"
 #include "absl/base/internal/endian.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/numeric/bits.h"
 #include "absl/random/distributions.h"
@@ -98,6 +101,14 @@ DatapointIndex GetSample(MTRandom* random, ConstSpan<double> distances,
   return distances.size() - 1;
 }
 
+std::string SampleIdDocid(DatapointIndex sample_id) {
+  uint32_t big_endian_sample_id = absl::ghtonl(sample_id);
+  std::string docid;
+  docid.resize(sizeof(big_endian_sample_id));
+  memcpy(docid.data(), &big_endian_sample_id, sizeof(big_endian_sample_id));
+  return docid;
+}
+
 }  // namespace
 
 class GmmUtilsImplInterface : public VirtualDestructor {
@@ -330,10 +341,170 @@ vector<pair<DatapointIndex, double>> UnbalancedPartitionAssignment(
   return top1_results;
 }
 
+constexpr size_t kNumBalancedAssignmentCandidates = 8;
+
+constexpr uint32_t kMaxBidsPerDatapoint = 8 * kNumBalancedAssignmentCandidates;
+
+constexpr double kAuctionEpsilonFraction = 0.05;
+
+constexpr size_t kMaxReclusterDistanceMatrixBytes = size_t{256} << 20;
+
+vector<pair<uint32_t, double>> ComputeCandidateCenters(
+    GmmUtilsImplInterface* impl, const DistanceMeasure& distance,
+    const DenseDataset<double>& centers, size_t num_candidates,
+    ThreadPool* pool) {
+  const size_t num_centers = centers.size();
+  vector<pair<uint32_t, double>> candidates(impl->size() * num_candidates);
+  impl->IterateDataset(
+      pool, [&](size_t offset, const DenseDataset<double>& dataset_batch) {
+        vector<double> distances(dataset_batch.size() * num_centers);
+        DenseDistanceManyToMany<double>(
+            distance, dataset_batch, centers,
+            [&](MutableSpan<double> block_distances,
+                DatapointIndex first_center_idx, DatapointIndex batch_idx) {
+              std::copy(block_distances.begin(), block_distances.end(),
+                        distances.begin() + batch_idx * num_centers +
+                            first_center_idx);
+            });
+
+        vector<uint32_t> order(num_centers);
+        for (size_t batch_idx : IndicesOf(dataset_batch)) {
+          const double* row = distances.data() + batch_idx * num_centers;
+          std::iota(order.begin(), order.end(), 0);
+          std::partial_sort(
+              order.begin(), order.begin() + num_candidates, order.end(),
+              [row](uint32_t a, uint32_t b) { return row[a] < row[b]; });
+          auto* dp_candidates =
+              candidates.data() + (offset + batch_idx) * num_candidates;
+          for (size_t j : Seq(num_candidates)) {
+            dp_candidates[j] = {order[j], row[order[j]]};
+          }
+        }
+      });
+  return candidates;
+}
+
 vector<pair<DatapointIndex, double>> MinCostMaxFlowPartitionAssignment(
     GmmUtilsImplInterface* impl, const DistanceMeasure& distance,
-    const DenseDataset<double>& centers, ThreadPool* pool) {
-  LOG(ERROR) << "Min-cost max-flow based assignment not supported.";
+    const DenseDataset<double>& centers, int32_t max_cluster_size,
+    ThreadPool* pool) {
+  const size_t dataset_size = impl->size();
+  const size_t num_centers = centers.size();
+  const size_t capacity = std::max<size_t>(
+      max_cluster_size, DivRoundUp(dataset_size, num_centers));
+  if (capacity >= dataset_size) {
+    return UnbalancedPartitionAssignment(impl, distance, centers, pool);
+  }
+
+  const size_t num_candidates =
+      std::min(kNumBalancedAssignmentCandidates, num_centers);
+  const vector<pair<uint32_t, double>> candidates =
+      ComputeCandidateCenters(impl, distance, centers, num_candidates, pool);
+  auto dp_candidates = [&](DatapointIndex dp_idx) {
+    return ConstSpan<pair<uint32_t, double>>(
+        candidates.data() + dp_idx * num_candidates, num_candidates);
+  };
+
+  double gap_sum = 0.0;
+  for (DatapointIndex dp_idx : Seq(dataset_size)) {
+    auto c = dp_candidates(dp_idx);
+    gap_sum += c.back().second - c.front().second;
+  }
+  const double auction_epsilon = std::max(
+      kAuctionEpsilonFraction * gap_sum / (dataset_size * num_candidates),
+      std::numeric_limits<double>::epsilon());
+
+  using Bid = pair<double, DatapointIndex>;
+  vector<std::priority_queue<Bid, vector<Bid>, std::greater<Bid>>> admitted(
+      num_centers);
+  auto price = [&](uint32_t center_idx) {
+    const auto& bids = admitted[center_idx];
+    return bids.size() < capacity ? 0.0 : bids.top().first;
+  };
+
+  constexpr uint8_t kUnassigned = numeric_limits<uint8_t>::max();
+  vector<uint8_t> assigned_candidate(dataset_size, kUnassigned);
+  vector<uint32_t> num_bids(dataset_size, 0);
+  vector<DatapointIndex> unassigned(dataset_size);
+  std::iota(unassigned.rbegin(), unassigned.rend(), 0);
+  vector<DatapointIndex> exhausted;
+  while (!unassigned.empty()) {
+    const DatapointIndex dp_idx = unassigned.back();
+    unassigned.pop_back();
+    if (++num_bids[dp_idx] > kMaxBidsPerDatapoint) {
+      exhausted.push_back(dp_idx);
+      continue;
+    }
+
+    auto c = dp_candidates(dp_idx);
+    uint8_t best = 0;
+    double best_value = -numeric_limits<double>::infinity();
+    double second_value = -numeric_limits<double>::infinity();
+    for (size_t j : IndicesOf(c)) {
+      const double value = -c[j].second - price(c[j].first);
+      if (value > best_value) {
+        second_value = best_value;
+        best_value = value;
+        best = j;
+      } else if (value > second_value) {
+        second_value = value;
+      }
+    }
+
+    const uint32_t center_idx = c[best].first;
+    const double bid =
+        price(center_idx) + best_value - second_value + auction_epsilon;
+    auto& bids = admitted[center_idx];
+    bids.push({bid, dp_idx});
+    assigned_candidate[dp_idx] = best;
+    if (bids.size() > capacity) {
+      const DatapointIndex evicted = bids.top().second;
+      bids.pop();
+      assigned_candidate[evicted] = kUnassigned;
+      unassigned.push_back(evicted);
+    }
+  }
+
+  vector<pair<DatapointIndex, double>> top1_results(dataset_size);
+  vector<size_t> cluster_sizes(num_centers);
+  for (DatapointIndex dp_idx : Seq(dataset_size)) {
+    if (assigned_candidate[dp_idx] == kUnassigned) continue;
+    top1_results[dp_idx] = dp_candidates(dp_idx)[assigned_candidate[dp_idx]];
+    ++cluster_sizes[top1_results[dp_idx].first];
+  }
+
+  if (!exhausted.empty()) {
+    VLOG(1) << StrFormat(
+        "%d datapoints exhausted their auction bids; assigning them to the "
+        "nearest center with spare capacity.",
+        exhausted.size());
+  }
+  Datapoint<double> storage;
+  vector<double> distances(num_centers);
+  for (DatapointIndex dp_idx : exhausted) {
+    pair<DatapointIndex, double> best = {kInvalidDatapointIndex,
+                                         numeric_limits<double>::infinity()};
+    for (const auto& candidate : dp_candidates(dp_idx)) {
+      if (cluster_sizes[candidate.first] < capacity) {
+        best = candidate;
+        break;
+      }
+    }
+    if (best.first == kInvalidDatapointIndex) {
+      DenseDistanceOneToMany(distance, impl->GetPoint(dp_idx, &storage),
+                             centers, MakeMutableSpan(distances));
+      for (uint32_t center_idx : Seq(num_centers)) {
+        if (cluster_sizes[center_idx] < capacity &&
+            distances[center_idx] < best.second) {
+          best = {center_idx, distances[center_idx]};
+        }
+      }
+    }
+    DCHECK_NE(best.first, kInvalidDatapointIndex);
+    top1_results[dp_idx] = best;
+    ++cluster_sizes[best.first];
+  }
+  return top1_results;
 }
 
 vector<pair<DatapointIndex, double>> GreedyBalancedPartitionAssignment(
@@ -343,14 +514,22 @@ vector<pair<DatapointIndex, double>> GreedyBalancedPartitionAssignment(
 }
 
 GmmUtils::PartitionAssignmentFn GetPartitionAssignmentFn(
-    GmmUtils::Options::PartitionAssignmentType type) {
-  switch (type) {
+    const GmmUtils::Options& opts) {
+  switch (opts.partition_assignment_type) {
     case GmmUtils::Options::UNBALANCED:
       return &UnbalancedPartitionAssignment;
     case GmmUtils::Options::GREEDY_BALANCED:
       return &GreedyBalancedPartitionAssignment;
-    case GmmUtils::Options::MIN_COST_MAX_FLOW:
-      return &MinCostMaxFlowPartitionAssignment;
+    case GmmUtils::Options::MIN_COST_MAX_FLOW: {
+      const int32_t max_cluster_size = opts.max_cluster_size;
+      return [max_cluster_size](GmmUtilsImplInterface* impl,
+                                const DistanceMeasure& distance,
+                                const DenseDataset<double>& centers,
+                                ThreadPool* pool) {
+        return MinCostMaxFlowPartitionAssignment(impl, distance, centers,
+                                                 max_cluster_size, pool);
+      };
+    }
     default:
       LOG(FATAL) << "Invalid partition assignment type.";
   }
@@ -363,7 +542,7 @@ Status GmmUtils::GenericKmeans(
     DenseDataset<double>* final_centers,
     vector<vector<DatapointIndex>>* final_partitions) {
   return KMeansImpl(false, dataset, {}, num_clusters,
-                    GetPartitionAssignmentFn(opts_.partition_assignment_type),
+                    GetPartitionAssignmentFn(opts_),
                     final_centers, final_partitions);
 }
 Status GmmUtils::GenericKmeans(
@@ -371,7 +550,7 @@ Status GmmUtils::GenericKmeans(
     const int32_t num_clusters, DenseDataset<double>* final_centers,
     vector<vector<DatapointIndex>>* final_partitions) {
   return KMeansImpl(false, dataset, subset, num_clusters,
-                    GetPartitionAssignmentFn(opts_.partition_assignment_type),
+                    GetPartitionAssignmentFn(opts_),
                     final_centers, final_partitions);
 }
 
@@ -380,7 +559,7 @@ Status GmmUtils::SphericalKmeans(
     DenseDataset<double>* final_centers,
     vector<vector<DatapointIndex>>* final_partitions) {
   return KMeansImpl(true, dataset, {}, num_clusters,
-                    GetPartitionAssignmentFn(opts_.partition_assignment_type),
+                    GetPartitionAssignmentFn(opts_),
                     final_centers, final_partitions);
 }
 Status GmmUtils::SphericalKmeans(
@@ -388,7 +567,7 @@ Status GmmUtils::SphericalKmeans(
     const int32_t num_clusters, DenseDataset<double>* final_centers,
     vector<vector<DatapointIndex>>* final_partitions) {
   return KMeansImpl(true, dataset, subset, num_clusters,
-                    GetPartitionAssignmentFn(opts_.partition_assignment_type),
+                    GetPartitionAssignmentFn(opts_),
                     final_centers, final_partitions);
 }
 
@@ -406,6 +585,9 @@ Status GmmUtils::InitializeCenters(const Dataset& dataset,
     case Options::MEAN_DISTANCE_INITIALIZATION:
       return MeanDistanceInitializeCenters(dataset, subset, num_clusters,
                                            initial_centers);
+    case Options::KMEANS_PARALLEL:
+      return KMeansParallelInitializeCenters(dataset, subset, num_clusters,
+                                             initial_centers);
   }
 }
 
@@ -544,11 +726,7 @@ Status GmmUtils::KMeansPPInitializeCenters(
     last_center = impl->GetPoint(sample_id, &storage);
     SCANN_RETURN_IF_ERROR(VerifyAllFinite(storage.values()));
 
-    uint32_t big_endian_sample_id = absl::ghtonl(sample_id);
-    std::string docid;
-    docid.resize(sizeof(big_endian_sample_id));
-    memcpy(docid.data(), &big_endian_sample_id, sizeof(big_endian_sample_id));
-    centers.AppendOrDie(last_center, docid);
+    centers.AppendOrDie(last_center, SampleIdDocid(sample_id));
   }
 
   centers.set_normalization_tag(dataset.normalization());
@@ -591,6 +769,222 @@ Status GmmUtils::RandomInitializeCenters(
   return OkStatus();
 }
 
+Status GmmUtils::KMeansParallelInitializeCenters(
+    const Dataset& dataset, ConstSpan<DatapointIndex> subset,
+    int32_t num_clusters, DenseDataset<double>* initial_centers) {
+  SCANN_RET_CHECK(initial_centers);
+  initial_centers->clear();
+  ThreadPool* pool = opts_.parallelization_pool.get();
+  auto impl = GmmUtilsImplInterface::Create(*distance_, dataset, subset, pool);
+  SCANN_RETURN_IF_ERROR(impl->CheckAllFinite())
+      << "Non-finite values detected in the initial dataset in "
+         "GmmUtils::InitializeCenters.";
+
+  const size_t dataset_size = impl->size();
+  if (dataset_size < num_clusters) {
+    return InvalidArgumentError(StrFormat(
+        "Number of points (%d) is less than the number of clusters (%d).",
+        dataset_size, num_clusters));
+  }
+  if (opts_.kmeans_parallel_num_rounds < 1 ||
+      !(opts_.kmeans_parallel_oversampling_factor > 0.0)) {
+    return InvalidArgumentError(
+        "k-means|| requires at least one round and a positive oversampling "
+        "factor (got %d rounds, oversampling factor %f).",
+        opts_.kmeans_parallel_num_rounds,
+        opts_.kmeans_parallel_oversampling_factor);
+  }
+
+  Datapoint<double> storage;
+  vector<double> distances(dataset_size);
+  SCANN_RETURN_IF_ERROR(impl->GetCentroid(&storage));
+  impl->DistancesFromPoint(storage.ToPtr(), MakeMutableSpan(distances));
+
+  vector<DatapointIndex> candidate_ids;
+  vector<uint8_t> is_candidate(dataset_size, false);
+  vector<DatapointIndex> nearest_candidate(dataset_size, 0);
+  vector<double> sampling_weights(dataset_size);
+  auto compute_sampling_weights = [&]() -> StatusOr<double> {
+    double min_dist = numeric_limits<double>::infinity();
+    for (size_t j : Seq(dataset_size)) {
+      SCANN_RET_CHECK(!std::isnan(distances[j]))
+          << "NaN distances found (j = " << j << ").";
+      if (!is_candidate[j]) min_dist = std::min(min_dist, distances[j]);
+    }
+    const double bias = std::min(min_dist, 0.0);
+    double sum = 0.0;
+    for (size_t j : Seq(dataset_size)) {
+      sampling_weights[j] = is_candidate[j] ? 0.0 : distances[j] - bias;
+      sum += sampling_weights[j];
+    }
+    SCANN_RET_CHECK(std::isfinite(sum)) << "Infinite distances sum found.";
+    return sum;
+  };
+
+  auto add_candidates = [&](ConstSpan<DatapointIndex> new_ids) {
+    DenseDataset<double> new_candidates;
+    new_candidates.set_dimensionality(dataset.dimensionality());
+    new_candidates.Reserve(new_ids.size());
+    for (DatapointIndex idx : new_ids) {
+      new_candidates.AppendOrDie(impl->GetPoint(idx, &storage), "");
+      is_candidate[idx] = true;
+    }
+    const DatapointIndex base = candidate_ids.size();
+    candidate_ids.insert(candidate_ids.end(), new_ids.begin(), new_ids.end());
+    auto top1 = UnbalancedPartitionAssignment(impl.get(), *distance_,
+                                              new_candidates, pool);
+    for (size_t j : Seq(dataset_size)) {
+      if (base == 0 || top1[j].second < distances[j]) {
+        distances[j] = top1[j].second;
+        nearest_candidate[j] = base + top1[j].first;
+      }
+    }
+  };
+
+  TF_ASSIGN_OR_RETURN(double sum, compute_sampling_weights());
+  const DatapointIndex first_id =
+      GetSample(&random_, sampling_weights, sum, true);
+  add_candidates({first_id});
+
+  const double oversampling =
+      opts_.kmeans_parallel_oversampling_factor * num_clusters;
+  constexpr size_t kSamplingBlockSize = 4096;
+  const size_t num_blocks = DivRoundUp(dataset_size, kSamplingBlockSize);
+  for (int32_t round_idx : Seq(opts_.kmeans_parallel_num_rounds)) {
+    TF_ASSIGN_OR_RETURN(sum, compute_sampling_weights());
+    if (!(sum > 0.0)) break;
+
+    const uint32_t round_seed = random_();
+    vector<vector<DatapointIndex>> sampled_by_block(num_blocks);
+    ParallelFor<1>(Seq(num_blocks), pool, [&](size_t block) {
+      MTRandom block_random(round_seed + block);
+      const size_t begin = block * kSamplingBlockSize;
+      const size_t end = std::min(begin + kSamplingBlockSize, dataset_size);
+      for (size_t j : Seq(begin, end)) {
+        const double prob = oversampling * sampling_weights[j] / sum;
+        if (absl::Uniform<double>(block_random, 0.0, 1.0) < prob) {
+          sampled_by_block[block].push_back(j);
+        }
+      }
+    });
+    vector<DatapointIndex> sampled;
+    for (auto& block_samples : sampled_by_block) {
+      sampled.insert(sampled.end(), block_samples.begin(),
+                     block_samples.end());
+    }
+    VLOG(1) << StrFormat("k-means|| round %d sampled %d new candidates.",
+                         round_idx, sampled.size());
+    if (!sampled.empty()) add_candidates(sampled);
+  }
+
+  if (candidate_ids.size() < num_clusters) {
+    vector<DatapointIndex> fill_ids;
+    while (candidate_ids.size() + fill_ids.size() < num_clusters) {
+      const DatapointIndex idx =
+          absl::Uniform<DatapointIndex>(random_, 0, dataset_size);
+      if (is_candidate[idx]) continue;
+      is_candidate[idx] = true;
+      fill_ids.push_back(idx);
+    }
+    candidate_ids.insert(candidate_ids.end(), fill_ids.begin(),
+                         fill_ids.end());
+  }
+
+  DenseDataset<double> centers;
+  centers.set_dimensionality(dataset.dimensionality());
+  centers.Reserve(num_clusters);
+  if (candidate_ids.size() == num_clusters) {
+    for (DatapointIndex idx : candidate_ids) {
+      centers.AppendOrDie(impl->GetPoint(idx, &storage), SampleIdDocid(idx));
+    }
+    centers.set_normalization_tag(dataset.normalization());
+    *initial_centers = std::move(centers);
+    return OkStatus();
+  }
+
+  vector<double> candidate_weights(candidate_ids.size(), 0.0);
+  for (DatapointIndex nearest : nearest_candidate) {
+    candidate_weights[nearest] += 1.0;
+  }
+  DenseDataset<double> candidates;
+  candidates.set_dimensionality(dataset.dimensionality());
+  candidates.Reserve(candidate_ids.size());
+  for (DatapointIndex idx : candidate_ids) {
+    candidates.AppendOrDie(impl->GetPoint(idx, &storage), "");
+  }
+  const size_t num_candidates = candidates.size();
+  vector<float> candidate_distances;
+  unique_ptr<GmmUtilsImplInterface> candidates_impl;
+  if (num_candidates * num_candidates * sizeof(float) <=
+      kMaxReclusterDistanceMatrixBytes) {
+    candidate_distances.resize(num_candidates * num_candidates);
+    DenseDistanceManyToMany<double>(
+        *distance_, candidates, candidates, pool,
+        [&](MutableSpan<double> block_distances,
+            DatapointIndex first_candidate_idx, DatapointIndex query_idx) {
+          std::copy(block_distances.begin(), block_distances.end(),
+                    candidate_distances.begin() + query_idx * num_candidates +
+                        first_candidate_idx);
+        });
+  } else {
+    candidates_impl =
+        GmmUtilsImplInterface::Create(*distance_, candidates, {}, pool);
+  }
+
+  vector<double> min_distances(candidates.size(),
+                               numeric_limits<double>::infinity());
+  vector<double> temp(candidates.size());
+  vector<double> scores(candidates.size());
+  vector<uint8_t> selected(candidates.size(), false);
+  double score_sum = std::accumulate(candidate_weights.begin(),
+                                     candidate_weights.end(), 0.0);
+  DatapointIndex sample_id =
+      GetSample(&random_, candidate_weights, score_sum, true);
+  while (true) {
+    selected[sample_id] = true;
+    const DatapointPtr<double> center = candidates[sample_id];
+    SCANN_RETURN_IF_ERROR(VerifyAllFinite(center.values_slice()))
+        << "(Center Number = " << centers.size() << ")";
+    centers.AppendOrDie(center, SampleIdDocid(candidate_ids[sample_id]));
+    if (centers.size() == num_clusters) break;
+
+    if (candidates_impl) {
+      candidates_impl->DistancesFromPoint(center, MakeMutableSpan(temp));
+    } else {
+      const float* row =
+          candidate_distances.data() + sample_id * num_candidates;
+      std::copy(row, row + num_candidates, temp.begin());
+    }
+    double min_dist = 0.0;
+    for (size_t j : Seq(candidates.size())) {
+      SCANN_RET_CHECK(!std::isnan(temp[j]))
+          << "NaN distances found (j = " << j << ").";
+      min_distances[j] = std::min(min_distances[j], temp[j]);
+      if (!selected[j]) min_dist = std::min(min_dist, min_distances[j]);
+    }
+    score_sum = 0.0;
+    for (size_t j : Seq(candidates.size())) {
+      scores[j] = selected[j]
+                      ? 0.0
+                      : candidate_weights[j] * (min_distances[j] - min_dist);
+      score_sum += scores[j];
+    }
+    SCANN_RET_CHECK(std::isfinite(score_sum))
+        << "Infinite distances sum found.";
+
+    if (score_sum > 0.0) {
+      sample_id = GetSample(&random_, scores, score_sum, false);
+    } else {
+      sample_id = std::find(selected.begin(), selected.end(), false) -
+                  selected.begin();
+    }
+  }
+
+  centers.set_normalization_tag(dataset.normalization());
+  *initial_centers = std::move(centers);
+  return OkStatus();
+}
+
 namespace {
 
 bool IsStdIota(ConstSpan<DatapointIndex> indices) {
@@ -762,6 +1156,193 @@ SCANN_OUTLINE Status GmmUtils::KMeansImpl(
   return OkStatus();
 }
 
+Status GmmUtils::GenericMiniBatchKmeans(
+    StreamingDatasetSource* source, const int32_t num_clusters,
+    DenseDataset<double>* final_centers,
+    vector<vector<DatapointIndex>>* final_partitions) {
+  return MiniBatchKMeansImpl(false, source, num_clusters, final_centers,
+                             final_partitions);
+}
+
+Status GmmUtils::SphericalMiniBatchKmeans(
+    StreamingDatasetSource* source, const int32_t num_clusters,
+    DenseDataset<double>* final_centers,
+    vector<vector<DatapointIndex>>* final_partitions) {
+  return MiniBatchKMeansImpl(true, source, num_clusters, final_centers,
+                             final_partitions);
+}
+
+Status GmmUtils::MiniBatchKMeansImpl(
+    bool spherical, StreamingDatasetSource* source, int32_t num_clusters,
+    DenseDataset<double>* final_centers,
+    vector<vector<DatapointIndex>>* final_partitions) {
+  SCANN_RET_CHECK(source);
+  SCANN_RET_CHECK(final_centers);
+  if (opts_.max_iterations <= 0) {
+    return InvalidArgumentError(
+        "Zero or negative iterations specified in GmmUtils::Options!");
+  }
+  if (opts_.streaming_chunk_size <= 0) {
+    return InvalidArgumentError(
+        "Zero or negative streaming chunk size specified in "
+        "GmmUtils::Options!");
+  }
+  const size_t dataset_size = source->size();
+  if (num_clusters <= 0) {
+    return InvalidArgumentError("Initial centers are undefined.");
+  }
+  if (dataset_size < num_clusters) {
+    return InvalidArgumentError(
+        "Number of points (%d) is less than the number of clusters (%d).",
+        dataset_size, num_clusters);
+  }
+
+  constexpr size_t kInitializationSamplesPerCenter = 4;
+  const size_t sample_size = std::min(
+      dataset_size,
+      std::max<size_t>(opts_.streaming_chunk_size,
+                       kInitializationSamplesPerCenter * num_clusters));
+  vector<size_t> sample_indices;
+  if (sample_size == dataset_size) {
+    sample_indices.resize(dataset_size);
+    std::iota(sample_indices.begin(), sample_indices.end(), 0);
+  } else {
+    absl::flat_hash_set<size_t> sampled;
+    while (sampled.size() < sample_size) {
+      sampled.insert(absl::Uniform<size_t>(random_, 0, dataset_size));
+    }
+    sample_indices.assign(sampled.begin(), sampled.end());
+    std::sort(sample_indices.begin(), sample_indices.end());
+  }
+  DenseDataset<double> sample;
+  sample.set_dimensionality(source->dimensionality());
+  sample.Reserve(sample_size);
+  constexpr size_t kMaxSampleReadGap = 64;
+  DenseDataset<double> storage;
+  for (size_t i = 0; i < sample_indices.size();) {
+    const size_t range_begin = sample_indices[i];
+    size_t end = i + 1;
+    while (end < sample_indices.size() &&
+           sample_indices[end] - sample_indices[end - 1] <= kMaxSampleReadGap &&
+           sample_indices[end] - range_begin <
+               static_cast<size_t>(opts_.streaming_chunk_size)) {
+      ++end;
+    }
+    SCANN_RETURN_IF_ERROR(source->ReadRange(
+        range_begin, sample_indices[end - 1] - range_begin + 1, &storage));
+    for (; i < end; ++i) {
+      SCANN_RETURN_IF_ERROR(
+          sample.Append(storage[sample_indices[i] - range_begin], ""));
+    }
+  }
+  if (spherical) sample.set_normalization_tag(UNITL2NORM);
+
+  DenseDataset<double> centers;
+  SCANN_RETURN_IF_ERROR(
+      InitializeCenters(sample, {}, num_clusters, &centers));
+  SCANN_RETURN_IF_ERROR(VerifyAllFinite(centers.data()))
+      << "Initial centers contain NaN/infinity.";
+
+  const size_t dimensionality = centers.dimensionality();
+  vector<double> center_counts(num_clusters, 0.0);
+  vector<double> sums(num_clusters * dimensionality);
+  vector<uint32_t> batch_sizes(num_clusters);
+  vector<size_t> epoch_sizes(num_clusters);
+  ThreadPool* pool = opts_.parallelization_pool.get();
+  const absl::Time deadline = absl::Now() + opts_.max_iteration_duration;
+  double old_mean_distance = numeric_limits<double>::quiet_NaN();
+  for (size_t iteration : Seq(opts_.max_iterations)) {
+    double total_distance = 0.0;
+    std::fill(epoch_sizes.begin(), epoch_sizes.end(), 0);
+    SCANN_RETURN_IF_ERROR(source->IterateChunks(
+        opts_.streaming_chunk_size,
+        [&](size_t offset, const DenseDataset<double>& chunk) -> Status {
+          auto top1_results =
+              DenseDistanceManyToManyTop1(*distance_, chunk, centers, pool);
+          std::fill(sums.begin(), sums.end(), 0.0);
+          std::fill(batch_sizes.begin(), batch_sizes.end(), 0);
+          for (size_t j : IndicesOf(chunk)) {
+            const uint32_t cluster_idx = top1_results[j].first;
+            SCANN_RET_CHECK_LT(cluster_idx, num_clusters);
+            total_distance += top1_results[j].second;
+            ++batch_sizes[cluster_idx];
+            ConstSpan<double> datapoint = chunk[j].values_slice();
+            double* sum = sums.data() + cluster_idx * dimensionality;
+            for (size_t jj : Seq(dimensionality)) {
+              sum[jj] += datapoint[jj];
+            }
+          }
+
+          for (size_t c : Seq(num_clusters)) {
+            if (batch_sizes[c] == 0) continue;
+            epoch_sizes[c] += batch_sizes[c];
+            center_counts[c] += batch_sizes[c];
+            const double learning_rate = batch_sizes[c] / center_counts[c];
+            const double* sum = sums.data() + c * dimensionality;
+            MutableSpan<double> center = centers.mutable_data(c);
+            for (size_t jj : Seq(dimensionality)) {
+              center[jj] += learning_rate *
+                            (sum[jj] / batch_sizes[c] - center[jj]);
+            }
+            if (spherical) {
+              const double norm = std::sqrt(SquaredL2Norm(centers[c]));
+              if (norm == 0) continue;
+              for (double& x : center) x /= norm;
+            }
+          }
+          return OkStatus();
+        }));
+    SCANN_RETURN_IF_ERROR(VerifyAllFinite(centers.data()))
+        << "MiniBatchKMeansImpl";
+
+    int num_reinitialized = 0;
+    for (size_t c : Seq(num_clusters)) {
+      if (epoch_sizes[c] != 0) continue;
+      const size_t sample_idx = absl::Uniform<size_t>(random_, 0, sample_size);
+      ConstSpan<double> sampled_point = sample[sample_idx].values_slice();
+      std::copy(sampled_point.begin(), sampled_point.end(),
+                centers.mutable_data(c).begin());
+      center_counts[c] = 0.0;
+      ++num_reinitialized;
+    }
+
+    const double mean_distance = total_distance / dataset_size;
+    VLOG(1) << StrFormat(
+        "Mini-batch k-means iteration %d: mean distance = %f, reinitialized "
+        "%d empty clusters.",
+        iteration, mean_distance, num_reinitialized);
+    if (num_reinitialized == 0 &&
+        fabs(mean_distance - old_mean_distance) <= opts_.epsilon) {
+      VLOG(1) << StrFormat("Converged in %d iterations.", iteration);
+      break;
+    }
+    old_mean_distance = mean_distance;
+    if (absl::Now() > deadline) {
+      VLOG(1) << StrFormat("Exiting without converging after %d iterations.",
+                           iteration);
+      break;
+    }
+  }
+
+  if (final_partitions) {
+    vector<vector<DatapointIndex>> partitions(num_clusters);
+    SCANN_RETURN_IF_ERROR(source->IterateChunks(
+        opts_.streaming_chunk_size,
+        [&](size_t offset, const DenseDataset<double>& chunk) -> Status {
+          auto top1_results =
+              DenseDistanceManyToManyTop1(*distance_, chunk, centers, pool);
+          for (size_t j : IndicesOf(chunk)) {
+            partitions[top1_results[j].first].push_back(offset + j);
+          }
+          return OkStatus();
+        }));
+    *final_partitions = std::move(partitions);
+  }
+
+  *final_centers = std::move(centers);
+  return OkStatus();
+}
+
 StatusOr<double> GmmUtils::ComputeSpillingThreshold(
     const Dataset& dataset, ConstSpan<DatapointIndex> subset,
     const DenseDataset<double>& centers,
@@ -958,12 +1539,13 @@ Status GmmUtils::SplitLargeClusterReinitialization(
       sorted_partition_sizes.end(), partition_permutation.begin(),
       partition_permutation.end());
 
-  Datapoint<double> storage;
   int num_reinit_this_iter = 0;
   const uint32_t dim = centroids->dimensionality();
   const double perturbation_factor =
       std::max(opts_.perturbation, DBL_EPSILON * dim);
 
+  vector<pair<uint32_t, uint32_t>> big_small_pairs;
+  vector<double> rand_directions;
   for (size_t big_cluster_idx : Seq(centroids->size())) {
     if (sorted_partition_sizes[big_cluster_idx] < opts_.max_cluster_size) break;
     num_reinit_this_iter++;
@@ -973,49 +1555,127 @@ Status GmmUtils::SplitLargeClusterReinitialization(
 
     if (small_cluster_idx <= big_cluster_idx) break;
 
-    Eigen::VectorXd rand_direction(dim);
-    for (const auto& i : Seq(dim)) {
-      rand_direction[i] = absl::Gaussian<double>(random_);
-    }
-    rand_direction.normalize();
-    rand_direction *= perturbation_factor;
-    MutableSpan<double> big_cluster =
-        centroids->mutable_data(partition_permutation[big_cluster_idx]);
-    MutableSpan<double> small_cluster =
-        centroids->mutable_data(partition_permutation[small_cluster_idx]);
-    for (const auto& d : Seq(dim)) {
-      small_cluster[d] = big_cluster[d] + rand_direction[d];
-      big_cluster[d] = big_cluster[d] - rand_direction[d];
-    }
-    if (spherical) {
-      double big_cluster_norm =
-          1.0f / sqrt(SquaredL2Norm(
-                     centroids->at(partition_permutation[big_cluster_idx])));
-      double small_cluster_norm =
-          1.0f / sqrt(SquaredL2Norm(
-                     centroids->at(partition_permutation[small_cluster_idx])));
-      for (size_t d : Seq(dim)) {
-        big_cluster[d] *= big_cluster_norm;
-        small_cluster[d] *= small_cluster_norm;
-      }
+    big_small_pairs.emplace_back(partition_permutation[big_cluster_idx],
+                                 partition_permutation[small_cluster_idx]);
+    for (size_t d : Seq(dim)) {
+      rand_directions.push_back(absl::Gaussian<double>(random_));
     }
   }
+
+  ParallelFor<1>(
+      IndicesOf(big_small_pairs), opts_.parallelization_pool.get(),
+      [&](size_t pair_idx) {
+        Eigen::Map<Eigen::VectorXd> rand_direction(
+            rand_directions.data() + pair_idx * dim, dim);
+        rand_direction.normalize();
+        rand_direction *= perturbation_factor;
+        MutableSpan<double> big_cluster =
+            centroids->mutable_data(big_small_pairs[pair_idx].first);
+        MutableSpan<double> small_cluster =
+            centroids->mutable_data(big_small_pairs[pair_idx].second);
+        for (const auto& d : Seq(dim)) {
+          small_cluster[d] = big_cluster[d] + rand_direction[d];
+          big_cluster[d] = big_cluster[d] - rand_direction[d];
+        }
+        if (spherical) {
+          double big_cluster_norm =
+              1.0f / sqrt(SquaredL2Norm(
+                         centroids->at(big_small_pairs[pair_idx].first)));
+          double small_cluster_norm =
+              1.0f / sqrt(SquaredL2Norm(
+                         centroids->at(big_small_pairs[pair_idx].second)));
+          for (size_t d : Seq(dim)) {
+            big_cluster[d] *= big_cluster_norm;
+            small_cluster[d] *= small_cluster_norm;
+          }
+        }
+      });
   if (num_reinit_this_iter) {
     LOG(INFO) << StrFormat("Reinitialized %d clusters.", num_reinit_this_iter);
   }
   return OkStatus();
 }
 
+namespace {
+
+constexpr size_t kCovarianceBlockSize = 64;
+
+constexpr int kMaxPowerIterations = 100;
+
+constexpr double kPowerIterationTolerance = 1e-12;
+
+Eigen::MatrixXd ClusterCovariance(const GmmUtilsImplInterface& impl,
+                                  ConstSpan<DatapointIndex> members,
+                                  const Eigen::VectorXd& centroid,
+                                  const Eigen::VectorXd* normalized_centroid) {
+  const size_t dim = centroid.size();
+  Eigen::MatrixXd covariance = Eigen::MatrixXd::Zero(dim, dim);
+  Eigen::MatrixXd block(dim, kCovarianceBlockSize);
+  Datapoint<double> storage;
+  for (size_t begin = 0; begin < members.size();
+       begin += kCovarianceBlockSize) {
+    const size_t block_size =
+        std::min(kCovarianceBlockSize, members.size() - begin);
+    for (size_t j : Seq(block_size)) {
+      Eigen::Map<const Eigen::VectorXd> dp(
+          impl.GetPoint(members[begin + j], &storage).values(), dim);
+      auto x = block.col(j);
+      x = dp - centroid;
+      if (normalized_centroid) {
+        x -= x.dot(*normalized_centroid) * *normalized_centroid;
+      }
+    }
+    covariance.selfadjointView<Eigen::Lower>().rankUpdate(
+        block.leftCols(block_size));
+  }
+  covariance.triangularView<Eigen::StrictlyUpper>() = covariance.transpose();
+  return covariance;
+}
+
+void TopEigenvectors(
+    const Eigen::MatrixXd& matrix, int num_eigenvectors, uint32_t seed,
+    vector<double>* eigenvalues,
+    vector<Eigen::VectorXd, Eigen::aligned_allocator<Eigen::VectorXd>>*
+        eigenvectors) {
+  const size_t dim = matrix.rows();
+  MTRandom random(seed);
+  for (int k : Seq(std::min<size_t>(num_eigenvectors, dim))) {
+    auto orthogonalize = [&](Eigen::VectorXd* v) {
+      for (const Eigen::VectorXd& prev : *eigenvectors) {
+        *v -= prev.dot(*v) * prev;
+      }
+    };
+    Eigen::VectorXd v(dim);
+    for (size_t d : Seq(dim)) {
+      v[d] = absl::Gaussian<double>(random);
+    }
+    orthogonalize(&v);
+    v.normalize();
+
+    for (int iter = 0; iter < kMaxPowerIterations; ++iter) {
+      Eigen::VectorXd w = matrix * v;
+      orthogonalize(&w);
+      const double norm = w.norm();
+      if (norm == 0.0) break;
+      w /= norm;
+      const double change = (w - v).squaredNorm();
+      v = std::move(w);
+      if (change < kPowerIterationTolerance) break;
+    }
+    eigenvalues->push_back(v.dot(matrix * v));
+    eigenvectors->push_back(std::move(v));
+  }
+}
+
+}  // namespace
+
 Status GmmUtils::PCAKmeansReinitialization(
     ConstSpan<pair<uint32_t, double>> top1_results, GmmUtilsImplInterface* impl,
     ConstSpan<uint32_t> partition_sizes, bool spherical,
     DenseDataset<double>* centroids,
     std::vector<double>* convergence_means) const {
   using Eigen::aligned_allocator;
-  using Eigen::JacobiSVD;
   using Eigen::Map;
-  using Eigen::MatrixXd;
-  using Eigen::RowVectorXd;
   using Eigen::VectorXd;
 
   uint32_t dim = centroids->dimensionality();
@@ -1043,22 +1703,7 @@ Status GmmUtils::PCAKmeansReinitialization(
   }
   absl::Time cov_start = absl::Now();
 
-  std::vector<MatrixXd, aligned_allocator<MatrixXd>> covariances(
-      clusters_to_split.size());
-
-  std::vector<VectorXd, aligned_allocator<VectorXd>> normalized_centroids(
-      clusters_to_split.size());
-
-  for (const auto& i : Seq(covariances.size())) {
-    covariances[i].setZero(dim, dim);
-    if (spherical) {
-      Map<const RowVectorXd> centroid(
-          centroids->at(partition_permutation[i]).values(), dim);
-      normalized_centroids[i] = centroid.normalized();
-    }
-  }
-
-  Datapoint<double> storage;
+  vector<vector<DatapointIndex>> members(clusters_to_split.size());
   for (const auto& i : Seq(top1_results.size())) {
     const uint32_t cluster_idx = top1_results[i].first;
     auto it = clusters_to_split.find(cluster_idx);
@@ -1069,46 +1714,54 @@ Status GmmUtils::PCAKmeansReinitialization(
     if (!sorted_partition_idx) continue;
     SCANN_RET_CHECK_EQ(cluster_idx,
                        partition_permutation[sorted_partition_idx]);
-
-    Map<const RowVectorXd> centroid(centroids->at(cluster_idx).values(), dim);
-    impl->GetPoint(i, &storage);
-    Map<const RowVectorXd> dp(storage.values().data(), dim);
-    VectorXd x = dp - centroid;
-    if (spherical) {
-      x = x - x.dot(normalized_centroids[sorted_partition_idx]) *
-                  normalized_centroids[sorted_partition_idx];
-    }
-    covariances[sorted_partition_idx] += x * x.transpose();
+    members[sorted_partition_idx].push_back(i);
   }
 
   const uint32_t avg_size = impl->size() / centroids->size();
-  uint32_t min_partition_idx = sorted_partition_sizes.size();
-  for (const auto& i : Seq(covariances.size())) {
-    const uint32_t multiple_of_avg = (sorted_partition_sizes[i] - 1) / avg_size;
-    const uint32_t num_split_directions = std::min(
-        opts_.max_power_of_2_split, 32 - absl::countl_zero(multiple_of_avg));
-
-    covariances[i] /= sorted_partition_sizes[i];
-
-    JacobiSVD<MatrixXd> svd(covariances[i], Eigen::ComputeThinU);
-    std::vector<VectorXd, aligned_allocator<VectorXd>> split_directions;
-    for (int j = 0; j < dim && split_directions.size() < num_split_directions;
-         ++j) {
-      const double stdev = std::sqrt(svd.singularValues()[j]);
-      const double scaling_factor =
-          std::max(stdev * opts_.perturbation, DBL_EPSILON * dim);
-      split_directions.push_back(svd.matrixU().col(j) * scaling_factor);
-    }
+  std::vector<std::vector<VectorXd, aligned_allocator<VectorXd>>>
+      split_directions(clusters_to_split.size());
+  ParallelFor<1>(
+      Seq(clusters_to_split.size()), opts_.parallelization_pool.get(),
+      [&](size_t i) {
+        const uint32_t multiple_of_avg =
+            (sorted_partition_sizes[i] - 1) / avg_size;
+        const uint32_t num_split_directions =
+            std::min(opts_.max_power_of_2_split,
+                     32 - absl::countl_zero(multiple_of_avg));
+
+        Map<const VectorXd> centroid(
+            centroids->at(partition_permutation[i]).values(), dim);
+        VectorXd normalized_centroid;
+        if (spherical) normalized_centroid = centroid.normalized();
+        Eigen::MatrixXd covariance =
+            ClusterCovariance(*impl, members[i], centroid,
+                              spherical ? &normalized_centroid : nullptr);
+        covariance /= sorted_partition_sizes[i];
+
+        vector<double> eigenvalues;
+        std::vector<VectorXd, aligned_allocator<VectorXd>> eigenvectors;
+        TopEigenvectors(covariance, num_split_directions,
+                        opts_.seed + partition_permutation[i], &eigenvalues,
+                        &eigenvectors);
+        for (size_t j : IndicesOf(eigenvectors)) {
+          const double stdev = std::sqrt(std::max(eigenvalues[j], 0.0));
+          const double scaling_factor =
+              std::max(stdev * opts_.perturbation, DBL_EPSILON * dim);
+          split_directions[i].push_back(eigenvectors[j] * scaling_factor);
+        }
+      });
 
-    const uint64_t combinatoric_limit = 1ULL << split_directions.size();
+  uint32_t min_partition_idx = sorted_partition_sizes.size();
+  for (const auto& i : Seq(split_directions.size())) {
+    const uint64_t combinatoric_limit = 1ULL << split_directions[i].size();
     VectorXd old_centroid(dim);
     VectorXd centroid_storage(dim);
     auto old_centroid_span = centroids->mutable_data(partition_permutation[i]);
     std::copy(old_centroid_span.begin(), old_centroid_span.end(),
               old_centroid.begin());
     centroid_storage = old_centroid;
-    for (const auto& k : Seq(split_directions.size())) {
-      centroid_storage -= split_directions[k];
+    for (const auto& k : Seq(split_directions[i].size())) {
+      centroid_storage -= split_directions[i][k];
     }
     if (spherical) {
       centroid_storage.normalize();
@@ -1128,9 +1781,9 @@ Status GmmUtils::PCAKmeansReinitialization(
       auto override_centroid = centroids->mutable_data(small_cluster_index);
 
       centroid_storage = old_centroid;
-      for (const auto& k : Seq(split_directions.size())) {
+      for (const auto& k : Seq(split_directions[i].size())) {
         const double sign = j & (1ULL << k) ? 1.0 : -1.0;
-        centroid_storage += sign * split_directions[k];
+        centroid_storage += sign * split_directions[i][k];
       }
 
       centroid_storage.eval();
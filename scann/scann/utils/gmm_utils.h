@@ -30,6 +30,7 @@
 #include "scann/partitioning/partitioner.pb.h"
 #include "scann/proto/partitioning.pb.h"
 #include "scann/utils/parallel_for.h"
+#include "scann/utils/streaming_dataset_source.h"
 #include "scann/utils/types.h"
 #include "tensorflow/core/platform/types.h"
 
@@ -82,13 +83,21 @@ class GmmUtils {
       KMEANS_PLUS_PLUS,
 
       RANDOM_INITIALIZATION,
+
+      KMEANS_PARALLEL,
     };
 
     CenterInitializationType center_initialization_type = KMEANS_PLUS_PLUS;
 
+    int32_t kmeans_parallel_num_rounds = 5;
+
+    double kmeans_parallel_oversampling_factor = 2.0;
+
     int32_t max_power_of_2_split = 1;
 
     double parallel_cost_multiplier = 1.0;
+
+    int32_t streaming_chunk_size = 65536;
   };
 
   GmmUtils(shared_ptr<const DistanceMeasure> dist, Options opts);
@@ -114,6 +123,16 @@ class GmmUtils {
       const int32_t num_clusters, DenseDataset<double>* final_centers,
       vector<vector<DatapointIndex>>* final_partitions = nullptr);
 
+  Status GenericMiniBatchKmeans(
+      StreamingDatasetSource* source, const int32_t num_clusters,
+      DenseDataset<double>* final_centers,
+      vector<vector<DatapointIndex>>* final_partitions = nullptr);
+
+  Status SphericalMiniBatchKmeans(
+      StreamingDatasetSource* source, const int32_t num_clusters,
+      DenseDataset<double>* final_centers,
+      vector<vector<DatapointIndex>>* final_partitions = nullptr);
+
   StatusOr<double> ComputeSpillingThreshold(
       const Dataset& dataset, ConstSpan<DatapointIndex> subset,
       const DenseDataset<double>& centers,
@@ -146,6 +165,11 @@ class GmmUtils {
       DenseDataset<double>* final_centers,
       vector<vector<DatapointIndex>>* final_partitions);
 
+  Status MiniBatchKMeansImpl(bool spherical, StreamingDatasetSource* source,
+                             int32_t num_clusters,
+                             DenseDataset<double>* final_centers,
+                             vector<vector<DatapointIndex>>* final_partitions);
+
   Status RandomReinitializeCenters(
       ConstSpan<pair<uint32_t, double>> top1_results,
       GmmUtilsImplInterface* impl, ConstSpan<uint32_t> partition_sizes,
@@ -177,6 +201,10 @@ class GmmUtils {
                                  int32_t num_clusters,
                                  DenseDataset<double>* initial_centers);
 
+  Status KMeansParallelInitializeCenters(
+      const Dataset& dataset, ConstSpan<DatapointIndex> subset,
+      int32_t num_clusters, DenseDataset<double>* initial_centers);
+
   shared_ptr<const DistanceMeasure> distance_;
   Options opts_;
   MTRandom random_;
@@ -23,10 +23,13 @@ namespace research_scann {
 StatusOr<DatapointIndex> ComputeConsistentNumPointsFromIndex(
     const Dataset* dataset, const DenseDataset<uint8_t>* hashed_dataset,
     const PreQuantizedFixedPoint* pre_quantized_fixed_point,
+    const CompressedDenseDataset* compressed_dataset,
     const vector<int64_t>* crowding_attributes) {
-  if (!dataset && !hashed_dataset && !pre_quantized_fixed_point) {
+  if (!dataset && !hashed_dataset && !pre_quantized_fixed_point &&
+      !compressed_dataset) {
     return InvalidArgumentError(
-        "dataset, hashed_dataset and pre_quantized_fixed_point are all null.");
+        "dataset, hashed_dataset, pre_quantized_fixed_point and "
+        "compressed_dataset are all null.");
   }
 
   DatapointIndex sz = kInvalidDatapointIndex;
@@ -55,6 +58,17 @@ StatusOr<DatapointIndex> ComputeConsistentNumPointsFromIndex(
     }
   }
 
+  if (compressed_dataset) {
+    if (sz == kInvalidDatapointIndex) {
+      sz = compressed_dataset->size();
+    } else {
+      SCANN_RET_CHECK_EQ(sz, compressed_dataset->size())
+              .SetErrorCode(error::INVALID_ARGUMENT)
+          << "Mismatch between original/hashed/fixed-point database and "
+             "compressed database sizes.";
+    }
+  }
+
   if (crowding_attributes && !crowding_attributes->empty() &&
       sz != kInvalidDatapointIndex) {
     SCANN_RET_CHECK_EQ(crowding_attributes->size(), sz);
@@ -68,10 +82,13 @@ StatusOr<DatapointIndex> ComputeConsistentNumPointsFromIndex(
 StatusOr<DimensionIndex> ComputeConsistentDimensionalityFromIndex(
     const HashConfig& config, const Dataset* dataset,
     const DenseDataset<uint8_t>* hashed_dataset,
-    const PreQuantizedFixedPoint* pre_quantized_fixed_point) {
-  if (!dataset && !hashed_dataset && !pre_quantized_fixed_point) {
+    const PreQuantizedFixedPoint* pre_quantized_fixed_point,
+    const CompressedDenseDataset* compressed_dataset) {
+  if (!dataset && !hashed_dataset && !pre_quantized_fixed_point &&
+      !compressed_dataset) {
     return InvalidArgumentError(
-        "dataset, hashed_dataset and pre_quantized_fixed_point are all null.");
+        "dataset, hashed_dataset, pre_quantized_fixed_point and "
+        "compressed_dataset are all null.");
   }
 
   DimensionIndex dims = kInvalidDimension;
@@ -89,6 +106,17 @@ StatusOr<DimensionIndex> ComputeConsistentDimensionalityFromIndex(
     }
   }
 
+  if (compressed_dataset) {
+    const DimensionIndex d = compressed_dataset->dimensionality();
+    if (dims == kInvalidDimension) {
+      dims = d;
+    } else {
+      SCANN_RET_CHECK_EQ(dims, d).SetErrorCode(error::INVALID_ARGUMENT)
+          << "Mismatch between original/fixed-point and compressed database "
+             "dimensionalities.";
+    }
+  }
+
   auto projection_check = [&dims](const ProjectionConfig& proj) -> Status {
     if (proj.has_input_dim()) {
       DimensionIndex d = proj.input_dim();
@@ -17,6 +17,7 @@
 
 #include <cstdint>
 
+#include "scann/data_format/compressed_dense_dataset.h"
 #include "scann/data_format/dataset.h"
 #include "scann/proto/hash.pb.h"
 #include "scann/utils/fixed_point/pre_quantized_fixed_point.h"
@@ -26,12 +27,14 @@ namespace research_scann {
 StatusOr<DatapointIndex> ComputeConsistentNumPointsFromIndex(
     const Dataset* dataset, const DenseDataset<uint8_t>* hashed_dataset,
     const PreQuantizedFixedPoint* pre_quantized_fixed_point,
+    const CompressedDenseDataset* compressed_dataset,
     const vector<int64_t>* crowding_attributes);
 
 StatusOr<DimensionIndex> ComputeConsistentDimensionalityFromIndex(
     const HashConfig& config, const Dataset* dataset,
     const DenseDataset<uint8_t>* hashed_dataset,
-    const PreQuantizedFixedPoint* pre_quantized_fixed_point);
+    const PreQuantizedFixedPoint* pre_quantized_fixed_point,
+    const CompressedDenseDataset* compressed_dataset);
 
 }  // namespace research_scann
 
@@ -22,6 +22,9 @@
 #define SCANN_AVX2 __attribute((target("avx,avx2,fma")))
 #define SCANN_AVX512 \
   __attribute((target("avx,avx2,fma,avx512f,avx512dq,avx512bw")))
+#define SCANN_AVX512_VPOPCNTDQ \
+  __attribute((                 \
+      target("avx,avx2,fma,avx512f,avx512dq,avx512bw,avx512vpopcntdq")))
 
 #else
 
@@ -29,6 +32,7 @@
 #define SCANN_AVX1
 #define SCANN_AVX2
 #define SCANN_AVX512
+#define SCANN_AVX512_VPOPCNTDQ
 
 #endif
 
@@ -52,4 +56,7 @@
 #define SCANN_AVX512_INLINE_LAMBDA SCANN_AVX512 SCANN_INLINE_LAMBDA
 #define SCANN_AVX512_OUTLINE SCANN_AVX512 SCANN_OUTLINE
 
+#define SCANN_AVX512_VPOPCNTDQ_INLINE SCANN_AVX512_VPOPCNTDQ SCANN_INLINE
+#define SCANN_AVX512_VPOPCNTDQ_OUTLINE SCANN_AVX512_VPOPCNTDQ SCANN_OUTLINE
+
 #endif
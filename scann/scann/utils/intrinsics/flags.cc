@@ -45,6 +45,12 @@ bool should_use_avx512 =
     tensorflow::port::TestCPUFeature(tensorflow::port::AVX512F) &&
     tensorflow::port::TestCPUFeature(tensorflow::port::AVX512DQ) &&
     tensorflow::port::TestCPUFeature(tensorflow::port::AVX512BW);
+#ifdef __x86_64__
+bool should_use_avx512_vpopcntdq =
+    __builtin_cpu_supports("avx512vpopcntdq");
+#else
+bool should_use_avx512_vpopcntdq = false;
+#endif
 
 }  // namespace flags_internal
 
@@ -32,6 +32,7 @@ extern bool should_use_avx1;
 extern bool should_use_avx2;
 extern bool should_use_avx512;
 extern bool should_use_sse4;
+extern bool should_use_avx512_vpopcntdq;
 
 }  // namespace flags_internal
 
@@ -41,6 +42,10 @@ inline bool RuntimeSupportsAvx2() { return flags_internal::should_use_avx2; }
 inline bool RuntimeSupportsAvx512() {
   return flags_internal::should_use_avx512;
 }
+inline bool RuntimeSupportsAvx512Vpopcntdq() {
+  return flags_internal::should_use_avx512 &&
+         flags_internal::should_use_avx512_vpopcntdq;
+}
 
 enum PlatformGeneration {
   kFallbackForNonX86 = 99,
@@ -15,8 +15,79 @@
 #include "scann/utils/io_npy.h"
 
 #include <cstdint>
+#include <string>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
 
 namespace research_scann {
+namespace {
+
+absl::string_view NumpyHeaderValue(absl::string_view dict,
+                                   absl::string_view key) {
+  const size_t key_pos = dict.find(absl::StrCat("'", key, "'"));
+  if (key_pos == absl::string_view::npos) return "";
+  const size_t colon = dict.find(':', key_pos);
+  if (colon == absl::string_view::npos) return "";
+  absl::string_view value = absl::StripLeadingAsciiWhitespace(
+      dict.substr(colon + 1));
+  if (absl::ConsumePrefix(&value, "(")) {
+    return value.substr(0, value.find(')'));
+  }
+  if (absl::ConsumePrefix(&value, "'")) {
+    return value.substr(0, value.find('\''));
+  }
+  return value.substr(0, value.find_first_of(",}"));
+}
+
+}  // namespace
+
+StatusOr<NumpyHeader> ReadNumpyHeader(absl::string_view filename) {
+  OpenSourceableFileReader reader(filename);
+  char preamble[12];
+  SCANN_RETURN_IF_ERROR(reader.ReadAt(0, MakeMutableSpan(preamble, 10)));
+  if (absl::string_view(preamble, 6) != "\x93NUMPY") {
+    return InvalidArgumentError("%s is not an npy file.", filename);
+  }
+  const uint8_t major_version = preamble[6];
+  size_t header_len, dict_offset;
+  if (major_version == 1) {
+    header_len = static_cast<uint8_t>(preamble[8]) |
+                 static_cast<uint8_t>(preamble[9]) << 8;
+    dict_offset = 10;
+  } else {
+    SCANN_RETURN_IF_ERROR(reader.ReadAt(0, MakeMutableSpan(preamble, 12)));
+    header_len = 0;
+    for (int i : {11, 10, 9, 8}) {
+      header_len = header_len << 8 | static_cast<uint8_t>(preamble[i]);
+    }
+    dict_offset = 12;
+  }
+
+  std::string dict(header_len, '\0');
+  SCANN_RETURN_IF_ERROR(
+      reader.ReadAt(dict_offset, MakeMutableSpan(dict.data(), dict.size())));
+
+  NumpyHeader header;
+  header.descr = std::string(NumpyHeaderValue(dict, "descr"));
+  header.fortran_order = NumpyHeaderValue(dict, "fortran_order") == "True";
+  for (absl::string_view dim :
+       absl::StrSplit(NumpyHeaderValue(dict, "shape"), ',', absl::SkipEmpty())) {
+    dim = absl::StripAsciiWhitespace(dim);
+    if (dim.empty()) continue;
+    size_t dim_size;
+    if (!absl::SimpleAtoi(dim, &dim_size)) {
+      return InvalidArgumentError("Malformed shape in npy header of %s.",
+                                  filename);
+    }
+    header.shape.push_back(dim_size);
+  }
+  header.data_offset = dict_offset + header_len;
+  return header;
+}
 
 template <typename T>
 struct assert_false : std::false_type {};
@@ -25,6 +25,18 @@ namespace research_scann {
 template <typename T>
 std::string numpy_type_name();
 
+struct NumpyHeader {
+  std::string descr;
+
+  bool fortran_order = false;
+
+  vector<size_t> shape;
+
+  size_t data_offset = 0;
+};
+
+StatusOr<NumpyHeader> ReadNumpyHeader(absl::string_view filename);
+
 template <typename T>
 Status SpanToNumpy(absl::string_view filename, ConstSpan<T> data,
                    ConstSpan<size_t> dim_sizes = {}) {
@@ -73,6 +85,30 @@ Status DatasetToNumpy(absl::string_view filename, const DenseDataset<T>& data) {
   return SpanToNumpy(filename, data.data(), {data.size()});
 }
 
+template <typename T>
+StatusOr<DenseDataset<T>> MmapNumpyDataset(
+    absl::string_view filename,
+    const MemoryMappedFileOptions& opts = MemoryMappedFileOptions()) {
+  TF_ASSIGN_OR_RETURN(NumpyHeader header, ReadNumpyHeader(filename));
+  if (absl::StrCat("'", header.descr, "'") != numpy_type_name<T>()) {
+    return InvalidArgumentError("%s has dtype %s but %s was expected.",
+                                filename, header.descr, numpy_type_name<T>());
+  }
+  if (header.fortran_order || header.shape.size() != 2) {
+    return InvalidArgumentError(
+        "Only two-dimensional C-order npy files can be memory-mapped (%s).",
+        filename);
+  }
+  TF_ASSIGN_OR_RETURN(shared_ptr<const MemoryMappedFile> file,
+                      MemoryMappedFile::Open(filename, opts));
+  TF_ASSIGN_OR_RETURN(
+      DenseDataset<T> result,
+      DenseDataset<T>::FromMemoryMappedFile(std::move(file), header.data_offset,
+                                            header.shape[0], header.shape[1]));
+  SCANN_RETURN_IF_ERROR(result.AdviseMemoryMapping(opts.access_pattern));
+  return result;
+}
+
 }  // namespace research_scann
 
 #endif
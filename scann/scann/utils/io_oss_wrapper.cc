@@ -14,6 +14,16 @@
 
 #include "scann/utils/io_oss_wrapper.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "absl/memory/memory.h"
+
 namespace research_scann {
 
 OpenSourceableFileWriter::OpenSourceableFileWriter(absl::string_view filename)
@@ -24,6 +34,95 @@ Status OpenSourceableFileWriter::Write(ConstSpan<char> bytes) {
   return OkStatus();
 }
 
+OpenSourceableFileReader::OpenSourceableFileReader(absl::string_view filename)
+    : filename_(filename), fin_(filename_, std::ifstream::binary) {}
+
+Status OpenSourceableFileReader::ReadAt(size_t offset, MutableSpan<char> bytes) {
+  if (!fin_) return InternalError("Failed to open file " + filename_);
+  fin_.seekg(offset);
+  fin_.read(bytes.data(), bytes.size());
+  if (static_cast<size_t>(fin_.gcount()) != bytes.size()) {
+    fin_.clear();
+    return OutOfRangeError("Short read from %s at offset %d.", filename_,
+                           offset);
+  }
+  return OkStatus();
+}
+
+StatusOr<unique_ptr<MemoryMappedFile>> MemoryMappedFile::Open(
+    absl::string_view filename, const MemoryMappedFileOptions& opts) {
+  std::string filename_str(filename);
+  const int fd = open(filename_str.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return InternalError("Failed to open %s: %s", filename_str,
+                         strerror(errno));
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return InternalError("Failed to stat %s: %s", filename_str,
+                         strerror(errno));
+  }
+  const size_t size = file_stat.st_size;
+  void* addr = nullptr;
+  if (size > 0) {
+    const int flags = MAP_SHARED | (opts.populate ? MAP_POPULATE : 0);
+    addr = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      return InternalError("Failed to mmap %s: %s", filename_str,
+                           strerror(errno));
+    }
+  }
+  close(fd);
+  auto result = absl::WrapUnique(
+      new MemoryMappedFile(std::move(filename_str), addr, size));
+  SCANN_RETURN_IF_ERROR(result->Advise(opts.access_pattern));
+  if (opts.huge_pages && addr) {
+#ifdef MADV_HUGEPAGE
+    if (madvise(addr, size, MADV_HUGEPAGE) != 0) {
+      LOG(WARNING) << "Huge pages are not available for " << result->filename_
+                   << ": " << strerror(errno);
+    }
+#else
+    LOG(WARNING) << "Huge pages are not supported on this platform.";
+#endif
+  }
+  return result;
+}
+
+MemoryMappedFile::~MemoryMappedFile() {
+  if (addr_) munmap(addr_, size_);
+}
+
+Status MemoryMappedFile::Advise(MmapAccessPattern access_pattern) const {
+  if (!addr_) return OkStatus();
+  int advice = MADV_NORMAL;
+  switch (access_pattern) {
+    case MmapAccessPattern::kNormal:
+      advice = MADV_NORMAL;
+      break;
+    case MmapAccessPattern::kSequential:
+      advice = MADV_SEQUENTIAL;
+      break;
+    case MmapAccessPattern::kRandom:
+      advice = MADV_RANDOM;
+      break;
+  }
+  if (madvise(addr_, size_, advice) != 0) {
+    return InternalError("madvise failed for %s: %s", filename_,
+                         strerror(errno));
+  }
+  return OkStatus();
+}
+
+void MemoryMappedFile::WillNeed(const void* ptr, size_t size) const {
+  static const uintptr_t kPageSize = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(ptr) & ~(kPageSize - 1);
+  const uintptr_t end = reinterpret_cast<uintptr_t>(ptr) + size;
+  madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+}
+
 Status WriteProtobufToFile(absl::string_view filename,
                            google::protobuf::Message* message) {
   std::ofstream fout(std::string(filename).c_str(), std::ofstream::binary);
@@ -16,6 +16,8 @@
 #define SCANN_UTILS_IO_OSS_WRAPPER_H_
 
 #include <fstream>
+#include <string>
+#include <utility>
 
 #include "google/protobuf/message.h"
 #include "scann/utils/common.h"
@@ -31,6 +33,56 @@ class OpenSourceableFileWriter {
   std::ofstream fout_;
 };
 
+class OpenSourceableFileReader {
+ public:
+  explicit OpenSourceableFileReader(absl::string_view filename);
+  Status ReadAt(size_t offset, MutableSpan<char> bytes);
+
+ private:
+  std::string filename_;
+  std::ifstream fin_;
+};
+
+enum class MmapAccessPattern { kNormal, kSequential, kRandom };
+
+struct MemoryMappedFileOptions {
+  MmapAccessPattern access_pattern = MmapAccessPattern::kNormal;
+
+  bool populate = false;
+
+  bool huge_pages = false;
+};
+
+class MemoryMappedFile {
+ public:
+  static StatusOr<unique_ptr<MemoryMappedFile>> Open(
+      absl::string_view filename,
+      const MemoryMappedFileOptions& opts = MemoryMappedFileOptions());
+
+  MemoryMappedFile(const MemoryMappedFile&) = delete;
+  MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+  ~MemoryMappedFile();
+
+  ConstSpan<char> data() const {
+    return MakeConstSpan(static_cast<const char*>(addr_), size_);
+  }
+
+  Status Advise(MmapAccessPattern access_pattern) const;
+
+  void WillNeed(const void* ptr, size_t size) const;
+
+ private:
+  MemoryMappedFile(std::string filename, void* addr, size_t size)
+      : filename_(std::move(filename)), addr_(addr), size_(size) {}
+
+  std::string filename_;
+
+  void* addr_ = nullptr;
+
+  size_t size_ = 0;
+};
+
 Status WriteProtobufToFile(absl::string_view filename,
                            google::protobuf::Message* message);
 Status ReadProtobufFromFile(absl::string_view filename,
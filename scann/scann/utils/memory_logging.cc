@@ -14,7 +14,13 @@
 
 #include "scann/utils/memory_logging.h"
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
 #include "scann/oss_wrappers/scann_malloc_extension.h"
 
 namespace research_scann {
@@ -61,4 +67,78 @@ std::string GetTcMallocLogString() {
                       "MB.");
 }
 
+MemoryUsageReport& MemoryUsageReport::AddChild(MemoryUsageReport child) {
+  children_.push_back(std::move(child));
+  return children_.back();
+}
+
+void MemoryUsageReport::MergeFrom(const MemoryUsageReport& other) {
+  flat_hash_set<const void*> seen;
+  MergeFromImpl(other, &seen);
+}
+
+void MemoryUsageReport::MergeFromImpl(const MemoryUsageReport& other,
+                                      flat_hash_set<const void*>* seen) {
+  if (other.shared_key_ && !seen->insert(other.shared_key_).second) return;
+  bytes_ += other.bytes_;
+  for (const MemoryUsageReport& other_child : other.children_) {
+    auto it = std::find_if(children_.begin(), children_.end(),
+                           [&](const MemoryUsageReport& child) {
+                             return child.name_ == other_child.name_;
+                           });
+    if (it == children_.end()) {
+      children_.emplace_back(other_child.name_, 0, other_child.shared_key_);
+      it = children_.end() - 1;
+    } else if (other_child.shared_key_ &&
+               other_child.shared_key_ == it->shared_key_) {
+      continue;
+    } else if (other_child.shared_key_ != it->shared_key_) {
+      it->shared_key_ = nullptr;
+    }
+    it->MergeFromImpl(other_child, seen);
+  }
+}
+
+size_t MemoryUsageReport::TotalBytes() const {
+  flat_hash_set<const void*> seen;
+  return TotalBytesImpl(&seen);
+}
+
+size_t MemoryUsageReport::TotalBytesImpl(
+    flat_hash_set<const void*>* seen) const {
+  if (shared_key_ && !seen->insert(shared_key_).second) return 0;
+  size_t result = bytes_;
+  for (const MemoryUsageReport& child : children_) {
+    result += child.TotalBytesImpl(seen);
+  }
+  return result;
+}
+
+std::string MemoryUsageReport::DebugString() const {
+  flat_hash_set<const void*> seen;
+  std::vector<std::string> lines;
+  AppendDebugString(0, &seen, &lines);
+  return absl::StrJoin(lines, "\n");
+}
+
+size_t MemoryUsageReport::AppendDebugString(
+    int depth, flat_hash_set<const void*>* seen,
+    std::vector<std::string>* lines) const {
+  const std::string indent(2 * depth, ' ');
+  if (shared_key_ && !seen->insert(shared_key_).second) {
+    lines->push_back(
+        absl::StrCat(indent, name_, ": shared with an earlier component"));
+    return 0;
+  }
+  const size_t line_idx = lines->size();
+  lines->emplace_back();
+  size_t total = bytes_;
+  for (const MemoryUsageReport& child : children_) {
+    total += child.AppendDebugString(depth + 1, seen, lines);
+  }
+  (*lines)[line_idx] =
+      absl::StrFormat("%s%s: %.3fMB", indent, name_, total / kBytesInMb);
+  return total;
+}
+
 }  // namespace research_scann
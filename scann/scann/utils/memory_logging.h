@@ -89,6 +89,57 @@ size_t DatapointStorage(const vector<Datapoint<T> >& dps) {
 
 std::string GetTcMallocLogString();
 
+class MemoryUsageReport {
+ public:
+  MemoryUsageReport() {}
+
+  explicit MemoryUsageReport(std::string name, size_t bytes = 0,
+                             const void* shared_key = nullptr)
+      : name_(std::move(name)), bytes_(bytes), shared_key_(shared_key) {}
+
+  const std::string& name() const { return name_; }
+
+  void set_name(std::string name) { name_ = std::move(name); }
+
+  size_t bytes() const { return bytes_; }
+
+  ConstSpan<MemoryUsageReport> children() const { return children_; }
+
+  MemoryUsageReport& AddChild(MemoryUsageReport child);
+
+  MemoryUsageReport& AddChild(std::string name, size_t bytes) {
+    return AddChild(MemoryUsageReport(std::move(name), bytes));
+  }
+
+  MemoryUsageReport& AddSharedChild(std::string name, const void* shared_key,
+                                    size_t bytes) {
+    return AddChild(MemoryUsageReport(std::move(name), bytes, shared_key));
+  }
+
+  void MergeFrom(const MemoryUsageReport& other);
+
+  size_t TotalBytes() const;
+
+  std::string DebugString() const;
+
+ private:
+  void MergeFromImpl(const MemoryUsageReport& other,
+                     flat_hash_set<const void*>* seen);
+
+  size_t TotalBytesImpl(flat_hash_set<const void*>* seen) const;
+
+  size_t AppendDebugString(int depth, flat_hash_set<const void*>* seen,
+                           std::vector<std::string>* lines) const;
+
+  std::string name_;
+
+  size_t bytes_ = 0;
+
+  const void* shared_key_ = nullptr;
+
+  std::vector<MemoryUsageReport> children_;
+};
+
 #define SCANN_LOG_TCMALLOC() LOG(INFO) << GetTcMallocLogString();
 #define SCANN_VLOG_TCMALLOC(verbosity_level) \
   VLOG(verbosity_level) << GetTcMallocLogString();
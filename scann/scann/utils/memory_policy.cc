@@ -0,0 +1,154 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/utils/memory_policy.h"
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+
+namespace research_scann {
+namespace {
+
+constexpr int kMpolBind = 2;
+constexpr int kMpolInterleave = 3;
+constexpr unsigned kMpolMfMove = 1 << 1;
+
+Status ApplyNumaPolicy(const MemoryPolicy& policy, void* start, size_t len) {
+  std::vector<int> nodes = policy.numa_nodes;
+  if (nodes.empty()) {
+    if (policy.numa_policy == MemoryPolicy::NumaPolicy::kBind) {
+      return InvalidArgumentError("NUMA bind policy requires numa_nodes.");
+    }
+    static const auto* online_nodes =
+        new StatusOr<std::vector<int>>(OnlineNumaNodes());
+    TF_ASSIGN_OR_RETURN(nodes, *online_nodes);
+  }
+  std::vector<unsigned long> node_mask;
+  constexpr int kBitsPerWord = 8 * sizeof(unsigned long);
+  for (int node : nodes) {
+    if (node < 0) return InvalidArgumentError("Invalid NUMA node %d.", node);
+    if (static_cast<size_t>(node / kBitsPerWord) >= node_mask.size()) {
+      node_mask.resize(node / kBitsPerWord + 1);
+    }
+    node_mask[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+  }
+  const int mode = policy.numa_policy == MemoryPolicy::NumaPolicy::kBind
+                       ? kMpolBind
+                       : kMpolInterleave;
+  if (syscall(SYS_mbind, start, len, mode, node_mask.data(),
+              node_mask.size() * kBitsPerWord + 1, kMpolMfMove) != 0) {
+    return InternalError("mbind failed: %s", strerror(errno));
+  }
+  return OkStatus();
+}
+
+}  // namespace
+
+StatusOr<std::vector<int>> ParseRangeList(string_view ranges) {
+  std::vector<int> result;
+  for (absl::string_view range : absl::StrSplit(
+           absl::StripAsciiWhitespace(ranges), ',', absl::SkipEmpty())) {
+    std::vector<absl::string_view> bounds = absl::StrSplit(range, '-');
+    int first, last;
+    if (bounds.size() > 2 || !absl::SimpleAtoi(bounds.front(), &first) ||
+        !absl::SimpleAtoi(bounds.back(), &last) || first > last) {
+      return InternalError("Malformed range list: %s", ranges);
+    }
+    for (int i = first; i <= last; ++i) result.push_back(i);
+  }
+  return result;
+}
+
+StatusOr<std::vector<int>> OnlineNumaNodes() {
+  std::ifstream fin("/sys/devices/system/node/online");
+  std::string online;
+  if (!fin || !std::getline(fin, online)) return std::vector<int>{0};
+  return ParseRangeList(online);
+}
+
+StatusOr<std::vector<int>> NumaNodeCpus(int node) {
+  const std::string filename =
+      absl::StrCat("/sys/devices/system/node/node", node, "/cpulist");
+  std::ifstream fin(filename);
+  std::string cpulist;
+  if (!fin || !std::getline(fin, cpulist)) {
+    if (node != 0) return NotFoundError("Unknown NUMA node %d.", node);
+    std::vector<int> result(std::thread::hardware_concurrency());
+    std::iota(result.begin(), result.end(), 0);
+    return result;
+  }
+  return ParseRangeList(cpulist);
+}
+
+Status PinCurrentThreadToNumaNode(int node) {
+  TF_ASSIGN_OR_RETURN(std::vector<int> cpus, NumaNodeCpus(node));
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpu_set);
+  }
+  if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    return InternalError("Failed to pin thread to NUMA node %d: %s", node,
+                         strerror(errno));
+  }
+  return OkStatus();
+}
+
+Status ApplyMemoryPolicy(const MemoryPolicy& policy, const void* ptr,
+                         size_t size) {
+  if (policy.IsDefault() || size == 0) return OkStatus();
+  static const uintptr_t kPageSize = sysconf(_SC_PAGESIZE);
+  const uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+  const uintptr_t begin = addr & ~(kPageSize - 1);
+  const uintptr_t end = NextMultipleOf(addr + size, kPageSize);
+  void* start = reinterpret_cast<void*>(begin);
+  const size_t len = end - begin;
+
+  if (policy.numa_policy != MemoryPolicy::NumaPolicy::kDefault) {
+    SCANN_RETURN_IF_ERROR(ApplyNumaPolicy(policy, start, len));
+  }
+  if (policy.page_size == MemoryPolicy::PageSize::kTransparentHuge) {
+#ifdef MADV_HUGEPAGE
+    if (madvise(start, len, MADV_HUGEPAGE) != 0) {
+      return InternalError("madvise(MADV_HUGEPAGE) failed: %s",
+                           strerror(errno));
+    }
+#ifdef MADV_COLLAPSE
+    madvise(start, len, MADV_COLLAPSE);
+#endif
+#else
+    return UnimplementedError(
+        "Transparent huge pages are not supported on this platform.");
+#endif
+  }
+  return OkStatus();
+}
+
+}  // namespace research_scann
@@ -0,0 +1,70 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_UTILS_MEMORY_POLICY_H_
+#define SCANN_UTILS_MEMORY_POLICY_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "scann/utils/common.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+struct MemoryPolicy {
+  enum class PageSize { kDefault, kTransparentHuge };
+
+  enum class NumaPolicy { kDefault, kInterleave, kBind };
+
+  PageSize page_size = PageSize::kDefault;
+
+  NumaPolicy numa_policy = NumaPolicy::kDefault;
+
+  std::vector<int> numa_nodes;
+
+  bool IsDefault() const {
+    return page_size == PageSize::kDefault &&
+           numa_policy == NumaPolicy::kDefault;
+  }
+};
+
+StatusOr<std::vector<int>> ParseRangeList(string_view ranges);
+
+StatusOr<std::vector<int>> OnlineNumaNodes();
+
+StatusOr<std::vector<int>> NumaNodeCpus(int node);
+
+Status PinCurrentThreadToNumaNode(int node);
+
+Status ApplyMemoryPolicy(const MemoryPolicy& policy, const void* ptr,
+                         size_t size);
+
+template <typename T>
+Status ApplyMemoryPolicy(const MemoryPolicy& policy, ConstSpan<T> data) {
+  return ApplyMemoryPolicy(policy, data.data(), data.size() * sizeof(T));
+}
+
+template <typename T>
+Status ApplyMemoryPolicy(const MemoryPolicy& policy,
+                         ConstSpan<std::vector<T>> lists) {
+  for (const std::vector<T>& list : lists) {
+    SCANN_RETURN_IF_ERROR(ApplyMemoryPolicy(policy, MakeConstSpan(list)));
+  }
+  return OkStatus();
+}
+
+}  // namespace research_scann
+
+#endif
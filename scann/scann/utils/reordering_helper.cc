@@ -14,6 +14,7 @@
 
 #include "scann/utils/reordering_helper.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <limits>
@@ -23,6 +24,7 @@
 #include "scann/data_format/datapoint.h"
 #include "scann/data_format/dataset.h"
 #include "scann/distance_measures/one_to_many/one_to_many.h"
+#include "scann/distance_measures/one_to_many/one_to_many_int4.h"
 #include "scann/oss_wrappers/scann_down_cast.h"
 #include "scann/oss_wrappers/scann_status.h"
 #include "scann/utils/common.h"
@@ -318,6 +320,15 @@ ExactReorderingHelper<T>::ComputeTop1ReorderingDistance(
   return std::make_pair(idx, smallest);
 }
 
+template <typename T>
+MemoryUsageReport ExactReorderingHelper<T>::MemoryUsageBreakdown() const {
+  MemoryUsageReport report(name());
+  report.AddSharedChild(
+      "dataset", exact_reordering_dataset_.get(),
+      exact_reordering_dataset_->MemoryUsageExcludingDocids());
+  return report;
+}
+
 FixedPointFloatDenseDotProductReorderingHelper::
     FixedPointFloatDenseDotProductReorderingHelper(
         const DenseDataset<float>& exact_reordering_dataset,
@@ -394,6 +405,15 @@ Status FixedPointFloatDenseDotProductReorderingHelper::Reconstruct(
   return OkStatus();
 }
 
+MemoryUsageReport
+FixedPointFloatDenseDotProductReorderingHelper::MemoryUsageBreakdown() const {
+  MemoryUsageReport report(name());
+  report.AddChild("fixed_point_dataset",
+                  fixed_point_dataset_.MemoryUsageExcludingDocids());
+  report.AddChild("inverse_multipliers", VectorStorage(inverse_multipliers_));
+  return report;
+}
+
 FixedPointFloatDenseCosineReorderingHelper::
     FixedPointFloatDenseCosineReorderingHelper(
         const DenseDataset<float>& exact_reordering_dataset,
@@ -431,6 +451,13 @@ FixedPointFloatDenseCosineReorderingHelper::ComputeTop1ReorderingDistance(
   return set_cosine_top1_functor.Top1Pair(*result);
 }
 
+MemoryUsageReport
+FixedPointFloatDenseCosineReorderingHelper::MemoryUsageBreakdown() const {
+  MemoryUsageReport report = dot_product_helper_.MemoryUsageBreakdown();
+  report.set_name(name());
+  return report;
+}
+
 FixedPointFloatDenseSquaredL2ReorderingHelper::
     FixedPointFloatDenseSquaredL2ReorderingHelper(
         const DenseDataset<float>& exact_reordering_dataset,
@@ -480,6 +507,17 @@ FixedPointFloatDenseSquaredL2ReorderingHelper::ComputeTop1ReorderingDistance(
   return set_sql2_top1.Top1Pair();
 }
 
+MemoryUsageReport
+FixedPointFloatDenseSquaredL2ReorderingHelper::MemoryUsageBreakdown() const {
+  MemoryUsageReport report = dot_product_helper_.MemoryUsageBreakdown();
+  report.set_name(name());
+  if (database_squared_l2_norms_) {
+    report.AddSharedChild("squared_l2_norms", database_squared_l2_norms_.get(),
+                          VectorStorage(*database_squared_l2_norms_));
+  }
+  return report;
+}
+
 FixedPointFloatDenseLimitedInnerReorderingHelper::
     FixedPointFloatDenseLimitedInnerReorderingHelper(
         const DenseDataset<float>& exact_reordering_dataset,
@@ -516,6 +554,311 @@ FixedPointFloatDenseLimitedInnerReorderingHelper::ComputeTop1ReorderingDistance(
   return top1_functor.Top1Pair();
 }
 
+MemoryUsageReport
+FixedPointFloatDenseLimitedInnerReorderingHelper::MemoryUsageBreakdown() const {
+  MemoryUsageReport report = dot_product_helper_.MemoryUsageBreakdown();
+  report.set_name(name());
+  report.AddChild("inverse_l2_norms",
+                  VectorStorage(inverse_database_l2_norms_));
+  return report;
+}
+
+FixedPointInt4FloatDenseDotProductReorderingHelper::
+    FixedPointInt4FloatDenseDotProductReorderingHelper(
+        const DenseDataset<float>& exact_reordering_dataset,
+        float fixed_point_multiplier_quantile) {
+  Int4ScalarQuantizationResults quantization_results =
+      ScalarQuantizeFloatDatasetToInt4(exact_reordering_dataset,
+                                       fixed_point_multiplier_quantile);
+  packed_dataset_ = std::move(quantization_results.packed_dataset);
+  inverse_multipliers_ =
+      std::move(quantization_results.inverse_multiplier_by_dimension);
+}
+
+FixedPointInt4FloatDenseDotProductReorderingHelper::
+    FixedPointInt4FloatDenseDotProductReorderingHelper(
+        const DenseDataset<int8_t>& fixed_point_dataset,
+        const shared_ptr<const vector<float>>& multiplier_by_dimension)
+    : packed_dataset_(PackInt4QuantizedDataset(fixed_point_dataset)) {
+  DCHECK_EQ(multiplier_by_dimension->size(),
+            fixed_point_dataset.dimensionality());
+  inverse_multipliers_.resize(multiplier_by_dimension->size());
+  for (size_t i = 0; i < multiplier_by_dimension->size(); ++i) {
+    inverse_multipliers_[i] = 1.0f / (*multiplier_by_dimension)[i];
+  }
+}
+
+FixedPointInt4FloatDenseDotProductReorderingHelper::
+    ~FixedPointInt4FloatDenseDotProductReorderingHelper() {}
+
+Status FixedPointInt4FloatDenseDotProductReorderingHelper::
+    ComputeDistancesForReordering(const DatapointPtr<float>& query,
+                                  NNResultsVector* result) const {
+  auto preprocessed = PrepareForAsymmetricScalarQuantizedDotProduct(
+      query, inverse_multipliers_);
+  DenseDotProductDistanceOneToManyInt4Float(
+      MakeDatapointPtr(preprocessed.get(), query.nonzero_entries()),
+      packed_dataset_, MakeMutableSpan(*result));
+  return OkStatus();
+}
+
+Status FixedPointInt4FloatDenseDotProductReorderingHelper::Reconstruct(
+    DatapointIndex i, MutableSpan<float> output) const {
+  if (i >= packed_dataset_.size())
+    return InvalidArgumentError(
+        "The datapoint index %d is >= the dataset size %d", i,
+        packed_dataset_.size());
+
+  const uint8_t* packed = packed_dataset_[i].values();
+  for (DimensionIndex j : Seq(dimensionality())) {
+    const uint8_t nibble = (j & 1) ? (packed[j / 2] >> 4) : packed[j / 2];
+    output[j] = Int4NibbleToInt8(nibble) * inverse_multipliers_[j];
+  }
+  return OkStatus();
+}
+
+MemoryUsageReport
+FixedPointInt4FloatDenseDotProductReorderingHelper::MemoryUsageBreakdown()
+    const {
+  MemoryUsageReport report(name());
+  report.AddChild("packed_int4_dataset",
+                  packed_dataset_.MemoryUsageExcludingDocids());
+  report.AddChild("inverse_multipliers", VectorStorage(inverse_multipliers_));
+  return report;
+}
+
+FixedPointInt4FloatDenseCosineReorderingHelper::
+    FixedPointInt4FloatDenseCosineReorderingHelper(
+        const DenseDataset<float>& exact_reordering_dataset,
+        float fixed_point_multiplier_quantile)
+    : dot_product_helper_(exact_reordering_dataset,
+                          fixed_point_multiplier_quantile) {
+  DCHECK_EQ(exact_reordering_dataset.normalization(), UNITL2NORM);
+}
+
+FixedPointInt4FloatDenseCosineReorderingHelper::
+    FixedPointInt4FloatDenseCosineReorderingHelper(
+        const DenseDataset<int8_t>& fixed_point_dataset,
+        const shared_ptr<const vector<float>>& multiplier_by_dimension)
+    : dot_product_helper_(fixed_point_dataset, multiplier_by_dimension) {}
+
+Status
+FixedPointInt4FloatDenseCosineReorderingHelper::ComputeDistancesForReordering(
+    const DatapointPtr<float>& query, NNResultsVector* result) const {
+  SCANN_RETURN_IF_ERROR(
+      dot_product_helper_.ComputeDistancesForReordering(query, result));
+  for (auto& neighbor : *result) {
+    neighbor.second += 1.0f;
+  }
+  return OkStatus();
+}
+
+MemoryUsageReport
+FixedPointInt4FloatDenseCosineReorderingHelper::MemoryUsageBreakdown() const {
+  MemoryUsageReport report = dot_product_helper_.MemoryUsageBreakdown();
+  report.set_name(name());
+  return report;
+}
+
+FixedPointInt4FloatDenseSquaredL2ReorderingHelper::
+    FixedPointInt4FloatDenseSquaredL2ReorderingHelper(
+        const DenseDataset<float>& exact_reordering_dataset,
+        float fixed_point_multiplier_quantile)
+    : dot_product_helper_(exact_reordering_dataset,
+                          fixed_point_multiplier_quantile) {
+  database_squared_l2_norms_.reserve(exact_reordering_dataset.size());
+  for (DatapointIndex i = 0; i < exact_reordering_dataset.size(); ++i) {
+    database_squared_l2_norms_.push_back(
+        SquaredL2Norm(exact_reordering_dataset[i]));
+  }
+}
+
+FixedPointInt4FloatDenseSquaredL2ReorderingHelper::
+    FixedPointInt4FloatDenseSquaredL2ReorderingHelper(
+        const DenseDataset<int8_t>& fixed_point_dataset,
+        const shared_ptr<const vector<float>>& multiplier_by_dimension,
+        const shared_ptr<const vector<float>>& squared_l2_norm_by_datapoint)
+    : dot_product_helper_(fixed_point_dataset, multiplier_by_dimension),
+      database_squared_l2_norms_(*squared_l2_norm_by_datapoint) {
+  DCHECK_EQ(database_squared_l2_norms_.size(), fixed_point_dataset.size());
+}
+
+Status FixedPointInt4FloatDenseSquaredL2ReorderingHelper::
+    ComputeDistancesForReordering(const DatapointPtr<float>& query,
+                                  NNResultsVector* result) const {
+  const float query_norm = SquaredL2Norm(query);
+  SCANN_RETURN_IF_ERROR(
+      dot_product_helper_.ComputeDistancesForReordering(query, result));
+  for (auto& neighbor : *result) {
+    neighbor.second = query_norm +
+                      database_squared_l2_norms_[neighbor.first] +
+                      2.0f * neighbor.second;
+  }
+  return OkStatus();
+}
+
+MemoryUsageReport
+FixedPointInt4FloatDenseSquaredL2ReorderingHelper::MemoryUsageBreakdown()
+    const {
+  MemoryUsageReport report = dot_product_helper_.MemoryUsageBreakdown();
+  report.set_name(name());
+  report.AddChild("squared_l2_norms",
+                  VectorStorage(database_squared_l2_norms_));
+  return report;
+}
+
+namespace {
+
+Status CompressedCandidateDistances(
+    const DistanceMeasure& distance, const CompressedDenseDataset& dataset,
+    const DatapointPtr<float>& query,
+    ConstSpan<pair<DatapointIndex, float>> result, ThreadPool* pool,
+    std::vector<float>* distances) {
+  if (!query.IsDense()) {
+    return InvalidArgumentError(
+        "Compressed exact reordering requires dense queries.");
+  }
+  std::vector<DatapointIndex> indices(result.size());
+  for (size_t i : IndicesOf(result)) indices[i] = result[i].first;
+  std::vector<float> decoded(indices.size() * dataset.dimensionality());
+  SCANN_RETURN_IF_ERROR(
+      dataset.GetDatapoints(indices, MakeMutableSpan(decoded), pool));
+  DenseDataset<float> candidates(std::move(decoded), indices.size());
+  distances->resize(indices.size());
+  DenseDistanceOneToMany(distance, query, candidates,
+                         MakeMutableSpan(*distances));
+  return OkStatus();
+}
+
+}  // namespace
+
+Status CompressedExactReorderingHelper::ComputeDistancesForReordering(
+    const DatapointPtr<float>& query, NNResultsVector* result) const {
+  std::vector<float> distances;
+  SCANN_RETURN_IF_ERROR(CompressedCandidateDistances(
+      *exact_reordering_distance_, *compressed_dataset_, query, *result,
+      pool_.get(), &distances));
+  for (size_t i : IndicesOf(*result)) (*result)[i].second = distances[i];
+  return OkStatus();
+}
+
+StatusOr<std::pair<DatapointIndex, float>>
+CompressedExactReorderingHelper::ComputeTop1ReorderingDistance(
+    const DatapointPtr<float>& query, NNResultsVector* result) const {
+  std::vector<float> distances;
+  SCANN_RETURN_IF_ERROR(CompressedCandidateDistances(
+      *exact_reordering_distance_, *compressed_dataset_, query, *result,
+      pool_.get(), &distances));
+  float smallest = std::numeric_limits<float>::max();
+  DatapointIndex idx = kInvalidDatapointIndex;
+  for (size_t i : IndicesOf(*result)) {
+    (*result)[i].second = distances[i];
+    if (distances[i] < smallest) {
+      smallest = distances[i];
+      idx = (*result)[i].first;
+    }
+  }
+  return std::make_pair(idx, smallest);
+}
+
+MemoryUsageReport CompressedExactReorderingHelper::MemoryUsageBreakdown()
+    const {
+  MemoryUsageReport report(name());
+  report.AddSharedChild("compressed_dataset", compressed_dataset_.get(),
+                        compressed_dataset_->MemoryUsage());
+  return report;
+}
+
+template <typename T>
+bool ChainedReorderingHelper<T>::needs_dataset() const {
+  for (const Stage& stage : intermediate_stages_) {
+    if (stage.helper->needs_dataset()) return true;
+  }
+  return final_stage_->needs_dataset();
+}
+
+template <typename T>
+StatusOr<typename ReorderingInterface<T>::Mutator*>
+ChainedReorderingHelper<T>::GetMutator() const {
+  if (mutator_) return mutator_.get();
+  vector<typename ReorderingInterface<T>::Mutator*> stage_mutators;
+  auto append_stage_mutator =
+      [&stage_mutators](const ReorderingInterface<T>& helper) -> Status {
+    if (!helper.owns_mutation_data_structures()) return OkStatus();
+    TF_ASSIGN_OR_RETURN(auto* mutator, helper.GetMutator());
+    stage_mutators.push_back(mutator);
+    return OkStatus();
+  };
+  for (const Stage& stage : intermediate_stages_) {
+    SCANN_RETURN_IF_ERROR(append_stage_mutator(*stage.helper));
+  }
+  SCANN_RETURN_IF_ERROR(append_stage_mutator(*final_stage_));
+  mutator_ = make_unique<ChainedMutator>(std::move(stage_mutators));
+  return mutator_.get();
+}
+
+template <typename T>
+bool ChainedReorderingHelper<T>::owns_mutation_data_structures() const {
+  for (const Stage& stage : intermediate_stages_) {
+    if (stage.helper->owns_mutation_data_structures()) return true;
+  }
+  return final_stage_->owns_mutation_data_structures();
+}
+
+template <typename T>
+void ChainedReorderingHelper<T>::AppendDataToSingleMachineFactoryOptions(
+    SingleMachineFactoryOptions* opts) const {
+  for (const Stage& stage : intermediate_stages_) {
+    stage.helper->AppendDataToSingleMachineFactoryOptions(opts);
+  }
+  final_stage_->AppendDataToSingleMachineFactoryOptions(opts);
+}
+
+template <typename T>
+MemoryUsageReport ChainedReorderingHelper<T>::MemoryUsageBreakdown() const {
+  MemoryUsageReport report(name());
+  for (const Stage& stage : intermediate_stages_) {
+    report.AddChild(stage.helper->MemoryUsageBreakdown());
+  }
+  report.AddChild(final_stage_->MemoryUsageBreakdown());
+  return report;
+}
+
+template <typename T>
+Status ChainedReorderingHelper<T>::ApplyIntermediateStages(
+    const DatapointPtr<T>& query, NNResultsVector* result) const {
+  for (const Stage& stage : intermediate_stages_) {
+    SCANN_RETURN_IF_ERROR(
+        stage.helper->ComputeDistancesForReordering(query, result));
+    if (stage.epsilon < std::numeric_limits<float>::infinity()) {
+      auto it = std::partition(
+          result->begin(), result->end(),
+          [&stage](const std::pair<DatapointIndex, float>& neighbor) {
+            return neighbor.second <= stage.epsilon;
+          });
+      result->resize(it - result->begin());
+    }
+    RemoveNeighborsPastLimit(stage.num_neighbors, result);
+  }
+  return OkStatus();
+}
+
+template <typename T>
+Status ChainedReorderingHelper<T>::ComputeDistancesForReordering(
+    const DatapointPtr<T>& query, NNResultsVector* result) const {
+  SCANN_RETURN_IF_ERROR(ApplyIntermediateStages(query, result));
+  return final_stage_->ComputeDistancesForReordering(query, result);
+}
+
+template <typename T>
+StatusOr<std::pair<DatapointIndex, float>>
+ChainedReorderingHelper<T>::ComputeTop1ReorderingDistance(
+    const DatapointPtr<T>& query, NNResultsVector* result) const {
+  SCANN_RETURN_IF_ERROR(ApplyIntermediateStages(query, result));
+  return final_stage_->ComputeTop1ReorderingDistance(query, result);
+}
+
 SCANN_INSTANTIATE_TYPED_CLASS(, ExactReorderingHelper);
+SCANN_INSTANTIATE_TYPED_CLASS(, ChainedReorderingHelper);
 
 }  // namespace research_scann
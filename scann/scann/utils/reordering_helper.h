@@ -18,15 +18,21 @@
 
 #include <cstdint>
 #include <limits>
+#include <string>
+#include <utility>
 
 #include "scann/base/single_machine_factory_options.h"
+#include "scann/data_format/compressed_dense_dataset.h"
 #include "scann/data_format/datapoint.h"
 #include "scann/data_format/dataset.h"
 #include "scann/distance_measures/distance_measures.h"
 #include "scann/hashes/asymmetric_hashing2/querying.h"
+#include "scann/oss_wrappers/scann_threadpool.h"
 #include "scann/oss_wrappers/scann_status.h"
 #include "scann/utils/common.h"
 #include "scann/utils/fixed_point/pre_quantized_fixed_point.h"
+#include "scann/utils/memory_logging.h"
+#include "scann/utils/scalar_quantization_helpers.h"
 #include "scann/utils/types.h"
 #include "scann/utils/util_functions.h"
 
@@ -63,6 +69,10 @@ class ReorderingInterface {
   virtual void AppendDataToSingleMachineFactoryOptions(
       SingleMachineFactoryOptions* opts) const {}
 
+  virtual MemoryUsageReport MemoryUsageBreakdown() const {
+    return MemoryUsageReport(name());
+  }
+
   virtual ~ReorderingInterface() {}
 };
 
@@ -118,12 +128,122 @@ class ExactReorderingHelper : public ReorderingHelper<T> {
 
   bool owns_mutation_data_structures() const override { return false; }
 
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
  private:
   shared_ptr<const DistanceMeasure> exact_reordering_distance_ = nullptr;
 
   shared_ptr<const TypedDataset<T>> exact_reordering_dataset_ = nullptr;
 };
 
+template <typename T>
+class ChainedReorderingHelper : public ReorderingHelper<T> {
+ public:
+  struct Stage {
+    shared_ptr<const ReorderingInterface<T>> helper;
+    int32_t num_neighbors = std::numeric_limits<int32_t>::max();
+    float epsilon = std::numeric_limits<float>::infinity();
+  };
+
+  ChainedReorderingHelper(
+      vector<Stage> intermediate_stages,
+      shared_ptr<const ReorderingInterface<T>> final_stage)
+      : intermediate_stages_(std::move(intermediate_stages)),
+        final_stage_(std::move(final_stage)) {}
+
+  std::string name() const override { return "ChainedReordering"; }
+
+  bool needs_dataset() const override;
+
+  Status ComputeDistancesForReordering(const DatapointPtr<T>& query,
+                                       NNResultsVector* result) const override;
+
+  StatusOr<std::pair<DatapointIndex, float>> ComputeTop1ReorderingDistance(
+      const DatapointPtr<T>& query, NNResultsVector* result) const override;
+
+  StatusOr<typename ReorderingInterface<T>::Mutator*> GetMutator()
+      const override;
+
+  bool owns_mutation_data_structures() const override;
+
+  void AppendDataToSingleMachineFactoryOptions(
+      SingleMachineFactoryOptions* opts) const override;
+
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
+  ConstSpan<Stage> intermediate_stages() const { return intermediate_stages_; }
+  const ReorderingInterface<T>& final_stage() const { return *final_stage_; }
+
+ private:
+  class ChainedMutator;
+
+  Status ApplyIntermediateStages(const DatapointPtr<T>& query,
+                                 NNResultsVector* result) const;
+
+  vector<Stage> intermediate_stages_;
+
+  shared_ptr<const ReorderingInterface<T>> final_stage_;
+
+  mutable unique_ptr<ChainedMutator> mutator_;
+};
+
+template <typename T>
+class ChainedReorderingHelper<T>::ChainedMutator
+    : public ReorderingInterface<T>::Mutator {
+ public:
+  explicit ChainedMutator(
+      vector<typename ReorderingInterface<T>::Mutator*> stage_mutators)
+      : stage_mutators_(std::move(stage_mutators)) {}
+
+  StatusOr<DatapointIndex> AddDatapoint(const DatapointPtr<T>& dptr) final {
+    DatapointIndex result = kInvalidDatapointIndex;
+    for (auto* mutator : stage_mutators_) {
+      TF_ASSIGN_OR_RETURN(const DatapointIndex index,
+                          mutator->AddDatapoint(dptr));
+      SCANN_RETURN_IF_ERROR(CheckConsistentIndex(result, index));
+      result = index;
+    }
+    return result;
+  }
+
+  StatusOr<DatapointIndex> RemoveDatapoint(DatapointIndex idx) final {
+    DatapointIndex result = kInvalidDatapointIndex;
+    for (auto* mutator : stage_mutators_) {
+      TF_ASSIGN_OR_RETURN(const DatapointIndex index,
+                          mutator->RemoveDatapoint(idx));
+      SCANN_RETURN_IF_ERROR(CheckConsistentIndex(result, index));
+      result = index;
+    }
+    return result;
+  }
+
+  Status UpdateDatapoint(const DatapointPtr<T>& dptr,
+                         DatapointIndex idx) final {
+    for (auto* mutator : stage_mutators_) {
+      SCANN_RETURN_IF_ERROR(mutator->UpdateDatapoint(dptr, idx));
+    }
+    return OkStatus();
+  }
+
+  void Reserve(DatapointIndex num_datapoints) final {
+    for (auto* mutator : stage_mutators_) mutator->Reserve(num_datapoints);
+  }
+
+ private:
+  static Status CheckConsistentIndex(DatapointIndex previous,
+                                     DatapointIndex current) {
+    if (previous != kInvalidDatapointIndex && previous != current) {
+      return InternalError(
+          "Chained reordering stages disagree on the mutated datapoint index "
+          "(%d vs. %d).",
+          previous, current);
+    }
+    return OkStatus();
+  }
+
+  vector<typename ReorderingInterface<T>::Mutator*> stage_mutators_;
+};
+
 class FixedPointFloatDenseDotProductReorderingHelper
     : public ReorderingHelper<float> {
  public:
@@ -141,6 +261,8 @@ class FixedPointFloatDenseDotProductReorderingHelper
     return "FixedPointFloatDenseDotProductReordering";
   }
 
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
   bool needs_dataset() const override { return false; }
 
   Status ComputeDistancesForReordering(const DatapointPtr<float>& query,
@@ -191,6 +313,8 @@ class FixedPointFloatDenseCosineReorderingHelper
     return "FixedPointFloatCosineReordering";
   }
 
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
   bool needs_dataset() const override { return false; }
 
   Status ComputeDistancesForReordering(const DatapointPtr<float>& query,
@@ -224,6 +348,8 @@ class FixedPointFloatDenseSquaredL2ReorderingHelper
     return "FixedPointFloatSquaredL2Reordering";
   }
 
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
   bool needs_dataset() const override { return false; }
 
   Status ComputeDistancesForReordering(const DatapointPtr<float>& query,
@@ -265,6 +391,8 @@ class FixedPointFloatDenseLimitedInnerReorderingHelper
     return "FixedPointFloatDenseLimitedInnerReordering";
   }
 
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
   bool needs_dataset() const override { return false; }
 
   Status ComputeDistancesForReordering(const DatapointPtr<float>& query,
@@ -279,7 +407,157 @@ class FixedPointFloatDenseLimitedInnerReorderingHelper
   std::vector<float> inverse_database_l2_norms_;
 };
 
+class FixedPointInt4FloatDenseDotProductReorderingHelper
+    : public ReorderingHelper<float> {
+ public:
+  explicit FixedPointInt4FloatDenseDotProductReorderingHelper(
+      const DenseDataset<float>& exact_reordering_dataset,
+      float fixed_point_multiplier_quantile = 1.0f);
+
+  FixedPointInt4FloatDenseDotProductReorderingHelper(
+      const DenseDataset<int8_t>& fixed_point_dataset,
+      const shared_ptr<const std::vector<float>>& multiplier_by_dimension);
+
+  ~FixedPointInt4FloatDenseDotProductReorderingHelper() override;
+
+  std::string name() const override {
+    return "FixedPointInt4FloatDenseDotProductReordering";
+  }
+
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
+  bool needs_dataset() const override { return false; }
+
+  Status ComputeDistancesForReordering(const DatapointPtr<float>& query,
+                                       NNResultsVector* result) const override;
+
+  DimensionIndex dimensionality() const {
+    return packed_dataset_.dimensionality();
+  }
+
+  Status Reconstruct(DatapointIndex i, MutableSpan<float> output) const;
+
+  void AppendDataToSingleMachineFactoryOptions(
+      SingleMachineFactoryOptions* opts) const override {
+    opts->pre_quantized_fixed_point =
+        make_shared<PreQuantizedFixedPoint>(CreatePreQuantizedFixedPoint(
+            UnpackInt4QuantizedDataset(packed_dataset_), inverse_multipliers_,
+            {}, true));
+  }
+
+ private:
+  DenseDataset<uint8_t> packed_dataset_;
+  std::vector<float> inverse_multipliers_;
+};
+
+class FixedPointInt4FloatDenseCosineReorderingHelper
+    : public ReorderingHelper<float> {
+ public:
+  explicit FixedPointInt4FloatDenseCosineReorderingHelper(
+      const DenseDataset<float>& exact_reordering_dataset,
+      float fixed_point_multiplier_quantile = 1.0f);
+
+  FixedPointInt4FloatDenseCosineReorderingHelper(
+      const DenseDataset<int8_t>& fixed_point_dataset,
+      const shared_ptr<const std::vector<float>>& multiplier_by_dimension);
+
+  std::string name() const override {
+    return "FixedPointInt4FloatCosineReordering";
+  }
+
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
+  bool needs_dataset() const override { return false; }
+
+  Status ComputeDistancesForReordering(const DatapointPtr<float>& query,
+                                       NNResultsVector* result) const override;
+
+  void AppendDataToSingleMachineFactoryOptions(
+      SingleMachineFactoryOptions* opts) const override {
+    dot_product_helper_.AppendDataToSingleMachineFactoryOptions(opts);
+  }
+
+ private:
+  FixedPointInt4FloatDenseDotProductReorderingHelper dot_product_helper_;
+};
+
+class FixedPointInt4FloatDenseSquaredL2ReorderingHelper
+    : public ReorderingHelper<float> {
+ public:
+  explicit FixedPointInt4FloatDenseSquaredL2ReorderingHelper(
+      const DenseDataset<float>& exact_reordering_dataset,
+      float fixed_point_multiplier_quantile = 1.0f);
+
+  FixedPointInt4FloatDenseSquaredL2ReorderingHelper(
+      const DenseDataset<int8_t>& fixed_point_dataset,
+      const shared_ptr<const std::vector<float>>& multiplier_by_dimension,
+      const shared_ptr<const std::vector<float>>& squared_l2_norm_by_datapoint);
+
+  std::string name() const override {
+    return "FixedPointInt4FloatSquaredL2Reordering";
+  }
+
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
+  bool needs_dataset() const override { return false; }
+
+  Status ComputeDistancesForReordering(const DatapointPtr<float>& query,
+                                       NNResultsVector* result) const override;
+
+  void AppendDataToSingleMachineFactoryOptions(
+      SingleMachineFactoryOptions* opts) const override {
+    dot_product_helper_.AppendDataToSingleMachineFactoryOptions(opts);
+    opts->pre_quantized_fixed_point->squared_l2_norm_by_datapoint =
+        make_shared<vector<float>>(database_squared_l2_norms_);
+  }
+
+ private:
+  FixedPointInt4FloatDenseDotProductReorderingHelper dot_product_helper_;
+
+  std::vector<float> database_squared_l2_norms_;
+};
+
+class CompressedExactReorderingHelper : public ReorderingHelper<float> {
+ public:
+  CompressedExactReorderingHelper(
+      shared_ptr<const DistanceMeasure> exact_reordering_distance,
+      shared_ptr<const CompressedDenseDataset> compressed_dataset,
+      shared_ptr<ThreadPool> pool = nullptr)
+      : exact_reordering_distance_(std::move(exact_reordering_distance)),
+        compressed_dataset_(std::move(compressed_dataset)),
+        pool_(std::move(pool)) {}
+
+  std::string name() const override { return "CompressedExactReordering"; }
+
+  MemoryUsageReport MemoryUsageBreakdown() const override;
+
+  bool needs_dataset() const override { return false; }
+
+  Status ComputeDistancesForReordering(const DatapointPtr<float>& query,
+                                       NNResultsVector* result) const override;
+
+  StatusOr<std::pair<DatapointIndex, float>> ComputeTop1ReorderingDistance(
+      const DatapointPtr<float>& query, NNResultsVector* result) const override;
+
+  const CompressedDenseDataset& compressed_dataset() const {
+    return *compressed_dataset_;
+  }
+
+  void AppendDataToSingleMachineFactoryOptions(
+      SingleMachineFactoryOptions* opts) const override {
+    opts->compressed_reordering_dataset = compressed_dataset_;
+  }
+
+ private:
+  shared_ptr<const DistanceMeasure> exact_reordering_distance_;
+
+  shared_ptr<const CompressedDenseDataset> compressed_dataset_;
+
+  shared_ptr<ThreadPool> pool_;
+};
+
 SCANN_INSTANTIATE_TYPED_CLASS(extern, ExactReorderingHelper);
+SCANN_INSTANTIATE_TYPED_CLASS(extern, ChainedReorderingHelper);
 
 }  // namespace research_scann
 
@@ -33,8 +33,10 @@
 
 namespace research_scann {
 
-std::vector<float> ComputeMaxQuantizationMultipliers(
-    const DenseDataset<float>& dataset) {
+namespace {
+
+std::vector<float> ComputeMaxQuantizationMultipliersImpl(
+    const DenseDataset<float>& dataset, float max_quantized_value) {
   const size_t dimensionality = dataset.dimensionality();
   vector<float> multipliers(dimensionality, 0.0f);
   for (auto dptr : dataset) {
@@ -47,17 +49,20 @@ std::vector<float> ComputeMaxQuantizationMultipliers(
     if (f == 0.0f) {
       f = 1.0f;
     } else {
-      f = numeric_limits<int8_t>::max() / f;
+      f = max_quantized_value / f;
     }
   }
   return multipliers;
 }
 
-std::vector<float> ComputeQuantiledQuantizationMultipliers(
-    const DenseDataset<float>& dataset, float multiplier_quantile) {
+std::vector<float> ComputeQuantiledQuantizationMultipliersImpl(
+    const DenseDataset<float>& dataset, float multiplier_quantile,
+    float max_quantized_value) {
   const size_t dimensionality = dataset.dimensionality();
   const size_t k = dataset.size() * (1.0 - multiplier_quantile) + 1;
-  if (k == 1) return ComputeMaxQuantizationMultipliers(dataset);
+  if (k == 1) {
+    return ComputeMaxQuantizationMultipliersImpl(dataset, max_quantized_value);
+  }
   std::vector<TopNAmortizedConstant<float>> top_ns(dimensionality);
   for (auto& elem : top_ns) {
     elem = TopNAmortizedConstant<float>(k);
@@ -70,11 +75,27 @@ std::vector<float> ComputeQuantiledQuantizationMultipliers(
   }
   std::vector<float> multipliers(dataset.dimensionality());
   for (size_t j : Seq(dimensionality)) {
-    multipliers[j] = numeric_limits<int8_t>::max() / top_ns[j].exact_bottom();
+    multipliers[j] = max_quantized_value / top_ns[j].exact_bottom();
   }
   return multipliers;
 }
 
+constexpr float kMaxInt4QuantizedMagnitude = 7.0f;
+
+}  // namespace
+
+std::vector<float> ComputeMaxQuantizationMultipliers(
+    const DenseDataset<float>& dataset) {
+  return ComputeMaxQuantizationMultipliersImpl(dataset,
+                                               numeric_limits<int8_t>::max());
+}
+
+std::vector<float> ComputeQuantiledQuantizationMultipliers(
+    const DenseDataset<float>& dataset, float multiplier_quantile) {
+  return ComputeQuantiledQuantizationMultipliersImpl(
+      dataset, multiplier_quantile, numeric_limits<int8_t>::max());
+}
+
 ScalarQuantizationResults ScalarQuantizeFloatDataset(
     const DenseDataset<float>& dataset, float multiplier_quantile,
     double noise_shaping_threshold) {
@@ -244,6 +265,113 @@ DatapointPtr<int8_t> ScalarQuantizeFloatDatapointWithNoiseShaping(
   return MakeDatapointPtr(quantized.data(), quantized.size());
 }
 
+std::vector<float> ComputeInt4QuantizationMultipliers(
+    const DenseDataset<float>& dataset, float multiplier_quantile) {
+  DCHECK_LE(multiplier_quantile, 1.0f);
+  DCHECK_GT(multiplier_quantile, 0.0f);
+  return (fabs(multiplier_quantile - 1.0f) < 0.001)
+             ? ComputeMaxQuantizationMultipliersImpl(dataset,
+                                                     kMaxInt4QuantizedMagnitude)
+             : ComputeQuantiledQuantizationMultipliersImpl(
+                   dataset, multiplier_quantile, kMaxInt4QuantizedMagnitude);
+}
+
+Int4ScalarQuantizationResults ScalarQuantizeFloatDatasetToInt4(
+    const DenseDataset<float>& dataset, float multiplier_quantile) {
+  return ScalarQuantizeFloatDatasetToInt4WithMultipliers(
+      dataset,
+      ComputeInt4QuantizationMultipliers(dataset, multiplier_quantile));
+}
+
+Int4ScalarQuantizationResults ScalarQuantizeFloatDatasetToInt4WithMultipliers(
+    const DenseDataset<float>& dataset, vector<float> multipliers) {
+  const size_t dimensionality = dataset.dimensionality();
+  DCHECK_EQ(multipliers.size(), dimensionality);
+  const size_t packed_dimensionality = (dimensionality + 1) / 2;
+
+  DenseDataset<uint8_t> packed_dataset;
+  packed_dataset.set_packing_strategy(HashedItem::NIBBLE);
+  packed_dataset.set_dimensionality(dimensionality);
+  packed_dataset.Reserve(dataset.size());
+  vector<uint8_t> packed(packed_dimensionality);
+  for (auto dptr : dataset) {
+    packed_dataset.AppendOrDie(
+        ScalarQuantizeFloatDatapointToInt4(dptr, multipliers,
+                                           MakeMutableSpan(packed)),
+        "");
+  }
+
+  vector<float> inv_multipliers(dimensionality);
+  for (size_t j : Seq(dimensionality)) {
+    inv_multipliers[j] = 1.0f / multipliers[j];
+  }
+
+  Int4ScalarQuantizationResults results;
+  results.packed_dataset = std::move(packed_dataset);
+  results.multiplier_by_dimension = std::move(multipliers);
+  results.inverse_multiplier_by_dimension = std::move(inv_multipliers);
+  return results;
+}
+
+DatapointPtr<uint8_t> ScalarQuantizeFloatDatapointToInt4(
+    const DatapointPtr<float>& dptr, absl::Span<const float> multipliers,
+    MutableSpan<uint8_t> packed) {
+  const size_t dimensionality = dptr.dimensionality();
+  DCHECK_EQ(multipliers.size(), dimensionality);
+  DCHECK_EQ(packed.size(), (dimensionality + 1) / 2);
+  const float* values = dptr.values();
+  size_t j = 0;
+  for (; j + 2 <= dimensionality; j += 2) {
+    packed[j / 2] =
+        Int4QuantizeToNibble(values[j] * multipliers[j]) |
+        (Int4QuantizeToNibble(values[j + 1] * multipliers[j + 1]) << 4);
+  }
+  if (j < dimensionality) {
+    packed[j / 2] = Int4QuantizeToNibble(values[j] * multipliers[j]);
+  }
+  return MakeDatapointPtr(nullptr, packed.data(), packed.size(),
+                          dimensionality);
+}
+
+DenseDataset<int8_t> UnpackInt4QuantizedDataset(
+    const DenseDataset<uint8_t>& packed_dataset) {
+  DCHECK_EQ(packed_dataset.packing_strategy(), HashedItem::NIBBLE);
+  const size_t dimensionality = packed_dataset.dimensionality();
+  DenseDataset<int8_t> result;
+  result.set_dimensionality(dimensionality);
+  result.Reserve(packed_dataset.size());
+  vector<int8_t> unpacked(dimensionality);
+  for (auto dptr : packed_dataset) {
+    const uint8_t* packed = dptr.values();
+    for (size_t j : Seq(dimensionality)) {
+      unpacked[j] = Int4NibbleToInt8(packed[j / 2] >> (4 * (j & 1)));
+    }
+    result.AppendOrDie(MakeDatapointPtr(unpacked), "");
+  }
+  return result;
+}
+
+DenseDataset<uint8_t> PackInt4QuantizedDataset(
+    const DenseDataset<int8_t>& unpacked_dataset) {
+  const size_t dimensionality = unpacked_dataset.dimensionality();
+  DenseDataset<uint8_t> result;
+  result.set_packing_strategy(HashedItem::NIBBLE);
+  result.set_dimensionality(dimensionality);
+  result.Reserve(unpacked_dataset.size());
+  vector<uint8_t> packed((dimensionality + 1) / 2);
+  for (DatapointIndex i : Seq(unpacked_dataset.size())) {
+    const int8_t* unpacked = unpacked_dataset[i].values();
+    std::fill(packed.begin(), packed.end(), 0);
+    for (size_t j : Seq(dimensionality)) {
+      packed[j / 2] |= Int4QuantizeToNibble(unpacked[j]) << (4 * (j & 1));
+    }
+    result.AppendOrDie(MakeDatapointPtr(nullptr, packed.data(), packed.size(),
+                                        dimensionality),
+                       unpacked_dataset.GetDocid(i));
+  }
+  return result;
+}
+
 unique_ptr<float[]> PrepareForAsymmetricScalarQuantizedDotProduct(
     const DatapointPtr<float>& query,
     ConstSpan<float> inverse_multiplier_by_dimension) {
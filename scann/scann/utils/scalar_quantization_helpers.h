@@ -32,6 +32,14 @@ struct ScalarQuantizationResults {
   vector<float> inverse_multiplier_by_dimension;
 };
 
+struct Int4ScalarQuantizationResults {
+  DenseDataset<uint8_t> packed_dataset;
+
+  vector<float> multiplier_by_dimension;
+
+  vector<float> inverse_multiplier_by_dimension;
+};
+
 SCANN_INLINE int8_t Int8Quantize(float value) {
   const float fp_val = std::round(value);
   if (ABSL_PREDICT_FALSE(fp_val > numeric_limits<int8_t>::max())) {
@@ -43,6 +51,19 @@ SCANN_INLINE int8_t Int8Quantize(float value) {
   return fp_val;
 }
 
+SCANN_INLINE uint8_t Int4QuantizeToNibble(float value) {
+  constexpr int kMaxInt4 = 7;
+  constexpr int kMinInt4 = -8;
+  const float fp_val = std::round(value);
+  if (ABSL_PREDICT_FALSE(fp_val > kMaxInt4)) return kMaxInt4 - kMinInt4;
+  if (ABSL_PREDICT_FALSE(fp_val < kMinInt4)) return 0;
+  return static_cast<int>(fp_val) - kMinInt4;
+}
+
+SCANN_INLINE int8_t Int4NibbleToInt8(uint8_t nibble) {
+  return static_cast<int8_t>(nibble & 0x0F) - 8;
+}
+
 std::vector<float> ComputeMaxQuantizationMultipliers(
     const DenseDataset<float>& dataset);
 
@@ -77,6 +98,25 @@ DatapointPtr<int8_t> ScalarQuantizeFloatDatapoint(
     const DatapointPtr<float>& dptr, float multiplier,
     vector<int8_t>* quantized_storage);
 
+std::vector<float> ComputeInt4QuantizationMultipliers(
+    const DenseDataset<float>& dataset, float multiplier_quantile = 1.0f);
+
+Int4ScalarQuantizationResults ScalarQuantizeFloatDatasetToInt4(
+    const DenseDataset<float>& dataset, float multiplier_quantile = 1.0f);
+
+Int4ScalarQuantizationResults ScalarQuantizeFloatDatasetToInt4WithMultipliers(
+    const DenseDataset<float>& dataset, std::vector<float> multipliers);
+
+DatapointPtr<uint8_t> ScalarQuantizeFloatDatapointToInt4(
+    const DatapointPtr<float>& dptr, absl::Span<const float> multipliers,
+    MutableSpan<uint8_t> packed);
+
+DenseDataset<int8_t> UnpackInt4QuantizedDataset(
+    const DenseDataset<uint8_t>& packed_dataset);
+
+DenseDataset<uint8_t> PackInt4QuantizedDataset(
+    const DenseDataset<int8_t>& unpacked_dataset);
+
 unique_ptr<float[]> PrepareForAsymmetricScalarQuantizedDotProduct(
     const DatapointPtr<float>& query,
     ConstSpan<float> inverse_multiplier_by_dimension);
@@ -0,0 +1,172 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scann/utils/streaming_dataset_source.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "absl/synchronization/notification.h"
+#include "scann/utils/io_npy.h"
+#include "scann/utils/threads.h"
+
+namespace research_scann {
+namespace {
+
+struct PrefetchedChunk {
+  ~PrefetchedChunk() { ready.WaitForNotification(); }
+
+  DenseDataset<double> data;
+  Status status;
+  absl::Notification ready;
+};
+
+}  // namespace
+
+Status StreamingDatasetSource::IterateChunks(size_t chunk_size,
+                                             const ChunkCallback& callback) {
+  if (chunk_size == 0) {
+    return InvalidArgumentError("chunk_size must be positive.");
+  }
+  const size_t total_size = size();
+  if (total_size == 0) return OkStatus();
+
+  auto io_pool = StartThreadPool("streaming_dataset_io", 1);
+  auto start_read = [&](size_t begin) {
+    auto chunk = make_unique<PrefetchedChunk>();
+    PrefetchedChunk* chunk_ptr = chunk.get();
+    const size_t count = std::min(chunk_size, total_size - begin);
+    io_pool->Schedule([this, chunk_ptr, begin, count] {
+      chunk_ptr->status = ReadRange(begin, count, &chunk_ptr->data);
+      chunk_ptr->ready.Notify();
+    });
+    return chunk;
+  };
+
+  unique_ptr<PrefetchedChunk> next = start_read(0);
+  for (size_t begin = 0; begin < total_size; begin += chunk_size) {
+    unique_ptr<PrefetchedChunk> current = std::move(next);
+    current->ready.WaitForNotification();
+    SCANN_RETURN_IF_ERROR(current->status);
+    if (begin + chunk_size < total_size) next = start_read(begin + chunk_size);
+    SCANN_RETURN_IF_ERROR(callback(begin, current->data));
+  }
+  return OkStatus();
+}
+
+Status DatasetSubsetSource::ReadRange(size_t begin, size_t count,
+                                      DenseDataset<double>* chunk) {
+  if (begin + count > size()) {
+    return OutOfRangeError("Range [%d, %d) exceeds dataset size %d.", begin,
+                           begin + count, size());
+  }
+  const DimensionIndex dimensionality = dataset_.dimensionality();
+  vector<double> values(count * dimensionality);
+  Datapoint<double> dp;
+  for (size_t i : Seq(count)) {
+    dataset_.GetDenseDatapoint(GetOriginalIndex(begin + i), &dp);
+    std::copy(dp.values().begin(), dp.values().end(),
+              values.begin() + i * dimensionality);
+  }
+  *chunk = DenseDataset<double>(std::move(values), count);
+  return OkStatus();
+}
+
+StatusOr<unique_ptr<NumpyShardedDatasetSource>>
+NumpyShardedDatasetSource::Create(ConstSpan<std::string> shard_filenames) {
+  if (shard_filenames.empty()) {
+    return InvalidArgumentError("At least one npy shard must be specified.");
+  }
+  unique_ptr<NumpyShardedDatasetSource> result(new NumpyShardedDatasetSource);
+  for (const std::string& filename : shard_filenames) {
+    TF_ASSIGN_OR_RETURN(NumpyHeader header, ReadNumpyHeader(filename));
+    if (header.descr != "<f4" && header.descr != "<f8") {
+      return InvalidArgumentError(
+          "Only little-endian float32 and float64 npy shards are supported "
+          "(%s has dtype %s).",
+          filename, header.descr);
+    }
+    if (header.fortran_order || header.shape.size() != 2) {
+      return InvalidArgumentError(
+          "npy shards must be two-dimensional C-order arrays (%s).", filename);
+    }
+    const bool is_float64 = header.descr == "<f8";
+    if (result->shards_.empty()) {
+      result->dimensionality_ = header.shape[1];
+      result->is_float64_ = is_float64;
+    } else if (header.shape[1] != result->dimensionality_ ||
+               is_float64 != result->is_float64_) {
+      return InvalidArgumentError(
+          "All npy shards must have the same dtype and dimensionality (%s "
+          "differs from %s).",
+          filename, result->shards_.front().filename);
+    }
+    if (header.shape[0] == 0) continue;
+    result->shards_.push_back(
+        {filename, result->size_, header.shape[0], header.data_offset});
+    result->size_ += header.shape[0];
+  }
+  return result;
+}
+
+Status NumpyShardedDatasetSource::ReadRange(size_t begin, size_t count,
+                                            DenseDataset<double>* chunk) {
+  if (begin + count > size_) {
+    return OutOfRangeError("Range [%d, %d) exceeds dataset size %d.", begin,
+                           begin + count, size_);
+  }
+  const size_t elem_size = is_float64_ ? sizeof(double) : sizeof(float);
+  const size_t row_bytes = dimensionality_ * elem_size;
+  vector<double> values(count * dimensionality_);
+
+  auto shard_it = std::upper_bound(
+      shards_.begin(), shards_.end(), begin,
+      [](size_t dp_idx, const Shard& shard) {
+        return dp_idx < shard.first_datapoint;
+      });
+  size_t shard_idx = shard_it - shards_.begin() - 1;
+  size_t num_read = 0;
+  while (num_read < count) {
+    const Shard& shard = shards_[shard_idx];
+    const size_t local_begin = begin + num_read - shard.first_datapoint;
+    const size_t local_count =
+        std::min(count - num_read, shard.size - local_begin);
+    if (!open_shard_ || open_shard_idx_ != shard_idx) {
+      open_shard_ = make_unique<OpenSourceableFileReader>(shard.filename);
+      open_shard_idx_ = shard_idx;
+    }
+    read_buffer_.resize(local_count * row_bytes);
+    SCANN_RETURN_IF_ERROR(open_shard_->ReadAt(
+        shard.data_offset + local_begin * row_bytes,
+        MakeMutableSpan(read_buffer_)));
+
+    double* dst = values.data() + num_read * dimensionality_;
+    const size_t num_values = local_count * dimensionality_;
+    if (is_float64_) {
+      std::memcpy(dst, read_buffer_.data(), num_values * sizeof(double));
+    } else {
+      const float* src = reinterpret_cast<const float*>(read_buffer_.data());
+      std::copy(src, src + num_values, dst);
+    }
+    num_read += local_count;
+    ++shard_idx;
+  }
+
+  *chunk = DenseDataset<double>(std::move(values), count);
+  return OkStatus();
+}
+
+}  // namespace research_scann
@@ -0,0 +1,109 @@
+// Copyright 2022 The Google Research Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCANN_UTILS_STREAMING_DATASET_SOURCE_H_
+#define SCANN_UTILS_STREAMING_DATASET_SOURCE_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "scann/data_format/dataset.h"
+#include "scann/oss_wrappers/scann_status.h"
+#include "scann/utils/common.h"
+#include "scann/utils/io_oss_wrapper.h"
+#include "scann/utils/types.h"
+
+namespace research_scann {
+
+class StreamingDatasetSource : public VirtualDestructor {
+ public:
+  virtual size_t size() const = 0;
+
+  virtual DimensionIndex dimensionality() const = 0;
+
+  virtual Status ReadRange(size_t begin, size_t count,
+                           DenseDataset<double>* chunk) = 0;
+
+  using ChunkCallback =
+      std::function<Status(size_t offset, const DenseDataset<double>& chunk)>;
+  Status IterateChunks(size_t chunk_size, const ChunkCallback& callback);
+};
+
+class DatasetSubsetSource final : public StreamingDatasetSource {
+ public:
+  DatasetSubsetSource(const Dataset& dataset,
+                      ConstSpan<DatapointIndex> subset = {})
+      : dataset_(dataset), subset_(subset) {}
+
+  size_t size() const final {
+    return subset_.empty() ? dataset_.size() : subset_.size();
+  }
+
+  DimensionIndex dimensionality() const final {
+    return dataset_.dimensionality();
+  }
+
+  Status ReadRange(size_t begin, size_t count,
+                   DenseDataset<double>* chunk) final;
+
+  DatapointIndex GetOriginalIndex(size_t i) const {
+    return subset_.empty() ? i : subset_[i];
+  }
+
+ private:
+  const Dataset& dataset_;
+
+  ConstSpan<DatapointIndex> subset_;
+};
+
+class NumpyShardedDatasetSource final : public StreamingDatasetSource {
+ public:
+  static StatusOr<unique_ptr<NumpyShardedDatasetSource>> Create(
+      ConstSpan<std::string> shard_filenames);
+
+  size_t size() const final { return size_; }
+
+  DimensionIndex dimensionality() const final { return dimensionality_; }
+
+  Status ReadRange(size_t begin, size_t count,
+                   DenseDataset<double>* chunk) final;
+
+ private:
+  struct Shard {
+    std::string filename;
+    size_t first_datapoint;
+    size_t size;
+    size_t data_offset;
+  };
+
+  NumpyShardedDatasetSource() {}
+
+  vector<Shard> shards_;
+
+  size_t size_ = 0;
+
+  DimensionIndex dimensionality_ = 0;
+
+  bool is_float64_ = false;
+
+  size_t open_shard_idx_ = 0;
+  unique_ptr<OpenSourceableFileReader> open_shard_;
+
+  vector<char> read_buffer_;
+};
+
+}  // namespace research_scann
+
+#endif